@@ -3,9 +3,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
-#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/netlink.h>
 
 #include <defines.h>
 #include <api.h>
@@ -13,20 +19,23 @@
 #include <sqlite3.h>
 #include <batmondb.h>
 
-#define CHECK_BATTERY_TIMEOUT_S 15 // s - check battery percentage every 15s
+#define BATTERY_FALLBACK_S 10 // s - re-read (and republish) the battery if no uevent came in for this long
+#define BATTERY_POLL_S 1 // s - without a uevent socket
+#define UEVENT_SETTLE_MS 200 // uevents come in bursts, read the battery once they stop
 
 // Battery logs
-#define FILO_MIN_SIZE 1000
+#define BAT_LOG_SIZE 1000 // newest entries kept, ids keep counting up
+#define BAT_LOG_BATCH 8 // entries written in one transaction
 #define MAX_DURATION_BEFORE_UPDATE 600
 
-static bool quit = false;
-static bool is_suspended = false;
+static volatile sig_atomic_t quit = false;
+static volatile sig_atomic_t resumed = false;
+static volatile sig_atomic_t flush_requested = false;
 
-int battery_current_state_duration = 0;
 int best_session_time = 0;
 char *device_model = NULL;
+sqlite3 *bat_log_db = NULL;
 
-void register_handler();
 void sigintHandler(int signum) {
     switch (signum)
     {
@@ -34,130 +43,233 @@ void sigintHandler(int signum) {
     case SIGTERM:
         quit = true;
         break;
-    case SIGSTOP:
-        is_suspended = true;
-        break;
     case SIGCONT:
-        is_suspended = false;
+        // stopped while sleeping, the battery may have changed meanwhile
+        resumed = true;
+        break;
+    case SIGUSR1:
+        // from PWR_flushBatmon(), about to be stopped for sleep or power off
+        flush_requested = true;
         break;
     default:
         break;
     }
-    // reregister
-    register_handler();
 }
 
 void register_handler() {
-    struct sigaction sa;
+    struct sigaction sa = {0};
     sa.sa_handler = sigintHandler;
-
     sigemptyset(&sa.sa_mask);
-    sigaddset(&sa.sa_mask, SIGINT);
+    // no SA_RESTART, poll() returns to handle it
     sigaction(SIGINT, &sa, 0);
-
-    sigemptyset(&sa.sa_mask);
-    sigaddset(&sa.sa_mask, SIGTERM);
     sigaction(SIGTERM, &sa, 0);
-
-    sigemptyset(&sa.sa_mask);
-    sigaddset(&sa.sa_mask, SIGSTOP);
-    sigaction(SIGSTOP, &sa, 0);
-
-    sigemptyset(&sa.sa_mask);
-    sigaddset(&sa.sa_mask, SIGCONT);
     sigaction(SIGCONT, &sa, 0);
+    sigaction(SIGUSR1, &sa, 0);
 }
 
-void cleanup(void)
+///////////////////////////////
+// power_supply uevents
+
+static struct {
+    int fd;
+    // BATMON_FAKE_UEVENT names a datagram socket that stands in for netlink on
+    // desktop, taking the same NUL separated KEY=VALUE payloads. The battery
+    // state then comes from the events themselves.
+    const char *fake_path;
+    int is_charging;
+    int charge;
+} uevent = {.fd = -1};
+
+static void uevent_open(void)
 {
-    remove("/tmp/percBat");
+    uevent.fake_path = getenv("BATMON_FAKE_UEVENT");
+    if (uevent.fake_path) {
+        PLAT_getBatteryStatusFine(&uevent.is_charging, &uevent.charge);
+
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        strncpy(addr.sun_path, uevent.fake_path, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        uevent.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (uevent.fd >= 0 && bind(uevent.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(uevent.fd);
+            uevent.fd = -1;
+        }
+    }
+    else {
+        struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_pid = 0, .nl_groups = 1}; // kernel events
+        uevent.fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+        if (uevent.fd >= 0 && bind(uevent.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(uevent.fd);
+            uevent.fd = -1;
+        }
+    }
+
+    if (uevent.fd < 0)
+        LOG_info("batmon: no uevent socket (%s), polling every %ds\n", strerror(errno), BATTERY_POLL_S);
 }
 
-void update_current_duration(void)
+static void uevent_close(void)
 {
-    sqlite3 *bat_log_db = open_battery_log_db();
-
-    if (bat_log_db != NULL)
-    {
-        const char *sql = "SELECT * FROM bat_activity WHERE device_serial = ? ORDER BY id DESC LIMIT 1;";
-        sqlite3_stmt *stmt;
-        int rc = sqlite3_prepare_v2(bat_log_db, sql, -1, &stmt, 0);
+    if (uevent.fd < 0)
+        return;
+    close(uevent.fd);
+    uevent.fd = -1;
+    if (uevent.fake_path)
+        unlink(uevent.fake_path);
+}
 
-        if (rc == SQLITE_OK)
-        {
-            sqlite3_bind_text(stmt, 1, device_model, -1, SQLITE_STATIC);
-            rc = sqlite3_step(stmt);
-            if (rc == SQLITE_ROW)
-            {
-                int current_duration = sqlite3_column_int(stmt, 3);
-                int new_duration = current_duration + battery_current_state_duration;
+// Drains the socket, true if any of it was about a power supply
+static bool uevent_read(void)
+{
+    bool power_supply = false;
+    char buf[4096];
+
+    while (true) {
+        struct sockaddr_nl from = {0};
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(uevent.fd, buf, sizeof(buf) - 1, MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (len < 0) {
+            if (errno == ENOBUFS) {
+                // overran while we were stopped, read the battery anyway
+                power_supply = true;
+                continue;
+            }
+            break;
+        }
+        if (!uevent.fake_path && from.nl_pid != 0)
+            continue; // only trust the kernel
+        buf[len] = '\0';
+
+        bool is_power_supply = false;
+        int capacity = -1;
+        const char *status = NULL;
+        for (char *key = buf; key < buf + len; key += strlen(key) + 1) {
+            if (strcmp(key, "SUBSYSTEM=power_supply") == 0)
+                is_power_supply = true;
+            else if (strncmp(key, "POWER_SUPPLY_CAPACITY=", 22) == 0)
+                capacity = atoi(key + 22);
+            else if (strncmp(key, "POWER_SUPPLY_STATUS=", 20) == 0)
+                status = key + 20;
+        }
+        if (!is_power_supply)
+            continue;
+
+        power_supply = true;
+        if (uevent.fake_path) {
+            if (capacity >= 0)
+                uevent.charge = capacity;
+            if (status)
+                uevent.is_charging = strcmp(status, "Charging") == 0;
+        }
+    }
+    return power_supply;
+}
 
-                const char *update_sql = "UPDATE bat_activity SET duration = ? WHERE id = ?";
+static void read_battery(int *is_charging, int *charge)
+{
+    if (uevent.fake_path) {
+        *is_charging = uevent.is_charging;
+        *charge = uevent.charge;
+    }
+    else {
+        PLAT_getBatteryStatusFine(is_charging, charge);
+    }
+}
 
-                sqlite3_stmt *update_stmt;
-                rc = sqlite3_prepare_v2(bat_log_db, update_sql, -1, &update_stmt, 0);
+///////////////////////////////
+// Battery log, bat_activity keeps the newest BAT_LOG_SIZE entries. New
+// entries and durations wait here and are written together.
 
-                if (rc == SQLITE_OK)
-                {
-                    sqlite3_bind_int(update_stmt, 1, new_duration);
-                    sqlite3_bind_int(update_stmt, 2, sqlite3_column_int(stmt, 0));
+typedef struct BatLogEntry {
+    int bat_level;
+    int is_charging;
+    int duration;
+} BatLogEntry;
 
-                    // Exécuter la mise à jour
-                    rc = sqlite3_step(update_stmt);
+static struct {
+    BatLogEntry entries[BAT_LOG_BATCH]; // not written yet
+    int count;
+    int duration; // to add to the newest entry already written
+    int unsaved; // s since the last write
+} bat_log;
 
-                    battery_current_state_duration = 0;
-                    sqlite3_finalize(stmt);
-                    sqlite3_finalize(update_stmt);
-                }
-            }
-        }
-        close_battery_log_db(bat_log_db);
-    }
+void add_duration(int seconds)
+{
+    if (bat_log.count)
+        bat_log.entries[bat_log.count - 1].duration += seconds;
+    else
+        bat_log.duration += seconds;
+    bat_log.unsaved += seconds;
 }
 
-void log_new_percentage(int new_bat_value, int is_charging)
+void flush_log(void)
 {
-    sqlite3 *bat_log_db = open_battery_log_db();
+    if (bat_log_db == NULL || (bat_log.count == 0 && bat_log.duration == 0))
+        return;
 
-    if (bat_log_db != NULL)
-    {
-        char *sql = sqlite3_mprintf("INSERT INTO bat_activity(device_serial, bat_level, duration, is_charging) VALUES(%Q, %d, %d, %d);", device_model, new_bat_value, 0, is_charging);
-        sqlite3_exec(bat_log_db, sql, NULL, NULL, NULL);
-        sqlite3_free(sql);
-
-        // FILO logic
-        sqlite3_stmt *stmt;
-        const char *count_sql = "SELECT COUNT(id) FROM bat_activity";
+    sqlite3_stmt *stmt;
+    sqlite3_exec(bat_log_db, "BEGIN;", NULL, NULL, NULL);
 
-        int count = 0;
+    if (bat_log.duration) {
+        const char *update_sql = "UPDATE bat_activity SET duration = duration + ? WHERE id = (SELECT MAX(id) FROM bat_activity WHERE device_serial = ?);";
+        if (sqlite3_prepare_v2(bat_log_db, update_sql, -1, &stmt, 0) == SQLITE_OK) {
+            sqlite3_bind_int(stmt, 1, bat_log.duration);
+            sqlite3_bind_text(stmt, 2, device_model, -1, SQLITE_STATIC);
+            sqlite3_step(stmt);
+        }
+        sqlite3_finalize(stmt);
+    }
 
-        if (sqlite3_prepare_v2(bat_log_db, count_sql, -1, &stmt, NULL) == SQLITE_OK)
-        {
-            if (sqlite3_step(stmt) == SQLITE_ROW)
-            {
-                count = sqlite3_column_int(stmt, 0);
+    if (bat_log.count) {
+        const char *insert_sql = "INSERT INTO bat_activity(device_serial, bat_level, duration, is_charging) VALUES(?, ?, ?, ?);";
+        if (sqlite3_prepare_v2(bat_log_db, insert_sql, -1, &stmt, 0) == SQLITE_OK) {
+            for (int i = 0; i < bat_log.count; i++) {
+                BatLogEntry *entry = &bat_log.entries[i];
+                sqlite3_bind_text(stmt, 1, device_model, -1, SQLITE_STATIC);
+                sqlite3_bind_int(stmt, 2, entry->bat_level);
+                sqlite3_bind_int(stmt, 3, entry->duration);
+                sqlite3_bind_int(stmt, 4, entry->is_charging);
+                sqlite3_step(stmt);
+                sqlite3_reset(stmt);
             }
-            sqlite3_finalize(stmt);
         }
+        sqlite3_finalize(stmt);
 
-        if (count > FILO_MIN_SIZE)
-        {
-            // Deletion of the 1st entry
-            const char *delete_sql = "DELETE FROM bat_activity WHERE id = (SELECT MIN(id) FROM bat_activity);";
-            sqlite3_prepare_v2(bat_log_db, delete_sql, -1, &stmt, 0);
+        // ids only grow, so this drops whatever fell out of the ring
+        // without counting or scanning for the oldest entry
+        const char *delete_sql = "DELETE FROM bat_activity WHERE id <= ?;";
+        if (sqlite3_prepare_v2(bat_log_db, delete_sql, -1, &stmt, 0) == SQLITE_OK) {
+            sqlite3_bind_int64(stmt, 1, sqlite3_last_insert_rowid(bat_log_db) - BAT_LOG_SIZE);
             sqlite3_step(stmt);
-            sqlite3_finalize(stmt);
         }
+        sqlite3_finalize(stmt);
     }
-    close_battery_log_db(bat_log_db);
+
+    sqlite3_exec(bat_log_db, "COMMIT;", NULL, NULL, NULL);
+
+    bat_log.count = 0;
+    bat_log.duration = 0;
+    bat_log.unsaved = 0;
+}
+
+void log_new_percentage(int new_bat_value, int is_charging)
+{
+    if (bat_log.count == BAT_LOG_BATCH)
+        flush_log();
+
+    bat_log.entries[bat_log.count++] = (BatLogEntry){
+        .bat_level = new_bat_value,
+        .is_charging = is_charging,
+        .duration = 0,
+    };
 }
 
 int get_current_session_time(void)
 {
     int current_session_duration = 0;
 
-    sqlite3 *bat_log_db = open_battery_log_db();
-    
+    flush_log();
+
     if (bat_log_db != NULL)
     {
         const char *sql = "SELECT * FROM bat_activity WHERE device_serial = ? AND is_charging = 1 ORDER BY id DESC LIMIT 1;";
@@ -189,8 +301,7 @@ int get_current_session_time(void)
         }
         sqlite3_finalize(stmt);
     }
-    close_battery_log_db(bat_log_db);
-    
+
     return current_session_duration;
 }
 
@@ -198,8 +309,6 @@ int set_best_session_time(int best_session)
 {
     int is_success = 0;
 
-    sqlite3* bat_log_db = open_battery_log_db();
-
     if (bat_log_db != NULL)
     {
         const char *sql = "SELECT * FROM device_specifics WHERE device_serial = ? ORDER BY id LIMIT 1;";
@@ -224,34 +333,47 @@ int set_best_session_time(int best_session)
 
                     // Exécuter la mise à jour
                     rc = sqlite3_step(update_stmt);
-
-                    sqlite3_finalize(stmt);
-                    sqlite3_finalize(update_stmt);
                     is_success = 1;
                 }
+                sqlite3_finalize(update_stmt);
             }
         }
-        close_battery_log_db(bat_log_db);
+        sqlite3_finalize(stmt);
     }
 
     return is_success;
 }
 
+void cleanup(void)
+{
+    flush_log();
+    close_battery_log_db(bat_log_db);
+    bat_log_db = NULL;
+    uevent_close();
+    remove(BATTERY_STATE_PATH);
+    remove(BATTERY_STATE_PATH ".new");
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 int main(int argc, char *argv[])
 {
     device_model = PLAT_getModel();
-    sqlite3 *bat_log_db = open_battery_log_db();
+    bat_log_db = open_battery_log_db();
     if(bat_log_db != NULL) {
         best_session_time = get_best_session_time(bat_log_db, device_model);
-        close_battery_log_db(bat_log_db);
     }
 
-    FILE *fp;
     int old_percentage = -1;
-    int lowest_percentage_after_charge = 500;
+    int old_charging = -1;
     atexit(cleanup);
     register_handler();
-    int ticks = CHECK_BATTERY_TIMEOUT_S;
+    uevent_open();
 
     struct {
         int is_charging;
@@ -259,17 +381,60 @@ int main(int argc, char *argv[])
     } pwr = {0};
     bool was_charging = false;
 
+    int interval_ms = (uevent.fd < 0 ? BATTERY_POLL_S : BATTERY_FALLBACK_S) * 1000;
+    uint64_t accounted_at = now_ms(); // durations are counted up to here
+    uint64_t read_at = 0; // read right away
+
     while (!quit)
     {
-        PLAT_getBatteryStatusFine(&pwr.is_charging, &pwr.charge);
+        uint64_t now = now_ms();
+        int timeout = read_at + interval_ms > now ? (int)(read_at + interval_ms - now) : 0;
+        if (resumed || flush_requested)
+            timeout = 0;
+
+        struct pollfd pfd = {.fd = uevent.fd, .events = POLLIN};
+        int ready = poll(&pfd, uevent.fd < 0 ? 0 : 1, timeout);
+        if (quit)
+            break;
+        if (flush_requested) {
+            flush_requested = false;
+            int seconds = (now_ms() - accounted_at) / 1000;
+            add_duration(seconds);
+            accounted_at += seconds * 1000;
+            flush_log();
+            PWR_ackBatteryFlush();
+            if (!resumed)
+                continue;
+        }
+        if (ready < 0 && errno == EINTR && !resumed)
+            continue;
+        if (ready > 0) {
+            if (!uevent_read())
+                continue; // some other subsystem
+            while (!quit && poll(&pfd, 1, UEVENT_SETTLE_MS) > 0)
+                uevent_read();
+        }
+
+        now = now_ms();
+        if (resumed) {
+            // the time spent stopped isn't time on the current level
+            resumed = false;
+            accounted_at = now;
+        }
+        else {
+            int seconds = (now - accounted_at) / 1000;
+            add_duration(seconds);
+            accounted_at += seconds * 1000;
+        }
+        read_at = now;
+
+        read_battery(&pwr.is_charging, &pwr.charge);
         if (pwr.is_charging)
         {
             if (!was_charging)
             {
                 // Charging just started
-                lowest_percentage_after_charge = 500; // Reset lowest percentage before charge
                 was_charging = true;
-                update_current_duration();
 
                 int session_time = get_current_session_time();
                 LOG_debug("Charging detected - Previous session duration = %d\n", session_time);
@@ -287,64 +452,32 @@ int main(int argc, char *argv[])
         {
             // Charging just stopped
             was_charging = false;
-            lowest_percentage_after_charge = 500; // Reset lowest percentage after charge
 
-            LOG_debug(
-                "Charging stopped: suspended = %d, perc = %d\n",
-                is_suspended, pwr.charge);
+            LOG_debug("Charging stopped: perc = %d\n", pwr.charge);
 
-            update_current_duration();
             log_new_percentage(pwr.charge, was_charging);
         }
 
-        if (!is_suspended)
-        {
-            if (ticks >= CHECK_BATTERY_TIMEOUT_S)
-            {
-                LOG_debug(
-                    "battery check: suspended = %d, perc = %d\n",
-                    is_suspended, pwr.charge);
+        // unchanged too, readers take the publish time as a heartbeat
+        if (pwr.charge != old_percentage || pwr.is_charging != old_charging)
+            LOG_debug("publishing battery: charging = %d, perc = %d\n", pwr.is_charging, pwr.charge);
+        PWR_publishBatteryStatus(pwr.is_charging, pwr.charge);
+        old_charging = pwr.is_charging;
 
-                ticks = -1;
-            }
-
-            if (pwr.charge != old_percentage)
-            {
-                // This statement is not englobed in the previous one
-                // in order to be launched once when batmon starts
-                LOG_debug(
-                    "saving percBat: suspended = %d, perc = %d\n",
-                    is_suspended, pwr.charge);
-                old_percentage = pwr.charge;
-                // Save battery percentage to file
-                if ((fp = fopen("/tmp/percBat", "w+"))) {
-                    fprintf(fp, "%d", pwr.charge);
-                    fflush(fp);
-                    fsync(fileno(fp));
-                    fclose(fp);
-                }
-                // Current battery state duration addition
-                update_current_duration();
-                // New battery percentage entry
-                log_new_percentage(pwr.charge, was_charging);
-            }
-        }
-        else
+        if (pwr.charge != old_percentage)
         {
-            ticks = -1;
+            old_percentage = pwr.charge;
+            // New battery percentage entry
+            log_new_percentage(pwr.charge, was_charging);
         }
 
-        if (battery_current_state_duration > MAX_DURATION_BEFORE_UPDATE)
-            update_current_duration();
-
-        sleep(1);
-        battery_current_state_duration++;
-        ticks++;
+        if (bat_log.unsaved > MAX_DURATION_BEFORE_UPDATE)
+            flush_log();
     }
 
     LOG_debug("caught SIGTERM/SIGINT, quitting\n");
 
-    // Current battery state duration addition
-    update_current_duration();
+    // Current battery state duration addition, written by cleanup()
+    add_duration((now_ms() - accounted_at) / 1000);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -7,6 +7,7 @@
 #include <msettings.h>
 #include <pthread.h>
 #include <samplerate.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,6 +16,8 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
 
 #include "utils.h"
 #include "config.h"
@@ -57,6 +60,115 @@ void LOG_note(int level, const char *fmt, ...)
 
 ///////////////////////////////
 
+// events are buffered in memory and only formatted on TRACE_flush(),
+// which empties the buffer again. timestamps are CLOCK_MONOTONIC so
+// nextui and minarch share a timeline
+#define TRACE_MAX_EVENTS 1024
+
+typedef struct TraceEvent {
+	const char* name;
+	uint64_t ts;
+	int64_t value;
+	int tid;
+	char phase;
+} TraceEvent;
+
+int trace_enabled = 0;
+static struct {
+	const char* process;
+	pthread_mutex_t mutex; // events come from any thread
+	TraceEvent events[TRACE_MAX_EVENTS];
+	int count;
+	int dropped; // since the last flush
+	int named; // process name written
+} trace = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+void TRACE_init(const char* process_name)
+{
+	trace_enabled = exists(TRACE_ENABLE_PATH);
+	trace.process = process_name;
+	trace.count = 0;
+	trace.dropped = 0;
+	trace.named = 0;
+}
+void TRACE_event(char phase, const char* name, int64_t value)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&trace.mutex);
+	if (trace.count >= TRACE_MAX_EVENTS)
+	{
+		if (trace.dropped++ == 0)
+			LOG_warn("trace: buffer full, dropping events until the next flush\n");
+		pthread_mutex_unlock(&trace.mutex);
+		return;
+	}
+	TraceEvent *event = &trace.events[trace.count++];
+	event->name = name;
+	event->ts = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	event->value = value;
+	event->tid = syscall(SYS_gettid);
+	event->phase = phase;
+	pthread_mutex_unlock(&trace.mutex);
+}
+void TRACE_flush(void)
+{
+	if (!trace_enabled)
+		return;
+
+	pthread_mutex_lock(&trace.mutex);
+	if (trace.count == 0)
+	{
+		pthread_mutex_unlock(&trace.mutex);
+		return;
+	}
+
+	// JSON array format, the closing bracket is optional so every
+	// process can just keep appending to the same file
+	FILE *file = fopen(TRACE_PATH, "a");
+	if (!file)
+	{
+		pthread_mutex_unlock(&trace.mutex);
+		return;
+	}
+	if (ftell(file) == 0)
+		fputs("[\n", file);
+
+	int pid = getpid();
+	if (!trace.named)
+		fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%i,\"args\":{\"name\":\"%s\"}},\n", pid, trace.process);
+
+	for (int i = 0; i < trace.count; i++)
+	{
+		TraceEvent *event = &trace.events[i];
+		fprintf(file, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%i,\"tid\":%i", event->name, event->phase, (unsigned long long)event->ts, pid, event->tid);
+		if (event->phase == 'C')
+			fprintf(file, ",\"args\":{\"value\":%lld}", (long long)event->value);
+		else if (event->phase == 'i')
+			fputs(",\"s\":\"p\"", file);
+		fputs("},\n", file);
+	}
+	if (trace.dropped)
+		LOG_warn("trace: dropped %i events\n", trace.dropped);
+
+	// a resident nextui flushes at every launch, start over once it's on disk
+	int failed = ferror(file);
+	if (fclose(file) != 0 || failed)
+	{
+		LOG_warn("trace: couldn't write %s\n", TRACE_PATH);
+	}
+	else
+	{
+		trace.named = 1;
+		trace.count = 0;
+		trace.dropped = 0;
+	}
+	pthread_mutex_unlock(&trace.mutex);
+}
+
+///////////////////////////////
+
 uint32_t RGB_WHITE;
 uint32_t RGB_BLACK;
 uint32_t RGB_LIGHT_GRAY;
@@ -210,6 +322,9 @@ double currentfps = 0.0;
 double currentreqfps = 0.0;
 int currentcpuspeed = 0;
 double currentcpuse = 0;
+int currentframeload = 0;
+int currentframeoverruns = 0;
+int currentbatterydraw = 0;
 
 int currentshaderpass = 0;
 int currentshadersrcw = 0;
@@ -229,18 +344,40 @@ FALLBACK_IMPLEMENTATION void *PLAT_cpu_monitor(void *arg)
 {
 	return NULL;
 }
+FALLBACK_IMPLEMENTATION void PLAT_pauseCPUMonitor(int pause) {}
 
 FALLBACK_IMPLEMENTATION void PLAT_getCPUTemp()
 {
 	currentcputemp = 0;
 }
 
+FALLBACK_IMPLEMENTATION void PLAT_getBatteryDraw(void)
+{
+	currentbatterydraw = 0;
+}
+
+FALLBACK_IMPLEMENTATION void PLAT_frameTime(int work_us, int budget_us)
+{
+	// no governor to feed
+}
+
+FALLBACK_IMPLEMENTATION void PLAT_setFrameProfile(int cycles, int budget_us)
+{
+	// no governor to start
+}
+
+FALLBACK_IMPLEMENTATION int PLAT_getCPUSpeed(void)
+{
+	return currentcpuspeed;
+}
+
 int GFX_loadSystemFont(const char *fontPath)
 {
 	// Load/Reload fonts
 	if (!TTF_WasInit())
 		TTF_Init();
 
+	GFX_flushTextCache(); // keyed by font
 	TTF_CloseFont(font.large);
 	TTF_CloseFont(font.medium);
 	TTF_CloseFont(font.small);
@@ -381,6 +518,7 @@ SDL_Surface *GFX_init(int mode)
 }
 void GFX_quit(void)
 {
+	GFX_flushTextCache();
 
 	TTF_CloseFont(font.large);
 	TTF_CloseFont(font.medium);
@@ -396,6 +534,21 @@ void GFX_quit(void)
 	PLAT_quitVideo();
 }
 
+void GFX_suspend(void)
+{
+	GFX_flushTextCache();
+	PLAT_quitVideo();
+}
+SDL_Surface *GFX_resume(void)
+{
+	// fonts, assets and mapped colors survive a suspend, only the
+	// window, renderer and layer textures have to be rebuilt
+	gfx.screen = PLAT_initVideo();
+	PLAT_setVsync(gfx.vsync);
+	PLAT_clearAll();
+	return gfx.screen;
+}
+
 void GFX_setMode(int mode)
 {
 	gfx.mode = mode;
@@ -775,23 +928,209 @@ void GFX_delay(void)
 FALLBACK_IMPLEMENTATION int PLAT_supportsOverscan(void) { return 0; }
 FALLBACK_IMPLEMENTATION void PLAT_setEffectColor(int next_color) {}
 
+static int GFX_utf8Length(const char *str)
+{
+	unsigned char c = (unsigned char)str[0];
+	int len = 1;
+	if (c >= 0xF0)
+		len = 4;
+	else if (c >= 0xE0)
+		len = 3;
+	else if (c >= 0xC0)
+		len = 2;
+	// never step over the terminator on malformed input
+	for (int i = 1; i < len; i++)
+	{
+		if (!str[i])
+			return i;
+	}
+	return len;
+}
+static uint32_t GFX_utf8Codepoint(const char *str, int len)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	switch (len)
+	{
+	case 2:
+		return ((s[0] & 0x1F) << 6) | (s[1] & 0x3F);
+	case 3:
+		return ((s[0] & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+	case 4:
+		return ((s[0] & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+	default:
+		return s[0];
+	}
+}
+
 int GFX_truncateText(TTF_Font *font, const char *in_name, char *out_name, int max_width, int padding)
 {
 	int text_width;
 	strcpy(out_name, in_name);
 	TTF_SizeUTF8(font, out_name, &text_width, NULL);
 	text_width += padding;
+	if (text_width <= max_width)
+		return text_width;
+
+	int ellipsis_width;
+	TTF_SizeUTF8(font, "...", &ellipsis_width, NULL);
+
+	// cumulative glyph advance at every codepoint boundary, this lets us binary
+	// search for the cut instead of re-measuring the whole string after every byte
+	int len = strlen(in_name);
+	int *offsets = malloc((len + 1) * sizeof(int));
+	int *advances = malloc((len + 1) * sizeof(int));
+	int count = 0;
+	int x = 0;
+	for (int i = 0; i < len;)
+	{
+		int n = GFX_utf8Length(&in_name[i]);
+		uint32_t ch = GFX_utf8Codepoint(&in_name[i], n);
+		int advance = 0;
+		if (ch > 0xFFFF || TTF_GlyphMetrics(font, (Uint16)ch, NULL, NULL, NULL, NULL, &advance) != 0)
+		{
+			char glyph[5] = {0};
+			memcpy(glyph, &in_name[i], n);
+			TTF_SizeUTF8(font, glyph, &advance, NULL);
+		}
+		offsets[count] = i;
+		advances[count] = x;
+		count += 1;
+		x += advance;
+		i += n;
+	}
+
+	// longest prefix that still fits next to the ellipsis
+	int lo = 0;
+	int hi = count - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (advances[mid] + ellipsis_width + padding <= max_width)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	// callers copy the result back over the input (GFX_wrapText) or into
+	// buffers sized for it, the ellipsized form must never be longer
+	int cut = lo;
+	while (cut > 0 && offsets[cut] + 3 >= len)
+		cut -= 1;
+	if (offsets[cut] + 3 >= len)
+	{
+		// too short to gain anything from an ellipsis, keep it whole
+		free(offsets);
+		free(advances);
+		return text_width;
+	}
 
-	while (text_width > max_width)
+	// advances ignore kerning and the bold outline, so confirm with a real
+	// measurement and back off if we were a glyph or two optimistic
+	while (1)
 	{
-		int len = strlen(out_name);
-		strcpy(&out_name[len - 4], "...\0");
+		int at = offsets[cut];
+		memcpy(out_name, in_name, at);
+		strcpy(&out_name[at], "...");
 		TTF_SizeUTF8(font, out_name, &text_width, NULL);
 		text_width += padding;
+		if (text_width <= max_width || cut == 0)
+			break;
+		cut -= 1;
 	}
 
+	free(offsets);
+	free(advances);
 	return text_width;
 }
+///////////////////////////////
+
+// most labels are redrawn unchanged every time the selection moves, keep the
+// last few rasterized strings around instead of rendering them again.
+// surfaces are handed out with an extra reference so callers keep calling
+// SDL_FreeSurface() as if they owned them, but must not modify them.
+// not thread safe, only use from the render thread.
+#define TEXT_CACHE_SIZE 32
+#define TEXT_CACHE_MAX_LEN 256
+
+typedef struct TextCacheEntry
+{
+	TTF_Font *font;
+	uint32_t color;
+	int max_width;
+	uint32_t used_at;
+	SDL_Surface *surface;
+	char text[TEXT_CACHE_MAX_LEN];
+} TextCacheEntry;
+
+static TextCacheEntry text_cache[TEXT_CACHE_SIZE];
+static uint32_t text_cache_tick = 0;
+
+void GFX_flushTextCache(void)
+{
+	for (int i = 0; i < TEXT_CACHE_SIZE; i++)
+	{
+		if (text_cache[i].surface)
+			SDL_FreeSurface(text_cache[i].surface);
+	}
+	memset(text_cache, 0, sizeof(text_cache));
+	text_cache_tick = 0;
+}
+
+SDL_Surface *GFX_renderText(TTF_Font *font, const char *text, SDL_Color color, int max_width)
+{
+	if (!font || !text)
+		return NULL;
+
+	uint32_t rgba = (color.r << 24) | (color.g << 16) | (color.b << 8) | color.a;
+	int len = strlen(text);
+	int cacheable = len < TEXT_CACHE_MAX_LEN;
+
+	TextCacheEntry *slot = &text_cache[0];
+	if (cacheable)
+	{
+		for (int i = 0; i < TEXT_CACHE_SIZE; i++)
+		{
+			TextCacheEntry *entry = &text_cache[i];
+			if (entry->surface && entry->font == font && entry->color == rgba && entry->max_width == max_width && !strcmp(entry->text, text))
+			{
+				entry->used_at = ++text_cache_tick;
+				entry->surface->refcount += 1;
+				return entry->surface;
+			}
+			// empty slot or least recently used
+			if (slot->surface && (!entry->surface || entry->used_at < slot->used_at))
+				slot = entry;
+		}
+	}
+
+	SDL_Surface *surface;
+	if (max_width > 0)
+	{
+		char *truncated = malloc(len + 4);
+		GFX_truncateText(font, text, truncated, max_width, 0);
+		surface = TTF_RenderUTF8_Blended(font, truncated, color);
+		free(truncated);
+	}
+	else
+	{
+		surface = TTF_RenderUTF8_Blended(font, text, color);
+	}
+	if (!surface || !cacheable)
+		return surface;
+
+	if (slot->surface)
+		SDL_FreeSurface(slot->surface);
+	slot->font = font;
+	slot->color = rgba;
+	slot->max_width = max_width;
+	slot->used_at = ++text_cache_tick;
+	slot->surface = surface;
+	strcpy(slot->text, text);
+
+	surface->refcount += 1; // one for the cache, one for the caller
+	return surface;
+}
+
 int GFX_getTextHeight(TTF_Font *font, const char *in_name, char *out_name, int max_width, int padding)
 {
 	int text_height;
@@ -1679,14 +2018,14 @@ void GFX_blitButton(char *hint, char *button, SDL_Surface *dst, SDL_Rect *dst_re
 		GFX_blitAssetColor(ASSET_BUTTON, NULL, dst, dst_rect, THEME_COLOR1);
 
 		// label
-		text = TTF_RenderUTF8_Blended(font.medium, button, ALT_BUTTON_TEXT_COLOR);
+		text = GFX_renderText(font.medium, button, ALT_BUTTON_TEXT_COLOR, 0);
 		SDL_BlitSurface(text, NULL, dst, &(SDL_Rect){dst_rect->x + (SCALE1(BUTTON_SIZE) - text->w) / 2, dst_rect->y + (SCALE1(BUTTON_SIZE) - text->h) / 2});
 		ox += SCALE1(BUTTON_SIZE);
 		SDL_FreeSurface(text);
 	}
 	else
 	{
-		text = TTF_RenderUTF8_Blended(special_case ? font.large : font.tiny, button, ALT_BUTTON_TEXT_COLOR);
+		text = GFX_renderText(special_case ? font.large : font.tiny, button, ALT_BUTTON_TEXT_COLOR, 0);
 		GFX_blitPillDark(ASSET_BUTTON, dst, &(SDL_Rect){dst_rect->x, dst_rect->y, SCALE1(BUTTON_SIZE) / 2 + text->w, SCALE1(BUTTON_SIZE)});
 		ox += SCALE1(BUTTON_SIZE) / 4;
 
@@ -1701,7 +2040,7 @@ void GFX_blitButton(char *hint, char *button, SDL_Surface *dst, SDL_Rect *dst_re
 
 	// hint text
 	SDL_Color text_color = uintToColour(THEME_COLOR6_255);
-	text = TTF_RenderUTF8_Blended(font.small, hint, text_color);
+	text = GFX_renderText(font.small, hint, text_color, 0);
 	SDL_BlitSurface(text, NULL, dst, &(SDL_Rect){ox + dst_rect->x, dst_rect->y + (SCALE1(BUTTON_SIZE) - text->h) / 2, text->w, text->h});
 	SDL_FreeSurface(text);
 }
@@ -2115,7 +2454,7 @@ void GFX_blitText(TTF_Font *font, const char *str, int leading, SDL_Color color,
 
 		if (len)
 		{
-			text = TTF_RenderUTF8_Blended(font, line, color);
+			text = GFX_renderText(font, line, color, 0);
 			SDL_BlitSurface(text, NULL, dst, &(SDL_Rect){x + ((dst_rect->w - text->w) / 2), y + (i * leading)});
 			SDL_FreeSurface(text);
 		}
@@ -3278,6 +3617,17 @@ FALLBACK_IMPLEMENTATION int PLAT_shouldWake(void)
 	}
 	return 0;
 }
+FALLBACK_IMPLEMENTATION int PLAT_waitInput(uint32_t timeout_ms)
+{
+	// peek only, PLAT_pollInput() still consumes the event
+	return SDL_WaitEventTimeout(NULL, timeout_ms);
+}
+FALLBACK_IMPLEMENTATION void PLAT_interruptWaitInput(void)
+{
+	// ignored by PLAT_pollInput(), only here to end SDL_WaitEventTimeout()
+	SDL_Event event = {.type = SDL_USEREVENT};
+	SDL_PushEvent(&event);
+}
 FALLBACK_IMPLEMENTATION int PLAT_supportsDeepSleep(void) { return 0; }
 FALLBACK_IMPLEMENTATION int PLAT_deepSleep(void)
 {
@@ -3341,6 +3691,27 @@ int PAD_tappedSelect(uint32_t now)
 	return PAD_tappedBtn(BTN_SELECT, now);
 }
 
+int PAD_wait(uint32_t timeout_ms)
+{
+	// held buttons need to wake us up in time to repeat
+	uint32_t tick = SDL_GetTicks();
+	for (int i = 0; i < BTN_ID_COUNT; i++)
+	{
+		if (!(pad.is_pressed & (1 << i)))
+			continue;
+		uint32_t repeat_in = pad.repeat_at[i] > tick ? pad.repeat_at[i] - tick : 0;
+		if (repeat_in < timeout_ms)
+			timeout_ms = repeat_in;
+	}
+	if (timeout_ms == 0)
+		return 0;
+	return PLAT_waitInput(timeout_ms);
+}
+void PAD_interruptWait(void)
+{
+	PLAT_interruptWaitInput();
+}
+
 ///////////////////////////////
 static struct VIB_Context
 {
@@ -3500,9 +3871,176 @@ static void PWR_initOverlay(void)
 	GFX_blitBattery(pwr.overlay, NULL);
 }
 
+// batmon keeps the current battery state in a small file on tmpfs that every
+// process maps, so reading it costs no syscalls into sysfs. The sequence is
+// odd while batmon is writing, readers retry until it is even and unchanged.
+// batmon republishes at least every 10s, a state older than the stale limit
+// means it was stopped (or hung) and sysfs is the better source.
+#define BATTERY_STATE_MAGIC 0x32544142 // "BAT2"
+#define BATTERY_STATE_STALE_S 30
+typedef struct BatteryState {
+	uint32_t magic;
+	uint32_t seq;
+	int32_t pid;
+	int32_t is_charging;
+	int32_t charge;
+	uint32_t published; // CLOCK_MONOTONIC seconds
+	uint32_t flushed; // counts log flushes done for PWR_flushBatmon()
+} BatteryState;
+// the battery thread unmaps it when batmon goes away while the main thread
+// may be waiting on it in PWR_flushBatmon(), both only touch it under this
+static pthread_mutex_t battery_state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BatteryState* battery_state = NULL;
+static int battery_state_linked = 0;
+
+static uint32_t PWR_monotonicSeconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+// with battery_state_mutex held
+static BatteryState* PWR_mapBatteryState(int create)
+{
+	if (battery_state)
+		return battery_state;
+
+	// batmon sizes it under another name and renames it into place once it
+	// holds a state, a reader never sees it short (which would SIGBUS)
+	int fd = create ? open(BATTERY_STATE_PATH ".new", O_RDWR | O_CREAT | O_TRUNC, 0644) : open(BATTERY_STATE_PATH, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (create ? ftruncate(fd, sizeof(BatteryState)) < 0 : fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(BatteryState))
+	{
+		close(fd);
+		return NULL;
+	}
+	void* map = mmap(NULL, sizeof(BatteryState), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	battery_state = map;
+	battery_state_linked = !create;
+	return battery_state;
+}
+
+// with battery_state_mutex held
+static void PWR_unmapBatteryState(void)
+{
+	if (!battery_state)
+		return;
+	munmap(battery_state, sizeof(BatteryState));
+	battery_state = NULL;
+}
+
+// for batmon
+void PWR_publishBatteryStatus(int is_charging, int charge)
+{
+	pthread_mutex_lock(&battery_state_mutex);
+	BatteryState* state = PWR_mapBatteryState(1);
+	if (!state)
+	{
+		pthread_mutex_unlock(&battery_state_mutex);
+		return;
+	}
+
+	uint32_t seq = state->seq | 1;
+	__atomic_store_n(&state->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	state->pid = getpid();
+	state->is_charging = is_charging;
+	state->charge = charge;
+	state->published = PWR_monotonicSeconds();
+	state->magic = BATTERY_STATE_MAGIC;
+	__atomic_store_n(&state->seq, seq + 1, __ATOMIC_RELEASE);
+
+	if (!battery_state_linked && rename(BATTERY_STATE_PATH ".new", BATTERY_STATE_PATH) == 0)
+		battery_state_linked = 1;
+	pthread_mutex_unlock(&battery_state_mutex);
+}
+
+// for batmon
+void PWR_ackBatteryFlush(void)
+{
+	pthread_mutex_lock(&battery_state_mutex);
+	BatteryState* state = PWR_mapBatteryState(1);
+	if (state)
+		__atomic_add_fetch(&state->flushed, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&battery_state_mutex);
+}
+
+// batmon batches its log in memory and a stopped batmon never gets to write it
+// (its exit handler doesn't run on power off), so it flushes before we stop it
+static void PWR_flushBatmon(void)
+{
+	// held throughout, the battery thread just waits its turn
+	pthread_mutex_lock(&battery_state_mutex);
+	BatteryState* state = PWR_mapBatteryState(0);
+	// only a fresh state, an old pid may belong to something else by now
+	if (state && state->magic == BATTERY_STATE_MAGIC && PWR_monotonicSeconds() - state->published <= BATTERY_STATE_STALE_S)
+	{
+		uint32_t flushed = __atomic_load_n(&state->flushed, __ATOMIC_ACQUIRE);
+		if (kill(state->pid, SIGUSR1) == 0)
+		{
+			for (int i = 0; i < 100 && __atomic_load_n(&state->flushed, __ATOMIC_ACQUIRE) == flushed; i++)
+				usleep(10000); // up to 1s, it's one sqlite transaction
+		}
+	}
+	pthread_mutex_unlock(&battery_state_mutex);
+}
+
+// with battery_state_mutex held
+static int PWR_readBatteryStateLocked(int* is_charging, int* charge)
+{
+	BatteryState* state = PWR_mapBatteryState(0);
+	if (!state)
+		return 0;
+	if (state->magic != BATTERY_STATE_MAGIC || kill(state->pid, 0) < 0)
+	{
+		// batmon quit, it leaves a new file behind when it starts again
+		PWR_unmapBatteryState();
+		return 0;
+	}
+
+	for (int tries = 0; tries < 100; tries++)
+	{
+		uint32_t seq = __atomic_load_n(&state->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		int c = state->is_charging;
+		int p = state->charge;
+		uint32_t published = state->published;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&state->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		// a stopped batmon still passes kill(pid, 0)
+		if (PWR_monotonicSeconds() - published > BATTERY_STATE_STALE_S)
+			return 0;
+		*is_charging = c;
+		*charge = p;
+		return 1;
+	}
+	return 0;
+}
+// 1 if batmon is running and had published a state, 0 to read sysfs instead
+static int PWR_readBatteryState(int* is_charging, int* charge)
+{
+	// PWR_quit() cancels the battery thread, never while it holds the lock
+	int cancel_state;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+	pthread_mutex_lock(&battery_state_mutex);
+	int ok = PWR_readBatteryStateLocked(is_charging, charge);
+	pthread_mutex_unlock(&battery_state_mutex);
+	pthread_setcancelstate(cancel_state, NULL);
+	return ok;
+}
+
 static void PWR_updateBatteryStatus(void)
 {
-	PLAT_getBatteryStatusFine(&pwr.is_charging, &pwr.charge);
+	if (!PWR_readBatteryState(&pwr.is_charging, &pwr.charge))
+		PLAT_getBatteryStatusFine(&pwr.is_charging, &pwr.charge);
 	PLAT_enableOverlay(pwr.should_warn && pwr.charge <= PWR_LOW_CHARGE);
 
 	// this is technically redundant, but PWR_update() might not always be called to conserve battery and cycles
@@ -3570,6 +4108,9 @@ void PWR_quit(void)
 	// cancel battery thread
 	pthread_cancel(pwr.battery_pt);
 	pthread_join(pwr.battery_pt, NULL);
+	pthread_mutex_lock(&battery_state_mutex);
+	PWR_unmapBatteryState();
+	pthread_mutex_unlock(&battery_state_mutex);
 }
 void PWR_warn(int enable)
 {
@@ -3582,6 +4123,30 @@ int PWR_ignoreSettingInput(int btn, int show_setting)
 	return show_setting && (btn == BTN_MOD_PLUS || btn == BTN_MOD_MINUS);
 }
 
+// play time tracking, in-process for binaries linked against libgametimedb
+extern void gametime_stop_all(void) __attribute__((weak));
+extern void gametime_resume(void) __attribute__((weak));
+extern void gametime_quit(void) __attribute__((weak));
+
+static void PWR_stopGameTime(int wait)
+{
+	if (!gametime_stop_all)
+	{
+		system("gametimectl.elf stop_all");
+		return;
+	}
+	gametime_stop_all();
+	if (wait)
+		gametime_quit(); // written before the power goes
+}
+static void PWR_resumeGameTime(void)
+{
+	if (gametime_resume)
+		gametime_resume();
+	else
+		system("gametimectl.elf resume");
+}
+
 void PWR_update(int *_dirty, int *_show_setting, PWR_callback_t before_sleep, PWR_callback_t after_sleep)
 {
 	int dirty = _dirty ? *_dirty : 0;
@@ -3621,7 +4186,7 @@ void PWR_update(int *_dirty, int *_show_setting, PWR_callback_t before_sleep, PW
 	{
 		if (before_sleep)
 			before_sleep();
-		system("gametimectl.elf stop_all");
+		PWR_stopGameTime(1);
 		PWR_powerOff(0);
 	}
 
@@ -3774,12 +4339,14 @@ void PWR_powerOff(int reboot)
 		GFX_flip(gfx.screen);
 
 		system("killall -STOP keymon.elf");
+		PWR_flushBatmon();
 		system("killall -STOP batmon.elf");
 		system("killall -STOP wifi_daemon");
 		system("killall -STOP audiomon.elf");
 
 		PWR_updateFrequency(-1, false);
 
+		CFG_flush();
 		PLAT_powerOff(reboot);
 	}
 }
@@ -3803,6 +4370,7 @@ static void PWR_enterSleep(void)
 		PLAT_enableBacklight(0);
 	}
 	system("killall -STOP keymon.elf");
+	PWR_flushBatmon();
 	system("killall -STOP batmon.elf");
 	// this is currently handled in wifi_init.sh from suspend script, doing this double or at same time causes problems
 	// system("killall -STOP wifi_daemon");
@@ -3810,6 +4378,7 @@ static void PWR_enterSleep(void)
 
 	PWR_updateFrequency(-1, false);
 
+	CFG_flush();
 	sync();
 }
 static void PWR_exitSleep(void)
@@ -3899,7 +4468,7 @@ void PWR_sleep(void)
 {
 	LOG_info("Entering hybrid sleep\n");
 
-	system("gametimectl.elf stop_all");
+	PWR_stopGameTime(0);
 
 	GFX_clear(gfx.screen);
 	PAD_reset();
@@ -3908,7 +4477,7 @@ void PWR_sleep(void)
 	PWR_exitSleep();
 	PAD_reset();
 
-	system("gametimectl.elf resume");
+	PWR_resumeGameTime();
 
 	pwr.resume_tick = SDL_GetTicks();
 }
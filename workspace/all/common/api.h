@@ -23,6 +23,22 @@ void LOG_note(int level, const char* fmt, ...);
 
 ///////////////////////////////
 
+// Chrome/Perfetto trace events, enabled by touching TRACE_ENABLE_PATH.
+// Each process appends to TRACE_PATH on TRACE_flush(). Names are stored
+// by pointer, so pass string literals. Spans must begin and end on the
+// same thread. When disabled every macro is a single branch.
+extern int trace_enabled;
+void TRACE_init(const char* process_name);
+void TRACE_event(char phase, const char* name, int64_t value);
+void TRACE_flush(void);
+
+#define TRACE_begin(name) do { if (trace_enabled) TRACE_event('B', (name), 0); } while (0)
+#define TRACE_end(name) do { if (trace_enabled) TRACE_event('E', (name), 0); } while (0)
+#define TRACE_instant(name) do { if (trace_enabled) TRACE_event('i', (name), 0); } while (0)
+#define TRACE_counter(name, value) do { if (trace_enabled) TRACE_event('C', (name), (value)); } while (0)
+
+///////////////////////////////
+
 #define PAGE_COUNT	2
 #define PAGE_SCALE	3
 #define PAGE_WIDTH	(FIXED_WIDTH * PAGE_SCALE)
@@ -100,9 +116,18 @@ extern int currentshadertexw;
 extern int currentshadertexh;
 extern double currentcpuse;
 extern int currentcputemp;
+extern int currentframeload; // % of the frame budget the last frames took, smoothed
+extern int currentframeoverruns;
+extern int currentbatterydraw; // mA, 0 if unknown
 extern int should_rotate;
 extern volatile int useAutoCpu;
 
+enum {
+	AUTO_CPU_OFF,
+	AUTO_CPU_USAGE, // follow the process cpu usage
+	AUTO_CPU_FRAME, // follow frame times reported with PLAT_frameTime()
+};
+
 enum {
 	ASSET_WHITE_PILL,
 	ASSET_BLACK_PILL,
@@ -282,6 +307,8 @@ void GFX_flip_fixed_rate(SDL_Surface* screen, double target_fps); // if target_f
 void GFX_sync(void); // call this to maintain 60fps when not calling GFX_flip() this frame
 void GFX_delay(void); // gfx_sync() is only for everywhere where there is no audio buffer to rely on for delaying, stupid so doing gfx_delay() for like waiting for input loop in binding menu. Need to remove gfx_sync() everwhere eventually
 void GFX_quit(void);
+void GFX_suspend(void); // releases the display for a child process, keeps fonts and assets
+SDL_Surface* GFX_resume(void);
 
 enum {
 	VSYNC_OFF = 0,
@@ -293,6 +320,8 @@ int GFX_getVsync(void);
 void GFX_setVsync(int vsync);
 
 int GFX_truncateText(TTF_Font* font, const char* in_name, char* out_name, int max_width, int padding); // returns final width
+SDL_Surface* GFX_renderText(TTF_Font* font, const char* text, SDL_Color color, int max_width); // cached, truncated to max_width if > 0, free with SDL_FreeSurface() but don't modify
+void GFX_flushTextCache(void);
 int PLAT_resetScrollText(TTF_Font* font, const char* in_name,int max_width);
 void GFX_scrollTextSurface(TTF_Font* font, const char* in_name, SDL_Surface** out_surface, int max_width, int height, int padding, SDL_Color color,float heightratio); // returns final width
 int GFX_getTextWidth(TTF_Font* font, const char* in_name, char* out_name, int max_width, int padding); // returns final width
@@ -395,6 +424,7 @@ extern LID_Context lid;
 void PLAT_initLid(void);
 int PLAT_lidChanged(int* state);
 void PLAT_getCPUTemp();
+void PLAT_getBatteryDraw(void);
 ///////////////////////////////
 
 typedef struct PAD_Axis {
@@ -436,6 +466,11 @@ int PAD_justRepeated(int btn);
 int PAD_tappedMenu(uint32_t now); // special case, returns 1 on release of BTN_MENU within 250ms if BTN_PLUS/BTN_MINUS haven't been pressed
 int PAD_tappedSelect(uint32_t now); // special case, returns 1 on release of BTN_SELECT within 250ms if BTN_PLUS/BTN_MINUS haven't been pressed
 
+// blocks until input arrives, PAD_interruptWait() is called or timeout_ms elapses,
+// the timeout is clamped to the next pending key repeat. returns 1 if woken early
+int PAD_wait(uint32_t timeout_ms);
+void PAD_interruptWait(void); // safe to call from any thread
+
 ///////////////////////////////
 #define VIB_sleepStrength 4
 #define VIB_sleepDuration_ms 100
@@ -480,6 +515,8 @@ int PWR_preventAutosleep(void);
 
 int PWR_isCharging(void);
 int PWR_getBattery(void);
+void PWR_publishBatteryStatus(int is_charging, int charge); // batmon only, PWR_* in every other process reads this
+void PWR_ackBatteryFlush(void); // batmon only, after the log flush SIGUSR1 asked for
 
 // rules-based presets managed and applied by LEDS_applyRules()
 enum LightProfile {
@@ -544,6 +581,8 @@ void PLAT_quitInput(void);
 
 void PLAT_pollInput(void);
 int PLAT_shouldWake(void);
+int PLAT_waitInput(uint32_t timeout_ms);
+void PLAT_interruptWaitInput(void);
 
 SDL_Surface* PLAT_initVideo(void);
 void PLAT_quitVideo(void);
@@ -630,8 +669,14 @@ int PLAT_deepSleep(void);
 void PLAT_powerOff(int reboot);
 
 void *PLAT_cpu_monitor(void *arg);
+void PLAT_pauseCPUMonitor(int pause); // parks the monitor while another process owns the clock
 void PLAT_setCPUSpeed(int speed); // enum
 void PLAT_setCustomCPUSpeed(int speed);
+int PLAT_getCPUSpeed(void); // MHz, the clock last set rather than an average
+void PLAT_frameTime(int work_us, int budget_us); // once per emulated frame
+// what most of a game's frames cost before, in cycles (work us * MHz), for
+// the governors to start at a clock that fits it, 0 to forget it
+void PLAT_setFrameProfile(int cycles, int budget_us);
 void PLAT_setRumble(int strength);
 int PLAT_pickSampleRate(int requested, int max);
 
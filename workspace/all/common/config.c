@@ -1,3 +1,8 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
 #include "config.h"
 #include "defines.h"
 #include "utils.h"
@@ -887,9 +892,8 @@ void CFG_get(const char *key, char *value)
     }
 }
 
-void CFG_sync(void)
+static void CFG_writeFile(const NextUISettings *cfg)
 {
-    // write to file
     char settingsPath[MAX_PATH];
     const char *shared_userdata = getenv("SHARED_USERDATA_PATH");
     if (!shared_userdata || !shared_userdata[0])
@@ -899,7 +903,9 @@ void CFG_sync(void)
     }
 
     snprintf(settingsPath, sizeof(settingsPath), "%s/minuisettings.txt", shared_userdata);
-    FILE *file = fopen(settingsPath, "w");
+    char tmpPath[MAX_PATH + 8];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", settingsPath);
+    FILE *file = fopen(tmpPath, "w");
     if (file == NULL)
     {
         printf("[CFG] Unable to open settings file, cant write\n");
@@ -907,45 +913,164 @@ void CFG_sync(void)
     }
 
     fprintf(file, "fontOrder=2\n");
-    fprintf(file, "font=%i\n", settings.font);
-    fprintf(file, "color1=0x%06X\n", settings.color1_255);
-    fprintf(file, "color2=0x%06X\n", settings.color2_255);
-    fprintf(file, "color3=0x%06X\n", settings.color3_255);
-    fprintf(file, "color4=0x%06X\n", settings.color4_255);
-    fprintf(file, "color5=0x%06X\n", settings.color5_255);
-    fprintf(file, "color6=0x%06X\n", settings.color6_255);
-    fprintf(file, "color7=0x%06X\n", settings.color7_255);
-    fprintf(file, "radius=%i\n", settings.thumbRadius);
-    fprintf(file, "showclock=%i\n", settings.showClock);
-    fprintf(file, "clock24h=%i\n", settings.clock24h);
-    fprintf(file, "batteryperc=%i\n", settings.showBatteryPercent);
-    fprintf(file, "menuanim=%i\n", settings.showMenuAnimations);
-    fprintf(file, "menutransitions=%i\n", settings.showMenuTransitions);
-    fprintf(file, "recents=%i\n", settings.showRecents);
-    fprintf(file, "tools=%i\n", settings.showTools);
-    fprintf(file, "gameart=%i\n", settings.showGameArt);
-    fprintf(file, "showfoldernamesatroot=%i\n", settings.showFolderNamesAtRoot);
-    fprintf(file, "screentimeout=%i\n", settings.screenTimeoutSecs);
-    fprintf(file, "suspendTimeout=%i\n", settings.suspendTimeoutSecs);
-    fprintf(file, "powerOffProtection=%i\n", settings.powerOffProtection);
-    fprintf(file, "switcherscale=%i\n", settings.gameSwitcherScaling);
-    fprintf(file, "haptics=%i\n", settings.haptics);
-    fprintf(file, "romfolderbg=%i\n", settings.romsUseFolderBackground);
-    fprintf(file, "saveFormat=%i\n", settings.saveFormat);
-    fprintf(file, "stateFormat=%i\n", settings.stateFormat);
-    fprintf(file, "useExtractedFileName=%i\n", settings.useExtractedFileName);
-    fprintf(file, "fnToggleLeds=%i\n", settings.fnToggleLeds);
-    fprintf(file, "chargingBreathingLed=%i\n", settings.chargingBreathingLed);
-    fprintf(file, "artWidth=%i\n", (int)(settings.gameArtWidth * 100));
-    fprintf(file, "wifi=%i\n", settings.wifi);
-    fprintf(file, "defaultView=%i\n", settings.defaultView);
-    fprintf(file, "quickSwitcherUi=%i\n", settings.showQuickSwitcherUi);
-    fprintf(file, "wifiDiagnostics=%i\n", settings.wifiDiagnostics);
-    fprintf(file, "bluetooth=%i\n", settings.bluetooth);
-    fprintf(file, "btDiagnostics=%i\n", settings.bluetoothDiagnostics);
-    fprintf(file, "btMaxRate=%i\n", settings.bluetoothSamplerateLimit);
-
-    fclose(file);
+    fprintf(file, "font=%i\n", cfg->font);
+    fprintf(file, "color1=0x%06X\n", cfg->color1_255);
+    fprintf(file, "color2=0x%06X\n", cfg->color2_255);
+    fprintf(file, "color3=0x%06X\n", cfg->color3_255);
+    fprintf(file, "color4=0x%06X\n", cfg->color4_255);
+    fprintf(file, "color5=0x%06X\n", cfg->color5_255);
+    fprintf(file, "color6=0x%06X\n", cfg->color6_255);
+    fprintf(file, "color7=0x%06X\n", cfg->color7_255);
+    fprintf(file, "radius=%i\n", cfg->thumbRadius);
+    fprintf(file, "showclock=%i\n", cfg->showClock);
+    fprintf(file, "clock24h=%i\n", cfg->clock24h);
+    fprintf(file, "batteryperc=%i\n", cfg->showBatteryPercent);
+    fprintf(file, "menuanim=%i\n", cfg->showMenuAnimations);
+    fprintf(file, "menutransitions=%i\n", cfg->showMenuTransitions);
+    fprintf(file, "recents=%i\n", cfg->showRecents);
+    fprintf(file, "tools=%i\n", cfg->showTools);
+    fprintf(file, "gameart=%i\n", cfg->showGameArt);
+    fprintf(file, "showfoldernamesatroot=%i\n", cfg->showFolderNamesAtRoot);
+    fprintf(file, "screentimeout=%i\n", cfg->screenTimeoutSecs);
+    fprintf(file, "suspendTimeout=%i\n", cfg->suspendTimeoutSecs);
+    fprintf(file, "powerOffProtection=%i\n", cfg->powerOffProtection);
+    fprintf(file, "switcherscale=%i\n", cfg->gameSwitcherScaling);
+    fprintf(file, "haptics=%i\n", cfg->haptics);
+    fprintf(file, "romfolderbg=%i\n", cfg->romsUseFolderBackground);
+    fprintf(file, "saveFormat=%i\n", cfg->saveFormat);
+    fprintf(file, "stateFormat=%i\n", cfg->stateFormat);
+    fprintf(file, "useExtractedFileName=%i\n", cfg->useExtractedFileName);
+    fprintf(file, "fnToggleLeds=%i\n", cfg->fnToggleLeds);
+    fprintf(file, "chargingBreathingLed=%i\n", cfg->chargingBreathingLed);
+    fprintf(file, "artWidth=%i\n", (int)(cfg->gameArtWidth * 100));
+    fprintf(file, "wifi=%i\n", cfg->wifi);
+    fprintf(file, "defaultView=%i\n", cfg->defaultView);
+    fprintf(file, "quickSwitcherUi=%i\n", cfg->showQuickSwitcherUi);
+    fprintf(file, "wifiDiagnostics=%i\n", cfg->wifiDiagnostics);
+    fprintf(file, "bluetooth=%i\n", cfg->bluetooth);
+    fprintf(file, "btDiagnostics=%i\n", cfg->bluetoothDiagnostics);
+    fprintf(file, "btMaxRate=%i\n", cfg->bluetoothSamplerateLimit);
+
+    // written next to the real file and renamed over it, so losing power
+    // mid-write leaves the previous settings rather than a truncated file
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok || rename(tmpPath, settingsPath) != 0)
+    {
+        printf("[CFG] Unable to write settings file: %s\n", strerror(errno));
+        unlink(tmpPath);
+    }
+}
+
+// setters only mark settings dirty, a writer thread saves them once they've
+// been left alone for a moment. scrubbing a slider or color used to rewrite
+// the whole file dozens of times a second. until then the file on disk is
+// behind, so anything that hands over to another process reading it (exec,
+// fork + exec, power off) has to CFG_flush() first
+#define CFG_SYNC_DELAY_MS 300
+
+static struct
+{
+    pthread_t thread;
+    pthread_mutex_t mx;
+    pthread_cond_t cv;
+    bool started;
+    bool quit;
+    bool dirty;
+    bool writing;
+    uint64_t dirty_at; // ms
+    NextUISettings pending; // snapshot taken by the setter that dirtied it
+} cfg_writer = {
+    .mx = PTHREAD_MUTEX_INITIALIZER,
+    .cv = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t CFG_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// called with mx held, returns with it held
+static void CFG_writePending(void)
+{
+    while (cfg_writer.writing)
+        pthread_cond_wait(&cfg_writer.cv, &cfg_writer.mx);
+    if (!cfg_writer.dirty)
+        return;
+
+    NextUISettings snapshot = cfg_writer.pending;
+    cfg_writer.dirty = false;
+    cfg_writer.writing = true;
+    pthread_mutex_unlock(&cfg_writer.mx);
+
+    CFG_writeFile(&snapshot);
+
+    pthread_mutex_lock(&cfg_writer.mx);
+    cfg_writer.writing = false;
+    pthread_cond_broadcast(&cfg_writer.cv);
+}
+
+static void *CFG_writerThread(void *arg)
+{
+    pthread_mutex_lock(&cfg_writer.mx);
+    while (!cfg_writer.quit)
+    {
+        if (!cfg_writer.dirty)
+        {
+            pthread_cond_wait(&cfg_writer.cv, &cfg_writer.mx);
+            continue;
+        }
+
+        // every new change pushes the deadline back
+        uint64_t now = CFG_now();
+        uint64_t deadline = cfg_writer.dirty_at + CFG_SYNC_DELAY_MS;
+        if (now < deadline)
+        {
+            // timedwait wants wall time, rechecked against CFG_now() anyway
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            uint64_t ns = ts.tv_nsec + (deadline - now) * 1000000;
+            ts.tv_sec += ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            pthread_cond_timedwait(&cfg_writer.cv, &cfg_writer.mx, &ts);
+            continue;
+        }
+        CFG_writePending();
+    }
+    pthread_mutex_unlock(&cfg_writer.mx);
+    return NULL;
+}
+
+static void CFG_startWriter(void)
+{
+    cfg_writer.started = pthread_create(&cfg_writer.thread, NULL, CFG_writerThread, NULL) == 0;
+    if (cfg_writer.started)
+        atexit(CFG_flush); // tools that never call CFG_quit still get their changes saved
+}
+
+void CFG_sync(void)
+{
+    pthread_mutex_lock(&cfg_writer.mx);
+    cfg_writer.pending = settings;
+    cfg_writer.dirty = true;
+    cfg_writer.dirty_at = CFG_now();
+    if (!cfg_writer.started && !cfg_writer.quit)
+        CFG_startWriter();
+    if (cfg_writer.started)
+        pthread_cond_broadcast(&cfg_writer.cv);
+    else
+        CFG_writePending(); // no thread, write it right away
+    pthread_mutex_unlock(&cfg_writer.mx);
+}
+
+void CFG_flush(void)
+{
+    pthread_mutex_lock(&cfg_writer.mx);
+    CFG_writePending();
+    pthread_mutex_unlock(&cfg_writer.mx);
 }
 
 void CFG_print(void)
@@ -1013,5 +1138,17 @@ void CFG_setSwapDpadLeftStick(bool enable)
 
 void CFG_quit(void)
 {
-    CFG_sync();
+    pthread_mutex_lock(&cfg_writer.mx);
+    bool started = cfg_writer.started;
+    cfg_writer.started = false;
+    cfg_writer.quit = true;
+    cfg_writer.pending = settings; // always saved on the way out
+    cfg_writer.dirty = true;
+    CFG_writePending();
+    if (started)
+        pthread_cond_broadcast(&cfg_writer.cv);
+    pthread_mutex_unlock(&cfg_writer.mx);
+
+    if (started)
+        pthread_join(cfg_writer.thread, NULL);
 }
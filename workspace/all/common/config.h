@@ -42,7 +42,11 @@ enum
 	//Retroarch: Game.state<n>
 	STATE_FORMAT_SRM,
 	//Retroarch: Game.state<n>
-	STATE_FORMAT_SRM_UNCOMRESSED
+	STATE_FORMAT_SRM_UNCOMRESSED,
+	// MinUI: Game.st0, lz4 compressed
+	STATE_FORMAT_SAV_LZ4,
+	// MinUI: Game.st0, zstd compressed
+	STATE_FORMAT_SAV_ZSTD
 };
 
 enum {
@@ -50,6 +54,7 @@ enum {
 	SCREEN_GAMELIST,
 	SCREEN_GAMESWITCHER,
 	SCREEN_QUICKMENU,
+	SCREEN_SEARCH,
 	// meta
 	SCREEN_GAME,
 	SCREEN_OFF
@@ -271,7 +276,12 @@ void CFG_setBluetoothDiagnostics(bool on);
 int CFG_getBluetoothSamplingrateLimit(void);
 void CFG_setBluetoothSamplingrateLimit(int value);
 
+// marks settings dirty, they're written shortly after the last change
 void CFG_sync(void);
+// writes pending changes now and waits for a write in progress. call it
+// before sleep, power off or starting another process that reads settings,
+// CFG_quit() alone isn't reached on every one of those paths
+void CFG_flush(void);
 void CFG_quit(void);
 
 #endif
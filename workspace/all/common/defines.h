@@ -24,6 +24,10 @@
 #define TOOLS_PATH SDCARD_PATH "/Tools/" PLATFORM
 #define RECENT_PATH SHARED_USERDATA_PATH "/.minui/recent.txt"
 #define SIMPLE_MODE_PATH SHARED_USERDATA_PATH "/enable-simple-mode"
+#define RESIDENT_MODE_PATH SHARED_USERDATA_PATH "/enable-resident-mode"
+#define PREFETCH_DISABLE_PATH SHARED_USERDATA_PATH "/disable-prefetch"
+#define TRACE_ENABLE_PATH SHARED_USERDATA_PATH "/enable-trace"
+#define TRACE_PATH USERDATA_PATH "/logs/trace.json"
 #define AUTO_RESUME_PATH SHARED_USERDATA_PATH "/.minui/auto_resume.txt"
 #define AUTO_RESUME_SLOT 9
 #define GAME_SWITCHER_PERSIST_PATH SHARED_USERDATA_PATH "/.minui/game_switcher.txt"
@@ -35,6 +39,7 @@
 #define CHANGE_DISC_PATH "/tmp/change_disc.txt"
 #define RESUME_SLOT_PATH "/tmp/resume_slot.txt"
 #define NOUI_PATH "/tmp/noui"
+#define BATTERY_STATE_PATH "/tmp/battery_state" // mapped, published by batmon
 
 #define TRIAD_WHITE 		0xff,0xff,0xff
 #define TRIAD_BLACK 		0x00,0x00,0x00
@@ -10,10 +10,19 @@
 #include <errno.h>
 #include <time.h>
 #include <sys/select.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <pthread.h>
 
+#include "statecodec.h"
+
 #define MAX_PACKET_SIZE 4096
 #define MAX_DATA_SIZE (MAX_PACKET_SIZE - sizeof(netpacket_header_t))
+#define STATE_CHUNK_DATA (MAX_DATA_SIZE - sizeof(netplay_state_chunk_t))
+#define STATE_CODEC STATE_CODEC_LZ4 // deltas are mostly zeros, speed matters more than ratio
+
+_Static_assert(NETPLAY_RX_BUFFER_SIZE >= 2 * MAX_PACKET_SIZE, "rx buffer must fit a partial packet plus a whole one");
 
 // Helper function to validate packet header
 static int validate_packet_header(const netpacket_header_t *header, const char *source_desc) {
@@ -72,6 +81,962 @@ static int set_nonblocking(int sock) {
     return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
 }
 
+static void set_nodelay(int sock) {
+    // Input packets are tiny and latency bound, don't let Nagle batch them
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+}
+
+// Called with the mutex held
+static bool has_peers(netplay_context_t *ctx) {
+    if (ctx->role == NETPLAY_ROLE_HOST) return ctx->client_count > 0;
+    return ctx->state == NETPLAY_STATE_CONNECTED;
+}
+
+// State chunks go out from their own thread, a packet must reach the
+// stream whole before another thread's starts
+static pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int send_all_locked(int sock, const uint8_t *data, int size) {
+    while (size > 0) {
+        int sent = send(sock, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            
+            // Non-blocking socket with a full send buffer, give it a moment
+            fd_set write_fds;
+            FD_ZERO(&write_fds);
+            FD_SET(sock, &write_fds);
+            struct timeval timeout = {0, 100000};
+            if (select(sock + 1, NULL, &write_fds, NULL, &timeout) <= 0) return -1;
+            continue;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return 0;
+}
+
+static int send_all(int sock, const uint8_t *data, int size) {
+    pthread_mutex_lock(&send_mutex);
+    int result = send_all_locked(sock, data, size);
+    pthread_mutex_unlock(&send_mutex);
+    return result;
+}
+
+static int send_packet(int sock, uint8_t type, uint32_t sequence, const void *payload, int length) {
+    uint8_t packet[MAX_PACKET_SIZE];
+    if (length < 0 || length > (int)MAX_DATA_SIZE) return -1;
+    
+    netpacket_header_t *header = (netpacket_header_t*)packet;
+    header->magic = NETPLAY_MAGIC;
+    header->type = type;
+    header->version = NETPLAY_PROTOCOL_VERSION;
+    header->length = length;
+    header->sequence = sequence;
+    if (length > 0) memcpy(packet + sizeof(netpacket_header_t), payload, length);
+    
+    return send_all(sock, packet, sizeof(netpacket_header_t) + length);
+}
+
+static uint32_t get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Network simulation
+
+static bool sim_enabled(netplay_context_t *ctx) {
+    return ctx->sim.latency_ms > 0 || ctx->sim.jitter_ms > 0 || ctx->sim.loss_pct > 0;
+}
+
+static void sim_flush(netplay_context_t *ctx, bool all) {
+    netplay_sim_t *sim = &ctx->sim;
+    uint32_t now = get_time_ms();
+    for (int i = 0; i < sim->count; i++) {
+        netplay_sim_packet_t *packet = &sim->packets[(sim->head + i) % NETPLAY_SIM_QUEUE];
+        if (packet->sent || (!all && (int32_t)(packet->due - now) > 0)) continue;
+        
+        if (packet->datagram) {
+            sendto(packet->sock, packet->data, packet->size, MSG_NOSIGNAL, (struct sockaddr*)&packet->to, sizeof(packet->to));
+        } else if (send_all(packet->sock, packet->data, packet->size) < 0) {
+            printf("NET: Failed to send delayed packet: %s\n", strerror(errno));
+        }
+        packet->sent = true;
+    }
+    while (sim->count > 0 && sim->packets[sim->head].sent) {
+        sim->head = (sim->head + 1) % NETPLAY_SIM_QUEUE;
+        sim->count--;
+    }
+}
+
+// Called before closing a socket, its descriptor may be reused right away
+static void sim_drop(netplay_context_t *ctx, int sock) {
+    netplay_sim_t *sim = &ctx->sim;
+    for (int i = 0; i < sim->count; i++) {
+        netplay_sim_packet_t *packet = &sim->packets[(sim->head + i) % NETPLAY_SIM_QUEUE];
+        if (sock < 0 || packet->sock == sock) packet->sent = true;
+    }
+}
+
+// ms until the next held back packet is due, -1 when there is none
+static int sim_next_due(netplay_context_t *ctx) {
+    netplay_sim_t *sim = &ctx->sim;
+    uint32_t now = get_time_ms();
+    int next = -1;
+    for (int i = 0; i < sim->count; i++) {
+        netplay_sim_packet_t *packet = &sim->packets[(sim->head + i) % NETPLAY_SIM_QUEUE];
+        if (packet->sent) continue;
+        int32_t wait = packet->due - now;
+        if (wait < 0) wait = 0;
+        if (next < 0 || wait < next) next = wait;
+    }
+    return next;
+}
+
+static uint32_t sim_random(netplay_sim_t *sim) {
+    // LCG, so the same seed gives the same run every time
+    sim->seed = sim->seed * 1103515245 + 12345;
+    return sim->seed >> 16;
+}
+
+// to is NULL for TCP
+static void sim_hold(netplay_context_t *ctx, int sock, const struct sockaddr_in *to, const uint8_t *data, int size) {
+    netplay_sim_t *sim = &ctx->sim;
+    if (sim->count == NETPLAY_SIM_QUEUE) sim_flush(ctx, true);
+    
+    bool lost = sim->loss_pct > 0 && (int)(sim_random(sim) % 100) < sim->loss_pct;
+    if (lost && to) return;
+    
+    uint32_t jitter = sim->jitter_ms > 0 ? sim_random(sim) % (sim->jitter_ms + 1) : 0;
+    uint32_t due = get_time_ms() + sim->latency_ms + jitter;
+    if (!to) {
+        if (lost) due += NETPLAY_SIM_RTO_MS;
+        if ((int32_t)(due - sim->last_due) < 0) due = sim->last_due; // TCP doesn't reorder
+        sim->last_due = due;
+    }
+    
+    netplay_sim_packet_t *packet = &sim->packets[(sim->head + sim->count) % NETPLAY_SIM_QUEUE];
+    memcpy(packet->data, data, size);
+    packet->due = due;
+    packet->sock = sock;
+    packet->datagram = to != NULL;
+    packet->sent = false;
+    if (to) packet->to = *to;
+    packet->size = size;
+    sim->count++;
+}
+
+static int session_send(netplay_context_t *ctx, int sock, uint8_t type, uint32_t sequence, const void *payload, int length) {
+    if (!sim_enabled(ctx)) {
+        return send_packet(sock, type, sequence, payload, length);
+    }
+    
+    sim_flush(ctx, false);
+    int size = sizeof(netpacket_header_t) + length;
+    if (size > NETPLAY_SIM_PACKET_SIZE) {
+        sim_flush(ctx, true); // too big to hold back, but mustn't overtake what is
+        return send_packet(sock, type, sequence, payload, length);
+    }
+    
+    uint8_t packet[NETPLAY_SIM_PACKET_SIZE];
+    netpacket_header_t *header = (netpacket_header_t*)packet;
+    header->magic = NETPLAY_MAGIC;
+    header->type = type;
+    header->version = NETPLAY_PROTOCOL_VERSION;
+    header->length = length;
+    header->sequence = sequence;
+    if (length > 0) memcpy(packet + sizeof(netpacket_header_t), payload, length);
+    sim_hold(ctx, sock, NULL, packet, size);
+    return 0;
+}
+
+static void udp_sendto(netplay_context_t *ctx, const struct sockaddr_in *to, const uint8_t *data, int size) {
+    if (sim_enabled(ctx)) {
+        sim_flush(ctx, false);
+        sim_hold(ctx, ctx->udp_socket, to, data, size);
+        return;
+    }
+    // Lost or not, the next datagram repeats it
+    sendto(ctx->udp_socket, data, size, MSG_NOSIGNAL, (const struct sockaddr*)to, sizeof(*to));
+}
+
+// Lockstep session
+
+// Inputs older than this are no longer needed, for running or for rollback
+static uint32_t session_oldest(netplay_session_t *s) {
+    return s->confirmed < s->frame ? s->confirmed : s->frame;
+}
+
+static bool same_input(const netplay_input_t *a, const netplay_input_t *b) {
+    return a->buttons == b->buttons
+        && a->analog_lx == b->analog_lx && a->analog_ly == b->analog_ly
+        && a->analog_rx == b->analog_rx && a->analog_ry == b->analog_ry;
+}
+
+static void session_store(netplay_session_t *s, uint32_t frame, int port, const netplay_input_t *input) {
+    // Peers can only be a couple of delays ahead, anything else is stale or bogus
+    uint32_t oldest = session_oldest(s);
+    if (frame < oldest || frame - oldest >= NETPLAY_INPUT_QUEUE) return;
+    if (port < 0 || port >= s->players) return;
+    
+    netplay_frame_t *slot = &s->queue[frame % NETPLAY_INPUT_QUEUE];
+    if (slot->frame != frame) {
+        memset(slot, 0, sizeof(netplay_frame_t));
+        slot->frame = frame;
+    }
+    if (slot->predicted & (1 << port)) {
+        // The frame already ran with a guess, redo it if the guess was wrong
+        if (frame < s->frame && !same_input(&slot->inputs[port], input)) {
+            if (!s->rollback_pending || frame < s->rollback_from) s->rollback_from = frame;
+            s->rollback_pending = true;
+        }
+        slot->predicted &= ~(1 << port);
+    }
+    slot->inputs[port] = *input;
+    slot->inputs[port].port = port;
+    slot->have |= 1 << port;
+    
+    while (1) {
+        netplay_frame_t *next = &s->queue[s->have_upto[port] % NETPLAY_INPUT_QUEUE];
+        if (next->frame != s->have_upto[port] || !(next->have & (1 << port))) break;
+        s->have_upto[port]++;
+    }
+    
+    if (!(s->last_have & (1 << port)) || frame >= s->last_frame[port]) {
+        s->last_input[port] = slot->inputs[port];
+        s->last_frame[port] = frame;
+        s->last_have |= 1 << port;
+    }
+    
+    int all = (1 << s->players) - 1;
+    while (1) {
+        netplay_frame_t *next = &s->queue[s->confirmed % NETPLAY_INPUT_QUEUE];
+        if (next->frame != s->confirmed || next->have != all) break;
+        s->confirmed++;
+    }
+}
+
+static void session_init(netplay_context_t *ctx, int players, int delay, int port) {
+    netplay_session_t *s = &ctx->session;
+    s->players = players;
+    s->delay = delay;
+    s->local_port = port;
+    s->frame = 0;
+    s->confirmed = 0;
+    memset(s->have_upto, 0, sizeof(s->have_upto));
+    s->next_submit = delay;
+    s->last_have = 0;
+    s->rollback_pending = false;
+    s->sync_pending = false;
+    s->rollbacks = 0;
+    s->resimulated = 0;
+    memset(s->queue, 0, sizeof(s->queue));
+    memset(s->checksums, 0, sizeof(s->checksums));
+    
+    // Nobody pressed anything before the session began
+    netplay_input_t idle;
+    memset(&idle, 0, sizeof(idle));
+    for (int frame = 0; frame < delay; frame++) {
+        for (int p = 0; p < players; p++) {
+            session_store(s, frame, p, &idle);
+        }
+    }
+    // Both sides have those already, UDP needn't send them
+    struct sockaddr_in host_addr = ctx->udp_links[0].addr;
+    memset(ctx->udp_links, 0, sizeof(ctx->udp_links));
+    ctx->udp_links[0].addr = host_addr;
+    for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
+        for (int p = 0; p < players; p++) {
+            ctx->udp_links[i].ack[p] = delay;
+            ctx->udp_links[i].sent_upto[p] = delay;
+            ctx->udp_links[i].tcp_upto[p] = delay;
+        }
+    }
+    s->active = true;
+}
+
+// Clients only talk to the host, the host talks to every client but `except_slot`
+static void session_broadcast(netplay_context_t *ctx, uint8_t type, uint32_t sequence, const void *payload, int length, int except_slot) {
+    pthread_mutex_lock(&ctx->mutex);
+    netplay_role_t role = ctx->role;
+    int server_socket = ctx->server_socket;
+    int client_sockets[NETPLAY_MAX_PEERS];
+    memcpy(client_sockets, ctx->client_sockets, sizeof(client_sockets));
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    if (role == NETPLAY_ROLE_CLIENT && server_socket >= 0) {
+        if (session_send(ctx, server_socket, type, sequence, payload, length) < 0) {
+            printf("NET: Failed to send to server: %s\n", strerror(errno));
+        }
+    } else if (role == NETPLAY_ROLE_HOST) {
+        for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
+            if (i == except_slot || client_sockets[i] < 0 || ctx->session.client_ports[i] < 0) continue;
+            if (session_send(ctx, client_sockets[i], type, sequence, payload, length) < 0) {
+                printf("NET: Failed to send to client %d: %s\n", i + 1, strerror(errno));
+            }
+        }
+    }
+}
+
+// UDP input
+
+static int link_socket(netplay_context_t *ctx, int link) {
+    pthread_mutex_lock(&ctx->mutex);
+    int sock = ctx->role == NETPLAY_ROLE_HOST ? ctx->client_sockets[link] : ctx->server_socket;
+    pthread_mutex_unlock(&ctx->mutex);
+    return sock;
+}
+
+// Whether the input of `port` goes out over `link`
+static bool link_sends_port(netplay_context_t *ctx, int link, int port) {
+    netplay_session_t *s = &ctx->session;
+    if (port >= s->players) return false;
+    if (ctx->role == NETPLAY_ROLE_HOST) return s->client_ports[link] > 0 && port != s->client_ports[link];
+    return port == s->local_port;
+}
+
+static void link_send_tcp(netplay_context_t *ctx, int link, uint32_t frame, const netplay_input_t *input) {
+    int sock = link_socket(ctx, link);
+    if (sock < 0) return;
+    if (session_send(ctx, sock, NETPACKET_INPUT_STATE, frame, input, sizeof(netplay_input_t)) < 0) {
+        printf("NET: Failed to send input: %s\n", strerror(errno));
+    }
+    netplay_udp_link_t *l = &ctx->udp_links[link];
+    if (frame + 1 > l->tcp_upto[input->port]) l->tcp_upto[input->port] = frame + 1;
+}
+
+// Sends input the other side doesn't have yet over TCP, unless the UDP
+// channel to it is up, then udp_flush() takes care of it
+static void session_send_input(netplay_context_t *ctx, uint32_t frame, const netplay_input_t *input, int except_slot) {
+    netplay_session_t *s = &ctx->session;
+    bool udp = ctx->udp_socket >= 0;
+    if (ctx->role == NETPLAY_ROLE_CLIENT) {
+        if (!udp || !ctx->udp_links[0].active) link_send_tcp(ctx, 0, frame, input);
+        return;
+    }
+    for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
+        if (i == except_slot || s->client_ports[i] <= 0) continue;
+        if (udp && ctx->udp_links[i].active) continue;
+        link_send_tcp(ctx, i, frame, input);
+    }
+}
+
+static void udp_send_link(netplay_context_t *ctx, int link, uint32_t now) {
+    netplay_session_t *s = &ctx->session;
+    netplay_udp_link_t *l = &ctx->udp_links[link];
+    uint8_t datagram[sizeof(netplay_udp_header_t) + NETPLAY_UDP_REDUNDANCY * NETPLAY_MAX_PLAYERS * sizeof(netplay_udp_input_t)];
+    netplay_udp_header_t *header = (netplay_udp_header_t*)datagram;
+    netplay_udp_input_t *entries = (netplay_udp_input_t*)(datagram + sizeof(netplay_udp_header_t));
+    int count = 0;
+    
+    for (int port = 0; port < s->players; port++) {
+        if (!link_sends_port(ctx, link, port)) continue;
+        
+        uint32_t upto = s->have_upto[port];
+        uint32_t from = upto > NETPLAY_UDP_REDUNDANCY ? upto - NETPLAY_UDP_REDUNDANCY : 0;
+        if (from < l->ack[port]) from = l->ack[port];
+        
+        // Whatever fell out of the window unacknowledged goes the reliable way
+        uint32_t frame = l->ack[port] > l->tcp_upto[port] ? l->ack[port] : l->tcp_upto[port];
+        for (; frame < from; frame++) {
+            netplay_frame_t *slot = &s->queue[frame % NETPLAY_INPUT_QUEUE];
+            if (slot->frame == frame && (slot->have & (1 << port))) link_send_tcp(ctx, link, frame, &slot->inputs[port]);
+        }
+        
+        for (frame = from; frame < upto; frame++) {
+            netplay_frame_t *slot = &s->queue[frame % NETPLAY_INPUT_QUEUE];
+            if (slot->frame != frame || !(slot->have & (1 << port))) continue;
+            entries[count].frame = frame;
+            entries[count].input = slot->inputs[port];
+            count++;
+        }
+        l->sent_upto[port] = upto;
+    }
+    
+    header->magic = NETPLAY_MAGIC;
+    header->version = NETPLAY_PROTOCOL_VERSION;
+    header->port = s->local_port;
+    header->count = count;
+    header->reserved = 0;
+    header->seq = ++l->seq;
+    header->echo_seq = l->heard ? l->peer_seq : 0;
+    header->echo_hold = l->heard ? now - l->peer_seq_at : 0;
+    memset(header->ack, 0, sizeof(header->ack));
+    memcpy(header->ack, s->have_upto, s->players * sizeof(uint32_t));
+    memcpy(l->acks_sent, s->have_upto, sizeof(l->acks_sent));
+    l->sent_at[l->seq % NETPLAY_UDP_SEQ_HISTORY] = now;
+    l->last_send = now;
+    
+    udp_sendto(ctx, &l->addr, datagram, sizeof(netplay_udp_header_t) + count * sizeof(netplay_udp_input_t));
+}
+
+// One datagram per link whenever there is new input or a new ack, and
+// again every NETPLAY_UDP_RESEND_MS until the other side has it all
+static void udp_flush(netplay_context_t *ctx) {
+    netplay_session_t *s = &ctx->session;
+    if (ctx->udp_socket < 0 || !s->active) return;
+    
+    uint32_t now = get_time_ms();
+    int links = ctx->role == NETPLAY_ROLE_HOST ? NETPLAY_MAX_PEERS : 1;
+    for (int i = 0; i < links; i++) {
+        netplay_udp_link_t *l = &ctx->udp_links[i];
+        // The host only learns where a client is from its first datagram
+        if (ctx->role == NETPLAY_ROLE_HOST && (!l->active || s->client_ports[i] <= 0)) continue;
+        
+        bool fresh = memcmp(l->acks_sent, s->have_upto, sizeof(l->acks_sent)) != 0;
+        bool unacked = false;
+        for (int port = 0; port < s->players; port++) {
+            if (!link_sends_port(ctx, i, port)) continue;
+            if (s->have_upto[port] > l->sent_upto[port]) fresh = true;
+            if (s->have_upto[port] > l->ack[port]) unacked = true;
+        }
+        uint32_t elapsed = now - l->last_send;
+        if (fresh || (unacked && elapsed >= NETPLAY_UDP_RESEND_MS) || elapsed >= NETPLAY_UDP_KEEPALIVE_MS) {
+            udp_send_link(ctx, i, now);
+        }
+    }
+}
+
+static void udp_stats(netplay_udp_link_t *l, const netplay_udp_header_t *header, uint32_t now) {
+    if (!l->heard) {
+        l->heard = true;
+        l->peer_seq = header->seq - 1;
+        l->window_start = header->seq;
+        l->window_received = 0;
+    }
+    if ((int32_t)(header->seq - l->peer_seq) > 0) {
+        l->peer_seq = header->seq;
+        l->peer_seq_at = now;
+    }
+    
+    l->window_received++;
+    uint32_t expected = header->seq - l->window_start + 1;
+    if ((int32_t)expected >= NETPLAY_UDP_LOSS_WINDOW) {
+        l->loss_pct = expected > l->window_received ? (expected - l->window_received) * 100 / expected : 0;
+        l->window_start = header->seq + 1;
+        l->window_received = 0;
+    }
+    
+    // Round trip of the datagram this one answers, less how long it sat on the other side
+    uint32_t echo = header->echo_seq;
+    if (echo && (int32_t)(l->seq - echo) >= 0 && l->seq - echo < NETPLAY_UDP_SEQ_HISTORY) {
+        int32_t rtt = now - l->sent_at[echo % NETPLAY_UDP_SEQ_HISTORY] - header->echo_hold;
+        if (rtt < 0) rtt = 0;
+        l->rtt_ms = l->rtt_ms ? (l->rtt_ms * 7 + rtt) / 8 : (uint32_t)rtt;
+    }
+}
+
+static void session_receive_input(netplay_context_t *ctx, int slot, uint32_t frame, const netplay_input_t *input);
+
+static void udp_receive(netplay_context_t *ctx) {
+    netplay_session_t *s = &ctx->session;
+    if (ctx->udp_socket < 0 || !s->active) return;
+    
+    uint8_t datagram[NETPLAY_SIM_PACKET_SIZE];
+    while (1) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int received = recvfrom(ctx->udp_socket, datagram, sizeof(datagram), MSG_DONTWAIT, (struct sockaddr*)&from, &from_len);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        
+        netplay_udp_header_t header;
+        if (received < (int)sizeof(header)) continue;
+        memcpy(&header, datagram, sizeof(header));
+        if (header.magic != NETPLAY_MAGIC || header.version != NETPLAY_PROTOCOL_VERSION) continue;
+        if (received != (int)(sizeof(header) + header.count * sizeof(netplay_udp_input_t))) continue;
+        
+        // Only take input from where the TCP connection of that player is
+        int link = 0;
+        if (ctx->role == NETPLAY_ROLE_HOST) {
+            for (link = 0; link < NETPLAY_MAX_PEERS; link++) {
+                if (s->client_ports[link] > 0 && s->client_ports[link] == header.port) break;
+            }
+            if (link == NETPLAY_MAX_PEERS) continue;
+            
+            struct sockaddr_in peer;
+            socklen_t peer_len = sizeof(peer);
+            int sock = link_socket(ctx, link);
+            if (sock < 0 || getpeername(sock, (struct sockaddr*)&peer, &peer_len) < 0) continue;
+            if (peer.sin_addr.s_addr != from.sin_addr.s_addr) continue;
+            ctx->udp_links[link].addr = from;
+        } else if (from.sin_addr.s_addr != ctx->udp_links[0].addr.sin_addr.s_addr || from.sin_port != ctx->udp_links[0].addr.sin_port) {
+            continue;
+        }
+        
+        netplay_udp_link_t *l = &ctx->udp_links[link];
+        uint32_t now = get_time_ms();
+        if (!l->active) {
+            l->active = true;
+            if (ctx->role == NETPLAY_ROLE_HOST) printf("NET: Client %d input over UDP\n", link + 1);
+            else printf("NET: Input over UDP\n");
+        }
+        udp_stats(l, &header, now);
+        
+        for (int port = 0; port < s->players; port++) {
+            if (link_sends_port(ctx, link, port) && (int32_t)(header.ack[port] - l->ack[port]) > 0) {
+                l->ack[port] = header.ack[port];
+            }
+        }
+        
+        for (int i = 0; i < header.count; i++) {
+            netplay_udp_input_t entry;
+            memcpy(&entry, datagram + sizeof(header) + i * sizeof(entry), sizeof(entry));
+            if (ctx->role == NETPLAY_ROLE_HOST) {
+                if (entry.input.port != header.port) continue;
+                session_receive_input(ctx, link, entry.frame, &entry.input);
+            } else {
+                session_receive_input(ctx, -1, entry.frame, &entry.input);
+            }
+        }
+    }
+}
+
+static int udp_open(netplay_context_t *ctx, const char *host_ip) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        printf("NET: Failed to create UDP socket: %s\n", strerror(errno));
+        return -1;
+    }
+    set_nonblocking(sock);
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETPLAY_PORT);
+    if (host_ip) {
+        // Clients send from any port, the host answers wherever they come from
+        if (inet_pton(AF_INET, host_ip, &addr.sin_addr) <= 0) {
+            close(sock);
+            return -1;
+        }
+        ctx->udp_links[0].addr = addr;
+    } else {
+        int opt = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        addr.sin_addr.s_addr = INADDR_ANY;
+        if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            printf("NET: Failed to bind UDP input socket: %s\n", strerror(errno));
+            close(sock);
+            return -1;
+        }
+    }
+    ctx->udp_socket = sock;
+    return 0;
+}
+
+static void udp_close(netplay_context_t *ctx) {
+    if (ctx->udp_socket < 0) return;
+    sim_drop(ctx, ctx->udp_socket);
+    close(ctx->udp_socket);
+    ctx->udp_socket = -1;
+}
+
+static void session_receive_input(netplay_context_t *ctx, int slot, uint32_t frame, const netplay_input_t *input) {
+    netplay_session_t *s = &ctx->session;
+    if (slot >= 0) {
+        // The host relays each client's input to everyone else
+        int port = s->client_ports[slot];
+        if (port <= 0) return;
+        netplay_input_t relayed = *input;
+        relayed.port = port;
+        bool fresh = !(s->queue[frame % NETPLAY_INPUT_QUEUE].frame == frame && (s->queue[frame % NETPLAY_INPUT_QUEUE].have & (1 << port)));
+        session_store(s, frame, port, &relayed);
+        // UDP repeats itself, only relay what's new
+        if (fresh) session_send_input(ctx, frame, &relayed, slot);
+    } else if (input->port != s->local_port && input->port < s->players) {
+        session_store(s, frame, input->port, input);
+    }
+}
+
+static void session_check(netplay_context_t *ctx, uint32_t frame, int port, uint32_t crc) {
+    netplay_session_t *s = &ctx->session;
+    if (port < 0 || port >= s->players) return;
+    
+    netplay_checksum_t *check = NULL;
+    for (int i = 0; i < NETPLAY_CHECKSUM_HISTORY; i++) {
+        netplay_checksum_t *c = &s->checksums[i];
+        if (c->have && c->frame == frame) {
+            check = c;
+            break;
+        }
+        if (!check || !c->have || (check->have && c->frame < check->frame)) check = c; // oldest or empty
+    }
+    if (!check->have || check->frame != frame) {
+        memset(check, 0, sizeof(netplay_checksum_t));
+        check->frame = frame;
+    }
+    check->crc[port] = crc;
+    check->have |= 1 << port;
+    
+    // Compare each pair once, when the second of the two arrives
+    int local = s->local_port;
+    if (!(check->have & (1 << local))) return;
+    for (int p = 0; p < s->players; p++) {
+        if (p == local || !(check->have & (1 << p))) continue;
+        if (port != local && port != p) continue;
+        if (check->crc[p] != check->crc[local]) {
+            printf("NET: Desync with player %d at frame %u\n", p + 1, frame);
+            if (ctx->on_desync) ctx->on_desync(frame, p);
+        }
+    }
+}
+
+// State transfer
+
+static void xor_state(uint8_t *dst, const uint8_t *src, uint32_t size) {
+    uint32_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < size; i++) dst[i] ^= src[i];
+}
+
+static bool grow(uint8_t **buffer, size_t size) {
+    uint8_t *grown = realloc(*buffer, size);
+    if (!grown) return false;
+    *buffer = grown;
+    return true;
+}
+
+static void state_tx_finish(netplay_context_t *ctx) {
+    netplay_state_tx_t *tx = &ctx->state_tx;
+    printf("NET: State %u delivered in %u ms\n", tx->id, get_time_ms() - tx->started);
+    
+    if (!tx->failed) {
+        // Everyone has it now, so later states can be sent as deltas against it
+        uint8_t *base = tx->base;
+        tx->base = tx->state;
+        tx->state = base;
+        tx->base_id = tx->id;
+        tx->base_size = tx->size;
+    }
+    tx->id = 0;
+}
+
+// Called when a client slot goes away or gets reused
+static void state_tx_drop(netplay_context_t *ctx, int slot) {
+    netplay_state_tx_t *tx = &ctx->state_tx;
+    tx->acked[slot] = 0;
+    if (tx->id && (tx->targets & (1 << slot))) {
+        tx->targets &= ~(1 << slot);
+        tx->failed |= 1 << slot;
+        if (!tx->targets) state_tx_finish(ctx);
+    }
+}
+
+static void state_tx_ack(netplay_context_t *ctx, int slot, const netplay_state_ack_t *ack) {
+    netplay_state_tx_t *tx = &ctx->state_tx;
+    if (!tx->id || ack->id != tx->id || !(tx->targets & (1 << slot))) return;
+    
+    tx->targets &= ~(1 << slot);
+    if (ack->ok) {
+        tx->acked[slot] = ack->id;
+    } else {
+        printf("NET: Client %d couldn't decode state %u\n", slot + 1, ack->id);
+        tx->acked[slot] = 0;
+        tx->failed |= 1 << slot;
+    }
+    if (!tx->targets) state_tx_finish(ctx);
+}
+
+// What NET_simulate_network's round trip would leave unacknowledged,
+// on loopback the socket's own queue empties right away
+static int state_tx_sim_queued(netplay_context_t *ctx, int slot) {
+    netplay_state_tx_t *tx = &ctx->state_tx;
+    if (!sim_enabled(ctx)) return 0;
+    
+    uint32_t now = get_time_ms();
+    if (now - tx->sim_window[slot] >= (uint32_t)ctx->sim.latency_ms * 2) {
+        tx->sim_window[slot] = now;
+        tx->sim_sent[slot] = 0;
+    }
+    return tx->sim_sent[slot];
+}
+
+// Sends what it can without queueing more than NETPLAY_STATE_INFLIGHT
+// bytes in front of the input packets sharing the connection. Returns
+// true while some client still has chunks coming. Holds the mutex so a
+// client can't be dropped, nor its socket closed, mid-chunk.
+static bool state_tx_pump(netplay_context_t *ctx) {
+    netplay_state_tx_t *tx = &ctx->state_tx;
+    bool pending = false;
+    
+    pthread_mutex_lock(&ctx->mutex);
+    uint8_t payload[MAX_DATA_SIZE];
+    for (int i = 0; tx->id && i < NETPLAY_MAX_PEERS; i++) {
+        int sock = ctx->client_sockets[i];
+        if (!(tx->targets & (1 << i)) || sock < 0) continue;
+        
+        while (tx->sent[i] < tx->encoded_size) {
+            int queued = 0;
+            if (ioctl(sock, SIOCOUTQ, &queued) < 0) queued = 0;
+            queued += state_tx_sim_queued(ctx, i);
+            if (queued >= NETPLAY_STATE_INFLIGHT) {
+                pending = true;
+                break;
+            }
+            
+            uint32_t length = tx->encoded_size - tx->sent[i];
+            if (length > STATE_CHUNK_DATA) length = STATE_CHUNK_DATA;
+            netplay_state_chunk_t chunk = {
+                .id = tx->id,
+                .base_id = tx->base_id,
+                .frame = tx->frame,
+                .size = tx->size,
+                .encoded_size = tx->encoded_size,
+                .offset = tx->sent[i],
+            };
+            memcpy(payload, &chunk, sizeof(chunk));
+            memcpy(payload + sizeof(chunk), tx->encoded + tx->sent[i], length);
+            if (send_packet(sock, NETPACKET_STATE_CHUNK, tx->id, payload, sizeof(chunk) + length) < 0) {
+                // Left to NET_wait, which drops the client if its connection is gone
+                printf("NET: Failed to send state to client %d: %s\n", i + 1, strerror(errno));
+                break;
+            }
+            tx->sent[i] += length;
+            tx->sim_sent[i] += sizeof(netpacket_header_t) + sizeof(chunk) + length;
+        }
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+    return pending;
+}
+
+// NET_wait alone would send NETPLAY_STATE_INFLIGHT bytes a frame, about
+// 2MB a second at 60fps, a PS1 state would take seconds to resync
+static void *state_tx_thread(void *arg) {
+    netplay_context_t *ctx = arg;
+    while (state_tx_pump(ctx)) usleep(NETPLAY_STATE_PUMP_MS * 1000);
+    return NULL;
+}
+
+static void state_tx_join(netplay_context_t *ctx) {
+    netplay_state_tx_t *tx = &ctx->state_tx;
+    if (!tx->pumping) return;
+    pthread_join(tx->thread, NULL);
+    tx->pumping = false;
+}
+
+static bool state_rx_decode(netplay_state_rx_t *rx) {
+    size_t decoded_size;
+    if (!StateCodec_detect(rx->encoded, rx->encoded_size, &decoded_size) || decoded_size != rx->size) {
+        return false;
+    }
+    if (rx->size > rx->capacity) {
+        // state is kept, it may be the base of this very delta
+        if (!grow(&rx->state, rx->size) || !grow(&rx->scratch, rx->size)) return false;
+        rx->capacity = rx->size;
+    }
+    if (!StateCodec_decode(rx->encoded, rx->encoded_size, rx->scratch, rx->size)) {
+        return false;
+    }
+    
+    if (rx->base_id) {
+        if (rx->state_id != rx->base_id || rx->state_size != rx->size) return false;
+        xor_state(rx->state, rx->scratch, rx->size);
+    } else {
+        uint8_t *state = rx->state;
+        rx->state = rx->scratch;
+        rx->scratch = state;
+    }
+    rx->state_id = rx->id;
+    rx->state_size = rx->size;
+    rx->state_frame = rx->frame;
+    return true;
+}
+
+static int state_rx_chunk(netplay_context_t *ctx, int sock, const netpacket_header_t *header, const uint8_t *payload) {
+    netplay_state_rx_t *rx = &ctx->state_rx;
+    if (header->length < sizeof(netplay_state_chunk_t)) return -1;
+    
+    netplay_state_chunk_t chunk;
+    memcpy(&chunk, payload, sizeof(chunk));
+    uint32_t length = header->length - sizeof(chunk);
+    
+    if (chunk.id != rx->id) {
+        if (chunk.offset != 0 || chunk.size > NETPLAY_STATE_MAX_SIZE || chunk.encoded_size > StateCodec_bound(STATE_CODEC, chunk.size)) {
+            printf("NET: Invalid state from server\n");
+            return -1;
+        }
+        if (chunk.encoded_size > rx->encoded_capacity) {
+            if (!grow(&rx->encoded, chunk.encoded_size)) return -1;
+            rx->encoded_capacity = chunk.encoded_size;
+        }
+        rx->id = chunk.id;
+        rx->base_id = chunk.base_id;
+        rx->frame = chunk.frame;
+        rx->size = chunk.size;
+        rx->encoded_size = chunk.encoded_size;
+        rx->received = 0;
+        
+        // Hold the session at the state's frame until it's in
+        ctx->session.sync_pending = true;
+        ctx->session.sync_frame = chunk.frame;
+    }
+    if (chunk.offset != rx->received || length > rx->encoded_size - rx->received) {
+        return -1;
+    }
+    memcpy(rx->encoded + rx->received, payload + sizeof(chunk), length);
+    rx->received += length;
+    if (rx->received < rx->encoded_size) return 0;
+    
+    netplay_state_ack_t ack = {
+        .id = rx->id,
+        .ok = state_rx_decode(rx),
+    };
+    rx->id = 0;
+    if (send_packet(sock, NETPACKET_STATE_ACK, ack.id, &ack, sizeof(ack)) < 0) {
+        printf("NET: Failed to acknowledge state: %s\n", strerror(errno));
+    }
+    
+    if (!ack.ok) {
+        // Play on, the next resync will be a full state
+        printf("NET: Couldn't decode state %u\n", ack.id);
+        ctx->session.sync_pending = false;
+        return 0;
+    }
+    rx->ready = true;
+    if (ctx->on_state_received) {
+        ctx->on_state_received(rx->state, rx->state_size, rx->state_frame);
+    }
+    return 0;
+}
+
+// slot is the client index on the host, -1 for the connection to the host.
+// Returns -1 when the connection should be dropped.
+static int handle_packet(netplay_context_t *ctx, int sock, int slot, const netpacket_header_t *header, const uint8_t *payload) {
+    switch (header->type) {
+    case NETPACKET_INPUT_STATE:
+        if (header->length >= sizeof(netplay_input_t)) {
+            netplay_input_t input;
+            memcpy(&input, payload, sizeof(input));
+            pthread_mutex_lock(&ctx->mutex);
+            memcpy(&ctx->remote_inputs[slot >= 0 ? slot : 0], &input, sizeof(netplay_input_t));
+            pthread_mutex_unlock(&ctx->mutex);
+            
+            if (ctx->session.active) {
+                session_receive_input(ctx, slot, header->sequence, &input);
+            }
+            if (ctx->on_input_received) {
+                ctx->on_input_received(&input);
+            }
+        }
+        break;
+    case NETPACKET_STATE_SYNC:
+        // Handle state synchronization
+        if (slot < 0 && header->length > 0 && ctx->on_state_received) {
+            ctx->on_state_received(payload, header->length, header->sequence);
+        }
+        break;
+    case NETPACKET_PING: {
+        // Send pong with the same ping_time payload
+        int length = header->length == sizeof(uint32_t) ? sizeof(uint32_t) : 0;
+        if (send_packet(sock, NETPACKET_PONG, header->sequence, payload, length) < 0) {
+            printf("NET: Failed to send pong: %s\n", strerror(errno));
+        }
+        break;
+    }
+    case NETPACKET_PONG:
+        // Handle pong response and calculate latency
+        if (header->length == sizeof(uint32_t)) {
+            uint32_t ping_time;
+            memcpy(&ping_time, payload, sizeof(ping_time));
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            uint32_t current_time = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+            pthread_mutex_lock(&ctx->mutex);
+            ctx->latency_ms = (current_time - ping_time) / 2;  // RTT / 2 = one-way latency
+            pthread_mutex_unlock(&ctx->mutex);
+            printf("NET: Latency updated to %u ms\n", ctx->latency_ms);
+        }
+        break;
+    case NETPACKET_SESSION_START:
+        if (slot < 0 && header->length >= sizeof(netplay_session_start_t)) {
+            netplay_session_start_t start;
+            memcpy(&start, payload, sizeof(start));
+            if (start.players < 2 || start.players > NETPLAY_MAX_PLAYERS || start.port == 0 || start.port >= start.players || start.delay > NETPLAY_MAX_DELAY) {
+                printf("NET: Invalid session from server\n");
+                return -1;
+            }
+            session_init(ctx, start.players, start.delay, start.port);
+            if (start.flags & NETPLAY_SESSION_SYNC_STATE) {
+                ctx->session.sync_pending = true;
+                ctx->session.sync_frame = 0;
+            }
+            udp_close(ctx);
+            if ((start.flags & NETPLAY_SESSION_UDP) && udp_open(ctx, ctx->server_ip) == 0) {
+                udp_flush(ctx); // so the host learns where we are
+            }
+            printf("NET: Joined session as player %d of %d, %d frames of input delay\n", start.port + 1, start.players, start.delay);
+        }
+        break;
+    case NETPACKET_CHECKSUM:
+        if (ctx->session.active && header->length >= sizeof(uint32_t)) {
+            uint32_t crc;
+            memcpy(&crc, payload, sizeof(crc));
+            session_check(ctx, header->sequence, slot >= 0 ? ctx->session.client_ports[slot] : 0, crc);
+        }
+        break;
+    case NETPACKET_STATE_CHUNK:
+        if (slot < 0) return state_rx_chunk(ctx, sock, header, payload);
+        break;
+    case NETPACKET_STATE_ACK:
+        if (slot >= 0 && header->length >= sizeof(netplay_state_ack_t)) {
+            netplay_state_ack_t ack;
+            memcpy(&ack, payload, sizeof(ack));
+            pthread_mutex_lock(&ctx->mutex);
+            state_tx_ack(ctx, slot, &ack);
+            pthread_mutex_unlock(&ctx->mutex);
+        }
+        break;
+    case NETPACKET_DISCONNECT:
+        return -1;
+    default:
+        break;
+    }
+    return 0;
+}
+
+// Handles every complete packet buffered for a connection. Returns -1 once
+// the connection is closed or its stream can't be trusted anymore.
+static int read_packets(netplay_context_t *ctx, int sock, netplay_rx_t *rx, int slot, const char *source_desc) {
+    while (1) {
+        int received = recv(sock, rx->data + rx->size, sizeof(rx->data) - rx->size, MSG_DONTWAIT);
+        if (received == 0) return -1;
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        rx->size += received;
+        
+        int offset = 0;
+        while (rx->size - offset >= (int)sizeof(netpacket_header_t)) {
+            netpacket_header_t header;
+            memcpy(&header, rx->data + offset, sizeof(header));
+            if (validate_packet_header(&header, source_desc) < 0) {
+                return -1; // no way to find the next packet boundary
+            }
+            int total = sizeof(netpacket_header_t) + header.length;
+            if (rx->size - offset < total) break;
+            if (handle_packet(ctx, sock, slot, &header, rx->data + offset + sizeof(netpacket_header_t)) < 0) {
+                return -1;
+            }
+            offset += total;
+        }
+        memmove(rx->data, rx->data + offset, rx->size - offset);
+        rx->size -= offset;
+    }
+}
+
 void NET_init(netplay_context_t *ctx, const char *device_name) {
     memset(ctx, 0, sizeof(netplay_context_t));
     
@@ -91,6 +1056,7 @@ void NET_init(netplay_context_t *ctx, const char *device_name) {
         ctx->client_sockets[i] = -1;
     }
     ctx->broadcast_socket = -1;
+    ctx->udp_socket = -1;
     
     printf("NET: Initialized netplay context for device: %s\n", ctx->device_name);
 }
@@ -100,6 +1066,15 @@ void NET_quit(netplay_context_t *ctx) {
     NET_disconnect(ctx);
     NET_stop_discovery(ctx);
     
+    free(ctx->state_tx.state);
+    free(ctx->state_tx.base);
+    free(ctx->state_tx.encoded);
+    free(ctx->state_rx.state);
+    free(ctx->state_rx.scratch);
+    free(ctx->state_rx.encoded);
+    memset(&ctx->state_tx, 0, sizeof(ctx->state_tx));
+    memset(&ctx->state_rx, 0, sizeof(ctx->state_rx));
+    
     // Destroy mutex
     pthread_mutex_destroy(&ctx->mutex);
     
@@ -161,7 +1136,7 @@ int NET_broadcast_discovery(netplay_context_t *ctx) {
     netpacket_header_t *header = (netpacket_header_t*)packet;
     header->magic = NETPLAY_MAGIC;
     header->type = NETPACKET_DISCOVERY;
-    header->version = 1;
+    header->version = NETPLAY_PROTOCOL_VERSION;
     header->length = NETPLAY_DEVICE_NAME_MAX;
     header->sequence = 0;
     offset += sizeof(netpacket_header_t);
@@ -221,7 +1196,7 @@ int NET_handle_discovery_packet(netplay_context_t *ctx, const char *data, int le
         netpacket_header_t *resp_header = (netpacket_header_t*)response;
         resp_header->magic = NETPLAY_MAGIC;
         resp_header->type = NETPACKET_DISCOVERY_RESPONSE;
-        resp_header->version = 1;
+        resp_header->version = NETPLAY_PROTOCOL_VERSION;
         resp_header->sequence = header->sequence;
         offset += sizeof(netpacket_header_t);
         
@@ -307,6 +1282,8 @@ int NET_start_hosting(netplay_context_t *ctx) {
 }
 
 void NET_stop_hosting(netplay_context_t *ctx) {
+    sim_drop(ctx, -1);
+    udp_close(ctx);
     pthread_mutex_lock(&ctx->mutex);
     
     if (ctx->server_socket >= 0) {
@@ -324,8 +1301,10 @@ void NET_stop_hosting(netplay_context_t *ctx) {
     ctx->client_count = 0;
     ctx->role = NETPLAY_ROLE_NONE;
     ctx->state = NETPLAY_STATE_IDLE;
+    ctx->session.active = false;
     
     pthread_mutex_unlock(&ctx->mutex);
+    state_tx_join(ctx); // nothing left to send it to
     
     printf("NET: Stopped hosting\n");
 }
@@ -351,7 +1330,11 @@ int NET_poll_host(netplay_context_t *ctx) {
     socklen_t addr_len = sizeof(client_addr);
     int client_sock = accept(server_socket, (struct sockaddr*)&client_addr, &addr_len);
     
-    if (client_sock >= 0) {
+    if (client_sock >= 0 && ctx->session.active) {
+        printf("NET: Connection rejected (session already running)\n");
+        close(client_sock);
+    } else if (client_sock >= 0) {
+        set_nodelay(client_sock);
         pthread_mutex_lock(&ctx->mutex);
         if (ctx->client_count < NETPLAY_MAX_PEERS) {
             // Find empty slot
@@ -359,6 +1342,8 @@ int NET_poll_host(netplay_context_t *ctx) {
                 if (ctx->client_sockets[i] < 0) {
                     ctx->client_sockets[i] = client_sock;
                     ctx->client_count++;
+                    ctx->client_rx[i].size = 0;
+                    state_tx_drop(ctx, i);
                     
                     char ip_str[INET_ADDRSTRLEN];
                     inet_ntop(AF_INET, &client_addr.sin_addr, ip_str, sizeof(ip_str));
@@ -371,11 +1356,11 @@ int NET_poll_host(netplay_context_t *ctx) {
                     netpacket_header_t *header = (netpacket_header_t*)response;
                     header->magic = NETPLAY_MAGIC;
                     header->type = NETPACKET_CONNECT_RESPONSE;
-                    header->version = 1;
+                    header->version = NETPLAY_PROTOCOL_VERSION;
                     header->length = 0;
                     header->sequence = 0;
                     
-                    if (send(client_sock, response, sizeof(response), 0) < 0) {
+                    if (send(client_sock, response, sizeof(response), MSG_NOSIGNAL) < 0) {
                         printf("NET: Failed to send connect response to client %d: %s\n", i + 1, strerror(errno));
                     }
                     
@@ -404,19 +1389,27 @@ int NET_poll_host(netplay_context_t *ctx) {
     
     for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
         if (client_sockets[i] >= 0) {
-            uint8_t buffer[MAX_PACKET_SIZE];
-            int received = recv(client_sockets[i], buffer, MAX_PACKET_SIZE, MSG_DONTWAIT);
+            char source_desc[32];
+            snprintf(source_desc, sizeof(source_desc), "client %d", i + 1);
             
-            if (received <= 0) {
+            if (read_packets(ctx, client_sockets[i], &ctx->client_rx[i], i, source_desc) < 0) {
                 // Client disconnected
                 pthread_mutex_lock(&ctx->mutex);
                 if (ctx->client_sockets[i] == client_sockets[i]) {
+                    sim_drop(ctx, client_sockets[i]);
+                    state_tx_drop(ctx, i);
                     close(ctx->client_sockets[i]);
                     ctx->client_sockets[i] = -1;
                     ctx->client_count--;
                     
                     printf("NET: Client %d disconnected\n", i + 1);
                     
+                    // Lockstep can't go on without one of its players
+                    if (ctx->session.active && ctx->session.client_ports[i] > 0) {
+                        printf("NET: Session ended\n");
+                        ctx->session.active = false;
+                    }
+                    
                     if (ctx->client_count == 0) {
                         ctx->state = NETPLAY_STATE_HOSTING;
                         if (ctx->on_connection_state_changed) {
@@ -427,62 +1420,6 @@ int NET_poll_host(netplay_context_t *ctx) {
                     }
                 }
                 pthread_mutex_unlock(&ctx->mutex);
-            } else {
-                // Process packet
-                netpacket_header_t *header = (netpacket_header_t*)buffer;
-                
-                char source_desc[32];
-                snprintf(source_desc, sizeof(source_desc), "client %d", i + 1);
-                
-                if (validate_packet_header(header, source_desc) < 0) {
-                    continue;
-                }
-                
-                if (header->type == NETPACKET_INPUT_STATE) {
-                    // Parse input
-                    if (header->length >= sizeof(netplay_input_t)) {
-                        netplay_input_t *input = (netplay_input_t*)(buffer + sizeof(netpacket_header_t));
-                        pthread_mutex_lock(&ctx->mutex);
-                        memcpy(&ctx->remote_inputs[i], input, sizeof(netplay_input_t));
-                        pthread_mutex_unlock(&ctx->mutex);
-                        
-                        if (ctx->on_input_received) {
-                            ctx->on_input_received(input);
-                        }
-                    }
-                } else if (header->type == NETPACKET_PING) {
-                    // Send pong with the same ping_time payload
-                    uint8_t pong[sizeof(netpacket_header_t) + sizeof(uint32_t)];
-                    netpacket_header_t *pong_header = (netpacket_header_t*)pong;
-                    pong_header->magic = NETPLAY_MAGIC;
-                    pong_header->type = NETPACKET_PONG;
-                    pong_header->version = 1;
-                    pong_header->sequence = header->sequence;
-                    
-                    if (header->length == sizeof(uint32_t)) {
-                        uint32_t ping_time = *(uint32_t*)(buffer + sizeof(netpacket_header_t));
-                        pong_header->length = sizeof(ping_time);
-                        memcpy(pong + sizeof(netpacket_header_t), &ping_time, sizeof(ping_time));
-                    } else {
-                        pong_header->length = 0;
-                    }
-                    
-                    if (send(client_sockets[i], pong, sizeof(netpacket_header_t) + pong_header->length, 0) < 0) {
-                        printf("NET: Failed to send pong to client %d: %s\n", i + 1, strerror(errno));
-                    }
-                } else if (header->type == NETPACKET_PONG) {
-                    // Handle pong response and calculate latency
-                    if (header->length == sizeof(uint32_t)) {
-                        uint32_t ping_time = *(uint32_t*)(buffer + sizeof(netpacket_header_t));
-                        struct timespec ts;
-                        clock_gettime(CLOCK_MONOTONIC, &ts);
-                        uint32_t current_time = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-                        pthread_mutex_lock(&ctx->mutex);
-                        ctx->latency_ms = (current_time - ping_time) / 2;  // RTT / 2 = one-way latency
-                        pthread_mutex_unlock(&ctx->mutex);
-                        printf("NET: Latency updated to %u ms (from client %d)\n", ctx->latency_ms, i + 1);
-                    }
-                }
             }
         }
     }
@@ -595,10 +1532,12 @@ int NET_connect_to_host(netplay_context_t *ctx, const char *host_ip) {
     if (received >= (int)sizeof(netpacket_header_t)) {
         netpacket_header_t *header = (netpacket_header_t*)buffer;
         if (header->magic == NETPLAY_MAGIC && header->type == NETPACKET_CONNECT_RESPONSE) {
+            set_nodelay(ctx->server_socket);
             pthread_mutex_lock(&ctx->mutex);
             ctx->role = NETPLAY_ROLE_CLIENT;
             ctx->state = NETPLAY_STATE_CONNECTED;
             ctx->frame_count = 0;
+            ctx->server_rx.size = 0;
             pthread_mutex_unlock(&ctx->mutex);
             
             printf("NET: Connected to host %s\n", host_ip);
@@ -634,14 +1573,16 @@ void NET_disconnect(netplay_context_t *ctx) {
         netpacket_header_t *header = (netpacket_header_t*)packet;
         header->magic = NETPLAY_MAGIC;
         header->type = NETPACKET_DISCONNECT;
-        header->version = 1;
+        header->version = NETPLAY_PROTOCOL_VERSION;
         header->length = 0;
         header->sequence = 0;
         
-        if (send(server_socket, packet, sizeof(packet), 0) < 0) {
+        if (send(server_socket, packet, sizeof(packet), MSG_NOSIGNAL) < 0) {
             printf("NET: Failed to send disconnect packet: %s\n", strerror(errno));
         }
         
+        sim_drop(ctx, -1);
+        udp_close(ctx);
         close(server_socket);
         
         pthread_mutex_lock(&ctx->mutex);
@@ -652,6 +1593,7 @@ void NET_disconnect(netplay_context_t *ctx) {
     pthread_mutex_lock(&ctx->mutex);
     ctx->role = NETPLAY_ROLE_NONE;
     ctx->state = NETPLAY_STATE_IDLE;
+    ctx->session.active = false;
     pthread_mutex_unlock(&ctx->mutex);
     
     printf("NET: Disconnected\n");
@@ -670,75 +1612,26 @@ int NET_poll_client(netplay_context_t *ctx) {
         return -1;
     }
     
-    uint8_t buffer[MAX_PACKET_SIZE];
-    int received = recv(server_socket, buffer, MAX_PACKET_SIZE, MSG_DONTWAIT);
-    
-    if (received < 0) {
-        return 0;
-    }
-    
-    if (received < (int)sizeof(netpacket_header_t)) {
-        return -1;
-    }
-    
-    netpacket_header_t *header = (netpacket_header_t*)buffer;
-    
-    if (validate_packet_header(header, "server") < 0) {
-        return -1;
-    }
-    
-    if (header->type == NETPACKET_INPUT_STATE) {
-        if (header->length >= sizeof(netplay_input_t)) {
-            netplay_input_t *input = (netplay_input_t*)(buffer + sizeof(netpacket_header_t));
-            pthread_mutex_lock(&ctx->mutex);
-            memcpy(&ctx->remote_inputs[0], input, sizeof(netplay_input_t));
-            pthread_mutex_unlock(&ctx->mutex);
-            
-            if (ctx->on_input_received) {
-                ctx->on_input_received(input);
-            }
-        }
-    } else if (header->type == NETPACKET_STATE_SYNC) {
-        // Handle state synchronization
-        if (header->length > 0 && ctx->on_state_received) {
-            void *state_data = buffer + sizeof(netpacket_header_t);
-            ctx->on_state_received(state_data, header->length, header->sequence);
-        }
-    } else if (header->type == NETPACKET_PING) {
-        // Send pong with the same ping_time payload
-        uint8_t pong[sizeof(netpacket_header_t) + sizeof(uint32_t)];
-        netpacket_header_t *pong_header = (netpacket_header_t*)pong;
-        pong_header->magic = NETPLAY_MAGIC;
-        pong_header->type = NETPACKET_PONG;
-        pong_header->version = 1;
-        pong_header->sequence = header->sequence;
+    if (read_packets(ctx, server_socket, &ctx->server_rx, -1, "server") < 0) {
+        printf("NET: Lost connection to host\n");
+        sim_drop(ctx, -1);
+        udp_close(ctx);
+        close(server_socket);
         
-        if (header->length == sizeof(uint32_t)) {
-            uint32_t ping_time = *(uint32_t*)(buffer + sizeof(netpacket_header_t));
-            pong_header->length = sizeof(ping_time);
-            memcpy(pong + sizeof(netpacket_header_t), &ping_time, sizeof(ping_time));
-        } else {
-            pong_header->length = 0;
-        }
+        pthread_mutex_lock(&ctx->mutex);
+        ctx->server_socket = -1;
+        ctx->role = NETPLAY_ROLE_NONE;
+        ctx->state = NETPLAY_STATE_ERROR;
+        ctx->session.active = false;
+        pthread_mutex_unlock(&ctx->mutex);
         
-        if (send(server_socket, pong, sizeof(netpacket_header_t) + pong_header->length, 0) < 0) {
-            printf("NET: Failed to send pong to server: %s\n", strerror(errno));
-        }
-    } else if (header->type == NETPACKET_PONG) {
-        // Handle pong response and calculate latency
-        if (header->length == sizeof(uint32_t)) {
-            uint32_t ping_time = *(uint32_t*)(buffer + sizeof(netpacket_header_t));
-            struct timespec ts;
-            clock_gettime(CLOCK_MONOTONIC, &ts);
-            uint32_t current_time = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-            pthread_mutex_lock(&ctx->mutex);
-            ctx->latency_ms = (current_time - ping_time) / 2;  // RTT / 2 = one-way latency
-            pthread_mutex_unlock(&ctx->mutex);
-            printf("NET: Latency updated to %u ms (from server)\n", ctx->latency_ms);
+        if (ctx->on_connection_state_changed) {
+            ctx->on_connection_state_changed(NETPLAY_STATE_ERROR);
         }
+        return -1;
     }
     
-    return received;
+    return 0;
 }
 
 // Input functions
@@ -751,7 +1644,7 @@ void NET_set_local_input(netplay_context_t *ctx, const netplay_input_t *input) {
 void NET_send_input(netplay_context_t *ctx) {
     pthread_mutex_lock(&ctx->mutex);
     
-    if (ctx->state != NETPLAY_STATE_CONNECTED) {
+    if (!has_peers(ctx)) {
         pthread_mutex_unlock(&ctx->mutex);
         return;
     }
@@ -762,7 +1655,7 @@ void NET_send_input(netplay_context_t *ctx) {
     netpacket_header_t *header = (netpacket_header_t*)packet;
     header->magic = NETPLAY_MAGIC;
     header->type = NETPACKET_INPUT_STATE;
-    header->version = 1;
+    header->version = NETPLAY_PROTOCOL_VERSION;
     header->sequence = ctx->frame_count;
     offset += sizeof(netpacket_header_t);
     
@@ -782,14 +1675,14 @@ void NET_send_input(netplay_context_t *ctx) {
     
     // Send packets outside of mutex to avoid holding lock during I/O
     if (role == NETPLAY_ROLE_CLIENT && server_socket >= 0) {
-        if (send(server_socket, packet, offset, 0) < 0) {
+        if (send(server_socket, packet, offset, MSG_NOSIGNAL) < 0) {
             printf("NET: Failed to send input to server: %s\n", strerror(errno));
         }
     } else if (role == NETPLAY_ROLE_HOST) {
         // Broadcast to all clients
         for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
             if (client_sockets[i] >= 0) {
-                if (send(client_sockets[i], packet, offset, 0) < 0) {
+                if (send(client_sockets[i], packet, offset, MSG_NOSIGNAL) < 0) {
                     printf("NET: Failed to send input to client %d: %s\n", i + 1, strerror(errno));
                 }
             }
@@ -808,48 +1701,99 @@ netplay_input_t *NET_get_remote_input(netplay_context_t *ctx, int player_index)
 }
 
 // State sync functions
-void NET_send_state(netplay_context_t *ctx, const void *state_data, int size) {
-    netplay_state_t state;
-    netplay_role_t role;
-    uint32_t frame_count;
-    int client_sockets[NETPLAY_MAX_PEERS];
+int NET_send_state(netplay_context_t *ctx, const void *state_data, int size, uint32_t frame) {
+    netplay_state_tx_t *tx = &ctx->state_tx;
     
     pthread_mutex_lock(&ctx->mutex);
-    state = ctx->state;
-    role = ctx->role;
-    frame_count = ctx->frame_count;
+    netplay_role_t role = ctx->role;
+    int client_sockets[NETPLAY_MAX_PEERS];
     memcpy(client_sockets, ctx->client_sockets, sizeof(client_sockets));
     pthread_mutex_unlock(&ctx->mutex);
     
-    if (state != NETPLAY_STATE_CONNECTED || size > (int)MAX_DATA_SIZE) {
-        return;
+    if (role != NETPLAY_ROLE_HOST || tx->id || size <= 0 || size > NETPLAY_STATE_MAX_SIZE) {
+        return -1;
     }
+    state_tx_join(ctx); // done sending the last one, it's been acknowledged
     
-    uint8_t packet[MAX_PACKET_SIZE];
-    int offset = 0;
-    
-    netpacket_header_t *header = (netpacket_header_t*)packet;
-    header->magic = NETPLAY_MAGIC;
-    header->type = NETPACKET_STATE_SYNC;
-    header->version = 1;
-    header->sequence = frame_count;
-    offset += sizeof(netpacket_header_t);
-    
-    memcpy(packet + offset, state_data, size);
-    offset += size;
-    
-    header->length = offset - sizeof(netpacket_header_t);
+    uint8_t targets = 0;
+    bool delta = tx->base_id && tx->base_size == (uint32_t)size;
+    for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
+        if (client_sockets[i] < 0) continue;
+        if (ctx->session.active && ctx->session.client_ports[i] <= 0) continue;
+        targets |= 1 << i;
+        if (tx->acked[i] != tx->base_id) delta = false;
+    }
+    if (!targets) {
+        return -1;
+    }
     
-    if (role == NETPLAY_ROLE_HOST) {
-        // Broadcast to all clients
-        for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
-            if (client_sockets[i] >= 0) {
-                if (send(client_sockets[i], packet, offset, 0) < 0) {
-                    printf("NET: Failed to send state to client %d: %s\n", i + 1, strerror(errno));
-                }
-            }
+    if ((uint32_t)size > tx->capacity) {
+        if (!grow(&tx->state, size) || !grow(&tx->base, size) || !grow(&tx->encoded, StateCodec_bound(STATE_CODEC, size))) {
+            return -1;
         }
+        tx->capacity = size;
+    }
+    memcpy(tx->state, state_data, size);
+    
+    // Most of a state stays the same from one resync to the next, XORing
+    // against the last one leaves zeros that compress to next to nothing.
+    // Done in place, a second XOR restores the base.
+    uint8_t *source = tx->state;
+    if (delta) {
+        xor_state(tx->base, tx->state, size);
+        source = tx->base;
+    }
+    size_t encoded_size = StateCodec_encode(STATE_CODEC, source, size, tx->encoded, StateCodec_bound(STATE_CODEC, size));
+    if (delta) {
+        xor_state(tx->base, tx->state, size);
+    }
+    if (!encoded_size) {
+        return -1;
+    }
+    
+    if (++tx->next_id == 0) tx->next_id = 1;
+    tx->id = tx->next_id;
+    tx->frame = frame;
+    tx->size = size;
+    tx->encoded_size = encoded_size;
+    tx->targets = targets;
+    tx->failed = 0;
+    memset(tx->sent, 0, sizeof(tx->sent));
+    memset(tx->sim_sent, 0, sizeof(tx->sim_sent));
+    tx->started = get_time_ms();
+    if (!delta) tx->base_id = 0;
+    
+    printf("NET: Sending state %u for frame %u, %s %d -> %u bytes\n", tx->id, frame, delta ? "delta" : "full", size, tx->encoded_size);
+    if (state_tx_pump(ctx)) {
+        tx->pumping = pthread_create(&tx->thread, NULL, state_tx_thread, ctx) == 0;
     }
+    return 0;
+}
+
+bool NET_state_busy(netplay_context_t *ctx) {
+    return ctx->state_tx.id != 0;
+}
+
+const void *NET_received_state(netplay_context_t *ctx, int *size, uint32_t *frame) {
+    netplay_state_rx_t *rx = &ctx->state_rx;
+    if (!rx->ready) return NULL;
+    if (ctx->session.active && ctx->session.frame < rx->state_frame) return NULL;
+    
+    *size = rx->state_size;
+    *frame = rx->state_frame;
+    return rx->state;
+}
+
+void NET_state_applied(netplay_context_t *ctx) {
+    netplay_session_t *s = &ctx->session;
+    ctx->state_rx.ready = false;
+    
+    // Unless the next one is already on its way
+    if (!ctx->state_rx.id) s->sync_pending = false;
+    // Rerunning from the state covers any rollback, and checksums from
+    // before it no longer mean anything
+    s->rollback_pending = false;
+    memset(s->checksums, 0, sizeof(s->checksums));
 }
 
 int NET_receive_state(netplay_context_t *ctx, void *state_data, int max_size) {
@@ -865,12 +1809,37 @@ int NET_receive_state(netplay_context_t *ctx, void *state_data, int max_size) {
 
 // Ping/Latency functions
 uint32_t NET_get_latency(netplay_context_t *ctx) {
+    netplay_link_stats_t stats;
+    if (NET_get_link_stats(ctx, &stats) && stats.udp) return stats.rtt_ms / 2;
+    
     pthread_mutex_lock(&ctx->mutex);
     uint32_t latency = ctx->latency_ms;
     pthread_mutex_unlock(&ctx->mutex);
     return latency;
 }
 
+// The worst of the links, measured from the input datagrams while UDP is up
+bool NET_get_link_stats(netplay_context_t *ctx, netplay_link_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!ctx->session.active) return false;
+    
+    if (ctx->udp_socket >= 0) {
+        for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
+            netplay_udp_link_t *l = &ctx->udp_links[i];
+            if (!l->active || !l->heard) continue;
+            stats->udp = true;
+            if (l->rtt_ms > stats->rtt_ms) stats->rtt_ms = l->rtt_ms;
+            if (l->loss_pct > stats->loss_pct) stats->loss_pct = l->loss_pct;
+        }
+        if (stats->udp) return true;
+    }
+    
+    pthread_mutex_lock(&ctx->mutex);
+    stats->rtt_ms = ctx->latency_ms * 2;
+    pthread_mutex_unlock(&ctx->mutex);
+    return true;
+}
+
 void NET_send_ping(netplay_context_t *ctx) {
     netplay_state_t state;
     netplay_role_t role;
@@ -879,7 +1848,7 @@ void NET_send_ping(netplay_context_t *ctx) {
     int client_sockets[NETPLAY_MAX_PEERS];
     
     pthread_mutex_lock(&ctx->mutex);
-    state = ctx->state;
+    state = has_peers(ctx) ? NETPLAY_STATE_CONNECTED : ctx->state;
     role = ctx->role;
     frame_count = ctx->frame_count;
     server_socket = ctx->server_socket;
@@ -894,7 +1863,7 @@ void NET_send_ping(netplay_context_t *ctx) {
     netpacket_header_t *header = (netpacket_header_t*)packet;
     header->magic = NETPLAY_MAGIC;
     header->type = NETPACKET_PING;
-    header->version = 1;
+    header->version = NETPLAY_PROTOCOL_VERSION;
     header->sequence = frame_count;
     
     struct timespec ts;
@@ -906,16 +1875,217 @@ void NET_send_ping(netplay_context_t *ctx) {
     int packet_size = sizeof(netpacket_header_t) + sizeof(ping_time);
     
     if (role == NETPLAY_ROLE_CLIENT && server_socket >= 0) {
-        if (send(server_socket, packet, packet_size, 0) < 0) {
+        if (send(server_socket, packet, packet_size, MSG_NOSIGNAL) < 0) {
             printf("NET: Failed to send ping to server: %s\n", strerror(errno));
         }
     } else if (role == NETPLAY_ROLE_HOST) {
         for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
             if (client_sockets[i] >= 0) {
-                if (send(client_sockets[i], packet, packet_size, 0) < 0) {
+                if (send(client_sockets[i], packet, packet_size, MSG_NOSIGNAL) < 0) {
                     printf("NET: Failed to send ping to client %d: %s\n", i + 1, strerror(errno));
                 }
             }
         }
     }
-}
\ No newline at end of file
+}
+
+int NET_wait(netplay_context_t *ctx, int timeout_ms) {
+    pthread_mutex_lock(&ctx->mutex);
+    netplay_role_t role = ctx->role;
+    int server_socket = ctx->server_socket;
+    int client_sockets[NETPLAY_MAX_PEERS];
+    memcpy(client_sockets, ctx->client_sockets, sizeof(client_sockets));
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    if (role == NETPLAY_ROLE_NONE || server_socket < 0) {
+        return -1;
+    }
+    
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(server_socket, &read_fds);
+    int max_fd = server_socket;
+    if (role == NETPLAY_ROLE_HOST) {
+        for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
+            if (client_sockets[i] < 0) continue;
+            FD_SET(client_sockets[i], &read_fds);
+            if (client_sockets[i] > max_fd) max_fd = client_sockets[i];
+        }
+    }
+    if (ctx->udp_socket >= 0) {
+        FD_SET(ctx->udp_socket, &read_fds);
+        if (ctx->udp_socket > max_fd) max_fd = ctx->udp_socket;
+        // Wake up in time to resend what the others haven't acknowledged
+        if (ctx->session.active && timeout_ms > NETPLAY_UDP_RESEND_MS) timeout_ms = NETPLAY_UDP_RESEND_MS;
+    }
+    
+    sim_flush(ctx, false);
+    int due = sim_next_due(ctx);
+    if (due >= 0 && due < timeout_ms) timeout_ms = due;
+    
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+    
+    int result = role == NETPLAY_ROLE_HOST ? NET_poll_host(ctx) : NET_poll_client(ctx);
+    udp_receive(ctx);
+    udp_flush(ctx);
+    sim_flush(ctx, false);
+    state_tx_pump(ctx);
+    return result;
+}
+
+// Lockstep functions
+int NET_start_session(netplay_context_t *ctx, int delay, bool sync_state) {
+    netplay_session_t *s = &ctx->session;
+    
+    pthread_mutex_lock(&ctx->mutex);
+    netplay_role_t role = ctx->role;
+    int client_sockets[NETPLAY_MAX_PEERS];
+    memcpy(client_sockets, ctx->client_sockets, sizeof(client_sockets));
+    pthread_mutex_unlock(&ctx->mutex);
+    
+    if (role != NETPLAY_ROLE_HOST) {
+        return -1;
+    }
+    if (delay < 0) delay = 0;
+    if (delay > NETPLAY_MAX_DELAY) delay = NETPLAY_MAX_DELAY;
+    
+    // Clients take the ports after the host's in the order they joined
+    int players = 1;
+    for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
+        s->client_ports[i] = -1;
+        if (client_sockets[i] >= 0 && players < NETPLAY_MAX_PLAYERS) {
+            s->client_ports[i] = players++;
+        }
+    }
+    if (players < 2) {
+        return -1;
+    }
+    if (ctx->udp_enabled && ctx->udp_socket < 0) udp_open(ctx, NULL);
+    
+    uint8_t flags = sync_state ? NETPLAY_SESSION_SYNC_STATE : 0;
+    if (ctx->udp_socket >= 0) flags |= NETPLAY_SESSION_UDP;
+    for (int i = 0; i < NETPLAY_MAX_PEERS; i++) {
+        if (s->client_ports[i] < 0) continue;
+        netplay_session_start_t start = {
+            .players = players,
+            .delay = delay,
+            .port = s->client_ports[i],
+            .flags = flags,
+        };
+        if (send_packet(client_sockets[i], NETPACKET_SESSION_START, 0, &start, sizeof(start)) < 0) {
+            printf("NET: Failed to start session with client %d: %s\n", i + 1, strerror(errno));
+            return -1;
+        }
+    }
+    
+    session_init(ctx, players, delay, 0);
+    printf("NET: Session started, %d players, %d frames of input delay\n", players, delay);
+    return 0;
+}
+
+void NET_end_session(netplay_context_t *ctx) {
+    ctx->session.active = false;
+}
+
+bool NET_session_active(netplay_context_t *ctx) {
+    return ctx->session.active;
+}
+
+void NET_submit_input(netplay_context_t *ctx, const netplay_input_t *input) {
+    netplay_session_t *s = &ctx->session;
+    if (!s->active) return;
+    
+    // Once per frame, however often we're called while waiting on the others
+    while (s->next_submit <= s->frame + s->delay) {
+        netplay_input_t local = *input;
+        local.port = s->local_port;
+        session_store(s, s->next_submit, s->local_port, &local);
+        session_send_input(ctx, s->next_submit, &local, -1);
+        s->next_submit++;
+    }
+    udp_flush(ctx);
+}
+
+bool NET_frame_ready(netplay_context_t *ctx) {
+    netplay_session_t *s = &ctx->session;
+    if (!s->active) return true;
+    if (s->sync_pending && s->frame >= s->sync_frame) return false;
+    
+    return s->frame < s->confirmed || s->frame - s->confirmed < (uint32_t)s->max_rollback;
+}
+
+const netplay_input_t *NET_frame_input(netplay_context_t *ctx, int port) {
+    netplay_session_t *s = &ctx->session;
+    if (!s->active || port < 0 || port >= s->players) {
+        return NULL;
+    }
+    
+    netplay_frame_t *slot = &s->queue[s->frame % NETPLAY_INPUT_QUEUE];
+    if (slot->frame != s->frame) {
+        memset(slot, 0, sizeof(netplay_frame_t));
+        slot->frame = s->frame;
+    }
+    if (!(slot->have & (1 << port))) {
+        // Players mostly keep holding what they held, guess they still do
+        if (s->last_have & (1 << port)) {
+            slot->inputs[port] = s->last_input[port];
+        } else {
+            memset(&slot->inputs[port], 0, sizeof(netplay_input_t));
+        }
+        slot->inputs[port].port = port;
+        slot->predicted |= 1 << port;
+    }
+    return &slot->inputs[port];
+}
+
+void NET_advance_frame(netplay_context_t *ctx) {
+    if (ctx->session.active) ctx->session.frame++;
+}
+
+void NET_submit_checksum(netplay_context_t *ctx, uint32_t frame, uint32_t crc) {
+    netplay_session_t *s = &ctx->session;
+    if (!s->active) return;
+    
+    session_check(ctx, frame, s->local_port, crc);
+    session_broadcast(ctx, NETPACKET_CHECKSUM, frame, &crc, sizeof(crc), -1);
+}
+
+// Rollback functions
+void NET_set_rollback(netplay_context_t *ctx, int max_frames) {
+    if (max_frames < 0) max_frames = 0;
+    if (max_frames > NETPLAY_MAX_ROLLBACK) max_frames = NETPLAY_MAX_ROLLBACK;
+    ctx->session.max_rollback = max_frames;
+}
+
+bool NET_rollback(netplay_context_t *ctx, uint32_t *frame) {
+    netplay_session_t *s = &ctx->session;
+    if (!s->active || !s->rollback_pending) return false;
+    
+    s->rollback_pending = false;
+    if (s->rollback_from >= s->frame) return false;
+    
+    s->rollbacks++;
+    s->resimulated += s->frame - s->rollback_from;
+    s->frame = s->rollback_from;
+    *frame = s->rollback_from;
+    return true;
+}
+
+void NET_enable_udp(netplay_context_t *ctx, bool enable) {
+    ctx->udp_enabled = enable;
+}
+
+void NET_simulate_network(netplay_context_t *ctx, int latency_ms, int jitter_ms, int loss_pct, uint32_t seed) {
+    sim_flush(ctx, true);
+    ctx->sim.latency_ms = latency_ms > 0 ? latency_ms : 0;
+    ctx->sim.jitter_ms = jitter_ms > 0 ? jitter_ms : 0;
+    ctx->sim.loss_pct = loss_pct > 0 ? (loss_pct < 100 ? loss_pct : 99) : 0;
+    ctx->sim.seed = seed;
+    ctx->sim.last_due = get_time_ms();
+    if (sim_enabled(ctx)) {
+        printf("NET: Simulating %d ms latency with up to %d ms jitter, %d%% loss\n", ctx->sim.latency_ms, ctx->sim.jitter_ms, ctx->sim.loss_pct);
+    }
+}
@@ -4,13 +4,35 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <netinet/in.h>
 
 #define NETPLAY_PORT 55435
 #define NETPLAY_BROADCAST_PORT 55436
 #define NETPLAY_MAX_PEERS 4
 #define NETPLAY_DEVICE_NAME_MAX 64
 #define NETPLAY_MAX_INPUT_STATE 32
-#define NETPLAY_PROTOCOL_VERSION 1
+#define NETPLAY_PROTOCOL_VERSION 4
+#define NETPLAY_RX_BUFFER_SIZE 8192
+
+// Lockstep
+#define NETPLAY_MAX_PLAYERS 4       // libretro ports 0-3, the host is always port 0
+#define NETPLAY_MAX_DELAY 15        // frames
+#define NETPLAY_INPUT_QUEUE 64      // frames of input buffered ahead, power of two
+#define NETPLAY_CHECKSUM_HISTORY 8
+#define NETPLAY_MAX_ROLLBACK 8      // frames run ahead on predicted input
+#define NETPLAY_SIM_QUEUE 256       // packets held back by the network simulation
+#define NETPLAY_SIM_PACKET_SIZE 1280
+#define NETPLAY_SIM_RTO_MS 200      // what a lost TCP segment costs, Linux's minimum retransmission timeout
+#define NETPLAY_STATE_INFLIGHT 32768 // bytes left unsent in a socket before state chunks back off
+#define NETPLAY_STATE_PUMP_MS 1     // between state chunks once the socket has backed off
+#define NETPLAY_STATE_MAX_SIZE (64 * 1024 * 1024)
+
+// UDP input
+#define NETPLAY_UDP_REDUNDANCY 8    // newest frames of unacknowledged input repeated in every datagram
+#define NETPLAY_UDP_RESEND_MS 8     // resend unacknowledged input this often while nothing new comes
+#define NETPLAY_UDP_KEEPALIVE_MS 100
+#define NETPLAY_UDP_SEQ_HISTORY 64  // send times kept to measure round trips
+#define NETPLAY_UDP_LOSS_WINDOW 128 // datagrams per loss estimate
 
 // Netplay states
 typedef enum {
@@ -59,7 +81,11 @@ typedef enum {
     NETPACKET_INPUT_STATE,
     NETPACKET_STATE_SYNC,
     NETPACKET_PING,
-    NETPACKET_PONG
+    NETPACKET_PONG,
+    NETPACKET_SESSION_START,
+    NETPACKET_CHECKSUM,
+    NETPACKET_STATE_CHUNK,
+    NETPACKET_STATE_ACK
 } netpacket_type_t;
 
 // Netplay packet header
@@ -73,6 +99,203 @@ typedef struct {
 
 #define NETPLAY_MAGIC 0x4E504159  // "NPAY"
 
+// Sent by the host to each client once everyone is connected
+typedef struct {
+    uint8_t players;
+    uint8_t delay;          // frames between sampling input and using it
+    uint8_t port;           // the receiving player's port
+    uint8_t flags;
+} netplay_session_start_t;
+
+#define NETPLAY_SESSION_SYNC_STATE 0x01 // the host's frame 0 state follows
+#define NETPLAY_SESSION_UDP 0x02        // input goes over UDP, the host listens on NETPLAY_PORT
+
+// Datagram on the UDP input channel, followed by count netplay_udp_input_t
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t port;           // sender's player port
+    uint8_t count;
+    uint8_t reserved;
+    uint32_t seq;           // counts up per link
+    uint32_t echo_seq;      // latest seq received from the other side
+    uint32_t echo_hold;     // ms between receiving echo_seq and sending this
+    uint32_t ack[NETPLAY_MAX_PLAYERS]; // next frame of each port the sender is missing
+} netplay_udp_header_t;
+
+typedef struct {
+    uint32_t frame;
+    netplay_input_t input;
+} netplay_udp_input_t;
+// Precedes each piece of a state transfer. States are compressed, later
+// ones as an XOR delta against the last state every client acknowledged.
+typedef struct {
+    uint32_t id;            // counts up from 1
+    uint32_t base_id;       // transfer this is a delta against, 0 for a full state
+    uint32_t frame;         // the state is from the start of this frame
+    uint32_t size;          // decoded
+    uint32_t encoded_size;
+    uint32_t offset;        // of this chunk in the encoded state
+} netplay_state_chunk_t;
+
+typedef struct {
+    uint32_t id;
+    uint8_t ok;             // 0 when it couldn't be decoded
+    uint8_t reserved[3];
+} netplay_state_ack_t;
+
+// Every player's input for one frame
+typedef struct {
+    uint32_t frame;
+    uint8_t have;           // bit per port
+    uint8_t predicted;      // bit per port, inputs[port] is a guess the frame ran with
+    netplay_input_t inputs[NETPLAY_MAX_PLAYERS];
+} netplay_frame_t;
+
+typedef struct {
+    uint32_t frame;
+    uint8_t have;           // bit per port
+    uint32_t crc[NETPLAY_MAX_PLAYERS];
+} netplay_checksum_t;
+
+// Lockstep session. Each frame only runs once every player's input for it
+// has arrived; local input is sent `delay` frames ahead to hide latency.
+// With rollback enabled frames may also run up to max_rollback frames past
+// the last confirmed one, repeating each player's last known input; a late
+// input that contradicts the guess schedules a rollback to its frame.
+// Only touched from the thread that polls and runs frames.
+typedef struct {
+    bool active;
+    int players;
+    int local_port;
+    int delay;
+    int max_rollback;       // 0 is pure lockstep
+    uint32_t frame;         // next frame to run
+    uint32_t confirmed;     // every frame before this has everyone's input
+    uint32_t have_upto[NETPLAY_MAX_PLAYERS]; // per port, every frame before this is in
+    uint32_t next_submit;   // next frame to send local input for
+    int client_ports[NETPLAY_MAX_PEERS]; // host only, port of each client slot
+    netplay_frame_t queue[NETPLAY_INPUT_QUEUE];
+    netplay_checksum_t checksums[NETPLAY_CHECKSUM_HISTORY];
+    
+    // Prediction
+    uint8_t last_have;      // bit per port
+    uint32_t last_frame[NETPLAY_MAX_PLAYERS];
+    netplay_input_t last_input[NETPLAY_MAX_PLAYERS];
+    bool rollback_pending;
+    uint32_t rollback_from;
+    
+    // Frames from sync_frame on wait for a state the host is sending
+    bool sync_pending;
+    uint32_t sync_frame;
+    
+    // Stats
+    uint32_t rollbacks;
+    uint32_t resimulated;   // frames
+} netplay_session_t;
+
+// Host side of state transfers, one at a time to every client
+typedef struct {
+    uint32_t id;            // in flight, 0 when idle
+    uint32_t next_id;
+    uint32_t frame;
+    uint32_t size;
+    uint8_t *state;         // in flight
+    uint8_t *base;          // what base_id decoded to
+    uint32_t base_id;
+    uint32_t base_size;
+    uint8_t *encoded;
+    uint32_t encoded_size;
+    uint32_t capacity;      // of state, base and encoded alike
+    uint8_t targets;        // bit per client slot still receiving
+    uint8_t failed;         // bit per client slot that couldn't decode
+    uint32_t sent[NETPLAY_MAX_PEERS];  // encoded bytes
+    uint32_t acked[NETPLAY_MAX_PEERS]; // last transfer decoded, 0 for none
+    uint32_t started;       // ms
+    uint32_t sim_window[NETPLAY_MAX_PEERS]; // ms, start of the simulated round trip
+    uint32_t sim_sent[NETPLAY_MAX_PEERS];   // bytes sent within it, not acknowledged yet
+    pthread_t thread;       // sends the chunks, between frames too
+    bool pumping;           // thread still needs joining
+} netplay_state_tx_t;
+
+// Client side
+typedef struct {
+    uint32_t id;            // being received
+    uint32_t base_id;
+    uint32_t frame;
+    uint32_t size;
+    uint32_t encoded_size;
+    uint32_t received;
+    uint8_t *encoded;
+    uint32_t encoded_capacity;
+    uint8_t *state;         // last one decoded, the base of the next delta
+    uint8_t *scratch;
+    uint32_t state_id;
+    uint32_t state_size;
+    uint32_t state_frame;
+    uint32_t capacity;      // of state and scratch
+    bool ready;             // state waits to be applied
+} netplay_state_rx_t;
+
+// One end of the UDP input channel, per client on the host, to the host
+// on a client
+typedef struct {
+    bool active;            // heard from the other side, input no longer needs TCP
+    struct sockaddr_in addr;
+    uint32_t seq;           // next to send
+    uint32_t sent_at[NETPLAY_UDP_SEQ_HISTORY]; // ms, by seq
+    uint32_t last_send;     // ms
+    uint32_t sent_upto[NETPLAY_MAX_PLAYERS];   // per port, newest frame sent + 1
+    uint32_t acks_sent[NETPLAY_MAX_PLAYERS];   // session have_upto when last sent
+    uint32_t ack[NETPLAY_MAX_PLAYERS];         // per port, next frame the other side is missing
+    uint32_t tcp_upto[NETPLAY_MAX_PLAYERS];    // per port, frames before this went over TCP
+    
+    // Received
+    bool heard;
+    uint32_t peer_seq;
+    uint32_t peer_seq_at;   // ms
+    uint32_t window_start;  // first seq of the current loss window
+    uint32_t window_received;
+    
+    // Stats
+    uint32_t rtt_ms;        // smoothed
+    uint32_t loss_pct;      // of datagrams from the other side, last window
+} netplay_udp_link_t;
+
+typedef struct {
+    bool udp;
+    uint32_t rtt_ms;
+    uint32_t loss_pct;
+} netplay_link_stats_t;
+
+// Outgoing session packets held back to simulate a worse network
+typedef struct {
+    uint32_t due;           // ms
+    int sock;
+    bool datagram;
+    bool sent;
+    struct sockaddr_in to;  // datagrams
+    int size;
+    uint8_t data[NETPLAY_SIM_PACKET_SIZE];
+} netplay_sim_packet_t;
+
+typedef struct {
+    int latency_ms;
+    int jitter_ms;
+    int loss_pct;
+    uint32_t seed;
+    uint32_t last_due;      // keeps TCP packets in order despite the jitter
+    int head;
+    int count;
+    netplay_sim_packet_t packets[NETPLAY_SIM_QUEUE];
+} netplay_sim_t;
+
+// TCP is a byte stream, packets are reassembled per connection
+typedef struct {
+    int size;
+    uint8_t data[NETPLAY_RX_BUFFER_SIZE];
+} netplay_rx_t;
+
 // Netplay API
 typedef struct {
     pthread_mutex_t mutex;  // Mutex for thread safety
@@ -101,10 +324,21 @@ typedef struct {
     uint32_t latency_ms;
     uint32_t last_ping_sent_time;  // Timestamp when last ping was sent
     
+    netplay_rx_t client_rx[NETPLAY_MAX_PEERS];
+    netplay_rx_t server_rx;
+    netplay_session_t session;
+    bool udp_enabled;       // host, offer UDP input with the next session
+    int udp_socket;
+    netplay_udp_link_t udp_links[NETPLAY_MAX_PEERS]; // by client slot, [0] to the host on a client
+    netplay_sim_t sim;
+    netplay_state_tx_t state_tx;
+    netplay_state_rx_t state_rx;
+    
     void (*on_input_received)(netplay_input_t *input);
     void (*on_state_received)(const void *state_data, int size, uint32_t frame);
     void (*on_device_discovered)(netplay_device_t *device);
     void (*on_connection_state_changed)(netplay_state_t state);
+    void (*on_desync)(uint32_t frame, int port);
 } netplay_context_t;
 
 // API functions
@@ -133,11 +367,60 @@ void NET_send_input(netplay_context_t *ctx);
 netplay_input_t *NET_get_remote_input(netplay_context_t *ctx, int player_index);
 
 // State sync
-void NET_send_state(netplay_context_t *ctx, const void *state_data, int size);
+// Host, starts sending the state `frame` starts from to every client.
+// Returns -1 while a transfer is still in flight.
+int NET_send_state(netplay_context_t *ctx, const void *state_data, int size, uint32_t frame);
+bool NET_state_busy(netplay_context_t *ctx);
+// Client, the state the host sent once the session reached its frame.
+// Load it, rerun any frames past it and call NET_state_applied().
+const void *NET_received_state(netplay_context_t *ctx, int *size, uint32_t *frame);
+void NET_state_applied(netplay_context_t *ctx);
 int NET_receive_state(netplay_context_t *ctx, void *state_data, int max_size);
 
 // Ping/Latency
 uint32_t NET_get_latency(netplay_context_t *ctx);
 void NET_send_ping(netplay_context_t *ctx);
+// Round trip and loss of the worst link, measured on the UDP input channel
+// when it's up, from pings otherwise. False outside of a session.
+bool NET_get_link_stats(netplay_context_t *ctx, netplay_link_stats_t *stats);
+
+// Waits up to timeout_ms for network activity, then polls as host or client.
+// Returns what NET_poll_host/NET_poll_client return, -1 when not connected.
+int NET_wait(netplay_context_t *ctx, int timeout_ms);
+
+// Lockstep
+// Host, once every client is connected. With sync_state the clients wait
+// for the state frame 0 starts from, send it with NET_send_state().
+int NET_start_session(netplay_context_t *ctx, int delay, bool sync_state);
+void NET_end_session(netplay_context_t *ctx);
+bool NET_session_active(netplay_context_t *ctx);
+// Sends local input for the frame `delay` frames ahead of the current one
+void NET_submit_input(netplay_context_t *ctx, const netplay_input_t *input);
+// True once every player's input for the current frame is in
+bool NET_frame_ready(netplay_context_t *ctx);
+// Input for the current frame, predicted when it hasn't arrived yet
+const netplay_input_t *NET_frame_input(netplay_context_t *ctx, int port);
+void NET_advance_frame(netplay_context_t *ctx);
+// Checksum of the state `frame` starts from, compared with the other
+// players' to detect desyncs (reported through on_desync). Only submit
+// checksums of confirmed frames.
+void NET_submit_checksum(netplay_context_t *ctx, uint32_t frame, uint32_t crc);
+
+// Rollback
+void NET_set_rollback(netplay_context_t *ctx, int max_frames);
+// When a prediction turned out wrong, rewinds the current frame to the
+// first mispredicted one and returns true. The caller restores its state
+// from the start of *frame and runs the frames up to the old one again.
+bool NET_rollback(netplay_context_t *ctx, uint32_t *frame);
+
+// Host, before NET_start_session(). TCP stays for everything else.
+void NET_enable_udp(netplay_context_t *ctx, bool enable);
+
+// Delays outgoing session packets by latency_ms plus up to jitter_ms and
+// loses loss_pct of them, drawn from seed so a run can be repeated. Lost
+// datagrams are dropped, lost TCP packets arrive NETPLAY_SIM_RTO_MS late
+// and hold up everything behind them, as a retransmission would.
+// 0 turns it off.
+void NET_simulate_network(netplay_context_t *ctx, int latency_ms, int jitter_ms, int loss_pct, uint32_t seed);
 
 #endif // __NETPLAY_H__
\ No newline at end of file
@@ -0,0 +1,1079 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <lzma.h>
+
+#include "defines.h"
+#include "api.h"
+#include "sevenzip.h"
+
+///////////////////////////////
+// format reference: 7zFormat.txt from the LZMA SDK
+
+#define SZ_SIGNATURE_SIZE 32
+#define SZ_MAX_STREAMS 16 // per folder, 7-Zip itself never gets near this
+#define SZ_MAX_HEADER_SIZE (64 * 1024 * 1024)
+#define SZ_READ_SIZE (1024 * 1024)
+#define SZ_MAX_THREADS 4
+#define SZ_THREAD_MEMORY (128 * 1024 * 1024) // dictionaries of all decoder threads combined
+
+enum {
+	SZ_END = 0x00,
+	SZ_HEADER,
+	SZ_ARCHIVE_PROPERTIES,
+	SZ_ADDITIONAL_STREAMS_INFO,
+	SZ_MAIN_STREAMS_INFO,
+	SZ_FILES_INFO,
+	SZ_PACK_INFO,
+	SZ_UNPACK_INFO,
+	SZ_SUBSTREAMS_INFO,
+	SZ_SIZE,
+	SZ_CRC,
+	SZ_FOLDER,
+	SZ_CODERS_UNPACK_SIZE,
+	SZ_NUM_UNPACK_STREAM,
+	SZ_EMPTY_STREAM,
+	SZ_EMPTY_FILE,
+	SZ_ANTI,
+	SZ_NAME,
+	SZ_CTIME,
+	SZ_ATIME,
+	SZ_MTIME,
+	SZ_WIN_ATTRIBUTES,
+	SZ_COMMENT,
+	SZ_ENCODED_HEADER,
+};
+
+enum {
+	SZ_METHOD_COPY = 0x00,
+	SZ_METHOD_DELTA = 0x03,
+	SZ_METHOD_ARM64 = 0x0A,
+	SZ_METHOD_LZMA2 = 0x21,
+	SZ_METHOD_LZMA = 0x030101,
+	SZ_METHOD_X86 = 0x03030103,
+	SZ_METHOD_PPC = 0x03030205,
+	SZ_METHOD_IA64 = 0x03030401,
+	SZ_METHOD_ARM = 0x03030501,
+	SZ_METHOD_ARMT = 0x03030701,
+	SZ_METHOD_SPARC = 0x03030805,
+};
+
+typedef struct SZCoder {
+	uint64_t method;
+	int num_in;
+	int num_out;
+	uint8_t* props;
+	size_t props_size;
+} SZCoder;
+
+typedef struct SZFolder {
+	int num_coders;
+	SZCoder coders[SZ_MAX_STREAMS];
+	int num_bonds;
+	uint64_t bond_in[SZ_MAX_STREAMS];
+	uint64_t bond_out[SZ_MAX_STREAMS];
+	int num_packed;
+	int num_out;
+	uint64_t unpack_sizes[SZ_MAX_STREAMS]; // one per coder output
+	uint64_t size; // of the unbound output, what the folder decodes to
+	uint64_t pack_offset; // absolute, of the first packed stream
+	uint64_t pack_size;
+	int has_crc;
+	uint32_t crc;
+	int num_substreams;
+} SZFolder;
+
+typedef struct SZStreams {
+	uint64_t pack_pos;
+	int num_pack_streams;
+	uint64_t* pack_sizes;
+	int num_folders;
+	SZFolder* folders;
+	int num_substreams;
+	uint64_t* sub_sizes;
+	uint8_t* sub_has_crc;
+	uint32_t* sub_crcs;
+} SZStreams;
+
+typedef struct SZFile {
+	char* name;
+	int has_stream;
+	int folder;
+	uint64_t offset; // within the folder's output
+	uint64_t size;
+	int has_crc;
+	uint32_t crc;
+} SZFile;
+
+struct SevenZip {
+	int fd;
+	int num_folders;
+	SZFolder* folders;
+	int num_files;
+	SZFile* files;
+};
+
+///////////////////////////////
+
+typedef struct SZBuffer {
+	const uint8_t* data;
+	size_t size;
+	size_t pos;
+	int error;
+} SZBuffer;
+
+static int SZ_byte(SZBuffer* b) {
+	if (b->pos>=b->size) {
+		b->error = 1;
+		return 0;
+	}
+	return b->data[b->pos++];
+}
+static uint32_t SZ_uint32(SZBuffer* b) {
+	uint32_t value = 0;
+	for (int i=0; i<4; i++) value |= (uint32_t)SZ_byte(b) << (8 * i);
+	return value;
+}
+// 7z's variable length number: the leading one bits of the first
+// byte say how many little endian bytes follow
+static uint64_t SZ_number(SZBuffer* b) {
+	int first = SZ_byte(b);
+	int mask = 0x80;
+	uint64_t value = 0;
+	for (int i=0; i<8; i++) {
+		if ((first & mask)==0) {
+			uint64_t high = first & (mask - 1);
+			return value | (high << (8 * i));
+		}
+		value |= (uint64_t)SZ_byte(b) << (8 * i);
+		mask >>= 1;
+	}
+	return value;
+}
+static int SZ_count(SZBuffer* b, int limit) {
+	uint64_t value = SZ_number(b);
+	if (value>(uint64_t)limit) {
+		b->error = 1;
+		return 0;
+	}
+	return (int)value;
+}
+static void SZ_skip(SZBuffer* b, uint64_t size) {
+	if (size>b->size - b->pos) {
+		b->error = 1;
+		b->pos = b->size;
+	}
+	else b->pos += size;
+}
+static uint8_t* SZ_bits(SZBuffer* b, int count) {
+	uint8_t* bits = calloc(count + 1, 1);
+	int mask = 0;
+	int byte = 0;
+	for (int i=0; i<count; i++) {
+		if (mask==0) {
+			byte = SZ_byte(b);
+			mask = 0x80;
+		}
+		bits[i] = (byte & mask)!=0;
+		mask >>= 1;
+	}
+	return bits;
+}
+static void SZ_digests(SZBuffer* b, int count, uint8_t** defined, uint32_t** crcs) {
+	if (SZ_byte(b)) { // all defined
+		*defined = calloc(count + 1, 1);
+		memset(*defined, 1, count);
+	}
+	else *defined = SZ_bits(b, count);
+
+	*crcs = calloc(count + 1, sizeof(uint32_t));
+	for (int i=0; i<count; i++) {
+		if ((*defined)[i]) (*crcs)[i] = SZ_uint32(b);
+	}
+}
+static char* SZ_name(SZBuffer* b) {
+	// utf-16le to utf-8, at most 3 bytes per unit (4 per surrogate pair)
+	size_t start = b->pos;
+	while (b->pos + 1<b->size && (b->data[b->pos] || b->data[b->pos + 1])) b->pos += 2;
+	size_t units = (b->pos - start) / 2;
+	SZ_skip(b, 2); // terminator
+
+	char* name = malloc(units * 3 + 1);
+	char* out = name;
+	for (size_t i=0; i<units; i++) {
+		uint32_t c = b->data[start + i * 2] | (b->data[start + i * 2 + 1] << 8);
+		if (c>=0xD800 && c<0xDC00 && i + 1<units) {
+			uint32_t low = b->data[start + i * 2 + 2] | (b->data[start + i * 2 + 3] << 8);
+			if (low>=0xDC00 && low<0xE000) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				i += 1;
+			}
+		}
+		if (c<0x80) *out++ = c;
+		else if (c<0x800) {
+			*out++ = 0xC0 | (c >> 6);
+			*out++ = 0x80 | (c & 0x3F);
+		}
+		else if (c<0x10000) {
+			*out++ = 0xE0 | (c >> 12);
+			*out++ = 0x80 | ((c >> 6) & 0x3F);
+			*out++ = 0x80 | (c & 0x3F);
+		}
+		else {
+			*out++ = 0xF0 | (c >> 18);
+			*out++ = 0x80 | ((c >> 12) & 0x3F);
+			*out++ = 0x80 | ((c >> 6) & 0x3F);
+			*out++ = 0x80 | (c & 0x3F);
+		}
+	}
+	*out = '\0';
+	return name;
+}
+
+///////////////////////////////
+
+static void SZ_readPackInfo(SZBuffer* b, SZStreams* s) {
+	s->pack_pos = SZ_number(b);
+	s->num_pack_streams = SZ_count(b, 1 << 20);
+	s->pack_sizes = calloc(s->num_pack_streams + 1, sizeof(uint64_t));
+
+	for (int id=SZ_number(b); id!=SZ_END && !b->error; id=SZ_number(b)) {
+		if (id==SZ_SIZE) {
+			for (int i=0; i<s->num_pack_streams; i++) s->pack_sizes[i] = SZ_number(b);
+		}
+		else if (id==SZ_CRC) {
+			uint8_t* defined;
+			uint32_t* crcs;
+			SZ_digests(b, s->num_pack_streams, &defined, &crcs);
+			free(defined);
+			free(crcs);
+		}
+		else b->error = 1;
+	}
+}
+static void SZ_readFolder(SZBuffer* b, SZFolder* f) {
+	int num_in = 0;
+	f->num_out = 0;
+	f->num_coders = SZ_count(b, SZ_MAX_STREAMS);
+	for (int i=0; i<f->num_coders && !b->error; i++) {
+		SZCoder* coder = &f->coders[i];
+		int flags = SZ_byte(b);
+		if (flags & 0x80) { // alternative methods, never written by anything
+			b->error = 1;
+			return;
+		}
+
+		for (int j=0; j<(flags & 0x0F); j++) coder->method = (coder->method << 8) | SZ_byte(b);
+
+		coder->num_in = 1;
+		coder->num_out = 1;
+		if (flags & 0x10) {
+			coder->num_in = SZ_count(b, SZ_MAX_STREAMS);
+			coder->num_out = SZ_count(b, SZ_MAX_STREAMS);
+		}
+		if (flags & 0x20) {
+			coder->props_size = SZ_count(b, 256);
+			coder->props = malloc(coder->props_size + 1);
+			if (coder->props_size<=b->size - b->pos) memcpy(coder->props, b->data + b->pos, coder->props_size);
+			SZ_skip(b, coder->props_size);
+		}
+		num_in += coder->num_in;
+		f->num_out += coder->num_out;
+	}
+	if (f->num_out<1 || f->num_out>SZ_MAX_STREAMS || num_in>SZ_MAX_STREAMS) {
+		b->error = 1;
+		return;
+	}
+
+	f->num_bonds = f->num_out - 1;
+	for (int i=0; i<f->num_bonds; i++) {
+		f->bond_in[i] = SZ_number(b);
+		f->bond_out[i] = SZ_number(b);
+	}
+
+	f->num_packed = num_in - f->num_bonds;
+	if (f->num_packed<1) b->error = 1;
+	else if (f->num_packed>1) {
+		for (int i=0; i<f->num_packed; i++) SZ_number(b); // packed stream indices, only matter for BCJ2
+	}
+}
+static void SZ_readUnpackInfo(SZBuffer* b, SZStreams* s) {
+	if (SZ_number(b)!=SZ_FOLDER) {
+		b->error = 1;
+		return;
+	}
+	s->num_folders = SZ_count(b, 1 << 16);
+	if (SZ_byte(b)!=0) { // external
+		b->error = 1;
+		return;
+	}
+
+	s->folders = calloc(s->num_folders + 1, sizeof(SZFolder));
+	for (int i=0; i<s->num_folders && !b->error; i++) SZ_readFolder(b, &s->folders[i]);
+
+	if (SZ_number(b)!=SZ_CODERS_UNPACK_SIZE) {
+		b->error = 1;
+		return;
+	}
+	for (int i=0; i<s->num_folders && !b->error; i++) {
+		SZFolder* f = &s->folders[i];
+		for (int j=0; j<f->num_out; j++) f->unpack_sizes[j] = SZ_number(b);
+
+		// the folder's output is the one coder output nothing else consumes
+		for (int j=0; j<f->num_out; j++) {
+			int bound = 0;
+			for (int k=0; k<f->num_bonds; k++) {
+				if (f->bond_out[k]==(uint64_t)j) bound = 1;
+			}
+			if (!bound) {
+				f->size = f->unpack_sizes[j];
+				break;
+			}
+		}
+	}
+
+	for (int id=SZ_number(b); id!=SZ_END && !b->error; id=SZ_number(b)) {
+		if (id==SZ_CRC) {
+			uint8_t* defined;
+			uint32_t* crcs;
+			SZ_digests(b, s->num_folders, &defined, &crcs);
+			for (int i=0; i<s->num_folders; i++) {
+				s->folders[i].has_crc = defined[i];
+				s->folders[i].crc = crcs[i];
+			}
+			free(defined);
+			free(crcs);
+		}
+		else b->error = 1;
+	}
+}
+static void SZ_allocSubStreams(SZStreams* s) {
+	s->num_substreams = 0;
+	for (int i=0; i<s->num_folders; i++) s->num_substreams += s->folders[i].num_substreams;
+	s->sub_sizes = calloc(s->num_substreams + 1, sizeof(uint64_t));
+	s->sub_has_crc = calloc(s->num_substreams + 1, 1);
+	s->sub_crcs = calloc(s->num_substreams + 1, sizeof(uint32_t));
+}
+static void SZ_defaultSubStreams(SZStreams* s) {
+	for (int i=0; i<s->num_folders; i++) s->folders[i].num_substreams = 1;
+	SZ_allocSubStreams(s);
+	for (int i=0; i<s->num_folders; i++) {
+		s->sub_sizes[i] = s->folders[i].size;
+		s->sub_has_crc[i] = s->folders[i].has_crc;
+		s->sub_crcs[i] = s->folders[i].crc;
+	}
+}
+static void SZ_readSubStreamsInfo(SZBuffer* b, SZStreams* s) {
+	for (int i=0; i<s->num_folders; i++) s->folders[i].num_substreams = 1;
+
+	int id = SZ_number(b);
+	if (id==SZ_NUM_UNPACK_STREAM) {
+		for (int i=0; i<s->num_folders; i++) s->folders[i].num_substreams = SZ_count(b, 1 << 20);
+		id = SZ_number(b);
+	}
+	SZ_allocSubStreams(s);
+
+	// every size but the last of each folder is stored, the last is what's left
+	int k = 0;
+	int unknown_crcs = 0;
+	for (int i=0; i<s->num_folders; i++) {
+		SZFolder* f = &s->folders[i];
+		if (f->num_substreams==0) continue;
+
+		uint64_t sum = 0;
+		for (int j=0; j<f->num_substreams - 1; j++) {
+			if (id!=SZ_SIZE) b->error = 1;
+			s->sub_sizes[k] = SZ_number(b);
+			sum += s->sub_sizes[k++];
+		}
+		if (sum>f->size) b->error = 1;
+		s->sub_sizes[k++] = f->size - sum;
+
+		if (f->num_substreams!=1 || !f->has_crc) unknown_crcs += f->num_substreams;
+	}
+	if (id==SZ_SIZE) id = SZ_number(b);
+
+	for (; id!=SZ_END && !b->error; id=SZ_number(b)) {
+		if (id!=SZ_CRC) {
+			b->error = 1;
+			break;
+		}
+
+		uint8_t* defined;
+		uint32_t* crcs;
+		SZ_digests(b, unknown_crcs, &defined, &crcs);
+		k = 0;
+		int u = 0;
+		for (int i=0; i<s->num_folders; i++) {
+			SZFolder* f = &s->folders[i];
+			if (f->num_substreams==1 && f->has_crc) {
+				k += 1;
+				continue;
+			}
+			for (int j=0; j<f->num_substreams; j++, k++, u++) {
+				s->sub_has_crc[k] = defined[u];
+				s->sub_crcs[k] = crcs[u];
+			}
+		}
+		free(defined);
+		free(crcs);
+	}
+
+	// a lone substream inherits the folder's crc
+	k = 0;
+	for (int i=0; i<s->num_folders; i++) {
+		SZFolder* f = &s->folders[i];
+		if (f->num_substreams==1 && f->has_crc) {
+			s->sub_has_crc[k] = 1;
+			s->sub_crcs[k] = f->crc;
+		}
+		k += f->num_substreams;
+	}
+}
+static void SZ_readStreamsInfo(SZBuffer* b, SZStreams* s) {
+	int id = SZ_number(b);
+	if (id==SZ_PACK_INFO) {
+		SZ_readPackInfo(b, s);
+		id = SZ_number(b);
+	}
+	if (id==SZ_UNPACK_INFO && !b->error) {
+		SZ_readUnpackInfo(b, s);
+		id = SZ_number(b);
+	}
+	if (id==SZ_SUBSTREAMS_INFO && !b->error) {
+		SZ_readSubStreamsInfo(b, s);
+		id = SZ_number(b);
+	}
+	else if (!b->error) SZ_defaultSubStreams(s);
+	if (id!=SZ_END) b->error = 1;
+	if (b->error) return;
+
+	// packed streams are stored back to back in folder order
+	uint64_t offset = SZ_SIGNATURE_SIZE + s->pack_pos;
+	int p = 0;
+	for (int i=0; i<s->num_folders; i++) {
+		SZFolder* f = &s->folders[i];
+		for (int j=0; j<f->num_packed; j++, p++) {
+			if (p>=s->num_pack_streams) {
+				b->error = 1;
+				return;
+			}
+			if (j==0) {
+				f->pack_offset = offset;
+				f->pack_size = s->pack_sizes[p];
+			}
+			offset += s->pack_sizes[p];
+		}
+	}
+}
+static void SZ_readFilesInfo(SZBuffer* b, SevenZip* archive, SZStreams* s) {
+	archive->num_files = SZ_count(b, 1 << 20);
+	archive->files = calloc(archive->num_files + 1, sizeof(SZFile));
+
+	uint8_t* empty_stream = NULL;
+	for (int type=SZ_number(b); type!=SZ_END && !b->error; type=SZ_number(b)) {
+		uint64_t size = SZ_number(b);
+		if (size>b->size - b->pos) {
+			b->error = 1;
+			break;
+		}
+		size_t end = b->pos + size;
+
+		if (type==SZ_EMPTY_STREAM && !empty_stream) {
+			empty_stream = SZ_bits(b, archive->num_files);
+		}
+		else if (type==SZ_NAME) {
+			if (SZ_byte(b)!=0) b->error = 1; // external
+			for (int i=0; i<archive->num_files && !b->error; i++) {
+				SZBuffer names = {b->data, end, b->pos, 0};
+				archive->files[i].name = SZ_name(&names);
+				b->pos = names.pos;
+			}
+		}
+		b->pos = end; // times, attributes and anything newer are of no use here
+	}
+
+	// files with data map onto the substreams in order
+	int k = 0;
+	int folder = 0;
+	int in_folder = 0;
+	uint64_t offset = 0;
+	for (int i=0; i<archive->num_files && !b->error; i++) {
+		SZFile* file = &archive->files[i];
+		if (empty_stream && empty_stream[i]) continue;
+
+		while (folder<s->num_folders && in_folder>=s->folders[folder].num_substreams) {
+			folder += 1;
+			in_folder = 0;
+			offset = 0;
+		}
+		if (folder>=s->num_folders) {
+			b->error = 1;
+			break;
+		}
+
+		file->has_stream = 1;
+		file->folder = folder;
+		file->offset = offset;
+		file->size = s->sub_sizes[k];
+		file->has_crc = s->sub_has_crc[k];
+		file->crc = s->sub_crcs[k];
+		offset += file->size;
+		in_folder += 1;
+		k += 1;
+	}
+	if (empty_stream) free(empty_stream);
+}
+static void SZ_readHeader(SZBuffer* b, SevenZip* archive, SZStreams* s) {
+	int id = SZ_number(b);
+	if (id==SZ_ARCHIVE_PROPERTIES) {
+		for (int type=SZ_number(b); type!=SZ_END && !b->error; type=SZ_number(b)) SZ_skip(b, SZ_number(b));
+		id = SZ_number(b);
+	}
+	if (id==SZ_ADDITIONAL_STREAMS_INFO) { // never written by 7-Zip
+		b->error = 1;
+		return;
+	}
+	if (id==SZ_MAIN_STREAMS_INFO) {
+		SZ_readStreamsInfo(b, s);
+		id = SZ_number(b);
+	}
+	if (id==SZ_FILES_INFO && !b->error) {
+		SZ_readFilesInfo(b, archive, s);
+		id = SZ_number(b);
+	}
+	if (id!=SZ_END) b->error = 1;
+}
+static void SZ_freeFolders(SZFolder* folders, int count) {
+	if (!folders) return;
+	for (int i=0; i<count; i++) {
+		for (int j=0; j<folders[i].num_coders; j++) {
+			if (folders[i].coders[j].props) free(folders[i].coders[j].props);
+		}
+	}
+	free(folders);
+}
+static void SZ_freeStreams(SZStreams* s) {
+	if (s->pack_sizes) free(s->pack_sizes);
+	if (s->sub_sizes) free(s->sub_sizes);
+	if (s->sub_has_crc) free(s->sub_has_crc);
+	if (s->sub_crcs) free(s->sub_crcs);
+	SZ_freeFolders(s->folders, s->num_folders);
+	memset(s, 0, sizeof(SZStreams));
+}
+
+///////////////////////////////
+
+// only plain chains are supported: each coder decodes what the next one
+// outputs and the last one reads the packed stream, which is also the
+// order liblzma wants its filters in. returns the filter count or -1
+static int SZ_filters(SZFolder* f, lzma_filter* filters) {
+	if (f->num_packed!=1 || f->num_bonds!=f->num_coders - 1) return -1;
+	for (int i=0; i<f->num_coders; i++) {
+		if (f->coders[i].num_in!=1 || f->coders[i].num_out!=1) return -1;
+	}
+	for (int i=0; i<f->num_bonds; i++) {
+		int found = 0;
+		for (int j=0; j<f->num_bonds; j++) {
+			if (f->bond_in[j]==(uint64_t)i && f->bond_out[j]==(uint64_t)i + 1) found = 1;
+		}
+		if (!found) return -1;
+	}
+
+	int count = 0;
+	for (int i=0; i<f->num_coders; i++) {
+		SZCoder* coder = &f->coders[i];
+		lzma_vli id;
+		switch (coder->method) {
+			case SZ_METHOD_COPY: continue;
+			case SZ_METHOD_LZMA2: id = LZMA_FILTER_LZMA2; break;
+			case SZ_METHOD_LZMA: id = LZMA_FILTER_LZMA1; break;
+			case SZ_METHOD_DELTA: id = LZMA_FILTER_DELTA; break;
+			case SZ_METHOD_X86: id = LZMA_FILTER_X86; break;
+			case SZ_METHOD_PPC: id = LZMA_FILTER_POWERPC; break;
+			case SZ_METHOD_IA64: id = LZMA_FILTER_IA64; break;
+			case SZ_METHOD_ARM: id = LZMA_FILTER_ARM; break;
+			case SZ_METHOD_ARMT: id = LZMA_FILTER_ARMTHUMB; break;
+			case SZ_METHOD_SPARC: id = LZMA_FILTER_SPARC; break;
+#ifdef LZMA_FILTER_ARM64
+			case SZ_METHOD_ARM64: id = LZMA_FILTER_ARM64; break;
+#endif
+			default: id = LZMA_VLI_UNKNOWN; break;
+		}
+
+		filters[count].id = id;
+		filters[count].options = NULL;
+		if (id==LZMA_VLI_UNKNOWN || lzma_properties_decode(&filters[count], NULL, coder->props, coder->props_size)!=LZMA_OK) {
+			LOG_error("7z: unsupported method %llx\n", (unsigned long long)coder->method);
+			for (int j=0; j<count; j++) free(filters[j].options);
+			return -1;
+		}
+		count += 1;
+	}
+	filters[count].id = LZMA_VLI_UNKNOWN;
+	return count;
+}
+static void SZ_freeFilters(lzma_filter* filters, int count) {
+	for (int i=0; i<count; i++) free(filters[i].options);
+}
+
+typedef int (*SZ_output_t)(void* userdata, const uint8_t* data, size_t size);
+
+// decodes the folder from the start on the calling thread,
+// handing everything in [start, end) to output
+static int SZ_decodeRange(SevenZip* archive, SZFolder* f, uint64_t start, uint64_t end, SZ_output_t output, void* userdata) {
+	lzma_filter filters[SZ_MAX_STREAMS + 1];
+	int count = SZ_filters(f, filters);
+	if (count<0) return 0;
+
+	lzma_stream strm = LZMA_STREAM_INIT;
+	if (count>0) {
+		lzma_ret ret = lzma_raw_decoder(&strm, filters);
+		SZ_freeFilters(filters, count);
+		if (ret!=LZMA_OK) {
+			LOG_error("7z: decoder init failed (%i)\n", ret);
+			return 0;
+		}
+	}
+
+	uint8_t* in = malloc(SZ_READ_SIZE);
+	uint8_t* out = malloc(SZ_READ_SIZE);
+	uint64_t pack_pos = f->pack_offset;
+	uint64_t pack_left = f->pack_size;
+	uint64_t out_pos = 0;
+	int ok = in && out;
+	while (ok && out_pos<end) {
+		if (strm.avail_in==0 && pack_left>0) {
+			ssize_t len = pread(archive->fd, in, pack_left<SZ_READ_SIZE ? pack_left : SZ_READ_SIZE, pack_pos);
+			if (len<=0) {
+				ok = 0;
+				break;
+			}
+			pack_pos += len;
+			pack_left -= len;
+			strm.next_in = in;
+			strm.avail_in = len;
+		}
+
+		size_t want = end - out_pos<SZ_READ_SIZE ? end - out_pos : SZ_READ_SIZE;
+		size_t produced;
+		if (count>0) {
+			strm.next_out = out;
+			strm.avail_out = want;
+			lzma_ret ret = lzma_code(&strm, LZMA_RUN);
+			produced = want - strm.avail_out;
+			if (ret!=LZMA_OK && ret!=LZMA_STREAM_END) ok = 0;
+			if (ret==LZMA_STREAM_END && produced==0) ok = 0; // ended early
+		}
+		else { // copy
+			produced = strm.avail_in<want ? strm.avail_in : want;
+			memcpy(out, strm.next_in, produced);
+			strm.next_in += produced;
+			strm.avail_in -= produced;
+		}
+		if (produced==0 && strm.avail_in==0 && pack_left==0) ok = 0; // truncated
+
+		if (ok && out_pos + produced>start) {
+			size_t skip = start>out_pos ? start - out_pos : 0;
+			ok = output(userdata, out + skip, produced - skip);
+		}
+		out_pos += produced;
+	}
+
+	if (count>0) lzma_end(&strm);
+	if (in) free(in);
+	if (out) free(out);
+	if (!ok) LOG_error("7z: decoding failed\n");
+	return ok;
+}
+
+///////////////////////////////
+
+// LZMA2 chunks that reset the dictionary and set new properties can be
+// decoded without anything before them, 7-Zip's multithreaded encoder
+// starts every block with one
+typedef struct SZSegment {
+	uint64_t pack_offset;
+	uint64_t pack_size;
+	uint64_t unpack_offset;
+	uint64_t unpack_size;
+} SZSegment;
+
+// walks the chunk headers only (a pread per chunk, at most 64KiB apart),
+// what's between them is only read once we know it's worth decoding
+static int SZ_splitLZMA2(int fd, uint64_t offset, uint64_t size, SZSegment** segments) {
+	int count = 0;
+	int capacity = 16;
+	*segments = malloc(capacity * sizeof(SZSegment));
+	if (!*segments) return -1;
+
+	uint64_t pos = 0;
+	uint64_t unpack = 0;
+	uint8_t chunk[5];
+	while (pos<size) {
+		ssize_t len = pread(fd, chunk, size - pos<sizeof(chunk) ? size - pos : sizeof(chunk), offset + pos);
+		if (len<=0) return -1;
+		int control = chunk[0];
+		if (control==0x00) break;
+
+		size_t header;
+		uint64_t pack_size;
+		uint64_t unpack_size;
+		if (control==0x01 || control==0x02) { // stored
+			if (len<3) return -1;
+			pack_size = unpack_size = ((chunk[1] << 8) | chunk[2]) + 1;
+			header = 3;
+		}
+		else if (control>=0x80) {
+			if (len<5) return -1;
+			unpack_size = (((control & 0x1F) << 16) | (chunk[1] << 8) | chunk[2]) + 1;
+			pack_size = ((chunk[3] << 8) | chunk[4]) + 1;
+			header = control>=0xC0 ? 6 : 5;
+		}
+		else return -1;
+
+		if (count==0 || control>=0xE0) {
+			if (count==capacity) {
+				capacity *= 2;
+				SZSegment* grown = realloc(*segments, capacity * sizeof(SZSegment));
+				if (!grown) return -1;
+				*segments = grown;
+			}
+			(*segments)[count++] = (SZSegment){pos, 0, unpack, 0};
+		}
+		pos += header + pack_size;
+		unpack += unpack_size;
+		if (pos>size) return -1;
+
+		SZSegment* segment = &(*segments)[count - 1];
+		segment->pack_size = pos - segment->pack_offset;
+		segment->unpack_size = unpack - segment->unpack_offset;
+	}
+	return count;
+}
+
+typedef struct SZJob {
+	const uint8_t* packed;
+	SZSegment* segments;
+	int first;
+	int last;
+	int next;
+	uint8_t* out; // starts at segments[first]
+	lzma_filter* filters;
+	pthread_mutex_t lock;
+	int failed;
+} SZJob;
+
+static void* SZ_segmentWorker(void* arg) {
+	SZJob* job = arg;
+	uint64_t base = job->segments[job->first].unpack_offset;
+	while (1) {
+		pthread_mutex_lock(&job->lock);
+		int i = job->next++;
+		int failed = job->failed;
+		pthread_mutex_unlock(&job->lock);
+		if (i>job->last || failed) break;
+
+		SZSegment* segment = &job->segments[i];
+		lzma_stream strm = LZMA_STREAM_INIT;
+		int ok = lzma_raw_decoder(&strm, job->filters)==LZMA_OK;
+		if (ok) {
+			strm.next_in = job->packed + segment->pack_offset;
+			strm.avail_in = segment->pack_size;
+			strm.next_out = job->out + (segment->unpack_offset - base);
+			strm.avail_out = segment->unpack_size;
+			lzma_ret ret = lzma_code(&strm, LZMA_RUN);
+			ok = (ret==LZMA_OK || ret==LZMA_STREAM_END) && strm.avail_out==0;
+			lzma_end(&strm);
+		}
+		if (!ok) {
+			pthread_mutex_lock(&job->lock);
+			job->failed = 1;
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+	return NULL;
+}
+
+// returns NULL if the folder doesn't qualify (including when the member sits
+// in a single segment, streaming that needs no copy of the packed data),
+// *failed is set if it did but decoding went wrong
+static uint8_t* SZ_decodeParallel(SevenZip* archive, SZFolder* f, uint64_t start, uint64_t end, int* failed) {
+	*failed = 0;
+	if (f->num_coders!=1 || f->coders[0].method!=SZ_METHOD_LZMA2 || f->num_packed!=1) return NULL;
+
+	SZSegment* segments = NULL;
+	int count = SZ_splitLZMA2(archive->fd, f->pack_offset, f->pack_size, &segments);
+	int first = 0;
+	int last = count - 1;
+	if (count>0) {
+		while (first<last && segments[first].unpack_offset + segments[first].unpack_size<=start) first += 1;
+		while (last>first && segments[last].unpack_offset>=end) last -= 1;
+		if (segments[last].unpack_offset + segments[last].unpack_size<end) count = -1; // stream is shorter than the headers claim
+	}
+	uint64_t pack_start = count>0 ? segments[first].pack_offset : 0;
+	uint64_t pack_size = count>0 ? segments[last].pack_offset + segments[last].pack_size - pack_start : 0;
+	if (count<0 || last==first || pack_size>SIZE_MAX / 2) {
+		if (segments) free(segments);
+		return NULL; // SZ_decodeRange reports anything broken
+	}
+
+	lzma_filter filters[2];
+	if (SZ_filters(f, filters)!=1) {
+		free(segments);
+		return NULL;
+	}
+	uint32_t dict_size = ((lzma_options_lzma*)filters[0].options)->dict_size;
+
+	// just the segments the member is in, offsets made relative to them
+	uint8_t* packed = malloc(pack_size);
+	uint8_t* out = NULL;
+	size_t read = 0;
+	while (packed && read<pack_size) {
+		ssize_t len = pread(archive->fd, packed + read, pack_size - read, f->pack_offset + pack_start + read);
+		if (len<0 && errno==EINTR) continue;
+		if (len<=0) break;
+		read += len;
+	}
+	if (!packed || read<pack_size) count = -1;
+	for (int i=first; i<=last; i++) segments[i].pack_offset -= pack_start;
+
+	if (count>0) {
+		uint64_t out_size = segments[last].unpack_offset + segments[last].unpack_size - segments[first].unpack_offset;
+		out = malloc(out_size ? out_size : 1);
+
+		int threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads>SZ_MAX_THREADS) threads = SZ_MAX_THREADS;
+		if (dict_size && threads>(int)(SZ_THREAD_MEMORY / dict_size)) threads = SZ_THREAD_MEMORY / dict_size;
+		if (threads>last - first + 1) threads = last - first + 1;
+		if (threads<1) threads = 1;
+
+		SZJob job = {packed, segments, first, last, first, out, filters, PTHREAD_MUTEX_INITIALIZER, out==NULL};
+		pthread_t workers[SZ_MAX_THREADS];
+		int started = 0;
+		for (int i=1; i<threads; i++) {
+			if (pthread_create(&workers[started], NULL, SZ_segmentWorker, &job)==0) started += 1;
+		}
+		SZ_segmentWorker(&job);
+		for (int i=0; i<started; i++) pthread_join(workers[i], NULL);
+		LOG_info("7z: decoded %i of %i segments on %i threads\n", last - first + 1, count, started + 1);
+
+		if (!job.failed) {
+			// move the member to the front, it's the only part anyone asked for
+			uint64_t skip = start - segments[first].unpack_offset;
+			memmove(out, out + skip, end - start);
+			uint8_t* shrunk = realloc(out, end - start ? end - start : 1);
+			if (shrunk) out = shrunk;
+		}
+		else {
+			free(out);
+			out = NULL;
+		}
+	}
+
+	if (!out) *failed = 1;
+	SZ_freeFilters(filters, 1);
+	if (segments) free(segments);
+	if (packed) free(packed);
+	return out;
+}
+
+typedef struct SZMemory {
+	uint8_t* data;
+	size_t size;
+} SZMemory;
+
+static int SZ_toMemory(void* userdata, const uint8_t* data, size_t size) {
+	SZMemory* memory = userdata;
+	memcpy(memory->data + memory->size, data, size);
+	memory->size += size;
+	return 1;
+}
+
+// [start, end) of a folder's output in a malloc'd buffer
+static uint8_t* SZ_decodeToMemory(SevenZip* archive, SZFolder* f, uint64_t start, uint64_t end) {
+	if (end<start || end>f->size || end - start>SIZE_MAX - 1) return NULL;
+
+	int failed;
+	uint8_t* data = SZ_decodeParallel(archive, f, start, end, &failed);
+	if (data || failed) return data;
+
+	SZMemory memory = {malloc(end - start + 1), 0};
+	if (!memory.data) return NULL;
+	if (!SZ_decodeRange(archive, f, start, end, SZ_toMemory, &memory)) {
+		free(memory.data);
+		return NULL;
+	}
+	return memory.data;
+}
+
+///////////////////////////////
+
+SevenZip* SevenZip_open(const char* path) {
+	static const uint8_t magic[6] = {'7', 'z', 0xBC, 0xAF, 0x27, 0x1C};
+
+	int fd = open(path, O_RDONLY);
+	if (fd<0) {
+		LOG_error("7z: can't open %s (%s)\n", path, strerror(errno));
+		return NULL;
+	}
+
+	uint8_t signature[SZ_SIGNATURE_SIZE];
+	SZBuffer b = {signature, SZ_SIGNATURE_SIZE, 8, 0};
+	if (pread(fd, signature, SZ_SIGNATURE_SIZE, 0)!=SZ_SIGNATURE_SIZE || memcmp(signature, magic, 6)) {
+		LOG_error("7z: %s is not a 7z archive\n", path);
+		close(fd);
+		return NULL;
+	}
+	uint32_t start_crc = SZ_uint32(&b);
+	uint64_t next_offset = SZ_uint32(&b);
+	next_offset |= (uint64_t)SZ_uint32(&b) << 32;
+	uint64_t next_size = SZ_uint32(&b);
+	next_size |= (uint64_t)SZ_uint32(&b) << 32;
+	uint32_t next_crc = SZ_uint32(&b);
+	if (lzma_crc32(signature + 12, 20, 0)!=start_crc || next_size>SZ_MAX_HEADER_SIZE) {
+		LOG_error("7z: %s has a broken signature header\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	SevenZip* archive = calloc(1, sizeof(SevenZip));
+	archive->fd = fd;
+	if (next_size==0) return archive; // empty
+
+	uint8_t* header = malloc(next_size);
+	int ok = header && pread(fd, header, next_size, SZ_SIGNATURE_SIZE + next_offset)==(ssize_t)next_size;
+	if (ok && lzma_crc32(header, next_size, 0)!=next_crc) ok = 0;
+
+	SZStreams s = {0};
+	b = (SZBuffer){header, next_size, 0, !ok};
+	int id = SZ_number(&b);
+	while (id==SZ_ENCODED_HEADER && !b.error) {
+		// the real header is packed like any other folder
+		SZ_readStreamsInfo(&b, &s);
+		if (b.error || s.num_folders<1 || s.folders[0].size>SZ_MAX_HEADER_SIZE) {
+			b.error = 1;
+			break;
+		}
+
+		SZFolder* f = &s.folders[0];
+		uint8_t* decoded = SZ_decodeToMemory(archive, f, 0, f->size);
+		if (!decoded || (f->has_crc && lzma_crc32(decoded, f->size, 0)!=f->crc)) {
+			if (decoded) free(decoded);
+			b.error = 1;
+			break;
+		}
+
+		free(header);
+		header = decoded;
+		b = (SZBuffer){header, f->size, 0, 0};
+		SZ_freeStreams(&s);
+		id = SZ_number(&b);
+	}
+	if (id!=SZ_HEADER) b.error = 1;
+	if (!b.error) SZ_readHeader(&b, archive, &s);
+
+	// folders outlive the header, everything else was only needed to map the files
+	archive->num_folders = s.num_folders;
+	archive->folders = s.folders;
+	s.folders = NULL;
+	s.num_folders = 0;
+	SZ_freeStreams(&s);
+	if (header) free(header);
+
+	if (b.error) {
+		LOG_error("7z: can't read the header of %s\n", path);
+		SevenZip_close(archive);
+		return NULL;
+	}
+	return archive;
+}
+void SevenZip_close(SevenZip* archive) {
+	if (!archive) return;
+	for (int i=0; i<archive->num_files; i++) {
+		if (archive->files[i].name) free(archive->files[i].name);
+	}
+	if (archive->files) free(archive->files);
+	SZ_freeFolders(archive->folders, archive->num_folders);
+	close(archive->fd);
+	free(archive);
+}
+
+int SevenZip_count(SevenZip* archive) {
+	return archive->num_files;
+}
+const char* SevenZip_name(SevenZip* archive, int index) {
+	if (index<0 || index>=archive->num_files || !archive->files[index].has_stream) return NULL;
+	return archive->files[index].name;
+}
+uint64_t SevenZip_size(SevenZip* archive, int index) {
+	if (index<0 || index>=archive->num_files) return 0;
+	return archive->files[index].size;
+}
+
+static SZFile* SZ_member(SevenZip* archive, int index) {
+	if (index<0 || index>=archive->num_files || !archive->files[index].has_stream) return NULL;
+	SZFile* file = &archive->files[index];
+	if (file->folder>=archive->num_folders) return NULL;
+	if (file->offset + file->size>archive->folders[file->folder].size) return NULL;
+	return file;
+}
+
+void* SevenZip_readToMemory(SevenZip* archive, int index, size_t* size) {
+	SZFile* file = SZ_member(archive, index);
+	if (!file) return NULL;
+
+	uint8_t* data = SZ_decodeToMemory(archive, &archive->folders[file->folder], file->offset, file->offset + file->size);
+	if (!data) return NULL;
+
+	if (file->has_crc && lzma_crc32(data, file->size, 0)!=file->crc) {
+		LOG_error("7z: crc mismatch in %s\n", file->name);
+		free(data);
+		return NULL;
+	}
+	*size = file->size;
+	return data;
+}
+
+typedef struct SZWriter {
+	int fd;
+	uint32_t crc;
+} SZWriter;
+
+static int SZ_toFile(void* userdata, const uint8_t* data, size_t size) {
+	SZWriter* writer = userdata;
+	writer->crc = lzma_crc32(data, size, writer->crc);
+	while (size>0) {
+		ssize_t len = write(writer->fd, data, size);
+		if (len<0) {
+			if (errno==EINTR) continue;
+			return 0;
+		}
+		data += len;
+		size -= len;
+	}
+	return 1;
+}
+
+int SevenZip_extractToFile(SevenZip* archive, int index, const char* path) {
+	SZFile* file = SZ_member(archive, index);
+	if (!file) return 0;
+
+	SZWriter writer = {open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644), 0};
+	if (writer.fd<0) {
+		LOG_error("7z: can't create %s (%s)\n", path, strerror(errno));
+		return 0;
+	}
+
+	int ok = file->size==0 || SZ_decodeRange(archive, &archive->folders[file->folder], file->offset, file->offset + file->size, SZ_toFile, &writer);
+	if (ok && file->has_crc && writer.crc!=file->crc) {
+		LOG_error("7z: crc mismatch in %s\n", file->name);
+		ok = 0;
+	}
+	if (close(writer.fd)) ok = 0;
+	return ok;
+}
@@ -0,0 +1,25 @@
+#ifndef SEVENZIP_H
+#define SEVENZIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// minimal 7z reader on top of liblzma, enough for rom archives:
+// LZMA/LZMA2 with optional branch filters (BCJ etc) and Delta,
+// solid or not, plain or compressed headers. No BCJ2, PPMd or AES.
+
+typedef struct SevenZip SevenZip;
+
+SevenZip* SevenZip_open(const char* path);
+void SevenZip_close(SevenZip* archive);
+
+int SevenZip_count(SevenZip* archive);
+const char* SevenZip_name(SevenZip* archive, int index); // utf-8, NULL for empty files and folders
+uint64_t SevenZip_size(SevenZip* archive, int index);
+
+// LZMA2 streams split by dictionary resets (7-Zip's multithreaded
+// encoder) are decoded in parallel, anything else on the calling thread
+void* SevenZip_readToMemory(SevenZip* archive, int index, size_t* size);
+int SevenZip_extractToFile(SevenZip* archive, int index, const char* path);
+
+#endif
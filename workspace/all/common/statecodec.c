@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+
+#include "statecodec.h"
+
+///////////////////////////////
+// header: "NXST", codec, version, 2 reserved, decoded size (u64 le)
+
+#define STATE_MAGIC "NXST"
+#define STATE_VERSION 1
+
+static void writeHeader(uint8_t* dst, int codec, size_t size) {
+	memcpy(dst, STATE_MAGIC, 4);
+	dst[4] = codec;
+	dst[5] = STATE_VERSION;
+	dst[6] = 0;
+	dst[7] = 0;
+	for (int i=0; i<8; i++) dst[8 + i] = (uint64_t)size >> (8 * i);
+}
+static int readHeader(const uint8_t* src, size_t size, int* codec, size_t* decoded_size) {
+	if (size<STATE_CODEC_HEADER_SIZE || memcmp(src, STATE_MAGIC, 4) || src[5]!=STATE_VERSION) return 0;
+	if (src[4]<=STATE_CODEC_NONE || src[4]>=STATE_CODEC_COUNT) return 0;
+
+	uint64_t value = 0;
+	for (int i=0; i<8; i++) value |= (uint64_t)src[8 + i] << (8 * i);
+	if (value>SIZE_MAX) return 0;
+
+	*codec = src[4];
+	*decoded_size = value;
+	return 1;
+}
+
+///////////////////////////////
+// lz4 block format, not in the toolchain so it lives here. greedy
+// single probe matching, which is what makes lz4 fast in the first place
+
+#define LZ4_HASH_LOG 14
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the spec wants the block to end in at least this many literals
+#define LZ4_MF_LIMIT 12 // and no match to start closer than this to the end
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_SKIP_TRIGGER 6 // step ahead faster through data that won't compress
+
+static uint32_t LZ4_read32(const uint8_t* p) {
+	uint32_t value;
+	memcpy(&value, p, 4);
+	return value;
+}
+static uint64_t LZ4_read64(const uint8_t* p) {
+	uint64_t value;
+	memcpy(&value, p, 8);
+	return value;
+}
+static uint32_t LZ4_hash(uint32_t value) {
+	return (value * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+static size_t LZ4_matchLength(const uint8_t* ip, const uint8_t* ref, const uint8_t* limit) {
+	size_t len = LZ4_MIN_MATCH;
+#if __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+	// 8 bytes at a time, the first differing byte is the lowest set one
+	while (ip + len + 8<=limit) {
+		uint64_t diff = LZ4_read64(ip + len) ^ LZ4_read64(ref + len);
+		if (diff) return len + (__builtin_ctzll(diff) >> 3);
+		len += 8;
+	}
+#endif
+	while (ip + len<limit && ip[len]==ref[len]) len += 1;
+	return len;
+}
+static size_t LZ4_bound(size_t size) {
+	return size + size / 255 + 16;
+}
+static int LZ4_emit(uint8_t** op, uint8_t* oend, const uint8_t* literals, size_t literal_len, size_t offset, size_t match_len) {
+	size_t need = 1 + literal_len / 255 + 1 + literal_len + 2 + match_len / 255 + 1;
+	if ((size_t)(oend - *op)<need) return 0;
+
+	uint8_t* token = (*op)++;
+	*token = (literal_len>=15 ? 15 : literal_len) << 4;
+	if (literal_len>=15) {
+		size_t len = literal_len - 15;
+		for (; len>=255; len-=255) *(*op)++ = 255;
+		*(*op)++ = len;
+	}
+	memcpy(*op, literals, literal_len);
+	*op += literal_len;
+	if (!match_len) return 1; // the last sequence is literals only
+
+	*(*op)++ = offset & 0xFF;
+	*(*op)++ = offset >> 8;
+	size_t len = match_len - LZ4_MIN_MATCH;
+	*token |= len>=15 ? 15 : len;
+	if (len>=15) {
+		len -= 15;
+		for (; len>=255; len-=255) *(*op)++ = 255;
+		*(*op)++ = len;
+	}
+	return 1;
+}
+static size_t LZ4_compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity) {
+	uint32_t* table = calloc(1 << LZ4_HASH_LOG, sizeof(uint32_t));
+	if (!table) return 0;
+
+	const uint8_t* ip = src;
+	const uint8_t* anchor = src;
+	const uint8_t* end = src + size;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + capacity;
+	int ok = 1;
+
+	if (size>LZ4_MF_LIMIT) {
+		const uint8_t* match_start_limit = end - LZ4_MF_LIMIT;
+		const uint8_t* match_end_limit = end - LZ4_LAST_LITERALS;
+		unsigned misses = 0;
+		while (ok && ip<match_start_limit) {
+			uint32_t sequence = LZ4_read32(ip);
+			uint32_t h = LZ4_hash(sequence);
+			const uint8_t* ref = src + table[h];
+			table[h] = ip - src;
+
+			if (ref>=ip || ip - ref>LZ4_MAX_OFFSET || LZ4_read32(ref)!=sequence) {
+				ip += 1 + (misses++ >> LZ4_SKIP_TRIGGER);
+				continue;
+			}
+			misses = 0;
+
+			while (ip>anchor && ref>src && ip[-1]==ref[-1]) {
+				ip -= 1;
+				ref -= 1;
+			}
+			size_t len = LZ4_matchLength(ip, ref, match_end_limit);
+
+			ok = LZ4_emit(&op, oend, anchor, ip - anchor, ip - ref, len);
+			ip += len;
+			anchor = ip;
+
+			// the position just before the match end is a cheap extra probe
+			if (ip<match_start_limit) table[LZ4_hash(LZ4_read32(ip - 2))] = ip - 2 - src;
+		}
+	}
+	if (ok) ok = LZ4_emit(&op, oend, anchor, end - anchor, 0, 0);
+
+	free(table);
+	return ok ? (size_t)(op - dst) : 0;
+}
+static size_t LZ4_decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity) {
+	const uint8_t* ip = src;
+	const uint8_t* iend = src + size;
+	uint8_t* op = dst;
+	uint8_t* oend = dst + capacity;
+
+	while (ip<iend) {
+		int token = *ip++;
+
+		size_t literal_len = token >> 4;
+		if (literal_len==15) {
+			int byte;
+			do {
+				if (ip>=iend) return 0;
+				byte = *ip++;
+				literal_len += byte;
+			} while (byte==255);
+		}
+		if (literal_len>(size_t)(iend - ip) || literal_len>(size_t)(oend - op)) return 0;
+		memcpy(op, ip, literal_len);
+		op += literal_len;
+		ip += literal_len;
+		if (ip==iend) break; // last sequence
+
+		if (iend - ip<2) return 0;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset==0 || offset>(size_t)(op - dst)) return 0;
+
+		size_t match_len = token & 0x0F;
+		if (match_len==15) {
+			int byte;
+			do {
+				if (ip>=iend) return 0;
+				byte = *ip++;
+				match_len += byte;
+			} while (byte==255);
+		}
+		match_len += LZ4_MIN_MATCH;
+		if (match_len>(size_t)(oend - op)) return 0;
+
+		const uint8_t* ref = op - offset;
+		if (offset>=match_len) memcpy(op, ref, match_len);
+		else for (size_t i=0; i<match_len; i++) op[i] = ref[i]; // overlapping, repeats the last offset bytes
+		op += match_len;
+	}
+	return op - dst;
+}
+
+///////////////////////////////
+
+const char* StateCodec_name(int codec) {
+	switch (codec) {
+		case STATE_CODEC_LZ4: return "lz4";
+		case STATE_CODEC_ZSTD: return "zstd";
+		default: return "none";
+	}
+}
+
+size_t StateCodec_bound(int codec, size_t size) {
+	switch (codec) {
+		case STATE_CODEC_LZ4: return STATE_CODEC_HEADER_SIZE + LZ4_bound(size);
+		case STATE_CODEC_ZSTD: return STATE_CODEC_HEADER_SIZE + ZSTD_compressBound(size);
+		default: return size;
+	}
+}
+size_t StateCodec_encode(int codec, const void* src, size_t size, void* dst, size_t capacity) {
+	if (codec<=STATE_CODEC_NONE || codec>=STATE_CODEC_COUNT || capacity<STATE_CODEC_HEADER_SIZE) return 0;
+
+	uint8_t* out = (uint8_t*)dst + STATE_CODEC_HEADER_SIZE;
+	capacity -= STATE_CODEC_HEADER_SIZE;
+	size_t len = 0;
+	if (codec==STATE_CODEC_LZ4) len = LZ4_compress(src, size, out, capacity);
+	else {
+		len = ZSTD_compress(out, capacity, src, size, 1);
+		if (ZSTD_isError(len)) len = 0;
+	}
+	if (!len) return 0;
+
+	writeHeader(dst, codec, size);
+	return STATE_CODEC_HEADER_SIZE + len;
+}
+
+int StateCodec_detect(const void* data, size_t size, size_t* decoded_size) {
+	int codec;
+	return readHeader(data, size, &codec, decoded_size);
+}
+int StateCodec_decode(const void* src, size_t size, void* dst, size_t capacity) {
+	int codec;
+	size_t decoded_size;
+	if (!readHeader(src, size, &codec, &decoded_size) || decoded_size>capacity) return 0;
+
+	const uint8_t* in = (const uint8_t*)src + STATE_CODEC_HEADER_SIZE;
+	size -= STATE_CODEC_HEADER_SIZE;
+	if (codec==STATE_CODEC_LZ4) return LZ4_decompress(in, size, dst, decoded_size)==decoded_size;
+
+	size_t len = ZSTD_decompress(dst, decoded_size, in, size);
+	return !ZSTD_isError(len) && len==decoded_size;
+}
@@ -0,0 +1,31 @@
+#ifndef STATECODEC_H
+#define STATECODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// savestate compression. encoded states start with a small header naming
+// their codec, so loading works no matter which format is currently picked
+
+enum {
+	STATE_CODEC_NONE,
+	STATE_CODEC_LZ4, // fast
+	STATE_CODEC_ZSTD, // level 1, balanced
+	STATE_CODEC_COUNT,
+};
+
+#define STATE_CODEC_HEADER_SIZE 16
+
+const char* StateCodec_name(int codec);
+
+// worst case encoded size, header included
+size_t StateCodec_bound(int codec, size_t size);
+// returns the encoded size, 0 on failure
+size_t StateCodec_encode(int codec, const void* src, size_t size, void* dst, size_t capacity);
+
+// returns 1 if data starts with a codec header and sets the decoded size
+int StateCodec_detect(const void* data, size_t size, size_t* decoded_size);
+// returns 1 if the whole state was decoded into dst
+int StateCodec_decode(const void* src, size_t size, void* dst, size_t capacity);
+
+#endif
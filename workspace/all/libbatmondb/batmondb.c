@@ -40,6 +40,10 @@ sqlite3* open_battery_log_db(void)
                      NULL, NULL, NULL);
     }
 
+    // the battery app reads while batmon writes, neither waits on the other
+    sqlite3_busy_timeout(bat_log_db, 1000);
+    sqlite3_exec(bat_log_db, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", NULL, NULL, NULL);
+
     return bat_log_db;
 }
 
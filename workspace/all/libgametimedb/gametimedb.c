@@ -1,6 +1,8 @@
 // heavily modified from the Onion original: https://github.com/OnionUI/Onion/blob/main/src/playActivity/playActivityDB.h
 #include <stdlib.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #include <defines.h>
@@ -14,6 +16,45 @@
 
 #define GAMETIME_LOG_PATH SHARED_USERDATA_PATH
 #define GAMETIME_LOG_FILE GAMETIME_LOG_PATH "/game_logs.sqlite"
+#define GAMETIME_BUSY_TIMEOUT 2000 // ms, gametimectl or another process may be writing too
+#define GAMETIME_SCHEMA_VERSION 1
+
+// Brings databases from before the summary table up to date, once
+static void __db_migrate(sqlite3* game_log_db)
+{
+    sqlite3_exec(game_log_db, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+
+    int version = 0;
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(game_log_db, "PRAGMA user_version;", -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+        version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    if (version < 1) {
+        // play_summary holds per rom what play_activity_find_all() used to
+        // aggregate over all of play_activity, kept up by a trigger whenever
+        // an activity is stopped
+        sqlite3_exec(game_log_db,
+                     "DROP INDEX IF EXISTS rom_id_index;" // id is the rowid already
+                     "CREATE INDEX IF NOT EXISTS rom_file_path_index ON rom(file_path);"
+                     "CREATE INDEX IF NOT EXISTS play_activity_play_time_index ON play_activity(play_time);"
+                     "CREATE TABLE IF NOT EXISTS play_summary(rom_id INTEGER PRIMARY KEY, play_count INTEGER, play_time_total INTEGER, first_played_at INTEGER, last_played_at INTEGER);"
+                     "DELETE FROM play_summary;"
+                     "INSERT INTO play_summary SELECT rom_id, COUNT(*), SUM(play_time), MIN(created_at), MAX(created_at) FROM play_activity WHERE play_time >= 0 GROUP BY rom_id;"
+                     "CREATE TRIGGER IF NOT EXISTS play_summary_on_stop AFTER UPDATE OF play_time ON play_activity "
+                     "WHEN OLD.play_time IS NULL AND NEW.play_time >= 0 BEGIN "
+                     "    INSERT OR IGNORE INTO play_summary VALUES(NEW.rom_id, 0, 0, NEW.created_at, NEW.created_at);"
+                     "    UPDATE play_summary SET play_count = play_count + 1, play_time_total = play_time_total + NEW.play_time, "
+                     "        first_played_at = MIN(first_played_at, NEW.created_at), last_played_at = MAX(last_played_at, NEW.created_at) "
+                     "    WHERE rom_id = NEW.rom_id;"
+                     "END;",
+                     NULL, NULL, NULL);
+    }
+    if (version < GAMETIME_SCHEMA_VERSION)
+        sqlite3_exec(game_log_db, "PRAGMA user_version = " STR(GAMETIME_SCHEMA_VERSION) ";", NULL, NULL, NULL);
+
+    sqlite3_exec(game_log_db, "COMMIT;", NULL, NULL, NULL);
+}
 
 sqlite3* play_activity_db_open(void)
 {
@@ -33,8 +74,7 @@ sqlite3* play_activity_db_open(void)
     if (!db_exists) {
         sqlite3_exec(game_log_db,
                      "DROP TABLE IF EXISTS rom;"
-                     "CREATE TABLE rom(id INTEGER PRIMARY KEY, type TEXT, name TEXT, file_path TEXT, image_path TEXT, created_at INTEGER DEFAULT (strftime('%s', 'now')), updated_at INTEGER);"
-                     "CREATE UNIQUE INDEX rom_id_index ON rom(id);",
+                     "CREATE TABLE rom(id INTEGER PRIMARY KEY, type TEXT, name TEXT, file_path TEXT, image_path TEXT, created_at INTEGER DEFAULT (strftime('%s', 'now')), updated_at INTEGER);",
                      NULL, NULL, NULL);
         sqlite3_exec(game_log_db,
                      "DROP TABLE IF EXISTS play_activity;"
@@ -43,13 +83,75 @@ sqlite3* play_activity_db_open(void)
                      NULL, NULL, NULL);
     }
 
+    // readers no longer block the writer, and a commit is one append to the
+    // log instead of a journal written, synced and deleted
+    sqlite3_busy_timeout(game_log_db, GAMETIME_BUSY_TIMEOUT);
+    sqlite3_exec(game_log_db, "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", NULL, NULL, NULL);
+    __db_migrate(game_log_db);
+
     return game_log_db;
 }
 
 void play_activity_db_close(sqlite3* game_log_db)
 {
+    if (!game_log_db)
+        return;
+    sqlite3_stmt *stmt;
+    while ((stmt = sqlite3_next_stmt(game_log_db, NULL)) != NULL)
+        sqlite3_finalize(stmt);
     sqlite3_close(game_log_db);
-    game_log_db = NULL;
+}
+
+// The connection the calls below share, opened once per process. The writer
+// thread has its own, a connection is only ever used by one thread.
+static sqlite3 *shared_db = NULL;
+
+static void __db_quit(void)
+{
+    play_activity_db_close(shared_db);
+    shared_db = NULL;
+}
+
+static sqlite3* __db(void)
+{
+    if (!shared_db && (shared_db = play_activity_db_open()) != NULL)
+        atexit(__db_quit);
+    return shared_db;
+}
+
+// Statements stay prepared on their connection and are found again by their
+// text, reset and ready to bind. Reset them after use rather than finalizing.
+static sqlite3_stmt* __db_statement(sqlite3* game_log_db, const char *sql)
+{
+    if (!game_log_db)
+        return NULL;
+
+    sqlite3_stmt *stmt = NULL;
+    while ((stmt = sqlite3_next_stmt(game_log_db, stmt)) != NULL) {
+        if (strcmp(sqlite3_sql(stmt), sql) == 0) {
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+            return stmt;
+        }
+    }
+    if (sqlite3_prepare_v2(game_log_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        printf("%s: %s\n", sqlite3_errmsg(game_log_db), sql);
+        sqlite3_finalize(stmt);
+        return NULL;
+    }
+    return stmt;
+}
+
+// Runs a cached statement that returns nothing or one int, fallback if it doesn't
+static int __db_step_int(sqlite3_stmt *stmt, int fallback)
+{
+    if (!stmt)
+        return fallback;
+    int value = fallback;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        value = sqlite3_column_int(stmt, 0);
+    sqlite3_reset(stmt);
+    return value;
 }
 
 void free_play_activities(PlayActivities *pa_ptr)
@@ -94,10 +196,7 @@ int play_activity_db_transaction(sqlite3* game_log_db, int (*exec_transaction)(s
 int play_activity_db_execute(char *sql)
 {
     //LOG_info("play_activity_db_execute(%s)\n", sql);
-    sqlite3* game_log_db = play_activity_db_open();
-    int rc = sqlite3_exec(game_log_db, sql, NULL, NULL, NULL);
-    play_activity_db_close(game_log_db);
-    return rc;
+    return sqlite3_exec(__db(), sql, NULL, NULL, NULL);
 }
 
 sqlite3_stmt *play_activity_db_prepare(sqlite3* game_log_db, char *sql)
@@ -116,45 +215,25 @@ sqlite3_stmt *play_activity_db_prepare(sqlite3* game_log_db, char *sql)
 
 int play_activity_get_total_play_time(void)
 {
-    int total_play_time = 0;
-    char *sql =
-        "SELECT SUM(play_time_total) FROM (SELECT SUM(play_time) AS play_time_total FROM play_activity GROUP BY rom_id) "
-        "WHERE play_time_total > 60;";
-    sqlite3_stmt *stmt;
-
-    sqlite3* game_log_db = play_activity_db_open();
-    stmt = play_activity_db_prepare(game_log_db, sql);
-
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        total_play_time = sqlite3_column_int(stmt, 0);
-    }
-
-    sqlite3_finalize(stmt);
-    play_activity_db_close(game_log_db);
-
-    return total_play_time;
+    sqlite3_stmt *stmt = __db_statement(__db(), "SELECT SUM(play_time_total) FROM play_summary WHERE play_time_total > 60;");
+    return __db_step_int(stmt, 0);
 }
 
 PlayActivities *play_activity_find_all(void)
 {
     PlayActivities *play_activities = NULL;
+    // one row per rom that has been played, however long the history
     char *sql =
-        "SELECT * FROM ("
-        "    SELECT rom.id, rom.type, rom.name, rom.file_path, "
-        "           COUNT(play_activity.ROWID) AS play_count_total, "
-        "           SUM(play_activity.play_time) AS play_time_total, "
-        "           SUM(play_activity.play_time)/COUNT(play_activity.ROWID) AS play_time_average, "
-        "           datetime(MIN(play_activity.created_at), 'unixepoch') AS first_played_at, "
-        "           datetime(MAX(play_activity.created_at), 'unixepoch') AS last_played_at "
-        "    FROM rom LEFT JOIN play_activity ON rom.id = play_activity.rom_id "
-        "    GROUP BY rom.id) "
-        "WHERE play_time_total > 0 "
-        "ORDER BY play_time_total DESC;";
-    sqlite3_stmt *stmt;
-
-    sqlite3* game_log_db = play_activity_db_open();
-
-    stmt = play_activity_db_prepare(game_log_db, sql);
+        "SELECT rom.id, rom.type, rom.name, rom.file_path, "
+        "       play_summary.play_count, "
+        "       play_summary.play_time_total, "
+        "       play_summary.play_time_total/play_summary.play_count, "
+        "       datetime(play_summary.first_played_at, 'unixepoch'), "
+        "       datetime(play_summary.last_played_at, 'unixepoch') "
+        "FROM play_summary JOIN rom ON rom.id = play_summary.rom_id "
+        "WHERE play_summary.play_time_total > 0 "
+        "ORDER BY play_summary.play_time_total DESC;";
+    sqlite3_stmt *stmt = __db_statement(__db(), sql);
 
     int play_activity_count = 0;
     while (sqlite3_step(stmt) == SQLITE_ROW) {
@@ -199,8 +278,7 @@ PlayActivities *play_activity_find_all(void)
         play_activities->play_time_total += entry->play_time_total;
     }
 
-    sqlite3_finalize(stmt);
-    play_activity_db_close(game_log_db);
+    sqlite3_reset(stmt);
 
     return play_activities;
 }
@@ -219,23 +297,20 @@ void __ensure_rel_path(char *rel_path, const char *rom_path)
 
 int __db_insert_rom(sqlite3* game_log_db, const char *rom_type, const char *rom_name, const char *file_path, const char *image_path)
 {
-    int rom_id = ROM_NOT_FOUND;
-
     char rel_path[MAX_PATH];
     __ensure_rel_path(rel_path, file_path);
 
-    char *sql = sqlite3_mprintf("INSERT INTO rom(type, name, file_path, image_path) VALUES(%Q, %Q, %Q, %Q);",
-                                rom_type, rom_name, rel_path, image_path);
-    sqlite3_exec(game_log_db, sql, NULL, NULL, NULL);
-    sqlite3_free(sql);
-
-    sqlite3_stmt *stmt = play_activity_db_prepare(game_log_db, "SELECT id FROM rom WHERE ROWID = last_insert_rowid()");
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        rom_id = sqlite3_column_int(stmt, 0);
-    }
-    sqlite3_finalize(stmt);
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "INSERT INTO rom(type, name, file_path, image_path) VALUES(?, ?, ?, ?);");
+    if (!stmt)
+        return ROM_NOT_FOUND;
+    sqlite3_bind_text(stmt, 1, rom_type, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, rom_name, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, rel_path, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 4, image_path, -1, SQLITE_TRANSIENT);
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
 
-    return rom_id;
+    return rc == SQLITE_DONE ? (int)sqlite3_last_insert_rowid(game_log_db) : ROM_NOT_FOUND;
 }
 
 void __db_update_rom(sqlite3* game_log_db, int rom_id, const char *rom_type, const char *rom_name, const char *file_path, const char *image_path)
@@ -243,52 +318,46 @@ void __db_update_rom(sqlite3* game_log_db, int rom_id, const char *rom_type, con
     char rel_path[MAX_PATH];
     __ensure_rel_path(rel_path, file_path);
 
-    char *sql = sqlite3_mprintf("UPDATE rom SET type = %Q, name = %Q, file_path = %Q, image_path = %Q WHERE id = %d;",
-                                rom_type, rom_name, rel_path, image_path, rom_id);
-    sqlite3_exec(game_log_db, sql, NULL, NULL, NULL);
-    sqlite3_free(sql);
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "UPDATE rom SET type = ?, name = ?, file_path = ?, image_path = ? WHERE id = ?;");
+    if (!stmt)
+        return;
+    sqlite3_bind_text(stmt, 1, rom_type, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, rom_name, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, rel_path, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 4, image_path, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 5, rom_id);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
 }
 
 int __db_get_orphan_rom_id(sqlite3* game_log_db, const char *rom_path)
 {
-    int rom_id = ROM_NOT_FOUND;
     char *_file_name = strdup(rom_path);
     const char *file_name = baseName(_file_name);
     char *rom_name = removeExtension(file_name);
 
-    char *sql = sqlite3_mprintf("SELECT id FROM rom WHERE (name=%Q OR name=%Q) AND type='ORPHAN' LIMIT 1;", rom_name, file_name);
-    sqlite3_stmt *stmt = play_activity_db_prepare(game_log_db, sql);
-    sqlite3_free(sql);
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "SELECT id FROM rom WHERE (name = ? OR name = ?) AND type = 'ORPHAN' LIMIT 1;");
+    if (stmt) {
+        sqlite3_bind_text(stmt, 1, rom_name, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, file_name, -1, SQLITE_TRANSIENT);
+    }
+    int rom_id = __db_step_int(stmt, ROM_NOT_FOUND);
     free(rom_name);
     free(_file_name);
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        rom_id = sqlite3_column_int(stmt, 0);
-    }
-
-    sqlite3_finalize(stmt);
-
     return rom_id;
 }
 
 int __db_get_rom_id_by_path(sqlite3* game_log_db, const char *rom_path)
 {
-    int rom_id = ROM_NOT_FOUND;
-
     char rel_path[MAX_PATH];
     __ensure_rel_path(rel_path, rom_path);
 
-    char *sql = sqlite3_mprintf("SELECT id FROM rom WHERE file_path=%Q LIMIT 1;", rel_path);
-    sqlite3_stmt *stmt = play_activity_db_prepare(game_log_db, sql);
-    sqlite3_free(sql);
-
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        rom_id = sqlite3_column_int(stmt, 0);
-    }
-
-    sqlite3_finalize(stmt);
-
-    return rom_id;
+    // rom_file_path_index
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "SELECT id FROM rom WHERE file_path = ? LIMIT 1;");
+    if (stmt)
+        sqlite3_bind_text(stmt, 1, rel_path, -1, SQLITE_TRANSIENT);
+    return __db_step_int(stmt, ROM_NOT_FOUND);
 }
 
 int __db_rom_find_by_file_path(sqlite3* game_log_db, const char *rom_path, bool create_or_update)
@@ -321,29 +390,20 @@ int __db_rom_find_by_file_path(sqlite3* game_log_db, const char *rom_path, bool
 
 int play_activity_transaction_rom_find_by_file_path(const char *rom_path, bool create_or_update)
 {
-    int retval;
-    sqlite3* game_log_db = play_activity_db_open();
-    retval = __db_rom_find_by_file_path(game_log_db, rom_path, create_or_update);
-    play_activity_db_close(game_log_db);
-    return retval;
+    return __db_rom_find_by_file_path(__db(), rom_path, create_or_update);
 }
 
 int play_activity_get_play_time(const char *rom_path)
 {
-    int play_time = 0;
-    sqlite3* game_log_db = play_activity_db_open();
+    sqlite3* game_log_db = __db();
     int rom_id = __db_rom_find_by_file_path(game_log_db, rom_path, false);
-    if (rom_id != ROM_NOT_FOUND) {
-        char *sql = sqlite3_mprintf("SELECT SUM(play_time) FROM play_activity WHERE rom_id = %d;", rom_id);
-        sqlite3_stmt *stmt = play_activity_db_prepare(game_log_db, sql);
-        sqlite3_free(sql);
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            play_time = sqlite3_column_int(stmt, 0);
-        }
-        sqlite3_finalize(stmt);
-    }
-    play_activity_db_close(game_log_db);
-    return play_time;
+    if (rom_id == ROM_NOT_FOUND)
+        return 0;
+
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "SELECT play_time_total FROM play_summary WHERE rom_id = ?;");
+    if (stmt)
+        sqlite3_bind_int(stmt, 1, rom_id);
+    return __db_step_int(stmt, 0);
 }
 
 bool _get_active_rom_path(char *rom_path_out)
@@ -383,65 +443,235 @@ int __db_get_active_closed_activity(sqlite3* game_log_db)
         return ROM_NOT_FOUND;
     }
 
-    char *sql = sqlite3_mprintf("SELECT * FROM play_activity WHERE rom_id = %d AND play_time IS NULL;", rom_id);
-    sqlite3_stmt *stmt = play_activity_db_prepare(game_log_db, sql);
-
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "SELECT 1 FROM play_activity WHERE rom_id = ? AND play_time IS NULL LIMIT 1;");
+    if (stmt)
+        sqlite3_bind_int(stmt, 1, rom_id);
+    if (__db_step_int(stmt, 0)) {
         // Activity is not closed
         rom_id = ROM_NOT_FOUND;
     }
 
-    sqlite3_free(sql);
-    sqlite3_finalize(stmt);
+    return rom_id;
+}
 
+// The times are passed in rather than taken from sqlite's 'now', so a write
+// that waited in the queue (or through a sleep) still records when it happened
+
+static int __db_insert_activity(sqlite3* game_log_db, int rom_id, time_t at)
+{
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "INSERT INTO play_activity(rom_id, created_at) VALUES(?, ?);");
+    if (!stmt)
+        return ROM_NOT_FOUND;
+    sqlite3_bind_int(stmt, 1, rom_id);
+    sqlite3_bind_int64(stmt, 2, at);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
     return rom_id;
 }
 
+int __db_start(sqlite3* game_log_db, const char *rom_file_path, time_t at)
+{
+    int rom_id = __db_rom_find_by_file_path(game_log_db, rom_file_path, true);
+    if (rom_id == ROM_NOT_FOUND) {
+        return ROM_NOT_FOUND;
+    }
+    return __db_insert_activity(game_log_db, rom_id, at);
+}
+
+int __db_resume(sqlite3* game_log_db, time_t at)
+{
+    int rom_id = __db_get_active_closed_activity(game_log_db);
+    if (rom_id == ROM_NOT_FOUND) {
+        return ROM_NOT_FOUND;
+    }
+    return __db_insert_activity(game_log_db, rom_id, at);
+}
+
+void __db_stop_all(sqlite3* game_log_db, time_t at)
+{
+    // play_activity_play_time_index, the trigger adds each to play_summary
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "UPDATE play_activity SET play_time = ?1 - created_at, updated_at = ?1 WHERE play_time IS NULL;");
+    if (stmt) {
+        sqlite3_bind_int64(stmt, 1, at);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    stmt = __db_statement(game_log_db, "DELETE FROM play_activity WHERE play_time < 0;");
+    if (stmt) {
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+}
+
 void play_activity_start(char *rom_file_path)
 {
     //LOG_info("\n:: play_activity_start(%s)\n", rom_file_path);
-    int rom_id = play_activity_transaction_rom_find_by_file_path(rom_file_path, true);
-    if (rom_id == ROM_NOT_FOUND) {
+    if (__db_start(__db(), rom_file_path, time(NULL)) == ROM_NOT_FOUND) {
         exit(1);
     }
-    char *sql = sqlite3_mprintf("INSERT INTO play_activity(rom_id) VALUES(%d);", rom_id);
-    play_activity_db_execute(sql);
-    sqlite3_free(sql);
 }
 
 void play_activity_resume(void)
 {
     //LOG_info("\n:: play_activity_resume()");
-    sqlite3* game_log_db = play_activity_db_open();
-    int rom_id = play_activity_db_transaction(game_log_db, __db_get_active_closed_activity);
-    play_activity_db_close(game_log_db);
-    if (rom_id == ROM_NOT_FOUND) {
+    if (__db_resume(__db(), time(NULL)) == ROM_NOT_FOUND) {
         printf("Error: no active rom\n");
         exit(1);
     }
-    char *sql = sqlite3_mprintf("INSERT INTO play_activity(rom_id) VALUES(%d);", rom_id);
-    play_activity_db_execute(sql);
-    sqlite3_free(sql);
 }
 
 void play_activity_stop(char *rom_file_path)
 {
     //LOG_info("\n:: play_activity_stop(%s)\n", rom_file_path);
-    int rom_id = play_activity_transaction_rom_find_by_file_path(rom_file_path, false);
+    sqlite3* game_log_db = __db();
+    int rom_id = __db_rom_find_by_file_path(game_log_db, rom_file_path, false);
     if (rom_id == ROM_NOT_FOUND) {
         exit(1);
     }
-    char *sql = sqlite3_mprintf("UPDATE play_activity SET play_time = (strftime('%%s', 'now')) - created_at, updated_at = (strftime('%%s', 'now')) WHERE rom_id = %d AND play_time IS NULL;", rom_id);
-    play_activity_db_execute(sql);
-    sqlite3_free(sql);
+    sqlite3_stmt *stmt = __db_statement(game_log_db, "UPDATE play_activity SET play_time = ?1 - created_at, updated_at = ?1 WHERE rom_id = ?2 AND play_time IS NULL;");
+    if (stmt) {
+        sqlite3_bind_int64(stmt, 1, time(NULL));
+        sqlite3_bind_int(stmt, 2, rom_id);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
 }
 
 void play_activity_stop_all(void)
 {
     //LOG_info("\n:: play_activity_stop_all()");
-    play_activity_db_execute(
-        "UPDATE play_activity SET play_time = (strftime('%s', 'now')) - created_at, updated_at = (strftime('%s', 'now')) WHERE play_time IS NULL;"
-        "DELETE FROM play_activity WHERE play_time < 0;");
+    __db_stop_all(__db(), time(NULL));
+}
+
+///////////////////////////////
+// In-process writes, queued to one thread that keeps the database open
+
+#define GAMETIME_QUEUE_SIZE 16
+
+enum {
+    GAMETIME_JOB_START,
+    GAMETIME_JOB_STOP_ALL,
+    GAMETIME_JOB_RESUME,
+};
+
+typedef struct {
+    int type;
+    time_t at;
+    char rom_path[MAX_PATH];
+} GametimeJob;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running;
+    bool quitting;
+    GametimeJob jobs[GAMETIME_QUEUE_SIZE];
+    int head;
+    int count;
+} writer = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static void *gametime_writer(void *arg)
+{
+    sqlite3* game_log_db = play_activity_db_open();
+
+    pthread_mutex_lock(&writer.mutex);
+    while (1) {
+        while (!writer.count && !writer.quitting)
+            pthread_cond_wait(&writer.cond, &writer.mutex);
+        if (!writer.count)
+            break;
+
+        GametimeJob job = writer.jobs[writer.head];
+        pthread_mutex_unlock(&writer.mutex);
+
+        if (!game_log_db) {
+            printf("gametime: database unavailable, dropping update\n");
+        }
+        else if (job.type == GAMETIME_JOB_START) {
+            if (__db_start(game_log_db, job.rom_path, job.at) == ROM_NOT_FOUND)
+                printf("gametime: unable to track %s\n", job.rom_path);
+        }
+        else if (job.type == GAMETIME_JOB_RESUME) {
+            __db_resume(game_log_db, job.at); // nothing to resume is fine
+        }
+        else {
+            __db_stop_all(game_log_db, job.at);
+        }
+
+        // only dequeued once written, so gametime_quit() waits for it
+        pthread_mutex_lock(&writer.mutex);
+        writer.head = (writer.head + 1) % GAMETIME_QUEUE_SIZE;
+        writer.count--;
+        pthread_cond_broadcast(&writer.cond);
+    }
+    pthread_mutex_unlock(&writer.mutex);
+
+    if (game_log_db)
+        play_activity_db_close(game_log_db);
+    return NULL;
+}
+
+static void gametime_queue(int type, const char *rom_path)
+{
+    static bool registered = false;
+    pthread_mutex_lock(&writer.mutex);
+    if (!writer.running) {
+        if (pthread_create(&writer.thread, NULL, gametime_writer, NULL) != 0) {
+            pthread_mutex_unlock(&writer.mutex);
+            printf("gametime: unable to start writer thread\n");
+            return;
+        }
+        writer.running = true;
+        if (!registered) {
+            registered = true;
+            atexit(gametime_quit); // so nothing queued is lost on the way out
+        }
+    }
+    while (writer.count == GAMETIME_QUEUE_SIZE)
+        pthread_cond_wait(&writer.cond, &writer.mutex);
+
+    GametimeJob *job = &writer.jobs[(writer.head + writer.count) % GAMETIME_QUEUE_SIZE];
+    job->type = type;
+    job->at = time(NULL);
+    snprintf(job->rom_path, sizeof(job->rom_path), "%s", rom_path ? rom_path : "");
+    writer.count++;
+    pthread_cond_broadcast(&writer.cond);
+    pthread_mutex_unlock(&writer.mutex);
+}
+
+void gametime_start(const char *rom_path)
+{
+    gametime_queue(GAMETIME_JOB_START, rom_path);
+}
+
+void gametime_stop_all(void)
+{
+    gametime_queue(GAMETIME_JOB_STOP_ALL, NULL);
+}
+
+void gametime_resume(void)
+{
+    gametime_queue(GAMETIME_JOB_RESUME, NULL);
+}
+
+void gametime_quit(void)
+{
+    pthread_mutex_lock(&writer.mutex);
+    if (!writer.running) {
+        pthread_mutex_unlock(&writer.mutex);
+        return;
+    }
+    writer.quitting = true;
+    pthread_cond_broadcast(&writer.cond);
+    pthread_mutex_unlock(&writer.mutex);
+
+    pthread_join(writer.thread, NULL);
+
+    pthread_mutex_lock(&writer.mutex);
+    writer.running = false;
+    writer.quitting = false;
+    pthread_mutex_unlock(&writer.mutex);
 }
 
 void play_activity_list_all(void)
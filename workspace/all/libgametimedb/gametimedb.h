@@ -42,4 +42,13 @@ void play_activity_stop(char *rom_file_path);
 void play_activity_stop_all(void);
 void play_activity_list_all(void);
 
+// In-process interface, updates are queued to a background thread with its
+// own connection so launching and sleeping never wait on the database. The
+// thread starts with the first call, gametime_quit() (also run at exit)
+// writes out what's queued and stops it.
+void gametime_start(const char *rom_path);
+void gametime_stop_all(void);
+void gametime_resume(void);
+void gametime_quit(void);
+
 #endif // __gametime_db_h__
\ No newline at end of file
@@ -0,0 +1,141 @@
+// measures what getting a rom into memory costs raw, from a zip and from a 7z,
+// the part of a launch that depends on how the rom is stored, eg.
+// archivebench.elf game.sfc game.zip game.7z
+// cold runs drop the file from the page cache first, like the first launch after boot
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <zip.h>
+
+#include "sevenzip.h"
+
+#define BENCH_RUNS 5
+
+// sevenzip.c logs through api.c, which a bench doesn't need the rest of,
+// only warnings and errors (api.h's LOG_WARN and up), the rest would bury the numbers
+void LOG_note(int level, const char* fmt, ...) {
+	if (level<2) return;
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int suffix(const char* path, const char* ext) {
+	size_t len = strlen(path);
+	size_t ext_len = strlen(ext);
+	return len>=ext_len && strcasecmp(path + len - ext_len, ext)==0;
+}
+
+static void dropCache(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd<0) return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+// the same ways minarch's Game_open and extract_zip/extract_7z read them
+static void* readRaw(const char* path, size_t* size) {
+	int fd = open(path, O_RDONLY);
+	if (fd<0) return NULL;
+	off_t len = lseek(fd, 0, SEEK_END);
+	uint8_t* data = len>=0 ? malloc(len ? len : 1) : NULL;
+	size_t sum = 0;
+	while (data && sum<(size_t)len) {
+		ssize_t read = pread(fd, data + sum, len - sum, sum);
+		if (read<=0) break;
+		sum += read;
+	}
+	close(fd);
+	if (!data || sum!=(size_t)len) {
+		free(data);
+		return NULL;
+	}
+	*size = len;
+	return data;
+}
+static void* readZip(const char* path, size_t* size) {
+	int err;
+	zip_t* za = zip_open(path, ZIP_RDONLY, &err);
+	if (!za) return NULL;
+	uint8_t* data = NULL;
+	zip_stat_t st;
+	if (zip_get_num_entries(za, 0)>0 && zip_stat_index(za, 0, 0, &st)==0) {
+		zip_file_t* zf = zip_fopen_index(za, 0, 0);
+		data = zf ? malloc(st.size ? st.size : 1) : NULL;
+		zip_uint64_t sum = 0;
+		while (data && sum<st.size) {
+			zip_int64_t len = zip_fread(zf, data + sum, st.size - sum);
+			if (len<=0) break;
+			sum += len;
+		}
+		if (data && sum!=st.size) {
+			free(data);
+			data = NULL;
+		}
+		if (zf) zip_fclose(zf);
+		*size = st.size;
+	}
+	zip_close(za);
+	return data;
+}
+static void* read7z(const char* path, size_t* size) {
+	SevenZip* archive = SevenZip_open(path);
+	if (!archive) return NULL;
+	void* data = NULL;
+	for (int i=0; i<SevenZip_count(archive) && !data; i++) {
+		if (SevenZip_name(archive, i)) data = SevenZip_readToMemory(archive, i, size);
+	}
+	SevenZip_close(archive);
+	return data;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc<2) {
+		fprintf(stderr, "usage: %s rom|zip|7z...\n", argv[0]);
+		return 1;
+	}
+
+	for (int i=1; i<argc; i++) {
+		const char* path = argv[i];
+		void* (*load)(const char*, size_t*) = suffix(path, ".zip") ? readZip : suffix(path, ".7z") ? read7z : readRaw;
+
+		double cold = 0;
+		double warm = 0;
+		size_t size = 0;
+		int ok = 1;
+		for (int run=0; run<BENCH_RUNS && ok; run++) {
+			dropCache(path);
+			double start = now();
+			void* data = load(path, &size);
+			cold += now() - start;
+			ok = data!=NULL;
+			free(data);
+
+			start = now();
+			data = load(path, &size);
+			warm += now() - start;
+			ok = ok && data!=NULL;
+			free(data);
+		}
+		if (!ok) {
+			fprintf(stderr, "can't load %s\n", path);
+			continue;
+		}
+		printf("%-40s %9zu bytes  cold %7.1f ms  warm %7.1f ms\n", path, size, cold / BENCH_RUNS * 1000, warm / BENCH_RUNS * 1000);
+	}
+	return 0;
+}
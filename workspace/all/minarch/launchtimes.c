@@ -0,0 +1,194 @@
+// time to first frame of every launch in a trace, eg.
+// launchtimes.elf /mnt/SDCARD/.userdata/tg5040/logs/trace.json
+// from nextui queueing the game (or launching it resident) to the end of
+// minarch's first frame, with the startup spans readahead is meant to shorten.
+// Launch the same games with and without SHARED_USERDATA_PATH/disable-prefetch
+// (touch enable-trace first), the summary compares the two. The options column
+// is the time minarch spent looking up core options and cfg keys until then
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_PROCESSES 256
+#define NAME_MAX_LEN 32
+
+typedef struct Event {
+	char name[NAME_MAX_LEN];
+	char phase;
+	uint64_t ts; // us
+	int pid;
+	int64_t value;
+	int order; // in the file, a span's counter and end can share a timestamp
+} Event;
+
+static struct {
+	int pid;
+	char name[NAME_MAX_LEN];
+} processes[MAX_PROCESSES];
+static int process_count;
+
+static Event* events;
+static int event_count;
+
+// api.c's TRACE_flush writes one event per line, that's all this reads
+static int field(const char* line, const char* key, char* out, int size) {
+	char pattern[32];
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+	const char* at = strstr(line, pattern);
+	if (!at) return 0;
+	at += strlen(pattern);
+	if (*at=='"') {
+		at += 1;
+		int i = 0;
+		while (at[i] && at[i]!='"' && i<size-1) {
+			out[i] = at[i];
+			i += 1;
+		}
+		out[i] = '\0';
+	}
+	else snprintf(out, size, "%.*s", (int)strcspn(at, ",}"), at);
+	return 1;
+}
+
+static int load(const char* path) {
+	FILE* file = fopen(path, "r");
+	if (!file) return 0;
+
+	int capacity = 0;
+	char line[512];
+	while (fgets(line, sizeof(line), file)) {
+		char name[NAME_MAX_LEN];
+		char phase[4];
+		char value[32];
+		if (!field(line, "name", name, sizeof(name)) || !field(line, "ph", phase, sizeof(phase)) || !field(line, "pid", value, sizeof(value))) continue;
+		int pid = atoi(value);
+
+		if (phase[0]=='M') {
+			// the process name is in args, after the event's own name
+			const char* args = strstr(line, "\"args\"");
+			if (args && process_count<MAX_PROCESSES && field(args, "name", name, sizeof(name))) {
+				processes[process_count].pid = pid;
+				strcpy(processes[process_count].name, name);
+				process_count += 1;
+			}
+			continue;
+		}
+
+		if (event_count==capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			events = realloc(events, capacity * sizeof(Event));
+			if (!events) return 0;
+		}
+		Event* event = &events[event_count++];
+		strcpy(event->name, name);
+		event->phase = phase[0];
+		event->pid = pid;
+		event->ts = field(line, "ts", value, sizeof(value)) ? strtoull(value, NULL, 10) : 0;
+		event->value = field(line, "value", value, sizeof(value)) ? atoll(value) : 0;
+		event->order = event_count;
+	}
+	fclose(file);
+	return 1;
+}
+
+static const char* processName(int pid) {
+	// pids get reused, the last process to claim one wins
+	for (int i=process_count-1; i>=0; i--) {
+		if (processes[i].pid==pid) return processes[i].name;
+	}
+	return "";
+}
+
+// processes flush whenever they get to it, put them back on one timeline
+static int byTime(const void* a, const void* b) {
+	const Event* x = a;
+	const Event* y = b;
+	if (x->ts!=y->ts) return x->ts<y->ts ? -1 : 1;
+	return x->order - y->order;
+}
+
+// first event of pid after index from with this name and phase, -1 if none
+static int find(int from, int pid, const char* name, char phase) {
+	for (int i=from; i<event_count; i++) {
+		if (events[i].pid==pid && events[i].phase==phase && !strcmp(events[i].name, name)) return i;
+	}
+	return -1;
+}
+static double span(int from, int pid, const char* name) {
+	int begin = find(from, pid, name, 'B');
+	int end = begin>=0 ? find(begin, pid, name, 'E') : -1;
+	return end>=0 ? (events[end].ts - events[begin].ts) / 1000.0 : -1;
+}
+
+typedef struct Summary {
+	int count;
+	double total;
+} Summary;
+
+int main(int argc, char* argv[]) {
+	if (argc<2) {
+		fprintf(stderr, "usage: %s trace.json\n", argv[0]);
+		return 1;
+	}
+	if (!load(argv[1])) {
+		fprintf(stderr, "can't read %s\n", argv[1]);
+		return 1;
+	}
+	qsort(events, event_count, sizeof(Event), byTime);
+
+	Summary with = {0};
+	Summary without = {0};
+	printf("%-16s %9s %9s %9s %9s %9s %s\n", "launch", "ttff ms", "core ms", "rom ms", "state ms", "opts ms", "prefetched");
+	for (int i=0; i<event_count; i++) {
+		Event* launch = &events[i];
+		if (launch->phase!='i' || (strcmp(launch->name, "queueNext") && strcmp(launch->name, "resident launch"))) continue;
+
+		// the first minarch to start after it
+		int start = -1;
+		for (int j=i+1; j<event_count && start<0; j++) {
+			if (events[j].phase=='B' && !strcmp(events[j].name, "startup") && !strcmp(processName(events[j].pid), "minarch")) start = j;
+		}
+		if (start<0) continue; // a pak, or minarch didn't flush
+		int pid = events[start].pid;
+		int first_frame = find(start, pid, "first frame", 'E');
+		if (first_frame<0) continue;
+
+		// what the launcher's readahead got through for this selection, if it
+		// ran. One still reading at launch, or cancelled, didn't finish
+		int prefetch = -1;
+		int prefetch_done = 0;
+		int64_t prefetched = 0;
+		for (int j=i-1; j>=0 && prefetch<0; j--) {
+			if (events[j].pid==launch->pid && !strcmp(events[j].name, "prefetch") && events[j].phase!='C') {
+				prefetch = j;
+				prefetch_done = events[j].phase=='E';
+			}
+		}
+		for (int j=prefetch-1; prefetch_done && j>=0; j--) {
+			if (events[j].pid!=launch->pid) continue;
+			if (events[j].phase=='B' && !strcmp(events[j].name, "prefetch")) break;
+			if (events[j].phase=='C' && !strcmp(events[j].name, "prefetch bytes")) prefetched = events[j].value;
+			else if (events[j].phase=='i' && !strcmp(events[j].name, "prefetch cancelled")) prefetch_done = 0;
+		}
+
+		double ttff = (events[first_frame].ts - launch->ts) / 1000.0;
+		int lookups = find(start, pid, "option lookup us", 'C');
+		double options = lookups>=0 && lookups<first_frame ? events[lookups].value / 1000.0 : -1;
+		char note[32];
+		if (prefetch<0) strcpy(note, "no");
+		else if (!prefetch_done) strcpy(note, "cut short");
+		else snprintf(note, sizeof(note), "%lli KB", (long long)prefetched / 1024);
+		printf("%-16s %9.1f %9.1f %9.1f %9.1f %9.2f %s\n", launch->name, ttff, span(start, pid, "Core_open"), span(start, pid, "Game_open"), span(start, pid, "State_resume"), options, note);
+
+		Summary* summary = prefetch_done ? &with : &without;
+		summary->count += 1;
+		summary->total += ttff;
+	}
+
+	printf("\nwith readahead    %3i launches, mean ttff %7.1f ms\n", with.count, with.count ? with.total / with.count : 0);
+	printf("without readahead %3i launches, mean ttff %7.1f ms\n", without.count, without.count ? without.total / without.count : 0);
+	free(events);
+	return 0;
+}
@@ -9,10 +9,12 @@
 #include <libgen.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <zip.h> 
 #include <pthread.h>
 #include <glob.h>
+#include <zlib.h>
 
 // libretro-common
 #include "libretro.h"
@@ -27,6 +29,8 @@
 #include "scaler.h"
 #include "i18n.h"
 #include "netplay.h"
+#include "sevenzip.h"
+#include "statecodec.h"
 #include <dirent.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL.h>
@@ -45,7 +49,10 @@ enum retro_pixel_format fmt;
 // Netplay
 static netplay_context_t netplay_ctx;
 static int netplay_enabled = 0;
+static int netplay_guest = 0; // played the host's game, so the local saves are off limits until quit
 static int netplay_show_devices = 0;
+static int netplay_resimulating = 0; // rolling back, keep it off screen and out of the speakers
+static uint64_t netplay_present_time = 0; // us the current frame spent presenting rather than emulating
 static netplay_device_t discovered_devices[16];
 static int discovered_device_count = 0;
 
@@ -80,6 +87,8 @@ static int max_ff_speed = 3; // 4x
 static int ff_audio = 0;
 static int fast_forward = 0;
 static int overclock = 3; // auto
+static uint64_t frame_wait_time = 0; // us the current frame spent blocked on vsync or a full audio buffer
+static int frames_timed = 0;
 static int has_custom_controllers = 0;
 static int gamepad_type = 0; // index in gamepad_labels/gamepad_values
 static int downsample = 0; // set to 1 to convert from 8888 to 565
@@ -139,6 +148,7 @@ static struct Core {
 } core;
 
 int extract_zip(char** extensions);
+int extract_7z(char** extensions);
 static bool getAlias(char* path, char* alias);
 
 static struct Game {
@@ -146,40 +156,28 @@ static struct Game {
 	char name[MAX_PATH]; // TODO: rename to basename?
 	char alt_name[MAX_PATH]; // alternate name, eg. unzipped rom file name
 	char m3u_path[MAX_PATH];
-	char tmp_path[MAX_PATH]; // location of unzipped file
+	char tmp_path[MAX_PATH]; // location of unzipped file, empty if it went straight to memory
+	char member[MAX_PATH]; // file name of the rom inside the archive, if any
 	void* data;
 	size_t size;
+	int is_mapped; // data is an mmap of the rom rather than a heap copy
 	int is_open;
 } game;
 static void Game_open(char* path) {
 	LOG_info("Game_open\n");
-	int skipzip = 0;
 	memset(&game, 0, sizeof(game));
 	
 	strcpy((char*)game.path, path);
 	strcpy((char*)game.name, strrchr(path, '/')+1);
 	strcpy((char*)game.alt_name, game.name); // default it
 
-	// check first if the rom already is alive in tmp folder if so skip unzipping shit
-	char tmpfldr[255];
-	snprintf(tmpfldr, sizeof(tmpfldr), "/tmp/nextarch/%s", core.tag);
-	char *tmppath = PLAT_findFileInDir(tmpfldr, game.name);
-	if (tmppath) {
-		printf("File exists skipping unzipping and setting game.tmp_path: %s\n", tmppath);
-		strcpy((char*)game.tmp_path, tmppath);
-		skipzip = 1;
-		free(tmppath);
-		// Update the game name to the extracted file name instead of the zip name
-		if (CFG_getUseExtractedFileName())
-			strcpy((char*)game.alt_name, strrchr(game.tmp_path, '/')+1);
-	} else {
-		printf("File does not exist in %s\n",tmpfldr);
-	}
-		
-	// if we have a zip file
-	if (suffixMatch(".zip", game.path) && !skipzip) {
-		LOG_info("is zip file\n");
-		int supports_zip = 0;
+	// if we have a zip or 7z file
+	char* archive = NULL;
+	if (suffixMatch(".zip", game.path)) archive = "zip";
+	else if (suffixMatch(".7z", game.path)) archive = "7z";
+	if (archive) {
+		LOG_info("is %s file\n", archive);
+		int supports_archive = 0;
 		int i = 0;
 		char* ext;
 		char exts[128];
@@ -187,53 +185,83 @@ static void Game_open(char* path) {
 		strcpy(exts,core.extensions);
 		while ((ext=strtok(i?NULL:exts,"|"))) {
 			extensions[i++] = ext;
-			if (!strcmp("zip", ext)) {
-				supports_zip = 1;
+			if (!strcmp(archive, ext)) {
+				supports_archive = 1;
 				break;
 			}
 		}
 		extensions[i] = NULL;
 	
-		// if the core doesn't support zip files natively
-		if (!supports_zip) {
-			// extract zip file located at game.path to game.tmp_path
-			// game.tmp_path is temp dir generated by mkdtemp
-			LOG_info("Extracting zip file manually: %s\n", game.path);
-			if(!extract_zip(extensions))
+		// if the core doesn't support the archive natively
+		if (!supports_archive) {
+			// either loads the rom straight into game.data or
+			// extracts it to game.tmp_path for need_fullpath cores
+			LOG_info("Extracting %s file manually: %s\n", archive, game.path);
+			int ok = exactMatch(archive, "zip") ? extract_zip(extensions) : extract_7z(extensions);
+			if (!ok)
 				return;
-			// Update the game name to the extracted file name instead of the zip name
-			if (CFG_getUseExtractedFileName())
-				strcpy((char*)game.alt_name, strrchr(game.tmp_path, '/')+1);
 		}
 		else {
-			LOG_info("Core can handle zip file: %s\n", game.path);
+			LOG_info("Core can handle %s file: %s\n", archive, game.path);
 		}
 	}
 		
 	// some cores handle opening files themselves, eg. pcsx_rearmed
 	// if the frontend tries to load a 500MB file itself bad things happen
-	if (!core.need_fullpath) {
+	if (!core.need_fullpath && !game.data) {
 		path = game.tmp_path[0]=='\0'?game.path:game.tmp_path;
 
-		FILE *file = fopen(path, "r");
-		if (file==NULL) {
+		int fd = open(path, O_RDONLY);
+		if (fd<0) {
 			LOG_error("Error opening game: %s\n\t%s\n", path, strerror(errno));
 			return;
 		}
-	
-		fseek(file, 0, SEEK_END);
-		game.size = ftell(file);
-	
-		rewind(file);
-		game.data = malloc(game.size);
-		if (game.data==NULL) {
-			LOG_error("Couldn't allocate memory for file: %s\n", path);
-			return;
+
+		struct stat st;
+		fstat(fd, &st);
+		game.size = st.st_size;
+
+		// map the rom instead of copying it, pages are shared with the page cache
+		// and faulted in as the core touches them. private and writable so a core
+		// that pokes at its "const" rom gets its own copy of that page, not a crash
+		if (game.size) {
+			void* data = mmap(NULL, game.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (data!=MAP_FAILED) {
+				madvise(data, game.size, MADV_SEQUENTIAL);
+				madvise(data, game.size, MADV_WILLNEED);
+				game.data = data;
+				game.is_mapped = 1;
+			}
 		}
-	
-		fread(game.data, sizeof(uint8_t), game.size, file);
-	
-		fclose(file);
+
+		if (!game.data) {
+			game.data = malloc(game.size ? game.size : 1);
+			if (game.data==NULL) {
+				LOG_error("Couldn't allocate memory for file: %s\n", path);
+				close(fd);
+				return;
+			}
+
+			size_t sum = 0;
+			int err = 0;
+			while (sum<game.size) {
+				ssize_t len = read(fd, (uint8_t*)game.data + sum, game.size - sum);
+				if (len<0 && errno==EINTR) continue;
+				if (len<0) err = errno;
+				if (len<=0) break;
+				sum += len;
+			}
+			if (sum!=game.size) {
+				// a truncated rom boots into garbage or crashes the core later
+				LOG_error("Error reading game: %s\n\tread %zu of %zu bytes: %s\n", path, sum, (size_t)game.size, err ? strerror(err) : "unexpected end of file");
+				free(game.data);
+				game.data = NULL;
+				game.size = 0;
+				close(fd);
+				return;
+			}
+		}
+		close(fd);
 	}
 	
 	// m3u-based?
@@ -269,7 +297,8 @@ static void Game_open(char* path) {
 	game.is_open = 1;
 }
 static void Game_close(void) {
-	if (game.data) free(game.data);
+	if (game.is_mapped) munmap(game.data, game.size);
+	else if (game.data) free(game.data);
 	// why delete tempfile? keep it for next time when loading the game its much faster from /tmp ram folder
 	// if (game.tmp_path[0]) remove(game.tmp_path);
 	game.is_open = 0;
@@ -293,9 +322,151 @@ static void Game_changeDisc(char* path) {
 	putFile(CHANGE_DISC_PATH, path); // NextUI still needs to know this to update recents.txt
 }
 
+// an archive is extracted to /tmp/nextarch/<tag>/<archive name>/ next to a stamp
+// of its mtime and size, so a replaced archive never gets a stale extraction
+#define ZIP_CACHE_PATH "/tmp/nextarch"
+#define ZIP_STAMP_NAME ".source"
+#define ZIP_BUFFER_SIZE (256 * 1024)
+
+static void Zip_clearCache(char* cache_dir) {
+	DIR* dh = opendir(cache_dir);
+	if (!dh) return;
+	struct dirent* dp;
+	char path[MAX_PATH];
+	while ((dp = readdir(dh))) {
+		if (exactMatch(dp->d_name, ".") || exactMatch(dp->d_name, "..")) continue;
+		snprintf(path, sizeof(path), "%s/%s", cache_dir, dp->d_name);
+		unlink(path);
+	}
+	closedir(dh);
+}
+static void Zip_setMember(const char* name) {
+	snprintf(game.member, sizeof(game.member), "%s", name);
+	// saves and states go by the rom's own name instead of the archive's, if asked to
+	if (CFG_getUseExtractedFileName()) strcpy(game.alt_name, game.member);
+}
+static int Zip_findCached(char* cache_dir, struct stat* st) {
+	char stamp_path[MAX_PATH];
+	snprintf(stamp_path, sizeof(stamp_path), "%s/" ZIP_STAMP_NAME, cache_dir);
+
+	long long mtime, size;
+	FILE* file = fopen(stamp_path, "r");
+	if (!file) return 0;
+	int valid = fscanf(file, "%lld %lld", &mtime, &size)==2 && mtime==(long long)st->st_mtime && size==(long long)st->st_size;
+	fclose(file);
+	if (!valid) {
+		LOG_info("stale extraction of %s, discarding\n", game.path);
+		Zip_clearCache(cache_dir);
+		return 0;
+	}
+
+	DIR* dh = opendir(cache_dir);
+	if (!dh) return 0;
+	struct dirent* dp;
+	int found = 0;
+	while (!found && (dp = readdir(dh))) {
+		if (dp->d_name[0]=='.' || suffixMatch(".part", dp->d_name)) continue;
+		snprintf(game.tmp_path, sizeof(game.tmp_path), "%s/%s", cache_dir, dp->d_name);
+		Zip_setMember(dp->d_name);
+		found = 1;
+	}
+	closedir(dh);
+	return found;
+}
+static int Zip_readToMemory(struct zip_file* zf, zip_uint64_t size) {
+	game.data = malloc(size ? size : 1);
+	if (!game.data) {
+		LOG_error("Couldn't allocate memory for file: %s\n", game.path);
+		return 0;
+	}
+
+	zip_uint64_t sum = 0;
+	while (sum < size) {
+		zip_int64_t len = zip_fread(zf, (uint8_t*)game.data + sum, size - sum);
+		if (len <= 0) {
+			LOG_error("zip_fread failed\n");
+			free(game.data);
+			game.data = NULL;
+			return 0;
+		}
+		sum += len;
+	}
+	game.size = size;
+	return 1;
+}
+static void Zip_makeCacheDir(char* cache_dir) {
+	mkdir(ZIP_CACHE_PATH, 0777);
+	char tag_dir[MAX_PATH];
+	snprintf(tag_dir, sizeof(tag_dir), ZIP_CACHE_PATH "/%s", core.tag);
+	mkdir(tag_dir, 0777);
+	mkdir(cache_dir, 0777);
+}
+static int Zip_matchesExtension(const char* name, char** extensions) {
+	char extension[16];
+	for (int e=0; extensions[e]; e++) {
+		snprintf(extension, sizeof(extension), ".%s", extensions[e]);
+		if (suffixMatch(extension, (char*)name)) return 1;
+	}
+	return 0;
+}
+// moves a finished .part into place, or throws it away
+static int Zip_commitExtraction(int ok, char* part_path, char* cache_dir, struct stat* st) {
+	if (!ok || rename(part_path, game.tmp_path)) {
+		LOG_error("extracting %s failed\n", game.tmp_path);
+		unlink(part_path);
+		return 0;
+	}
+
+	// the stamp goes last, an interrupted extraction is never picked up
+	char stamp[64];
+	sprintf(stamp, "%lld %lld", (long long)st->st_mtime, (long long)st->st_size);
+	char stamp_path[MAX_PATH];
+	snprintf(stamp_path, sizeof(stamp_path), "%s/" ZIP_STAMP_NAME, cache_dir);
+	putFile(stamp_path, stamp);
+	return 1;
+}
+static int Zip_extractToFile(struct zip_file* zf, char* cache_dir, struct stat* st) {
+	char part_path[MAX_PATH];
+	snprintf(part_path, sizeof(part_path), "%s.part", game.tmp_path);
+	int fd = open(part_path, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+	if (fd < 0) {
+		LOG_error("open failed: %s (%s)\n", part_path, strerror(errno));
+		return 0;
+	}
+
+	uint8_t* buf = malloc(ZIP_BUFFER_SIZE);
+	int ok = buf!=NULL;
+	zip_int64_t len = 0;
+	while (ok && (len = zip_fread(zf, buf, ZIP_BUFFER_SIZE)) > 0) {
+		for (zip_int64_t written = 0; ok && written < len; ) {
+			ssize_t count = write(fd, buf + written, len - written);
+			if (count < 0 && errno==EINTR) continue;
+			if (count <= 0) ok = 0;
+			else written += count;
+		}
+	}
+	if (len < 0) ok = 0;
+	free(buf);
+	close(fd);
+
+	return Zip_commitExtraction(ok, part_path, cache_dir, st);
+}
+
 int extract_zip(char** extensions)
 {
-	char buf[100];
+	struct stat st;
+	if (stat(game.path, &st)) {
+		LOG_error("can't stat zip archive `%s': %s\n", game.path, strerror(errno));
+		return 0;
+	}
+
+	char cache_dir[MAX_PATH];
+	snprintf(cache_dir, sizeof(cache_dir), ZIP_CACHE_PATH "/%s/%s", core.tag, game.name);
+	if (Zip_findCached(cache_dir, &st)) {
+		LOG_info("using extraction in %s\n", game.tmp_path);
+		return 1;
+	}
+
 	struct zip *za;
 	int ze;
 	if ((za = zip_open(game.path, 0, &ze)) == NULL) {
@@ -305,79 +476,91 @@ int extract_zip(char** extensions)
 		return 0;
 	}
 
-	// char tmp_template[MAX_PATH];
-	// strcpy(tmp_template, "/tmp/minarch-XXXXXX");
-	
-	mkdir("/tmp/nextarch",0777);
-	char tmp_dirname[255];
-	snprintf(tmp_dirname, sizeof(tmp_dirname), "%s/%s", "/tmp/nextarch",core.tag);
-	mkdir(tmp_dirname,0777);
-
-	int i, len;
-	int fd;
-	struct zip_file *zf;
+	int ok = 0;
 	struct zip_stat sb;
-	long long sum;
-	for (i = 0; i < zip_get_num_entries(za, 0); i++) {
-		if (zip_stat_index(za, i, 0, &sb) == 0) {
-			len = strlen(sb.name);
-			//LOG_info("Name: [%s], ", sb.name);
-			//LOG_info("Size: [%llu], ", sb.size);
-			//LOG_info("mtime: [%u]\n", (unsigned int)sb.mtime);
-			if (sb.name[len - 1] == '/') {
-				sprintf(game.tmp_path, "%s/%s", tmp_dirname, basename((char*)sb.name));
-			} else {
-				int found = 0;
-				char extension[8];
-				for (int e=0; extensions[e]; e++) {
-					sprintf(extension, ".%s", extensions[e]);
-					if (suffixMatch(extension, sb.name)) {
-						found = 1;
-						break;
-					}
-				}
-				if (!found) continue;
+	zip_int64_t count = zip_get_num_entries(za, 0);
+	for (zip_int64_t i = 0; i < count; i++) {
+		if (zip_stat_index(za, i, 0, &sb) != 0) continue;
 
-				zf = zip_fopen_index(za, i, 0);
-				if (!zf) {
-					LOG_error( "zip_fopen_index failed\n");
-					return 0;
-				}
+		int len = strlen(sb.name);
+		if (len==0 || sb.name[len - 1] == '/') continue;
 
-				sprintf(game.tmp_path, "%s/%s", tmp_dirname, basename((char*)sb.name));
-				fd = open(game.tmp_path, O_RDWR | O_TRUNC | O_CREAT, 0644);
-				if (fd < 0) {
-					LOG_error( "open failed\n");
-					zip_fclose(zf);
-					return 0;
-				}
-				//LOG_info("Writing: %s\n", game.tmp_path);
-
-				sum = 0;
-				while (sum != sb.size) {
-					len = zip_fread(zf, buf, 100);
-					if (len < 0) {
-						LOG_error( "zip_fread failed\n");
-						close(fd);
-						zip_fclose(zf);
-						return 0;
-					}
-					write(fd, buf, len);
-					sum += len;
-				}
-				close(fd);
-				zip_fclose(zf);
-				return 1;
-			}
+		if (!Zip_matchesExtension(sb.name, extensions)) continue;
+
+		struct zip_file *zf = zip_fopen_index(za, i, 0);
+		if (!zf) {
+			LOG_error("zip_fopen_index failed\n");
+			break;
+		}
+
+		// cores that take data get it straight from the archive, there's no
+		// file then and tmp_path stays empty
+		const char* name = strrchr(sb.name, '/');
+		name = name ? name + 1 : sb.name;
+		Zip_setMember(name);
+		if (!core.need_fullpath) {
+			ok = Zip_readToMemory(zf, sb.size);
+		}
+		else {
+			snprintf(game.tmp_path, sizeof(game.tmp_path), "%s/%s", cache_dir, name);
+			Zip_makeCacheDir(cache_dir);
+			ok = Zip_extractToFile(zf, cache_dir, &st);
 		}
+		zip_fclose(zf);
+		break;
 	}
 	
-	if (zip_close(za) == -1) {
+	if (zip_close(za) == -1)
 		LOG_error("can't close zip archive `%s'\n", game.path);
+
+	return ok;
+}
+
+int extract_7z(char** extensions)
+{
+	struct stat st;
+	if (stat(game.path, &st)) {
+		LOG_error("can't stat 7z archive `%s': %s\n", game.path, strerror(errno));
 		return 0;
 	}
 
-	return 0;
+	char cache_dir[MAX_PATH];
+	snprintf(cache_dir, sizeof(cache_dir), ZIP_CACHE_PATH "/%s/%s", core.tag, game.name);
+	if (Zip_findCached(cache_dir, &st)) {
+		LOG_info("using extraction in %s\n", game.tmp_path);
+		return 1;
+	}
+
+	SevenZip* archive = SevenZip_open(game.path);
+	if (!archive) return 0;
+
+	int ok = 0;
+	for (int i=0; i<SevenZip_count(archive); i++) {
+		const char* member = SevenZip_name(archive, i);
+		if (!member || !Zip_matchesExtension(member, extensions)) continue;
+
+		// 7-Zip on Windows may store backslashes
+		const char* name = member;
+		for (const char* c=member; *c; c++) {
+			if (*c=='/' || *c=='\\') name = c + 1;
+		}
+		Zip_setMember(name);
+		if (!core.need_fullpath) {
+			game.data = SevenZip_readToMemory(archive, i, &game.size);
+			ok = game.data!=NULL;
+		}
+		else {
+			snprintf(game.tmp_path, sizeof(game.tmp_path), "%s/%s", cache_dir, name);
+			Zip_makeCacheDir(cache_dir);
+			char part_path[MAX_PATH];
+			snprintf(part_path, sizeof(part_path), "%s.part", game.tmp_path);
+			ok = Zip_commitExtraction(SevenZip_extractToFile(archive, i, part_path), part_path, cache_dir, &st);
+		}
+		break;
+	}
+	SevenZip_close(archive);
+
+	return ok;
 }
 
 ///////////////////////////////////////
@@ -730,6 +913,252 @@ finish:
 		fclose(file);
 }
 
+///////////////////////////////////////
+
+// savestates and sram are copied on the emulation thread into a pooled buffer
+// and handed to a worker that compresses and writes them to a .tmp next to
+// the target, fsyncs it and renames it into place, so gameplay never waits
+// on the sd card and a crash never leaves half a file behind
+#define STATE_JOB_COUNT 2
+
+typedef struct StateJob {
+	void* data;
+	size_t capacity;
+	size_t size;
+	int compress; // rzip
+	int codec;
+	void* packed; // encoded by the worker, which is the only one touching it
+	size_t packed_capacity;
+	int slot; // the state slot it's for, -1 for sram
+	char path[MAX_PATH];
+} StateJob;
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mx;
+	pthread_cond_t cv; // signaled whenever queued changes
+	int started;
+	int quit;
+	StateJob jobs[STATE_JOB_COUNT];
+	int head; // oldest queued job, the one being written
+	int queued;
+	uint32_t failed_slots; // slots whose last write failed, for the menu
+	int failed_slot; // the newest failure the menu hasn't shown yet, or -1
+	int sram_failing; // the last sram write failed
+	int sram_failed; // it started failing and the menu hasn't said so yet
+	int sram_stale; // the file doesn't hold what SRAM_autosave last handed over
+} state_writer = {
+	.mx = PTHREAD_MUTEX_INITIALIZER,
+	.cv = PTHREAD_COND_INITIALIZER,
+	.failed_slot = -1,
+};
+
+static int State_getCodec(void) {
+	switch (CFG_getStateFormat()) {
+		case STATE_FORMAT_SAV_LZ4: return STATE_CODEC_LZ4;
+		case STATE_FORMAT_SAV_ZSTD: return STATE_CODEC_ZSTD;
+		default: return STATE_CODEC_NONE;
+	}
+}
+static int State_writeRaw(char* path, void* data, size_t size) {
+	FILE *state_file = fopen(path, "w");
+	int ok = state_file && size==fwrite(data, 1, size, state_file);
+	if (state_file && fclose(state_file)) ok = 0;
+	return ok;
+}
+static int State_writeFile(StateJob* job) {
+	char tmp_path[MAX_PATH + 8];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", job->path);
+
+	int ok;
+	if (job->codec) {
+		size_t bound = StateCodec_bound(job->codec, job->size);
+		if (job->packed_capacity<bound) {
+			void* packed = realloc(job->packed, bound);
+			if (packed) {
+				job->packed = packed;
+				job->packed_capacity = bound;
+			}
+		}
+		size_t len = job->packed_capacity>=bound ? StateCodec_encode(job->codec, job->data, job->size, job->packed, job->packed_capacity) : 0;
+		ok = len && State_writeRaw(tmp_path, job->packed, len);
+	}
+#ifdef HAS_SRM
+	else if (job->compress) ok = rzipstream_write_file(tmp_path, job->data, job->size);
+	else ok = filestream_write_file(tmp_path, job->data, job->size);
+#else
+	else ok = State_writeRaw(tmp_path, job->data, job->size);
+#endif
+
+	// only this file, not every dirty page on the system like sync() did
+	if (ok) {
+		int fd = open(tmp_path, O_RDONLY);
+		ok = fd>=0 && fsync(fd)==0;
+		if (fd>=0) close(fd);
+	}
+	if (ok && rename(tmp_path, job->path)) ok = 0;
+	if (!ok) {
+		LOG_error("Error writing state data to file: %s (%s)\n", job->path, strerror(errno));
+		unlink(tmp_path);
+		return 0;
+	}
+
+	// and the directory entry the rename touched
+	char dir_path[MAX_PATH];
+	strcpy(dir_path, job->path);
+	char* tmp = strrchr(dir_path, '/');
+	if (tmp) {
+		tmp[0] = '\0';
+		int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+		if (fd>=0) {
+			fsync(fd);
+			close(fd);
+		}
+	}
+	return 1;
+}
+// with state_writer.mx held
+static void StateWriter_finish(StateJob* job, int ok) {
+	if (job->slot<0) {
+		// a card that keeps failing is reported once, retried every interval
+		if (!ok && !state_writer.sram_failing) state_writer.sram_failed = 1;
+		if (!ok) state_writer.sram_stale = 1;
+		state_writer.sram_failing = !ok;
+		return;
+	}
+	if (ok) state_writer.failed_slots &= ~(1u << job->slot);
+	else {
+		state_writer.failed_slots |= 1u << job->slot;
+		// the auto resume slot isn't one the menu can show
+		if (job->slot!=AUTO_RESUME_SLOT) state_writer.failed_slot = job->slot;
+	}
+}
+static void* StateWriter_thread(void* arg) {
+	pthread_mutex_lock(&state_writer.mx);
+	while (1) {
+		while (!state_writer.queued && !state_writer.quit) pthread_cond_wait(&state_writer.cv, &state_writer.mx);
+		if (!state_writer.queued) break; // quitting and drained
+
+		StateJob* job = &state_writer.jobs[state_writer.head];
+		pthread_mutex_unlock(&state_writer.mx);
+		
+		uint64_t start = getMicroseconds();
+		int ok = State_writeFile(job);
+		if (ok) LOG_info("saved %s in %llums\n", job->path, (unsigned long long)(getMicroseconds() - start) / 1000);
+		
+		pthread_mutex_lock(&state_writer.mx);
+		StateWriter_finish(job, ok);
+		state_writer.head = (state_writer.head + 1) % STATE_JOB_COUNT;
+		state_writer.queued -= 1;
+		pthread_cond_broadcast(&state_writer.cv);
+	}
+	pthread_mutex_unlock(&state_writer.mx);
+	return NULL;
+}
+// returns a free job with room for size bytes. when every buffer is still
+// queued it waits for one, or returns NULL if asked not to
+static StateJob* StateWriter_acquire(size_t size, int wait) {
+	pthread_mutex_lock(&state_writer.mx);
+	if (!state_writer.started) {
+		state_writer.started = pthread_create(&state_writer.thread, NULL, StateWriter_thread, NULL)==0;
+	}
+	if (!wait && state_writer.queued==STATE_JOB_COUNT) {
+		pthread_mutex_unlock(&state_writer.mx);
+		return NULL;
+	}
+	while (state_writer.queued==STATE_JOB_COUNT) pthread_cond_wait(&state_writer.cv, &state_writer.mx);
+	StateJob* job = &state_writer.jobs[(state_writer.head + state_writer.queued) % STATE_JOB_COUNT];
+	pthread_mutex_unlock(&state_writer.mx);
+
+	// the worker only touches queued jobs, this one is ours until submitted
+	if (job->capacity<size) {
+		void* data = realloc(job->data, size);
+		if (!data) return NULL;
+		job->data = data;
+		job->capacity = size;
+	}
+	return job;
+}
+static void StateWriter_submit(StateJob* job) {
+	if (!state_writer.started) { // no thread, write it here
+		int ok = State_writeFile(job);
+		pthread_mutex_lock(&state_writer.mx);
+		StateWriter_finish(job, ok);
+		pthread_mutex_unlock(&state_writer.mx);
+		return;
+	}
+	pthread_mutex_lock(&state_writer.mx);
+	state_writer.queued += 1;
+	pthread_cond_broadcast(&state_writer.cv);
+	pthread_mutex_unlock(&state_writer.mx);
+}
+static void StateWriter_wait(void) {
+	pthread_mutex_lock(&state_writer.mx);
+	while (state_writer.queued) pthread_cond_wait(&state_writer.cv, &state_writer.mx);
+	pthread_mutex_unlock(&state_writer.mx);
+}
+// a queued save counts as saved as far as the menu is concerned
+static int StateWriter_isPending(char* path) {
+	int pending = 0;
+	pthread_mutex_lock(&state_writer.mx);
+	for (int i=0; i<state_writer.queued; i++) {
+		if (exactMatch(state_writer.jobs[(state_writer.head + i) % STATE_JOB_COUNT].path, path)) pending = 1;
+	}
+	pthread_mutex_unlock(&state_writer.mx);
+	return pending;
+}
+static int StateWriter_failed(int slot) {
+	pthread_mutex_lock(&state_writer.mx);
+	int failed = (state_writer.failed_slots >> slot) & 1;
+	pthread_mutex_unlock(&state_writer.mx);
+	return failed;
+}
+// checked unlocked every frame, StateWriter_takeFailure() settles it under the lock
+static int StateWriter_hasFailure(void) {
+	return state_writer.failed_slot>=0 || state_writer.sram_failed;
+}
+// the slot of a save that failed since the last call, or -1
+static int StateWriter_takeFailure(void) {
+	pthread_mutex_lock(&state_writer.mx);
+	int slot = state_writer.failed_slot;
+	state_writer.failed_slot = -1;
+	pthread_mutex_unlock(&state_writer.mx);
+	return slot;
+}
+// whether sram started failing since the last call
+static int StateWriter_takeSramFailure(void) {
+	pthread_mutex_lock(&state_writer.mx);
+	int failed = state_writer.sram_failed;
+	state_writer.sram_failed = 0;
+	pthread_mutex_unlock(&state_writer.mx);
+	return failed;
+}
+// whether an sram write failed since the last call, so it's due again
+static int StateWriter_takeSramStale(void) {
+	pthread_mutex_lock(&state_writer.mx);
+	int stale = state_writer.sram_stale;
+	state_writer.sram_stale = 0;
+	pthread_mutex_unlock(&state_writer.mx);
+	return stale;
+}
+static void StateWriter_quit(void) {
+	if (state_writer.started) {
+		pthread_mutex_lock(&state_writer.mx);
+		state_writer.quit = 1;
+		pthread_cond_broadcast(&state_writer.cv);
+		pthread_mutex_unlock(&state_writer.mx);
+		pthread_join(state_writer.thread, NULL);
+		state_writer.started = 0;
+	}
+	for (int i=0; i<STATE_JOB_COUNT; i++) {
+		StateJob* job = &state_writer.jobs[i];
+		if (job->data) free(job->data);
+		if (job->packed) free(job->packed);
+		job->data = job->packed = NULL;
+		job->capacity = job->packed_capacity = 0;
+	}
+}
+
 ///////////////////////////////////////
 static void formatSavePath(char* work_name, char* filename, const char* suffix) {
 	char* tmp = strrchr(work_name, '.');
@@ -758,7 +1187,25 @@ static void SRAM_getPath(char* filename) {
 	LOG_info("SRAM_getPath %s\n", filename);
 }
 
+// the last contents handed to the writer, sram is only flushed again once it
+// differs or that write failed
+static struct {
+	void* data;
+	size_t size;
+	uint32_t last_check;
+} sram_shadow;
+
+static void SRAM_remember(void* sram, size_t sram_size) {
+	if (sram_shadow.size!=sram_size) {
+		void* data = realloc(sram_shadow.data, sram_size);
+		if (!data) return;
+		sram_shadow.data = data;
+		sram_shadow.size = sram_size;
+	}
+	memcpy(sram_shadow.data, sram, sram_size);
+}
 static void SRAM_read(void) {
+	if (netplay_guest) return; // the host's save comes over with its state
 	size_t sram_size = core.get_memory_size(RETRO_MEMORY_SAVE_RAM);
 	if (!sram_size) return;
 	
@@ -767,6 +1214,7 @@ static void SRAM_read(void) {
 	printf("sav path (read): %s\n", filename);
 
 	void* sram = core.get_memory_data(RETRO_MEMORY_SAVE_RAM);
+	if (sram) SRAM_remember(sram, sram_size); // whatever the core starts with, in case there's no file
 
 #ifdef HAS_SRM
 	// TODO: rzipstream_open can also handle uncompressed, else branch is probably unnecessary
@@ -798,40 +1246,67 @@ static void SRAM_read(void) {
 	}
 	fclose(sram_file);
 #endif
+	if (sram) SRAM_remember(sram, sram_size);
+}
+
+static void SRAM_setupJob(StateJob* job, size_t sram_size) {
+	job->size = sram_size;
+	job->compress = 0;
+	job->codec = STATE_CODEC_NONE;
+	job->slot = -1;
+#ifdef HAS_SRM
+	job->compress = CFG_getSaveFormat() == SAVE_FORMAT_SRM;
+#endif
+	SRAM_getPath(job->path);
 }
 
 static void SRAM_write(void) {
+	if (netplay_guest) return;
 	size_t sram_size = core.get_memory_size(RETRO_MEMORY_SAVE_RAM);
 	if (!sram_size) return;
 	
-	char filename[MAX_PATH];
-	SRAM_getPath(filename);
-	printf("sav path (write): %s\n", filename);
-	
 	void *sram = core.get_memory_data(RETRO_MEMORY_SAVE_RAM);
-
-#ifdef HAS_SRM
-	// srm, compressed
-	if (CFG_getSaveFormat() == SAVE_FORMAT_SRM) {
-		if(!rzipstream_write_file(filename, sram, sram_size))
-			LOG_error("rzipstream: Error writing SRAM data to file\n");
-	}
-	else {
-		if(!filestream_write_file(filename, sram, sram_size))
-			LOG_error("filestream: Error writing SRAM data to file\n");
-	}
-#else
-	FILE *sram_file = fopen(filename, "w");
-	if (!sram_file) {
-		LOG_error("Error opening SRAM file: %s\n", strerror(errno));
-		return;
-	}
-	if (!sram || sram_size != fwrite(sram, 1, sram_size, sram_file)) {
+	if (!sram) {
 		LOG_error("Error writing SRAM data to file\n");
+		return;
 	}
-	fclose(sram_file);
-#endif
-	sync();
+
+	// written right here, but after any background flush of the same file
+	StateJob job = {.data = sram};
+	SRAM_setupJob(&job, sram_size);
+	printf("sav path (write): %s\n", job.path);
+	StateWriter_wait();
+	if (State_writeFile(&job)) SRAM_remember(sram, sram_size);
+}
+
+// games save whenever they like, catch it within an interval instead of at exit.
+// a memcmp against the last written copy is all it costs while nothing changes
+#define SRAM_AUTOSAVE_INTERVAL 5000 // ms
+
+static void SRAM_autosave(void) {
+	if (netplay_guest) return;
+	uint32_t now = SDL_GetTicks();
+	if (now - sram_shadow.last_check<SRAM_AUTOSAVE_INTERVAL) return;
+	sram_shadow.last_check = now;
+
+	size_t sram_size = core.get_memory_size(RETRO_MEMORY_SAVE_RAM);
+	void *sram = core.get_memory_data(RETRO_MEMORY_SAVE_RAM);
+	if (!sram_size || !sram) return;
+	if (StateWriter_takeSramStale()) sram_shadow.size = 0; // never made it to disk, don't trust the copy
+	if (sram_shadow.size==sram_size && !memcmp(sram, sram_shadow.data, sram_size)) return;
+
+	StateJob* job = StateWriter_acquire(sram_size, 0);
+	if (!job) return; // writer is busy, try again next interval
+
+	memcpy(job->data, sram, sram_size);
+	SRAM_setupJob(job, sram_size);
+	StateWriter_submit(job);
+	SRAM_remember(sram, sram_size); // forgotten again if the write fails
+	LOG_info("SRAM changed, flushing %s\n", job->path);
+}
+static void SRAM_quit(void) {
+	if (sram_shadow.data) free(sram_shadow.data);
+	memset(&sram_shadow, 0, sizeof(sram_shadow));
 }
 
 ///////////////////////////////////////
@@ -840,6 +1315,7 @@ static void RTC_getPath(char* filename) {
 	sprintf(filename, "%s/%s.rtc", core.saves_dir, game.alt_name);
 }
 static void RTC_read(void) {
+	if (netplay_guest) return;
 	size_t rtc_size = core.get_memory_size(RETRO_MEMORY_RTC);
 	if (!rtc_size) return;
 	
@@ -859,6 +1335,7 @@ static void RTC_read(void) {
 	fclose(rtc_file);
 }
 static void RTC_write(void) {
+	if (netplay_guest) return;
 	size_t rtc_size = core.get_memory_size(RETRO_MEMORY_RTC);
 	if (!rtc_size) return;
 	
@@ -933,10 +1410,39 @@ static void State_getPath(char* filename) {
 	}
 }
 
+// returns -1 if the file wasn't written by a state codec, 1 if it was and decoded into state
+static int State_readCodec(char* filename, void* state, size_t state_size) {
+	FILE* state_file = fopen(filename, "r");
+	if (!state_file) return -1;
+
+	uint8_t header[STATE_CODEC_HEADER_SIZE];
+	size_t decoded_size;
+	if (fread(header, 1, sizeof(header), state_file)!=sizeof(header) || !StateCodec_detect(header, sizeof(header), &decoded_size)) {
+		fclose(state_file);
+		return -1;
+	}
+
+	fseek(state_file, 0, SEEK_END);
+	size_t size = ftell(state_file);
+	rewind(state_file);
+	void* packed = malloc(size);
+	int ok = packed && fread(packed, 1, size, state_file)==size;
+	fclose(state_file);
+
+	// same leeway as below for cores that misreport their serialize size
+	if (ok) ok = StateCodec_decode(packed, size, state, state_size);
+	if (!ok) LOG_error("Error decoding state data from file: %s (%zu bytes of %s into %zu)\n", filename, decoded_size, StateCodec_name(header[4]), state_size);
+	if (packed) free(packed);
+	return ok;
+}
+
 static void State_read(void) { // from picoarch
+	if (netplay_enabled) return; // would desync the other players
 	size_t state_size = core.serialize_size();
 	if (!state_size) return;
 
+	StateWriter_wait(); // the slot may still be on its way to disk
+
 	int was_ff = fast_forward;
 	fast_forward = 0;
 
@@ -949,6 +1455,17 @@ static void State_read(void) { // from picoarch
 	char filename[MAX_PATH];
 	State_getPath(filename);
 
+	// encoded states are recognized by their header, whatever the current format
+	int decoded = State_readCodec(filename, state, state_size);
+	if (decoded>=0) {
+		if (decoded && !core.unserialize(state, state_size)) {
+			LOG_error("Error restoring save state: %s\n", filename);
+		}
+		free(state);
+		fast_forward = was_ff;
+		return;
+	}
+
 #ifdef HAS_SRM
 	RFILE *state_rfile = NULL;
 	rzipstream_t *state_rzfile = NULL;
@@ -1037,51 +1554,29 @@ static void State_write(void) { // from picoarch
 	int was_ff = fast_forward;
 	fast_forward = 0;
 
-	void *state = calloc(1, state_size);
-	if (!state) {
+	StateJob* job = StateWriter_acquire(state_size, 1);
+	if (!job) {
 		LOG_error("Couldn't allocate memory for state\n");
 		goto error;
 	}
 
-	if (!core.serialize(state, state_size)) {
+	memset(job->data, 0, state_size); // pooled, but cores may expect the zeroes calloc gave them
+	if (!core.serialize(job->data, state_size)) {
 		LOG_error("Error serializing save state\n");
 		goto error;
 	}
 	
-	char filename[MAX_PATH];
-	State_getPath(filename);
+	job->size = state_size;
+	job->compress = 0;
+	job->codec = State_getCodec();
+	job->slot = state_slot;
+	State_getPath(job->path);
 #ifdef HAS_SRM
-	if (CFG_getStateFormat() == STATE_FORMAT_SRM || CFG_getStateFormat() == STATE_FORMAT_SRM_EXTRADOT) {
-		if(!rzipstream_write_file(filename, state, state_size)) {
-			LOG_error("rzipstream: Error writing state data to file: %s\n", filename);
-			goto error;
-		}
-	}
-	else {
-		if(!filestream_write_file(filename, state, state_size)) {
-			LOG_error("filestream: Error writing state data to file: %s\n", filename);
-			goto error;
-		}
-	}
-
-error:
-	if (state) free(state);
-#else
-	FILE *state_file = fopen(filename, "w");
-	if (!state_file) {
-		LOG_error("Error opening state file: %s (%s)\n", filename, strerror(errno));
-		goto error;
-	}
-	if (state_size != fwrite(state, 1, state_size, state_file)) {
-		LOG_error("Error writing state data to file: %s (%s)\n", filename, strerror(errno));
-		goto error;
-	}
-	error:
-	if (state) free(state);
-	if (state_file) fclose(state_file);
+	job->compress = CFG_getStateFormat() == STATE_FORMAT_SRM || CFG_getStateFormat() == STATE_FORMAT_SRM_EXTRADOT;
 #endif
+	StateWriter_submit(job);
 
-	sync();
+error:
 	fast_forward = was_ff;
 }
 
@@ -1133,6 +1628,12 @@ typedef struct OptionList {
 
 	OptionCategory *categories;
 	// OptionList_callback_t on_set;
+
+	// hashed by key, rebuilt when options or count change
+	int* index; // option index + 1, 0 is empty
+	int index_size; // power of two
+	Option* indexed_options;
+	int indexed_count;
 } OptionList;
 
 static char* onoff_labels[] = {
@@ -1557,6 +2058,7 @@ static char* overclock_labels[] = {
 	"Normal",
 	"Performance",
 	"Auto",
+	"Frame Time",
 	NULL,
 };
 
@@ -2022,7 +2524,7 @@ static void Minarch_initFrontendI18nOnce(void) {
 	static const char* overlay_keys[] = {"common.none", NULL};
 	static const char* tearing_keys[] = {"common.off", "minarch.vsync.lenient", "minarch.vsync.strict", NULL};
 	static const char* sync_ref_keys[] = {"common.auto", "minarch.sync_ref.screen", "minarch.sync_ref.native", NULL};
-	static const char* overclock_keys[] = {"minarch.cpu.powersave", "minarch.cpu.normal", "minarch.cpu.performance", "common.auto", NULL};
+	static const char* overclock_keys[] = {"minarch.cpu.powersave", "minarch.cpu.normal", "minarch.cpu.performance", "common.auto", "minarch.cpu.frame", NULL};
 	// For max FF, only translate the first entry (None).
 	static const char* max_ff_keys[] = {"common.none", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
 
@@ -2088,11 +2590,134 @@ static inline int getScreenScalingCount(void) {
 }
 	
 
+// cfg files are parsed once into a hashed key/value store instead of
+// rescanning the whole file for each of a core's (often 100+) options
+typedef struct ConfigEntry {
+	char* key;
+	char* value;
+	int lock; // prefixed with a `-`
+} ConfigEntry;
+typedef struct ConfigStore {
+	char* text; // as read from disk
+	char* data; // copy of text split into keys and values
+	int count;
+	ConfigEntry* entries;
+	int* buckets; // entry index + 1, 0 is empty
+	int bucket_count; // power of two
+} ConfigStore;
+
+static uint32_t hashKey(const char* key) { // fnv-1a
+	uint32_t hash = 2166136261u;
+	while (*key) hash = (hash ^ (uint8_t)*key++) * 16777619u;
+	return hash;
+}
+static int hashSize(int count) {
+	int size = 16;
+	while (size<count*2) size <<= 1;
+	return size;
+}
+
+// with tracing on, the first frame reports how many option and cfg lookups
+// the frontend and core did up to then and how long they took altogether
+static struct {
+	int count;
+	uint64_t ns;
+} option_lookups;
+static uint64_t OptionLookup_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static void OptionLookup_done(uint64_t start) { // cores may ask from their own threads
+	__atomic_add_fetch(&option_lookups.count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&option_lookups.ns, OptionLookup_now() - start, __ATOMIC_RELAXED);
+}
+
+static ConfigEntry* ConfigStore_find(ConfigStore* store, const char* key) {
+	if (!store || !store->bucket_count) return NULL;
+	uint32_t mask = store->bucket_count - 1;
+	for (uint32_t i=hashKey(key) & mask; store->buckets[i]; i=(i+1) & mask) {
+		ConfigEntry* entry = &store->entries[store->buckets[i] - 1];
+		if (!strcmp(entry->key, key)) return entry;
+	}
+	return NULL;
+}
+static void ConfigStore_add(ConfigStore* store, char* key, char* value, int lock) {
+	ConfigEntry* entry = ConfigStore_find(store, key);
+	if (entry) { // first value wins, a lock anywhere sticks
+		entry->lock |= lock;
+		return;
+	}
+
+	uint32_t mask = store->bucket_count - 1;
+	uint32_t i = hashKey(key) & mask;
+	while (store->buckets[i]) i = (i+1) & mask;
+
+	entry = &store->entries[store->count++];
+	entry->key = key;
+	entry->value = value;
+	entry->lock = lock;
+	store->buckets[i] = store->count;
+}
+static void ConfigStore_free(ConfigStore* store) {
+	if (!store) return;
+	free(store->text);
+	free(store->data);
+	free(store->entries);
+	free(store->buckets);
+	free(store);
+}
+static ConfigStore* ConfigStore_load(char* path) {
+	char* text = allocFile(path);
+	if (!text) return NULL;
+
+	int lines = 1;
+	for (char* tmp=text; *tmp; tmp++) {
+		if (*tmp=='\n') lines += 1;
+	}
+
+	ConfigStore* store = calloc(1, sizeof(ConfigStore));
+	if (store) {
+		store->text = text;
+		store->data = strdup(text);
+		store->entries = calloc(lines, sizeof(ConfigEntry));
+		store->bucket_count = hashSize(lines);
+		store->buckets = calloc(store->bucket_count, sizeof(int));
+	}
+	if (!store || !store->data || !store->entries || !store->buckets) {
+		LOG_error("Unable to parse config: %s\n", path);
+		if (store) ConfigStore_free(store);
+		else free(text);
+		return NULL;
+	}
+
+	// key = value, one per line
+	char* line = store->data;
+	while (line) {
+		char* next = strchr(line, '\n');
+		if (next) *next++ = '\0';
+		char* tmp = strchr(line, '\r');
+		if (tmp) *tmp = '\0';
+
+		char* value = strstr(line, " = ");
+		if (value) {
+			*value = '\0';
+			value += 3;
+			while (*line==' ' || *line=='\t') line += 1;
+			int lock = *line=='-';
+			if (lock) line += 1;
+			ConfigStore_add(store, line, value, lock);
+		}
+		line = next;
+	}
+	return store;
+}
+
 static struct Config {
-	char* system_cfg; // system.cfg based on system limitations
-	char* default_cfg; // pak.cfg based on platform limitations
-	char* user_cfg; // minarch.cfg or game.cfg based on user preference
-	char* shaders_preset; // minarch.cfg or game.cfg based on user preference
+	ConfigStore* system_cfg; // system.cfg based on system limitations
+	ConfigStore* default_cfg; // pak.cfg based on platform limitations
+	ConfigStore* user_cfg; // minarch.cfg or game.cfg based on user preference
+	ConfigStore* shaders_preset; // minarch.cfg or game.cfg based on user preference
 	char* device_tag;
 	OptionList frontend;
 	OptionList core;
@@ -2210,10 +2835,10 @@ static struct Config {
 			[FE_OPT_OVERCLOCK] = {
 				.key	= "minarch_cpu_speed",
 				.name	= "CPU Speed",
-				.desc	= "Over- or underclock the CPU to prioritize\npure performance or power savings.",
+				.desc	= "Over- or underclock the CPU to prioritize\npure performance or power savings.\nFrame Time clocks to each frame's deadline.",
 				.default_value = 3,
 				.value = 3,
-				.count = 4,
+				.count = 5,
 				.values = overclock_labels,
 				.labels = overclock_labels,
 			},
@@ -2474,21 +3099,15 @@ static struct Config {
 		{NULL}
 	},
 };
-static int Config_getValue(char* cfg, const char* key, char* out_value, int* lock) { // gets value from string
-	char* tmp = cfg;
-	while ((tmp = strstr(tmp, key))) {
-		if (lock!=NULL && tmp>cfg && *(tmp-1)=='-') *lock = 1; // prefixed with a `-` means lock
-		tmp += strlen(key);
-		if (!strncmp(tmp, " = ", 3)) break; // matched
-	};
-	if (!tmp) return 0;
-	tmp += 3;
-	
-	strncpy(out_value, tmp, 256);
+static int Config_getValue(ConfigStore* cfg, const char* key, char* out_value, int* lock) { // gets value from store
+	uint64_t start = trace_enabled ? OptionLookup_now() : 0;
+	ConfigEntry* entry = ConfigStore_find(cfg, key);
+	if (trace_enabled) OptionLookup_done(start);
+	if (!entry) return 0;
+	if (lock!=NULL && entry->lock) *lock = 1; // prefixed with a `-` means lock
+	
+	strncpy(out_value, entry->value, 256);
 	out_value[256 - 1] = '\0';
-	tmp = strchr(out_value, '\n');
-	if (!tmp) tmp = strchr(out_value, '\r');
-	if (tmp) *tmp = '\0';
 
 	// LOG_info("\t%s = %s (%s)\n", key, out_value, (lock && *lock) ? "hidden":"shown");
 	return 1;
@@ -2502,23 +3121,28 @@ static void setOverclock(int i) {
     overclock = i;
     switch (i) {
         case 0: {
-			useAutoCpu = 0;
+			useAutoCpu = AUTO_CPU_OFF;
             PWR_setCPUSpeed(CPU_SPEED_POWERSAVE);
             break;
 		}
         case 1:  {
-			useAutoCpu = 0;
+			useAutoCpu = AUTO_CPU_OFF;
             PWR_setCPUSpeed(CPU_SPEED_NORMAL);
             break;
 		}
         case 2:  {
-			useAutoCpu = 0;
+			useAutoCpu = AUTO_CPU_OFF;
             PWR_setCPUSpeed(CPU_SPEED_PERFORMANCE);
             break;
 		}
         case 3:  {
             PWR_setCPUSpeed(CPU_SPEED_NORMAL);
-			useAutoCpu = 1;
+			useAutoCpu = AUTO_CPU_USAGE;
+            break;
+		}
+        case 4:  {
+            PWR_setCPUSpeed(CPU_SPEED_NORMAL);
+			useAutoCpu = AUTO_CPU_FRAME;
             break;
 		}
     }
@@ -2686,7 +3310,7 @@ static void Config_init(void) {
 	if (!config.default_cfg || config.initialized) return;
 	
 	LOG_info("Config_init\n");
-	char* tmp = config.default_cfg;
+	char* tmp = config.default_cfg->text;
 	char* tmp2;
 	char* key;
 	
@@ -2802,7 +3426,7 @@ static void Config_quit(void) {
 		free(core_button_mapping[i].name);
 	}
 }
-static void Config_readOptionsString(char* cfg) {
+static void Config_readOptionsString(ConfigStore* cfg) {
 	if (!cfg) return;
 
 	LOG_info("Config_readOptions\n");
@@ -2841,7 +3465,7 @@ static void Config_readOptionsString(char* cfg) {
 		}
 	}
 }
-static void Config_readControlsString(char* cfg) {
+static void Config_readControlsString(ConfigStore* cfg) {
 	if (!cfg) return;
 
 	LOG_info("Config_readControlsString\n");
@@ -3018,9 +3642,9 @@ static void Config_load(void) {
 	
 	if (config.device_tag && exists(device_system_path)) {
 		LOG_info("usng device_system_path: %s\n", device_system_path);
-		config.system_cfg = allocFile(device_system_path);
+		config.system_cfg = ConfigStore_load(device_system_path);
 	}
-	else if (exists(system_path)) config.system_cfg = allocFile(system_path);
+	else if (exists(system_path)) config.system_cfg = ConfigStore_load(system_path);
 	else config.system_cfg = NULL;
 	
 	
@@ -3043,9 +3667,9 @@ static void Config_load(void) {
 	
 	if (config.device_tag && exists(device_default_path)) {
 		LOG_info("usng device_default_path: %s\n", device_default_path);
-		config.default_cfg = allocFile(device_default_path);
+		config.default_cfg = ConfigStore_load(device_default_path);
 	}
-	else if (exists(default_path)) config.default_cfg = allocFile(default_path);
+	else if (exists(default_path)) config.default_cfg = ConfigStore_load(default_path);
 	else config.default_cfg = NULL;
 	
 	// LOG_info("config.default_cfg: %s\n", config.default_cfg);
@@ -3057,7 +3681,7 @@ static void Config_load(void) {
 	if (exists(path)) override = 1; 
 	if (!override) Config_getPath(path, CONFIG_WRITE_ALL);
 	
-	config.user_cfg = allocFile(path);
+	config.user_cfg = ConfigStore_load(path);
 	if (!config.user_cfg) return;
 	
 	LOG_info("using user config: %s\n", path);
@@ -3065,9 +3689,12 @@ static void Config_load(void) {
 	config.loaded = override ? CONFIG_GAME : CONFIG_CONSOLE;
 }
 static void Config_free(void) {
-	if (config.system_cfg) free(config.system_cfg);
-	if (config.default_cfg) free(config.default_cfg);
-	if (config.user_cfg) free(config.user_cfg);
+	ConfigStore_free(config.system_cfg);
+	ConfigStore_free(config.default_cfg);
+	ConfigStore_free(config.user_cfg);
+	config.system_cfg = NULL;
+	config.default_cfg = NULL;
+	config.user_cfg = NULL;
 }
 static void Config_readOptions(void) {
 	Config_readOptionsString(config.system_cfg);
@@ -3200,8 +3827,9 @@ void readShadersPreset(int i) {
 		char shaderspath[MAX_PATH] = {0};
 		sprintf(shaderspath, SHADERS_FOLDER "/%s", config.shaders.options[SH_SHADERS_PRESET].values[i]);
 		LOG_info("read shaders preset %s\n",shaderspath);
+		ConfigStore_free(config.shaders_preset);
 		if (exists(shaderspath)) {
-			config.shaders_preset = allocFile(shaderspath);
+			config.shaders_preset = ConfigStore_load(shaderspath);
 			Config_readOptionsString(config.shaders_preset);
 		}
 		else config.shaders_preset = NULL;
@@ -3683,15 +4311,55 @@ static void OptionList_reset(void) {
 	if (config.core.enabled_options) free(config.core.enabled_options);
 	config.core.enabled_count = 0;
 	free(config.core.options);
+	free(config.core.index);
+	config.core.index = NULL;
+	config.core.index_size = 0;
 }
 
-static Option* OptionList_getOption(OptionList* list, const char* key) {
+static void OptionList_index(OptionList* list) {
+	int size = hashSize(list->count);
+	if (list->index_size!=size) {
+		free(list->index);
+		list->index = calloc(size, sizeof(int));
+		list->index_size = list->index ? size : 0;
+	}
+	else memset(list->index, 0, size * sizeof(int));
+	list->indexed_options = list->options;
+	list->indexed_count = list->count;
+	if (!list->index) return;
+
+	uint32_t mask = size - 1;
 	for (int i=0; i<list->count; i++) {
-		Option* item = &list->options[i];
+		if (!list->options[i].key) continue;
+		uint32_t j = hashKey(list->options[i].key) & mask;
+		while (list->index[j]) j = (j+1) & mask;
+		list->index[j] = i + 1;
+	}
+}
+static Option* OptionList_findOption(OptionList* list, const char* key) {
+	// cores ask for their options by key constantly, eg. on every GET_VARIABLE
+	if (list->indexed_options!=list->options || list->indexed_count!=list->count) OptionList_index(list);
+	if (!list->index) {
+		for (int i=0; i<list->count; i++) {
+			Option* item = &list->options[i];
+			if (!strcmp(item->key, key)) return item;
+		}
+		return NULL;
+	}
+
+	uint32_t mask = list->index_size - 1;
+	for (uint32_t i=hashKey(key) & mask; list->index[i]; i=(i+1) & mask) {
+		Option* item = &list->options[list->index[i] - 1];
 		if (!strcmp(item->key, key)) return item;
 	}
 	return NULL;
 }
+static Option* OptionList_getOption(OptionList* list, const char* key) {
+	uint64_t start = trace_enabled ? OptionLookup_now() : 0;
+	Option* item = OptionList_findOption(list, key);
+	if (trace_enabled) OptionLookup_done(start);
+	return item;
+}
 static char* OptionList_getOptionValue(OptionList* list, const char* key) {
 	Option* item = OptionList_getOption(list, key);
 	// if (item) LOG_info("\tGET %s (%s) = %s (%s)\n", item->name, item->key, item->labels[item->value], item->values[item->value]);
@@ -3746,6 +4414,7 @@ static void Menu_saveState(void);
 static void Menu_loadState(void);
 
 static int setFastForward(int enable) {
+	if (netplay_enabled) enable = 0; // everyone runs at the pace of the slowest player
 	fast_forward = enable;
 	return enable;
 }
@@ -3753,6 +4422,10 @@ static int setFastForward(int enable) {
 static uint32_t buttons = 0; // RETRO_DEVICE_ID_JOYPAD_* buttons
 static int ignore_menu = 0;
 static void input_poll_callback(void) {
+	// rerun frames read the inputs netplay kept for them, the pad and the
+	// shortcuts were handled when the frame first ran
+	if (netplay_resimulating) return;
+
 	PAD_poll();
 
 	int show_setting = 0;
@@ -3837,7 +4510,7 @@ static void input_poll_callback(void) {
 					case SHORTCUT_SCREENSHOT:
 						Menu_screenshot();
 						break;
-					case SHORTCUT_RESET_GAME: core.reset(); break;
+					case SHORTCUT_RESET_GAME: if (!netplay_enabled) core.reset(); break;
 					case SHORTCUT_SAVE_QUIT:
 						newScreenshot = 1;
 						quit = 1;
@@ -3871,6 +4544,8 @@ static void input_poll_callback(void) {
 	if (!ignore_menu && PAD_justReleased(BTN_MENU)) {
 		show_menu = 1;
 	}
+	if (StateWriter_hasFailure()) show_menu = 1; // the menu says which save
+
 	
 	// TODO: figure out how to ignore button when MENU+button is handled first
 	// TODO: array size of LOCAL_ whatever that macro is
@@ -3904,6 +4579,27 @@ static void input_poll_callback(void) {
 	// if (buttons) LOG_info("buttons: %i\n", buttons);
 }
 static int16_t input_state_callback(unsigned port, unsigned device, unsigned index, unsigned id) {
+	if (netplay_enabled) {
+		// every player reads the same, agreed upon, input for this frame
+		const netplay_input_t* input = NET_frame_input(&netplay_ctx, port);
+		if (!input) return 0;
+		if (device==RETRO_DEVICE_JOYPAD && index==0) {
+			if (id == RETRO_DEVICE_ID_JOYPAD_MASK) return input->buttons;
+			return (input->buttons >> id) & 1;
+		}
+		else if (device==RETRO_DEVICE_ANALOG) {
+			if (index==RETRO_DEVICE_INDEX_ANALOG_LEFT) {
+				if (id==RETRO_DEVICE_ID_ANALOG_X) return input->analog_lx;
+				else if (id==RETRO_DEVICE_ID_ANALOG_Y) return input->analog_ly;
+			}
+			else if (index==RETRO_DEVICE_INDEX_ANALOG_RIGHT) {
+				if (id==RETRO_DEVICE_ID_ANALOG_X) return input->analog_rx;
+				else if (id==RETRO_DEVICE_ID_ANALOG_Y) return input->analog_ry;
+			}
+		}
+		return 0;
+	}
+	
 	if (port==0 && device==RETRO_DEVICE_JOYPAD && index==0) {
 		if (id == RETRO_DEVICE_ID_JOYPAD_MASK) return buttons;
 		return (buttons >> id) & 1;
@@ -3920,6 +4616,472 @@ static int16_t input_state_callback(unsigned port, unsigned device, unsigned ind
 	}
 	return 0;
 }
+///////////////////////////////
+// lockstep netplay, set up from the environment for now:
+// MINARCH_NETPLAY=host|<host ip>, MINARCH_NETPLAY_PLAYERS, MINARCH_NETPLAY_DELAY,
+// MINARCH_NETPLAY_ROLLBACK (max frames to predict, 0 is off), MINARCH_NETPLAY_UDP=1
+// (host, input over UDP) and, to try things out on a good network,
+// MINARCH_NETPLAY_LATENCY/MINARCH_NETPLAY_JITTER (ms) and MINARCH_NETPLAY_LOSS (%)
+
+#define NETPLAY_WAIT_TIMEOUT 60000 // ms
+#define NETPLAY_CHECKSUM_INTERVAL 60 // frames
+
+static int netplay_players = 1;
+
+// snapshots of the state each frame started from, allocated once
+static struct {
+	int max; // frames, as configured
+	int depth; // frames, what the measured frame cost allows
+	size_t size;
+	uint8_t* data;
+	uint32_t frames[NETPLAY_MAX_ROLLBACK];
+	uint8_t valid[NETPLAY_MAX_ROLLBACK];
+	uint64_t frame_cost; // us, moving average of snapshot + core.run
+	uint64_t save_cost; // us, moving average of a snapshot alone
+	int saved; // this frame, counted in frame_cost even when it wasn't
+	uint64_t frame_start;
+	uint32_t next_check; // frame to checksum once it's confirmed
+} rollback;
+
+static int Rollback_init(void) {
+	rollback.size = core.serialize_size();
+	if (rollback.size) rollback.data = malloc(rollback.size * NETPLAY_MAX_ROLLBACK);
+	if (!rollback.data) {
+		LOG_warn("Netplay: core can't save state, rollback disabled\n");
+		rollback.max = 0;
+		return 0;
+	}
+	memset(rollback.valid, 0, sizeof(rollback.valid));
+	return 1;
+}
+static void Rollback_quit(void) {
+	free(rollback.data);
+	rollback.data = NULL;
+	rollback.max = 0;
+}
+static uint8_t* Rollback_snapshot(uint32_t frame) {
+	int i = frame % NETPLAY_MAX_ROLLBACK;
+	if (!rollback.valid[i] || rollback.frames[i]!=frame) return NULL;
+	return rollback.data + i * rollback.size;
+}
+static void Rollback_save(uint32_t frame) {
+	int i = frame % NETPLAY_MAX_ROLLBACK;
+	uint64_t start = getMicroseconds();
+	rollback.valid[i] = core.serialize(rollback.data + i * rollback.size, rollback.size);
+	rollback.frames[i] = frame;
+	uint64_t cost = getMicroseconds() - start;
+	rollback.save_cost = rollback.save_cost ? (rollback.save_cost * 7 + cost) / 8 : cost;
+	rollback.saved = 1;
+}
+static void Rollback_measure(uint64_t cost) {
+	// a frame that skipped its snapshot would have paid for one with depth
+	if (!rollback.saved) cost += rollback.save_cost;
+	rollback.saved = 0;
+	rollback.frame_cost = rollback.frame_cost ? (rollback.frame_cost * 7 + cost) / 8 : cost;
+
+	// a rollback reruns up to depth frames on top of the current one,
+	// all of which has to fit in most of a frame's time
+	uint64_t budget = 1000000 / core.fps * 3 / 4;
+	int depth = budget / MAX(rollback.frame_cost, 1) - 1;
+	rollback.depth = MAX(0, MIN(depth, rollback.max));
+	NET_set_rollback(&netplay_ctx, rollback.depth);
+}
+// runs the session's current frame up to `to` again, off screen
+static void Netplay_rerun(uint32_t to) {
+	netplay_resimulating = 1;
+	while (netplay_ctx.session.frame<to) {
+		if (rollback.data) Rollback_save(netplay_ctx.session.frame);
+		core.run();
+		NET_advance_frame(&netplay_ctx);
+	}
+	netplay_resimulating = 0;
+}
+static void Rollback_run(void) {
+	uint32_t from;
+	uint32_t to = netplay_ctx.session.frame;
+	if (!NET_rollback(&netplay_ctx, &from)) return;
+
+	uint8_t* snapshot = Rollback_snapshot(from);
+	if (!snapshot || !core.unserialize(snapshot, rollback.size)) {
+		// carry on with the wrong guess, the checksums will tell
+		LOG_warn("Netplay: no snapshot of frame %u to roll back to\n", from);
+		netplay_ctx.session.frame = to;
+		return;
+	}
+
+	uint64_t start = getMicroseconds();
+	Netplay_rerun(to);
+	Rollback_measure((getMicroseconds() - start) / (to - from));
+}
+static void Rollback_checksum(void) {
+	// the state a frame starts from is final once every input before it is in
+	netplay_session_t* session = &netplay_ctx.session;
+	while (rollback.next_check<=session->confirmed && rollback.next_check<=session->frame) {
+		uint8_t* snapshot = Rollback_snapshot(rollback.next_check);
+		if (snapshot) NET_submit_checksum(&netplay_ctx, rollback.next_check, crc32(0, snapshot, rollback.size));
+		rollback.next_check += NETPLAY_CHECKSUM_INTERVAL;
+	}
+}
+
+static int netplay_resync = 0; // host, send everyone our state
+static uint32_t netplay_synced_frame = 0; // of the last state sent
+
+static void Netplay_onDesync(uint32_t frame, int port) {
+	LOG_warn("Netplay: player %i desynced at frame %u\n", port+1, frame);
+	// the host's game is the one that counts, checksums from before the last resync are stale
+	if (netplay_ctx.role==NETPLAY_ROLE_HOST && frame>=netplay_synced_frame) netplay_resync = 1;
+}
+
+// host, once the state the current frame starts from is final
+static void Netplay_sendState(void) {
+	if (!netplay_resync || NET_state_busy(&netplay_ctx)) return;
+
+	netplay_session_t* session = &netplay_ctx.session;
+	if (rollback.data) {
+		// the latest state that isn't a guess
+		uint32_t frame = MIN(session->confirmed, session->frame);
+		uint8_t* snapshot = Rollback_snapshot(frame);
+		if (!snapshot || NET_send_state(&netplay_ctx, snapshot, rollback.size, frame)<0) return;
+		netplay_synced_frame = frame;
+	}
+	else {
+		size_t state_size = core.serialize_size();
+		void* state = state_size ? malloc(state_size) : NULL;
+		int sent = state && core.serialize(state, state_size) && NET_send_state(&netplay_ctx, state, state_size, session->frame)==0;
+		free(state);
+		if (!sent) return;
+		netplay_synced_frame = session->frame;
+	}
+	netplay_resync = 0;
+}
+
+// client, loads the host's state once we got to its frame
+static void Netplay_receiveState(void) {
+	int size;
+	uint32_t frame;
+	const void* state = NET_received_state(&netplay_ctx, &size, &frame);
+	if (!state) return;
+
+	uint32_t to = netplay_ctx.session.frame;
+	if (core.unserialize(state, size)) {
+		LOG_info("Netplay: loaded the host's state from frame %u\n", frame);
+		netplay_ctx.session.frame = frame;
+		memset(rollback.valid, 0, sizeof(rollback.valid));
+		rollback.next_check = (frame + NETPLAY_CHECKSUM_INTERVAL - 1) / NETPLAY_CHECKSUM_INTERVAL * NETPLAY_CHECKSUM_INTERVAL;
+		Netplay_rerun(to);
+	}
+	else LOG_warn("Netplay: couldn't load the host's state from frame %u\n", frame);
+	NET_state_applied(&netplay_ctx);
+}
+
+static int Netplay_waitScreen(const char* message) {
+	GFX_startFrame();
+	PAD_poll();
+	if (PAD_justPressed(BTN_B)) return 0;
+
+	GFX_clear(screen);
+	GFX_blitMessage(font.medium, (char*)message, screen, &(SDL_Rect){SCALE1(PADDING),SCALE1(PADDING),screen->w-SCALE1(2*PADDING),screen->h-SCALE1(PILL_SIZE+PADDING)});
+	GFX_blitButtonGroup((char*[]){ "B",(char*)TR("common.cancel"), NULL }, 0, screen, 1);
+	GFX_flip(screen);
+	return 1;
+}
+
+static void Netplay_init(void) {
+	char* mode = getenv("MINARCH_NETPLAY");
+	if (!mode || !*mode) return;
+
+	char* value = getenv("MINARCH_NETPLAY_PLAYERS");
+	int players = value ? atoi(value) : 2;
+	players = MAX(2, MIN(players, NETPLAY_MAX_PLAYERS));
+	value = getenv("MINARCH_NETPLAY_DELAY");
+	int delay = value ? atoi(value) : 2;
+	delay = MAX(0, MIN(delay, NETPLAY_MAX_DELAY));
+	value = getenv("MINARCH_NETPLAY_ROLLBACK");
+	rollback.max = value ? MAX(0, MIN(atoi(value), NETPLAY_MAX_ROLLBACK)) : 0;
+
+	netplay_ctx.on_desync = Netplay_onDesync;
+	char* latency = getenv("MINARCH_NETPLAY_LATENCY");
+	char* jitter = getenv("MINARCH_NETPLAY_JITTER");
+	char* loss = getenv("MINARCH_NETPLAY_LOSS");
+	if (latency || jitter || loss) NET_simulate_network(&netplay_ctx, latency ? atoi(latency) : 0, jitter ? atoi(jitter) : 0, loss ? atoi(loss) : 0, 1);
+	value = getenv("MINARCH_NETPLAY_UDP");
+	NET_enable_udp(&netplay_ctx, value && atoi(value));
+
+	if (exactMatch(mode, "host")) {
+		if (NET_start_hosting(&netplay_ctx)<0) return;
+
+		uint32_t start = SDL_GetTicks();
+		int ready = 0;
+		while (SDL_GetTicks() - start<NETPLAY_WAIT_TIMEOUT) {
+			NET_wait(&netplay_ctx, 0);
+			if (netplay_ctx.client_count>=players-1) {
+				ready = 1;
+				break;
+			}
+			if (!Netplay_waitScreen(TR("minarch.netplay.waiting"))) break;
+		}
+		if (!ready || NET_start_session(&netplay_ctx, delay, true)<0) {
+			NET_stop_hosting(&netplay_ctx);
+			return;
+		}
+	}
+	else {
+		Netplay_waitScreen(TR("minarch.netplay.connecting"));
+		if (NET_connect_to_host(&netplay_ctx, mode)<0) return;
+
+		uint32_t start = SDL_GetTicks();
+		while (!NET_session_active(&netplay_ctx) && SDL_GetTicks() - start<NETPLAY_WAIT_TIMEOUT) {
+			if (NET_wait(&netplay_ctx, 0)<0) break;
+			if (!Netplay_waitScreen(TR("minarch.netplay.connecting"))) break;
+		}
+		if (!NET_session_active(&netplay_ctx)) {
+			NET_disconnect(&netplay_ctx);
+			return;
+		}
+	}
+
+	netplay_players = netplay_ctx.session.players;
+	netplay_enabled = 1;
+	netplay_guest = netplay_ctx.role==NETPLAY_ROLE_CLIENT;
+	netplay_resync = !netplay_guest; // clients wait for the host's frame 0
+	LOG_info("Netplay: player %i of %i, %i frames of input delay, up to %i of rollback\n", netplay_ctx.session.local_port+1, netplay_players, netplay_ctx.session.delay, rollback.max);
+}
+
+// returns 0 while the other players' input for this frame is still on its way
+static int Netplay_beginFrame(void) {
+	if (!netplay_enabled) return 1;
+
+	if (!NET_session_active(&netplay_ctx)) {
+		// a player left, carry on alone from here
+		LOG_info("Netplay: session ended\n");
+		netplay_enabled = 0;
+		Rollback_quit();
+		return 1;
+	}
+	if (rollback.max && !rollback.data) Rollback_init(); // the core knows its state size by now
+
+	netplay_input_t input = {
+		.buttons = buttons,
+		.analog_lx = pad.laxis.x,
+		.analog_ly = pad.laxis.y,
+		.analog_rx = pad.raxis.x,
+		.analog_ry = pad.raxis.y,
+	};
+	NET_submit_input(&netplay_ctx, &input);
+	NET_wait(&netplay_ctx, NET_frame_ready(&netplay_ctx) ? 0 : 4);
+	if (!NET_session_active(&netplay_ctx)) return 0;
+
+	Netplay_receiveState();
+	if (rollback.max) Rollback_run();
+	if (!NET_frame_ready(&netplay_ctx)) {
+		input_poll_callback(); // keep the menu and power button responsive
+		return 0;
+	}
+
+	rollback.frame_start = getMicroseconds();
+	netplay_present_time = 0;
+	if (rollback.max) {
+		// without depth nothing is predicted, so nothing gets rolled back
+		// to, only checksummed frames need their snapshot
+		if (rollback.depth>0 || netplay_ctx.session.frame % NETPLAY_CHECKSUM_INTERVAL==0) Rollback_save(netplay_ctx.session.frame);
+		Rollback_checksum();
+	}
+	else if (netplay_ctx.session.frame % NETPLAY_CHECKSUM_INTERVAL==0) {
+		size_t state_size = core.serialize_size();
+		void* state = state_size ? malloc(state_size) : NULL;
+		if (state && core.serialize(state, state_size)) {
+			NET_submit_checksum(&netplay_ctx, netplay_ctx.session.frame, crc32(0, state, state_size));
+		}
+		free(state);
+	}
+	if (netplay_ctx.role==NETPLAY_ROLE_HOST) Netplay_sendState();
+	return 1;
+}
+static void Netplay_endFrame(void) {
+	if (!netplay_enabled) return;
+	if (rollback.max) Rollback_measure(getMicroseconds() - rollback.frame_start - netplay_present_time);
+	NET_advance_frame(&netplay_ctx);
+}
+
+///////////////////////////////
+// per game performance profiles, what each game cost to run last time so
+// the cpu governor starts at a clock that fits instead of finding it again.
+// One line per game: core, game, shaders, budget us, frames, median, p95
+// and max cycles per frame, then frames spent at each clock (MHz:frames).
+// Each session is merged in with the older ones counting half, so the
+// profile follows a game that got heavier or lighter within a few sessions
+
+#define PERF_PROFILES_PATH USERDATA_PATH "/perf_profiles.txt"
+#define PERF_MIN_FRAMES 600 // shorter sessions say little about a game
+#define PERF_CYCLE_BUCKET 250000 // cycles
+#define PERF_CYCLE_BUCKETS 256
+#define PERF_MHZ_BUCKET 100
+#define PERF_MHZ_BUCKETS 32
+#define PERF_LINE_MAX 2048
+
+static struct {
+	int frames;
+	int cycles[PERF_CYCLE_BUCKETS]; // frames by work us * MHz, independent of the clock
+	int max_cycles;
+	int mhz[PERF_MHZ_BUCKETS]; // frames by clock
+} perf;
+
+typedef struct PerfProfile {
+	int budget;
+	int frames;
+	int median;
+	int p95;
+	int max;
+	int mhz[PERF_MHZ_BUCKETS];
+} PerfProfile;
+
+static void Perf_frame(int work_us) {
+	int mhz = PLAT_getCPUSpeed(); // the clock it ran at, not the monitor's average
+	if (mhz<=0) return; // clock unknown
+	int64_t cycles = (int64_t)MAX(work_us, 0) * mhz;
+	if (cycles>INT_MAX) cycles = INT_MAX;
+	perf.cycles[MIN(cycles / PERF_CYCLE_BUCKET, PERF_CYCLE_BUCKETS-1)] += 1;
+	perf.max_cycles = MAX(perf.max_cycles, (int)cycles);
+	perf.mhz[MIN(mhz / PERF_MHZ_BUCKET, PERF_MHZ_BUCKETS-1)] += 1;
+	perf.frames += 1;
+}
+static int Perf_percentile(int percent) {
+	int count = 0;
+	for (int i=0; i<PERF_CYCLE_BUCKETS; i++) {
+		count += perf.cycles[i];
+		if (count * 100LL>=(int64_t)perf.frames * percent) return (i + 1) * PERF_CYCLE_BUCKET;
+	}
+	return perf.max_cycles;
+}
+static void Perf_getShaders(char* out, size_t size) {
+	// shaders change what a frame costs to present, a profile only fits the same ones
+	static const int shader_options[] = {SH_SHADER1, SH_SHADER2, SH_SHADER3};
+	int count = MIN(config.shaders.options[SH_NROFSHADERS].value, 3);
+	snprintf(out, size, "none");
+	for (int i=0; i<count; i++) {
+		Option* option = &config.shaders.options[shader_options[i]];
+		const char* name = option->values && option->value<option->count ? option->values[option->value] : "?";
+		size_t len = i ? strlen(out) : 0;
+		snprintf(out + len, size - len, "%s%s", i ? "+" : "", name);
+	}
+}
+static void Perf_getKey(char* out, size_t size) {
+	snprintf(out, size, "%s-%s\t%s\t", core.tag, core.name, game.name);
+}
+
+// 1 if this game has a profile for the current shaders
+static int Perf_read(PerfProfile* profile) {
+	FILE* file = fopen(PERF_PROFILES_PATH, "r");
+	if (!file) return 0;
+
+	char key[MAX_PATH * 2];
+	char shaders[256];
+	char line[PERF_LINE_MAX];
+	Perf_getKey(key, sizeof(key));
+	Perf_getShaders(shaders, sizeof(shaders));
+	int found = 0;
+	while (fgets(line, sizeof(line), file)) {
+		if (!prefixMatch(key, line)) continue;
+
+		char* fields = line + strlen(key);
+		char* tab = strchr(fields, '\t');
+		if (!tab) break;
+		*tab = '\0';
+		if (!exactMatch(fields, shaders)) {
+			LOG_info("perf profile is for shaders %s, not %s\n", fields, shaders);
+			break;
+		}
+		memset(profile, 0, sizeof(*profile));
+		int used = 0;
+		if (sscanf(tab + 1, "%i\t%i\t%i\t%i\t%i\t%n", &profile->budget, &profile->frames, &profile->median, &profile->p95, &profile->max, &used)!=5) break;
+		char* clocks = tab + 1 + used;
+		int mhz, frames, len;
+		while (sscanf(clocks, "%i:%i%n", &mhz, &frames, &len)==2) {
+			if (mhz>=0 && frames>0) profile->mhz[MIN(mhz / PERF_MHZ_BUCKET, PERF_MHZ_BUCKETS-1)] += frames;
+			clocks += len;
+			if (*clocks!=',') break;
+			clocks += 1;
+		}
+		found = 1;
+		break;
+	}
+	fclose(file);
+	return found;
+}
+
+static void Perf_load(void) {
+	if (core.fps<=0) return;
+
+	PerfProfile profile;
+	if (!Perf_read(&profile)) return;
+	LOG_info("perf profile: %i frames, median/p95/max %i/%i/%i cycles\n", profile.frames, profile.median, profile.p95, profile.max);
+	PLAT_setFrameProfile(profile.p95, 1000000 / core.fps);
+}
+
+static int Perf_merge(int old_value, int old_frames, int value, int frames) {
+	return ((int64_t)old_value * old_frames + (int64_t)value * frames) / (old_frames + frames);
+}
+static void Perf_save(void) {
+	if (perf.frames<PERF_MIN_FRAMES || core.fps<=0) return;
+
+	PerfProfile profile = {
+		.budget = (int)(1000000 / core.fps),
+		.frames = perf.frames,
+		.median = Perf_percentile(50),
+		.p95 = Perf_percentile(95),
+		.max = perf.max_cycles,
+	};
+	memcpy(profile.mhz, perf.mhz, sizeof(profile.mhz));
+
+	PerfProfile old;
+	if (Perf_read(&old) && old.budget==profile.budget && old.frames>0) {
+		int weight = old.frames / 2;
+		profile.median = Perf_merge(old.median, weight, profile.median, profile.frames);
+		profile.p95 = Perf_merge(old.p95, weight, profile.p95, profile.frames);
+		profile.max = MAX(profile.max, old.max / 2);
+		for (int i=0; i<PERF_MHZ_BUCKETS; i++) profile.mhz[i] += old.mhz[i] / 2;
+		profile.frames += weight;
+	}
+
+	char key[MAX_PATH * 2];
+	char shaders[256];
+	char tmp_path[MAX_PATH];
+	Perf_getKey(key, sizeof(key));
+	Perf_getShaders(shaders, sizeof(shaders));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", PERF_PROFILES_PATH);
+
+	FILE* out = fopen(tmp_path, "w");
+	if (!out) {
+		LOG_error("perf profile: unable to write %s\n", tmp_path);
+		return;
+	}
+	// every other game's line stays as it was
+	FILE* in = fopen(PERF_PROFILES_PATH, "r");
+	if (in) {
+		char line[PERF_LINE_MAX];
+		while (fgets(line, sizeof(line), in)) {
+			if (!prefixMatch(key, line)) fputs(line, out);
+		}
+		fclose(in);
+	}
+
+	fprintf(out, "%s%s\t%i\t%i\t%i\t%i\t%i\t", key, shaders, profile.budget, profile.frames, profile.median, profile.p95, profile.max);
+	int first = 1;
+	for (int i=0; i<PERF_MHZ_BUCKETS; i++) {
+		if (!profile.mhz[i]) continue;
+		fprintf(out, "%s%i:%i", first ? "" : ",", i * PERF_MHZ_BUCKET, profile.mhz[i]);
+		first = 0;
+	}
+	fputc('\n', out);
+
+	int ok = fflush(out)==0 && fsync(fileno(out))==0;
+	if (fclose(out)) ok = 0;
+	if (!ok || rename(tmp_path, PERF_PROFILES_PATH)) {
+		LOG_error("perf profile: unable to save %s\n", PERF_PROFILES_PATH);
+		unlink(tmp_path);
+	}
+}
+
 ///////////////////////////////
 
 static void Input_init(const struct retro_input_descriptor *vars) {
@@ -5256,6 +6418,19 @@ static void video_refresh_callback_main(const void *data, unsigned width, unsign
 
 		sprintf(debug_text, "%i,%i %ix%i", renderer.dst_x,renderer.dst_y, renderer.src_w*scale,renderer.src_h*scale);
 		blitBitmapText(debug_text,-x,y,(uint32_t*)data,pitch / 4, width,height);
+
+		if (netplay_enabled) {
+			// rollbacks/frames rerun, frames ahead of confirmed input/allowed
+			netplay_session_t* session = &netplay_ctx.session;
+			sprintf(debug_text, "rb %u/%u %i/%i", session->rollbacks, session->resimulated, (int)(session->frame - MIN(session->frame, session->confirmed)), session->max_rollback);
+			blitBitmapText(debug_text,-x,y + 14,(uint32_t*)data,pitch / 4, width,height);
+
+			netplay_link_stats_t link;
+			if (NET_get_link_stats(&netplay_ctx, &link)) {
+				sprintf(debug_text, "rtt %ums loss %u%% %s", link.rtt_ms, link.loss_pct, link.udp ? "udp" : "tcp");
+				blitBitmapText(debug_text,-x,y + 28,(uint32_t*)data,pitch / 4, width,height);
+			}
+		}
 	
 		sprintf(debug_text, "%ix%i", renderer.dst_w,renderer.dst_h);
 		blitBitmapText(debug_text,-x,-y,(uint32_t*)data,pitch / 4, width,height);
@@ -5265,6 +6440,11 @@ static void video_refresh_callback_main(const void *data, unsigned width, unsign
 		sprintf(debug_text, "%.01f/%.01f/%.0f%%/%ihz/%ic", currentfps, currentreqfps,currentcpuse,currentcpuspeed,currentcputemp);
 		blitBitmapText(debug_text,x,-y,(uint32_t*)data,pitch / 4, width,height);
 
+		// frame load/frames over budget/battery draw
+		PLAT_getBatteryDraw();
+		sprintf(debug_text, "%i%%/%i/%imA", currentframeload, currentframeoverruns, currentbatterydraw);
+		blitBitmapText(debug_text,x,-y - 28,(uint32_t*)data,pitch / 4, width,height);
+
 		sprintf(debug_text, "%i/%ix%i/%ix%i/%ix%i", currentshaderpass, currentshadersrcw,currentshadersrch,currentshadertexw,currentshadertexh,currentshaderdstw,currentshaderdsth);
 		blitBitmapText(debug_text,x,-y - 14,(uint32_t*)data,pitch / 4, width,height);
 	
@@ -5283,9 +6463,14 @@ static void video_refresh_callback_main(const void *data, unsigned width, unsign
 
 	renderer.src = (void*)data;
 	renderer.dst = screen->pixels;
+	uint64_t present_start = getMicroseconds();
 	GFX_blitRenderer(&renderer);
 
+	uint64_t flip_start = getMicroseconds();
 	screen_flip(screen);
+	uint64_t present_end = getMicroseconds();
+	netplay_present_time += present_end - present_start;
+	frame_wait_time += present_end - flip_start;
 	last_flip_time = SDL_GetTicks();
 }
 
@@ -5296,6 +6481,7 @@ static Uint32* rgbaData = NULL;
 static size_t rgbaDataSize = 0;
 
 static void video_refresh_callback(const void* data, unsigned width, unsigned height, size_t pitch) {
+	if (netplay_resimulating) return; // only the frame a rollback catches up to is shown
 
 	// I need to check quit here because sometimes quit is true but callback is still called by the core after and it still runs one more frame and it looks ugly :D
 	if(!quit) {
@@ -5365,6 +6551,7 @@ static void video_refresh_callback(const void* data, unsigned width, unsigned he
 ///////////////////////////////
 
 static void audio_sample_callback(int16_t left, int16_t right) {
+	if (netplay_resimulating) return;
 	if (!fast_forward || ff_audio) {
 		if (use_core_fps || fast_forward) {
 			SND_batchSamples_fixed_rate(&(const SND_Frame){left,right}, 1);
@@ -5375,13 +6562,21 @@ static void audio_sample_callback(int16_t left, int16_t right) {
 	}
 }
 static size_t audio_sample_batch_callback(const int16_t *data, size_t frames) { 
+	if (netplay_resimulating) return frames;
 	if (!fast_forward || ff_audio) {
+		// may block on a full buffer, which isn't emulation cost either
+		uint64_t start = getMicroseconds();
+		size_t written;
 		if (use_core_fps || fast_forward) {
-			return SND_batchSamples_fixed_rate((const SND_Frame*)data, frames);
+			written = SND_batchSamples_fixed_rate((const SND_Frame*)data, frames);
 		}
 		else {
-			return SND_batchSamples((const SND_Frame*)data, frames);
+			written = SND_batchSamples((const SND_Frame*)data, frames);
 		}
+		uint64_t waited = getMicroseconds() - start;
+		netplay_present_time += waited;
+		frame_wait_time += waited;
+		return written;
 	}
 	else return frames;
 };
@@ -5508,19 +6703,30 @@ int Core_updateAVInfo(void) {
 void Core_load(void) {
 	LOG_info("Core_load\n");
 	struct retro_game_info game_info;
-	game_info.path = game.tmp_path[0]?game.tmp_path:game.path;
+	// a member read straight into memory has no file of its own, cores that go
+	// by the extension get it from libretro's usual archive.zip#member form
+	char member_path[MAX_PATH * 2];
+	if (game.tmp_path[0]) game_info.path = game.tmp_path;
+	else if (game.member[0]) {
+		snprintf(member_path, sizeof(member_path), "%s#%s", game.path, game.member);
+		game_info.path = member_path;
+	}
+	else game_info.path = game.path;
 	game_info.data = game.data;
 	game_info.size = game.size;
 	LOG_info("game path: %s (%i)\n", game_info.path, game.size);
 	core.load_game(&game_info);
 
-	if (Cheats_load())
+	if (!netplay_enabled && Cheats_load())
 		Core_applyCheats(&cheatcodes);
 
 	SRAM_read();
 	RTC_read();
 	// NOTE: must be called after core.load_game!
 	core.set_controller_port_device(0, RETRO_DEVICE_JOYPAD); // set a default, may update after loading configs
+	for (int port=1; netplay_enabled && port<netplay_players; port++) {
+		core.set_controller_port_device(port, RETRO_DEVICE_JOYPAD);
+	}
 	Core_updateAVInfo();
 }
 void Core_reset(void) {
@@ -5584,6 +6790,7 @@ static struct {
 	int total_discs;
 	int slot;
 	int save_exists;
+	int save_failed; // the last save to the slot didn't make it to disk
 	int preview_exists;
 } menu = {
 	.bitmap = NULL,
@@ -5664,6 +6871,7 @@ void Menu_beforeSleep() {
 	SRAM_write();
 	RTC_write();
 	State_autosave();
+	StateWriter_wait(); // we might not wake up again
 	putFile(AUTO_RESUME_PATH, game.path + strlen(SDCARD_PATH));
 	
 	PWR_setCPUSpeed(CPU_SPEED_MENU);
@@ -7040,6 +8248,7 @@ static void Menu_initState(void) {
 	if (menu.slot==8) menu.slot = 0;
 	
 	menu.save_exists = 0;
+	menu.save_failed = 0;
 	menu.preview_exists = 0;
 }
 static void Menu_updateState(void) {
@@ -7057,7 +8266,8 @@ static void Menu_updateState(void) {
 	sprintf(menu.bmp_path, "%s/%s.%d.bmp", menu.minui_dir, game.name, menu.slot);
 	sprintf(menu.txt_path, "%s/%s.%d.txt", menu.minui_dir, game.name, menu.slot);
 	
-	menu.save_exists = exists(save_path);
+	menu.save_exists = exists(save_path) || StateWriter_isPending(save_path);
+	menu.save_failed = StateWriter_failed(menu.slot);
 	menu.preview_exists = menu.save_exists && exists(menu.bmp_path);
 
 	// LOG_info("save_path: %s (%i)\n", save_path, menu.save_exists);
@@ -7069,16 +8279,20 @@ typedef struct {
     char* path;
 	int w;
 	int h;
+	SDL_Surface* surface; // saved as is instead of pixels when set
 } SaveImageArgs;
 
 int save_screenshot_thread(void* data) {
 
     SaveImageArgs* args = (SaveImageArgs*)data;
-	SDL_Surface* rawSurface = SDL_CreateRGBSurfaceWithFormatFrom(
-		args->pixels, args->w, args->h, 32, args->w * 4, SDL_PIXELFORMAT_ABGR8888
-	);
-	SDL_Surface* converted = SDL_ConvertSurfaceFormat(rawSurface, SDL_PIXELFORMAT_RGBA8888, 0);
-	SDL_FreeSurface(rawSurface);
+	SDL_Surface* converted = args->surface;
+	if (!converted) {
+		SDL_Surface* rawSurface = SDL_CreateRGBSurfaceWithFormatFrom(
+			args->pixels, args->w, args->h, 32, args->w * 4, SDL_PIXELFORMAT_ABGR8888
+		);
+		converted = SDL_ConvertSurfaceFormat(rawSurface, SDL_PIXELFORMAT_RGBA8888, 0);
+		SDL_FreeSurface(rawSurface);
+	}
 
     SDL_RWops* rw = SDL_RWFromFile(args->path, "wb");
     if (!rw) {
@@ -7115,7 +8329,7 @@ static void Menu_screenshot(void) {
 	sprintf(png_path, SDCARD_PATH "/Screenshots/%s.%s.png", rom_name, buffer);
 	int cw, ch;
 	unsigned char* pixels = GFX_GL_screenCapture(&cw, &ch);
-	SaveImageArgs* args = malloc(sizeof(SaveImageArgs));
+	SaveImageArgs* args = calloc(1, sizeof(SaveImageArgs));
 	args->pixels = pixels;
 	args->w = cw;
 	args->h = ch;
@@ -7136,7 +8350,7 @@ static void Menu_saveState(void) {
 	if (newScreenshot) {
 		int cw, ch;
 		unsigned char* pixels = GFX_GL_screenCapture(&cw, &ch);
-		SaveImageArgs* args = malloc(sizeof(SaveImageArgs));
+		SaveImageArgs* args = calloc(1, sizeof(SaveImageArgs));
 		args->pixels = pixels;
 		args->w = cw;
 		args->h = ch;
@@ -7145,9 +8359,12 @@ static void Menu_saveState(void) {
 		screenshotsavethread = SDL_CreateThread(save_screenshot_thread, "SaveScreenshotThread", args);
 		newScreenshot = 0;
 	} else {
-		SDL_RWops* rw = SDL_RWFromFile(menu.bmp_path, "wb");
-		IMG_SavePNG_RW(menu.bitmap, rw,1);
-		LOG_info("saved screenshot\n");
+		// menu.bitmap goes away with the menu, the thread gets its own copy
+		SaveImageArgs* args = calloc(1, sizeof(SaveImageArgs));
+		args->surface = SDL_DuplicateSurface(menu.bitmap);
+		args->path = SDL_strdup(menu.bmp_path);
+		SDL_WaitThread(screenshotsavethread, NULL);
+		screenshotsavethread = SDL_CreateThread(save_screenshot_thread, "SaveScreenshotThread", args);
 	}
 	
 	state_slot = menu.slot;
@@ -7239,6 +8456,13 @@ static void Menu_loop(void) {
 		
 	int selected = 0; // resets every launch
 	Menu_initState();
+
+	// opened because a save failed in the background, show it on its slot
+	int failed_slot = StateWriter_takeFailure();
+	if (failed_slot>=0 && failed_slot<MENU_SLOT_COUNT) {
+		selected = ITEM_SAVE;
+		menu.slot = failed_slot;
+	}
 	
 	int status = STATUS_CONT; // TODO: no longer used?
 	int show_setting = 0;
@@ -7249,6 +8473,10 @@ static void Menu_loop(void) {
 
 	//set vid.blit to null for menu drawing no need for blitrender drawing
 	GFX_clearShaders();
+
+	// or because the game's own save didn't make it to disk, it has no slot to show it on
+	if (StateWriter_takeSramFailure()) Menu_message((char*)TR("minarch.sram_failed"), (char*[]){ "A",(char*)TR("common.ok"), NULL });
+
 	while (show_menu) {
 
 		GFX_startFrame();
@@ -7329,7 +8557,7 @@ static void Menu_loop(void) {
 				break;
 				case ITEM_OPTS: {
 					if (simple_mode) {
-						core.reset();
+						if (!netplay_enabled) core.reset();
 						status = STATUS_RESET;
 						show_menu = 0;
 					}
@@ -7469,7 +8697,14 @@ static void Menu_loop(void) {
 				ox += SCALE1(WINDOW_RADIUS);
 				oy += SCALE1(WINDOW_RADIUS);
 				
-				if (menu.preview_exists) { // has save, has preview
+				if (menu.save_failed) {
+					SDL_Rect preview_rect = {ox,oy,hw,hh};
+					SDL_FillRect(screen, &preview_rect, SDL_MapRGBA(screen->format,0,0,0,255));
+					GFX_blitMessage(font.large, (char*)TR("minarch.save_failed"), screen, &preview_rect);
+				}
+				else if (menu.preview_exists) { // has save, has preview
+					SDL_WaitThread(screenshotsavethread, NULL); // it might be the one just saved
+					screenshotsavethread = NULL;
 					// lotta memory churn here
 					SDL_Surface* bmp = IMG_Load(menu.bmp_path);
 					SDL_Surface* raw_preview = SDL_ConvertSurfaceFormat(bmp, SDL_PIXELFORMAT_RGBA8888,0);
@@ -7669,6 +8904,8 @@ void onAudioSinkChanged(int device, int watch_event)
 
 int main(int argc , char* argv[]) {
 	LOG_info("MinArch\n");
+	TRACE_init("minarch");
+	TRACE_begin("startup");
 	I18N_init();
 
 	static char asoundpath[MAX_PATH];
@@ -7700,12 +8937,18 @@ int main(int argc , char* argv[]) {
 	
 	LOG_info("rom_path: %s\n", rom_path);
 	
+	TRACE_begin("GFX_init");
 	screen = GFX_init(MODE_MENU);
+	TRACE_end("GFX_init");
 
 	// initialize default shaders
+	TRACE_begin("GFX_initShaders");
 	GFX_initShaders();
+	TRACE_end("GFX_initShaders");
 
+	TRACE_begin("PAD_init");
 	PAD_init();
+	TRACE_end("PAD_init");
 	DEVICE_WIDTH = screen->w;
 	DEVICE_HEIGHT = screen->h;
 	DEVICE_PITCH = screen->pitch;
@@ -7714,27 +8957,39 @@ int main(int argc , char* argv[]) {
 	LEDS_initLeds();
 	VIB_init();
 	NET_init(&netplay_ctx, "NextUI Device");
+	TRACE_begin("PWR_init");
 	PWR_init();
+	TRACE_end("PWR_init");
 	if (!HAS_POWER_BUTTON)
 		PWR_disableSleep();
 	MSG_init();
 	IMG_Init(IMG_INIT_PNG);
+	TRACE_begin("Core_open");
 	Core_open(core_path, tag_name);
+	TRACE_end("Core_open");
 
 	fmt = RETRO_PIXEL_FORMAT_XRGB8888;
 	environment_callback(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt);
 
+	TRACE_begin("Game_open");
 	Game_open(rom_path); // nes tries to load gamegenie setting before this returns ffs
+	TRACE_end("Game_open");
 	if (!game.is_open) goto finish;
+	TRACE_counter("rom size", game.size);
 	
 	simple_mode = exists(SIMPLE_MODE_PATH);
 	
 	// restore options
+	TRACE_begin("Config_load");
 	Config_load(); // before init?
 	Config_init();
 	Config_readOptions(); // cores with boot logo option (eg. gb) need to load options early
+	TRACE_end("Config_load");
 	setOverclock(overclock);
 	
+	Netplay_init(); // before the core loads any saves
+	
+	TRACE_begin("Core_init");
 	Core_init();
 
 	// TODO: find a better place to do this
@@ -7743,11 +8998,16 @@ int main(int argc , char* argv[]) {
 	// ah, because it's defined before options_menu...
 	options_menu.items[1].desc = (char*)core.version;
 	Core_load();
+	TRACE_end("Core_init");
 	Input_init(NULL);
+	TRACE_begin("Config_readOptions");
 	Config_readOptions(); // but others load and report options later (eg. nes)
 	Config_readControls(); // restore controls (after the core has reported its defaults)
+	TRACE_end("Config_readOptions");
 
+	TRACE_begin("SND_init");
 	SND_init(core.sample_rate, core.fps);
+	TRACE_end("SND_init");
 	SND_registerDeviceWatcher(onAudioSinkChanged);
 	InitSettings(); // after we initialize audio
 	
@@ -7756,7 +9016,9 @@ int main(int argc , char* argv[]) {
 		VIB_singlePulse(VIB_bootStrength, VIB_bootDuration_ms);
 	
 	Menu_init();
+	TRACE_begin("State_resume");
 	State_resume();
+	TRACE_end("State_resume");
 	Menu_initState(); // make ready for state shortcuts
 
 	PWR_warn(1);
@@ -7786,17 +9048,46 @@ int main(int argc , char* argv[]) {
 
 	// then initialize custom  shaders from settings
 	
+	TRACE_begin("initShaders");
 	initShaders();
 	Config_readOptions();
 	applyShaderSettings();
+	TRACE_end("initShaders");
 	// release config when all is loaded
 	Config_free();
+	Perf_load(); // after shaders
 
 	LOG_info("total startup time %ims\n\n",SDL_GetTicks());
+	TRACE_end("startup");
+	TRACE_begin("first frame");
+	int first_frame = 1;
 	while (!quit) {
 		GFX_startFrame();
 	
-		core.run();
+		if (Netplay_beginFrame()) {
+			uint64_t run_start = getMicroseconds();
+			frame_wait_time = 0;
+			core.run();
+			if (!fast_forward && core.fps>0) {
+				// what the frame cost to emulate and draw, waiting on vsync or audio is free time
+				int budget = 1000000 / core.fps;
+				int work = getMicroseconds() - run_start - frame_wait_time;
+				int load = work * 100 / budget;
+				currentframeload = frames_timed ? (currentframeload * 7 + load) / 8 : load;
+				if (work>budget) currentframeoverruns += 1;
+				frames_timed += 1;
+				Perf_frame(work);
+				PLAT_frameTime(work, budget);
+			}
+			Netplay_endFrame();
+		}
+		if (first_frame) {
+			first_frame = 0;
+			TRACE_counter("option lookups", option_lookups.count);
+			TRACE_counter("option lookup us", option_lookups.ns / 1000);
+			TRACE_end("first frame");
+			TRACE_flush();
+		}
 		limitFF();
 		trackFPS();
 		
@@ -7828,6 +9119,7 @@ int main(int argc , char* argv[]) {
 		}
 
 		hdmimon();
+		SRAM_autosave();
 	}
 	int cw, ch;
 	unsigned char* pixels = GFX_GL_screenCapture(&cw, &ch);
@@ -7846,16 +9138,20 @@ int main(int argc , char* argv[]) {
 	if(rgbaData) free(rgbaData);
 
 	PLAT_clearTurbo();
+	if (frames_timed) LOG_info("frame time: %i of %i frames over budget\n", currentframeoverruns, frames_timed);
+	Perf_save();
 
 	Menu_quit();
 	QuitSettings();
 	
 finish:
 
+	StateWriter_quit();
 	Game_close();
 	Core_unload();
 	Core_quit();
 	Core_close();
+	SRAM_quit();
 	Config_quit();
 	Special_quit();
 	MSG_quit();
@@ -7870,5 +9166,6 @@ finish:
 	PAD_quit();
 	GFX_quit();
 	SDL_WaitThread(screenshotsavethread, NULL);
+	TRACE_flush();
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,363 @@
+// plays netplay sessions against itself over loopback, with a stand-in core
+// whose state is a hash of every input it ran and the network slowed down by
+// NET_simulate_network, eg.
+// netplaytest.elf            (every scenario)
+// netplaytest.elf rollback
+// both players have to end on the same state without a desync, exits 1 if not.
+// The state scenarios also resync the client from the host twice, a full
+// state then a delta, with states the size of a SNES and a PS1 core's.
+// The loss scenarios play over TCP and over UDP with the same datagrams
+// lost, the UDP ones also have to measure the loss on the link
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "netplay.h"
+
+#define MIN(a, b) ((a)<(b) ? (a) : (b))
+
+#define TEST_FRAMES 600
+#define TEST_FRAME_MS (1000.0 / 60)
+#define TEST_TIMEOUT (TEST_FRAMES * TEST_FRAME_MS * 8) // ms
+#define TEST_CHECKSUM_INTERVAL 60 // frames, as minarch
+#define TEST_STATE_FULL 60 // frame the host sends its whole state
+#define TEST_STATE_DELTA 300 // and a delta against it
+#define TEST_STATE_CHANGED 2 // % of the state that differs by then
+
+typedef struct Scenario {
+	const char* name;
+	int delay; // frames
+	int rollback; // frames, 0 is lockstep
+	int udp; // input, TCP otherwise
+	int latency; // ms, each way
+	int jitter; // ms
+	int loss; // %
+	int state_size; // KB, resynced twice, 0 is none
+} Scenario;
+
+static Scenario scenarios[] = {
+	{"lockstep", 2, 0, 0, 40, 30, 0, 0},
+	{"rollback", 1, 7, 0, 40, 30, 0, 0},
+	{"rollback-far", 0, 7, 0, 80, 40, 0, 0},
+	{"state-snes", 2, 0, 0, 3, 2, 0, 512},
+	{"state-ps1", 2, 0, 0, 3, 2, 0, 4608},
+	{"tcp-loss", 2, 0, 0, 20, 5, 5, 0},
+	{"udp-loss", 2, 0, 1, 20, 5, 5, 0},
+	{"udp-loss-heavy", 2, 0, 1, 20, 5, 20, 0},
+	{"udp-rollback-loss", 1, 7, 1, 20, 5, 10, 0},
+};
+
+typedef struct Player {
+	netplay_context_t ctx;
+	uint32_t state;
+	uint32_t snapshots[NETPLAY_MAX_ROLLBACK];
+	uint32_t snapshot_frames[NETPLAY_MAX_ROLLBACK];
+	uint32_t next_check;
+	uint32_t seed;
+	uint32_t held;
+	Scenario* scenario;
+	double stalled; // ms waiting on the other player
+	int missing; // rollbacks without a snapshot to go back to
+	int loaded; // states from the host
+	volatile int done; // played every frame and has the other's input for them
+} Player;
+
+// host, the state last sent and when. The client can't get more than the
+// input delay behind, it has loaded a state before the host changes it
+static struct {
+	uint8_t* data;
+	int size;
+	int sent;
+	uint32_t frame;
+	uint32_t encoded_size;
+	double started;
+	int corrupt; // the client loaded something else
+} resync;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1e6;
+}
+
+static int desyncs;
+static void onDesync(uint32_t frame, int port) {
+	printf("  desync at frame %u (player %i)\n", frame, port + 1);
+	__sync_add_and_fetch(&desyncs, 1);
+}
+
+// the stand-in core, every input of every port changes the state
+static void runFrame(Player* p) {
+	for (int port=0; port<p->ctx.session.players; port++) {
+		const netplay_input_t* input = NET_frame_input(&p->ctx, port);
+		p->state = p->state * 31 + (input ? input->buttons : 0) * 7 + port;
+	}
+}
+
+// what a core's state looks like, runs of zeros, of code and of noise
+static void fillState(uint8_t* data, int size) {
+	FILE* file = fopen("/proc/self/exe", "rb");
+	uint8_t code[65536];
+	int code_size = file ? fread(code, 1, sizeof(code), file) : 0;
+	if (file) fclose(file);
+	srand(size);
+	for (int i=0; i<size;) {
+		int run = 1024 + rand() % 16384;
+		run = MIN(run, size - i);
+		int kind = rand() % 3;
+		for (int j=0; j<run; j++) {
+			if (kind==0) data[i+j] = 0;
+			else if (kind==1 && code_size) data[i+j] = code[(i+j) % code_size];
+			else data[i+j] = rand();
+		}
+		i += run;
+	}
+}
+static void changeState(uint8_t* data, int size, int percent) {
+	for (int changed=0; changed<size/100*percent;) {
+		int at = rand() % size;
+		int run = 1 + rand() % 64;
+		run = MIN(run, size - at);
+		for (int j=0; j<run; j++) data[at+j] ^= 1 + rand() % 255;
+		changed += run;
+	}
+}
+
+// like minarch's Netplay_sendState, the state's first bytes are the stand-in core's
+static void sendState(Player* p) {
+	Scenario* s = p->scenario;
+	netplay_session_t* session = &p->ctx.session;
+	if (!s->state_size || (session->frame!=TEST_STATE_FULL && session->frame!=TEST_STATE_DELTA)) return;
+
+	if (!resync.data) {
+		resync.size = s->state_size * 1024;
+		resync.data = malloc(resync.size);
+		fillState(resync.data, resync.size);
+	}
+	else changeState(resync.data, resync.size, TEST_STATE_CHANGED);
+	memcpy(resync.data, &p->state, sizeof(p->state));
+
+	resync.frame = session->frame;
+	double started = now();
+	if (NET_send_state(&p->ctx, resync.data, resync.size, resync.frame)<0) return;
+	resync.sent += 1;
+	resync.encoded_size = p->ctx.state_tx.encoded_size;
+	resync.started = started;
+}
+static void sentState(Player* p) {
+	if (!resync.started || NET_state_busy(&p->ctx)) return;
+	printf("  state %i, %s %i -> %u bytes, delivered in %.0f ms\n", resync.sent, resync.sent==1 ? "full" : "delta", resync.size, resync.encoded_size, now() - resync.started);
+	resync.started = 0;
+}
+// and its Netplay_receiveState
+static void receiveState(Player* p) {
+	int size;
+	uint32_t frame;
+	const uint8_t* state = NET_received_state(&p->ctx, &size, &frame);
+	if (!state) return;
+
+	if (size!=resync.size || frame!=resync.frame || memcmp(state, resync.data, size)) resync.corrupt += 1;
+	uint32_t to = p->ctx.session.frame;
+	memcpy(&p->state, state, sizeof(p->state));
+	p->ctx.session.frame = frame;
+	while (p->ctx.session.frame<to) {
+		runFrame(p);
+		NET_advance_frame(&p->ctx);
+	}
+	p->next_check = (frame + TEST_CHECKSUM_INTERVAL - 1) / TEST_CHECKSUM_INTERVAL * TEST_CHECKSUM_INTERVAL;
+	p->loaded += 1;
+	NET_state_applied(&p->ctx);
+}
+
+static void saveSnapshot(Player* p) {
+	uint32_t frame = p->ctx.session.frame;
+	p->snapshots[frame % NETPLAY_MAX_ROLLBACK] = p->state;
+	p->snapshot_frames[frame % NETPLAY_MAX_ROLLBACK] = frame;
+}
+
+// what minarch's Netplay_beginFrame/endFrame do around core.run,
+// returns 0 when the frame has to wait on the other player
+static int step(Player* p) {
+	Scenario* s = p->scenario;
+	netplay_session_t* session = &p->ctx.session;
+	// held buttons change now and then, like a player's
+	p->seed = p->seed * 1103515245 + 12345;
+	if (((p->seed >> 16) & 15)==0) p->held = (p->seed >> 20) & 0xFFF;
+	netplay_input_t input = {.buttons = p->held};
+	NET_submit_input(&p->ctx, &input);
+	NET_wait(&p->ctx, NET_frame_ready(&p->ctx) ? 0 : 4);
+	receiveState(p);
+
+	uint32_t from;
+	uint32_t to = session->frame;
+	if (s->rollback && NET_rollback(&p->ctx, &from)) {
+		int i = from % NETPLAY_MAX_ROLLBACK;
+		if (p->snapshot_frames[i]==from) {
+			p->state = p->snapshots[i];
+			while (session->frame<to) {
+				saveSnapshot(p);
+				runFrame(p);
+				NET_advance_frame(&p->ctx);
+			}
+		}
+		else {
+			p->missing += 1;
+			session->frame = to;
+		}
+	}
+	if (!NET_frame_ready(&p->ctx)) return 0;
+
+	saveSnapshot(p);
+	while (p->next_check<=session->confirmed && p->next_check<=session->frame) {
+		int i = p->next_check % NETPLAY_MAX_ROLLBACK;
+		if (p->snapshot_frames[i]==p->next_check) NET_submit_checksum(&p->ctx, p->next_check, p->snapshots[i]);
+		p->next_check += TEST_CHECKSUM_INTERVAL;
+	}
+	if (p->ctx.role==NETPLAY_ROLE_HOST) sendState(p);
+	runFrame(p);
+	NET_advance_frame(&p->ctx);
+	return 1;
+}
+
+// each player on its own thread, like on its own device, at 60fps
+static volatile int stop;
+static void* play(void* arg) {
+	Player* p = arg;
+	netplay_session_t* session = &p->ctx.session;
+	double next = now();
+	while (!stop) {
+		if (p->ctx.role==NETPLAY_ROLE_HOST) sentState(p);
+		if (session->frame>=TEST_FRAMES) {
+			p->done = session->confirmed>=TEST_FRAMES;
+			NET_wait(&p->ctx, 4); // keep acking for the other player
+			continue;
+		}
+
+		double start = now();
+		if (!step(p)) {
+			p->stalled += now() - start;
+			next = now();
+			continue;
+		}
+		next += TEST_FRAME_MS; // vsync
+		double wait = next - now();
+		if (wait>0) usleep(wait * 1000);
+		else next = now();
+	}
+	return NULL;
+}
+
+static Player host;
+static Player client;
+static int connected;
+static void* connectClient(void* arg) {
+	(void)arg;
+	connected = NET_connect_to_host(&client.ctx, "127.0.0.1")>=0;
+	return NULL;
+}
+
+static int startSession(Scenario* s) {
+	memset(&host, 0, sizeof(host));
+	memset(&client, 0, sizeof(client));
+	NET_init(&host.ctx, "host");
+	NET_init(&client.ctx, "client");
+	host.ctx.on_desync = client.ctx.on_desync = onDesync;
+	host.seed = 1;
+	client.seed = 2;
+	host.scenario = client.scenario = s;
+	NET_enable_udp(&host.ctx, s->udp);
+	if (NET_start_hosting(&host.ctx)<0) return 0;
+
+	pthread_t thread;
+	connected = 0;
+	pthread_create(&thread, NULL, connectClient, NULL);
+	for (int i=0; i<300 && host.ctx.client_count<1; i++) NET_wait(&host.ctx, 10);
+	pthread_join(thread, NULL);
+	if (!connected) return 0;
+
+	NET_set_rollback(&host.ctx, s->rollback);
+	NET_set_rollback(&client.ctx, s->rollback);
+	if (NET_start_session(&host.ctx, s->delay, false)<0) return 0;
+	for (int i=0; i<100 && !NET_session_active(&client.ctx); i++) NET_wait(&client.ctx, 10);
+	if (!NET_session_active(&client.ctx)) return 0;
+
+	NET_simulate_network(&host.ctx, s->latency, s->jitter, s->loss, 7);
+	NET_simulate_network(&client.ctx, s->latency, s->jitter, s->loss, 11);
+	return 1;
+}
+static void endSession(void) {
+	NET_quit(&client.ctx);
+	NET_quit(&host.ctx);
+}
+
+static int runScenario(Scenario* s) {
+	printf("%s: delay %i, rollback %i, %s, latency %i+-%ims, loss %i%%\n", s->name, s->delay, s->rollback, s->udp ? "udp" : "tcp", s->latency, s->jitter, s->loss);
+	desyncs = 0;
+	free(resync.data);
+	memset(&resync, 0, sizeof(resync));
+	if (!startSession(s)) {
+		printf("  FAIL couldn't start a loopback session\n");
+		endSession();
+		return 0;
+	}
+
+	double start = now();
+	pthread_t threads[2];
+	stop = 0;
+	pthread_create(&threads[0], NULL, play, &host);
+	pthread_create(&threads[1], NULL, play, &client);
+	while (now() - start<TEST_TIMEOUT && !(host.done && client.done)) usleep(10000);
+	double elapsed = now() - start;
+	stop = 1;
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+
+	// a rollback that finished late still has to agree with the other side
+	int ok = host.done && client.done && host.state==client.state && !desyncs && !host.missing && !client.missing;
+	if (s->state_size) ok = ok && resync.sent==2 && client.loaded==2 && !resync.corrupt;
+
+	// input went over UDP, and the acks and echoes measured the link
+	netplay_link_stats_t host_link;
+	netplay_link_stats_t client_link;
+	NET_get_link_stats(&host.ctx, &host_link);
+	NET_get_link_stats(&client.ctx, &client_link);
+	if (s->udp) {
+		printf("  udp link, rtt %u/%u ms, loss %u/%u%%\n", host_link.rtt_ms, client_link.rtt_ms, host_link.loss_pct, client_link.loss_pct);
+		ok = ok && host_link.udp && client_link.udp && host_link.rtt_ms>0 && client_link.rtt_ms>0;
+		if (s->loss) ok = ok && host_link.loss_pct>0 && client_link.loss_pct>0;
+	}
+	printf("  %i frames in %.0f ms, stalled %.0f/%.0f ms, rollbacks %u/%u, resimulated %u/%u, state %08x/%08x, desyncs %i, %s\n",
+		TEST_FRAMES, elapsed, host.stalled, client.stalled,
+		host.ctx.session.rollbacks, client.ctx.session.rollbacks,
+		host.ctx.session.resimulated, client.ctx.session.resimulated,
+		host.state, client.state, desyncs, ok ? "ok" : "FAIL"
+	);
+	endSession();
+	return ok;
+}
+
+int main(int argc, char* argv[]) {
+	int count = sizeof(scenarios) / sizeof(scenarios[0]);
+	int failed = 0;
+	int ran = 0;
+	for (int i=0; i<count; i++) {
+		int wanted = argc<2;
+		for (int j=1; j<argc; j++) {
+			if (!strcmp(argv[j], scenarios[i].name)) wanted = 1;
+		}
+		if (!wanted) continue;
+		if (!runScenario(&scenarios[i])) failed += 1;
+		ran += 1;
+	}
+	if (!ran) {
+		fprintf(stderr, "usage: %s [scenario...], one of:", argv[0]);
+		for (int i=0; i<count; i++) fprintf(stderr, " %s", scenarios[i].name);
+		fprintf(stderr, "\n");
+		return 1;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+// measures the savestate codecs on real state dumps, eg.
+// statebench.elf /mnt/SDCARD/.userdata/tg5040/PS-pcsx_rearmed/*.st0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "statecodec.h"
+
+#define BENCH_RUNS 5
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* readState(const char* path, size_t* size) {
+	FILE* file = fopen(path, "r");
+	if (!file) return NULL;
+	fseek(file, 0, SEEK_END);
+	size_t len = ftell(file);
+	rewind(file);
+	void* data = malloc(len ? len : 1);
+	if (data && fread(data, 1, len, file)!=len) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	if (!data) return NULL;
+
+	// already encoded dumps are benchmarked on what they decode to
+	size_t decoded_size;
+	if (StateCodec_detect(data, len, &decoded_size)) {
+		void* decoded = malloc(decoded_size ? decoded_size : 1);
+		if (!decoded || !StateCodec_decode(data, len, decoded, decoded_size)) {
+			free(decoded);
+			free(data);
+			return NULL;
+		}
+		free(data);
+		data = decoded;
+		len = decoded_size;
+	}
+	*size = len;
+	return data;
+}
+
+typedef struct Result {
+	size_t in;
+	size_t out;
+	double encode;
+	double decode;
+} Result;
+
+static void report(const char* name, Result* r) {
+	printf("%-10s ratio %5.2f  compress %7.1f MB/s  decompress %7.1f MB/s\n", name,
+		r->out ? (double)r->in / r->out : 0,
+		r->encode>0 ? r->in / r->encode / 1e6 : 0,
+		r->decode>0 ? r->in / r->decode / 1e6 : 0
+	);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc<2) {
+		fprintf(stderr, "usage: %s state...\n", argv[0]);
+		return 1;
+	}
+
+	// rzip is chunked deflate at zlib's default level, close enough to compare against
+	Result zlib = {0};
+	Result codecs[STATE_CODEC_COUNT] = {0};
+	for (int i=1; i<argc; i++) {
+		size_t size;
+		uint8_t* state = readState(argv[i], &size);
+		if (!state) {
+			fprintf(stderr, "can't read %s\n", argv[i]);
+			continue;
+		}
+		uint8_t* check = malloc(size ? size : 1);
+
+		uLongf zlib_size = compressBound(size);
+		uint8_t* packed = malloc(zlib_size);
+		double start = now();
+		for (int run=0; run<BENCH_RUNS; run++) {
+			zlib_size = compressBound(size);
+			compress2(packed, &zlib_size, state, size, Z_DEFAULT_COMPRESSION);
+		}
+		zlib.encode += (now() - start) / BENCH_RUNS;
+		start = now();
+		for (int run=0; run<BENCH_RUNS; run++) {
+			uLongf len = size;
+			uncompress(check, &len, packed, zlib_size);
+		}
+		zlib.decode += (now() - start) / BENCH_RUNS;
+		zlib.in += size;
+		zlib.out += zlib_size;
+		free(packed);
+
+		for (int codec=STATE_CODEC_NONE + 1; codec<STATE_CODEC_COUNT; codec++) {
+			Result* r = &codecs[codec];
+			size_t capacity = StateCodec_bound(codec, size);
+			packed = malloc(capacity);
+			size_t len = 0;
+			start = now();
+			for (int run=0; run<BENCH_RUNS; run++) len = StateCodec_encode(codec, state, size, packed, capacity);
+			r->encode += (now() - start) / BENCH_RUNS;
+
+			int ok = 1;
+			start = now();
+			for (int run=0; run<BENCH_RUNS; run++) ok = ok && StateCodec_decode(packed, len, check, size);
+			r->decode += (now() - start) / BENCH_RUNS;
+			if (!len || !ok || memcmp(state, check, size)) fprintf(stderr, "%s round trip failed on %s\n", StateCodec_name(codec), argv[i]);
+
+			r->in += size;
+			r->out += len;
+			free(packed);
+		}
+		free(check);
+		free(state);
+	}
+
+	report("zlib/rzip", &zlib);
+	for (int codec=STATE_CODEC_NONE + 1; codec<STATE_CODEC_COUNT; codec++) report(StateCodec_name(codec), &codecs[codec]);
+	return 0;
+}
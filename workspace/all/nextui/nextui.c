@@ -1,7 +1,10 @@
+#define _GNU_SOURCE // for syscall
 #include <stdio.h>
 #include <stdlib.h>
 #include <msettings.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <dirent.h>
 #include <ctype.h>
 #include <unistd.h>
@@ -13,10 +16,34 @@
 #include "utils.h"
 #include "config.h"
 #include "i18n.h"
+#include <sqlite3.h>
+#include <gametimedb.h>
 #include <sys/resource.h>
 #include <pthread.h>
 #include <assert.h>
 #include <limits.h>
+#include <sys/syscall.h>
+
+///////////////////////////////////////
+
+// background work parks here while a resident launch runs a game,
+// so the game doesn't share the cpu and sd card with the menu
+static pthread_mutex_t workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_cond = PTHREAD_COND_INITIALIZER;
+static volatile int workers_paused = 0;
+
+static void Workers_pause(int pause) {
+	pthread_mutex_lock(&workers_mutex);
+	workers_paused = pause;
+	pthread_cond_broadcast(&workers_cond);
+	pthread_mutex_unlock(&workers_mutex);
+}
+static void Workers_checkpoint(void) {
+	if (!workers_paused) return;
+	pthread_mutex_lock(&workers_mutex);
+	while (workers_paused) pthread_cond_wait(&workers_cond, &workers_mutex);
+	pthread_mutex_unlock(&workers_mutex);
+}
 
 ///////////////////////////////////////
 
@@ -429,36 +456,53 @@ static Array* getCollection(char* path);
 static Array* getDiscs(char* path);
 static Array* getEntries(char* path);
 
-static Directory* Directory_new(char* path, int selected) {
-	char display_name[256];
-	getDisplayName(path, display_name);
-	
-	Directory* self = malloc(sizeof(Directory));
-	self->path = strdup(path);
-	self->name = strdup(display_name);
+static Array* getDirectoryEntries(char* path) {
 	if (exactMatch(path, SDCARD_PATH)) {
-		self->entries = getRoot();
+		return getRoot();
 	}
 	else if (exactMatch(path, FAUX_RECENT_PATH)) {
-		self->entries = getRecents();
+		return getRecents();
 	}
 	else if (exactMatch(path, ROMS_PATH)) {
-		self->entries = getRoms();
+		return getRoms();
 	}
 	else if (!exactMatch(path, COLLECTIONS_PATH) && prefixMatch(COLLECTIONS_PATH, path) && suffixMatch(".txt", path)) {
-		self->entries = getCollection(path);
+		return getCollection(path);
 	}
 	else if (suffixMatch(".m3u", path)) {
-		self->entries = getDiscs(path);
+		return getDiscs(path);
 	}
 	else {
-		self->entries = getEntries(path);
+		return getEntries(path);
 	}
+}
+
+static Directory* Directory_new(char* path, int selected) {
+	char display_name[256];
+	getDisplayName(path, display_name);
+	
+	Directory* self = malloc(sizeof(Directory));
+	self->path = strdup(path);
+	self->name = strdup(display_name);
+	self->entries = getDirectoryEntries(path);
 	self->alphas = IntArray_new();
 	self->selected = selected;
 	Directory_index(self);
 	return self;
 }
+static void Directory_refresh(Directory* self) { // keeps the selection where it can
+	EntryArray_free(self->entries);
+	IntArray_free(self->alphas);
+	self->entries = getDirectoryEntries(self->path);
+	self->alphas = IntArray_new();
+	Directory_index(self);
+
+	int count = self->entries->count;
+	if (self->selected>=count) self->selected = count>0 ? count-1 : 0;
+	if (self->selected<self->start || self->selected>=self->start+MAIN_ROW_COUNT) self->start = self->selected;
+	self->end = MIN(count, self->start + MAIN_ROW_COUNT);
+	self->start = MAX(0, self->end - MAIN_ROW_COUNT);
+}
 static void Directory_free(Directory* self) {
 	free(self->path);
 	free(self->name);
@@ -488,19 +532,21 @@ typedef struct Recent {
 static char* recent_alias = NULL;
 
 static int hasEmu(char* emu_name);
-static Recent* Recent_new(char* path, char* alias) {
+static Recent* Recent_alloc(char* path, char* alias, int available) {
 	Recent* self = malloc(sizeof(Recent));
-
+	self->path = strdup(path);
+	self->alias = alias ? strdup(alias) : NULL;
+	self->available = available;
+	return self;
+}
+static Recent* Recent_new(char* path, char* alias) {
 	char sd_path[256]; // only need to get emu name
 	sprintf(sd_path, "%s%s", SDCARD_PATH, path);
 
 	char emu_name[256];
 	getEmuName(sd_path, emu_name);
 	
-	self->path = strdup(path);
-	self->alias = alias ? strdup(alias) : NULL;
-	self->available = hasEmu(emu_name);
-	return self;
+	return Recent_alloc(path, alias, hasEmu(emu_name));
 }
 static void Recent_free(Recent* self) {
 	free(self->path);
@@ -521,6 +567,16 @@ static void RecentArray_free(Array* self) {
 	}
 	Array_free(self);
 }
+static int RecentArray_equals(Array* self, Array* other) {
+	if (self->count!=other->count) return 0;
+	for (int i=0; i<self->count; i++) {
+		Recent* a = self->items[i];
+		Recent* b = other->items[i];
+		if (!exactMatch(a->path, b->path) || a->available!=b->available) return 0;
+		if (!a->alias!=!b->alias || (a->alias && !exactMatch(a->alias, b->alias))) return 0;
+	}
+	return 1;
+}
 
 ///////////////////////////////////////
 
@@ -549,6 +605,38 @@ static int startgame = 0;
 ///////////////////////////////////////
 
 #define MAX_RECENTS 24 // a multiple of all menu rows
+
+// recent.txt is shared between platforms but emu availability isn't, so the
+// checked list lives next to the other per-platform userdata. It is only
+// trusted while recent.txt still has the mtime and size it was written for.
+#define RECENT_CACHE_PATH USERDATA_PATH "/recent.cache"
+
+static SDL_mutex* recentsMutex = NULL;
+static Array* checked_recents = NULL; // RecentArray, handed over by RecentsCheckWorker
+static int checked_rewrite = 0;
+static int checked_generation = 0;
+static int recents_generation = 0; // bumped every time recent.txt is written
+static int recents_cached = 0;
+static _Atomic int recentschecked = 0; // set by RecentsCheckWorker, polled by the main loop
+static char change_disc_path[256];
+
+static void saveRecentsCache(void) {
+	struct stat st;
+	if (stat(RECENT_PATH, &st)!=0) return;
+
+	FILE* file = fopen(RECENT_CACHE_PATH, "w");
+	if (file) {
+		fprintf(file, "%lld %lld\n", (long long)st.st_mtime, (long long)st.st_size);
+		for (int i=0; i<recents->count; i++) {
+			Recent* recent = recents->items[i];
+			fprintf(file, "%i\t%s", recent->available, recent->path);
+			if (recent->alias) fprintf(file, "\t%s", recent->alias);
+			putc('\n', file);
+		}
+		fclose(file);
+		recents_cached = 1;
+	}
+}
 static void saveRecents(void) {
 	FILE* file = fopen(RECENT_PATH, "w");
 	if (file) {
@@ -562,7 +650,9 @@ static void saveRecents(void) {
 			putc('\n', file);
 		}
 		fclose(file);
+		saveRecentsCache();
 	}
+	recents_generation += 1;
 }
 static void addRecent(char* path, char* alias) {
 	path += strlen(SDCARD_PATH); // makes paths platform agnostic
@@ -647,21 +737,17 @@ static int hasM3u(char* rom_path, char* m3u_path) { // NOTE: rom_path not dir_pa
 	return exists(m3u_path);
 }
 
-static int hasRecents(void) {
-	LOG_info("hasRecents %s\n", RECENT_PATH);
-	int has = 0;
-	RecentArray_free(recents);
-	recents = Array_new();
-
+// the full check, stats every entry so it only ever runs on RecentsCheckWorker
+static Array* checkRecents(int* rewrite) {
+	Array* checked = Array_new();
 	Array* parent_paths = Array_new();
-	if (exists(CHANGE_DISC_PATH)) {
-		char sd_path[256];
-		getFile(CHANGE_DISC_PATH, sd_path, 256);
-		if (exists(sd_path)) {
-			char* disc_path = sd_path + strlen(SDCARD_PATH); // makes path platform agnostic
-			Recent* recent = Recent_new(disc_path, NULL);
-			if (recent->available) has += 1;
-			Array_push(recents, recent);
+	*rewrite = 0;
+
+	if (change_disc_path[0]) {
+		*rewrite = 1;
+		if (exists(change_disc_path)) {
+			char* disc_path = change_disc_path + strlen(SDCARD_PATH); // makes path platform agnostic
+			Array_push(checked, Recent_new(disc_path, NULL));
 		
 			char parent_path[256];
 			strcpy(parent_path, disc_path);
@@ -669,18 +755,19 @@ static int hasRecents(void) {
 			tmp[0] = '\0';
 			Array_push(parent_paths, strdup(parent_path));
 		}
-		unlink(CHANGE_DISC_PATH);
 	}
 
 	FILE *file = fopen(RECENT_PATH, "r"); // newest at top
 	if (file) {
 		char line[256];
 		while (fgets(line,256,file)!=NULL) {
+			Workers_checkpoint();
 			normalizeNewline(line);
 			trimTrailingNewlines(line);
-			if (strlen(line)==0) continue; // skip empty lines
-			
-			// LOG_info("line: %s\n", line);
+			if (strlen(line)==0) { // skip empty lines
+				*rewrite = 1;
+				continue;
+			}
 			
 			char* path = line;
 			char* alias = NULL;
@@ -692,44 +779,162 @@ static int hasRecents(void) {
 			
 			char sd_path[256];
 			sprintf(sd_path, "%s%s", SDCARD_PATH, path);
-			if (exists(sd_path)) {
-				if (recents->count<MAX_RECENTS) {
-					// this logic replaces an existing disc from a multi-disc game with the last used
-					char m3u_path[256];
-					if (hasM3u(sd_path, m3u_path)) { // TODO: this might tank launch speed
-						char parent_path[256];
-						strcpy(parent_path, path);
-						char* tmp = strrchr(parent_path, '/') + 1;
-						tmp[0] = '\0';
-						
-						int found = 0;
-						for (int i=0; i<parent_paths->count; i++) {
-							char* path = parent_paths->items[i];
-							if (prefixMatch(path, parent_path)) {
-								found = 1;
-								break;
-							}
-						}
-						if (found) continue;
-						
-						Array_push(parent_paths, strdup(parent_path));
+			if (!exists(sd_path) || checked->count>=MAX_RECENTS) {
+				*rewrite = 1;
+				continue;
+			}
+
+			// this logic replaces an existing disc from a multi-disc game with the last used
+			char m3u_path[256];
+			if (hasM3u(sd_path, m3u_path)) {
+				char parent_path[256];
+				strcpy(parent_path, path);
+				char* tmp = strrchr(parent_path, '/') + 1;
+				tmp[0] = '\0';
+				
+				int found = 0;
+				for (int i=0; i<parent_paths->count; i++) {
+					char* path = parent_paths->items[i];
+					if (prefixMatch(path, parent_path)) {
+						found = 1;
+						break;
 					}
-					
-					// LOG_info("path:%s alias:%s\n", path, alias);
-					
-					Recent* recent = Recent_new(path, alias);
-					if (recent->available) has += 1;
-					Array_push(recents, recent);
 				}
+				if (found) {
+					*rewrite = 1;
+					continue;
+				}
+				
+				Array_push(parent_paths, strdup(parent_path));
 			}
+			
+			Array_push(checked, Recent_new(path, alias));
 		}
 		fclose(file);
 	}
 	
-	saveRecents();
-	
 	StringArray_free(parent_paths);
-	return has>0;
+	return checked;
+}
+int RecentsCheckWorker(void* unused) {
+	int rewrite;
+	Array* checked = checkRecents(&rewrite);
+
+	SDL_LockMutex(recentsMutex);
+	checked_recents = checked;
+	checked_rewrite = rewrite;
+	SDL_UnlockMutex(recentsMutex);
+
+	recentschecked = 1;
+	PAD_interruptWait();
+	return 0;
+}
+
+// fills recents without touching anything but recent.txt and the cache,
+// the first frame shouldn't wait on a stat() per entry
+static void loadRecents(void) {
+	LOG_info("loadRecents %s\n", RECENT_PATH);
+	recents = Array_new();
+	recentsMutex = SDL_CreateMutex();
+
+	change_disc_path[0] = '\0';
+	if (exists(CHANGE_DISC_PATH)) {
+		getFile(CHANGE_DISC_PATH, change_disc_path, sizeof(change_disc_path));
+		unlink(CHANGE_DISC_PATH);
+	}
+
+	struct stat st;
+	if (!change_disc_path[0] && stat(RECENT_PATH, &st)==0) {
+		FILE* file = fopen(RECENT_CACHE_PATH, "r");
+		if (file) {
+			char line[256];
+			long long mtime, size;
+			if (fgets(line, 256, file) && sscanf(line, "%lld %lld", &mtime, &size)==2 && mtime==st.st_mtime && size==st.st_size) {
+				recents_cached = 1;
+				while (fgets(line, 256, file)!=NULL) {
+					normalizeNewline(line);
+					trimTrailingNewlines(line);
+					char* path = strchr(line, '\t');
+					if (!path) continue;
+					*path++ = '\0';
+					char* alias = strchr(path, '\t');
+					if (alias) *alias++ = '\0';
+					Array_push(recents, Recent_alloc(path, alias, atoi(line)));
+				}
+			}
+			fclose(file);
+		}
+	}
+
+	if (!recents_cached) {
+		// assume everything is still there until RecentsCheckWorker says otherwise
+		if (change_disc_path[0] && prefixMatch(SDCARD_PATH, change_disc_path))
+			Array_push(recents, Recent_alloc(change_disc_path + strlen(SDCARD_PATH), NULL, 1));
+
+		FILE* file = fopen(RECENT_PATH, "r");
+		if (file) {
+			char line[256];
+			while (fgets(line, 256, file)!=NULL && recents->count<MAX_RECENTS) {
+				normalizeNewline(line);
+				trimTrailingNewlines(line);
+				if (strlen(line)==0) continue;
+				char* alias = strchr(line, '\t');
+				if (alias) *alias++ = '\0';
+				Array_push(recents, Recent_alloc(line, alias, 1));
+			}
+			fclose(file);
+		}
+	}
+
+	checked_generation = recents_generation;
+	SDL_CreateThread(RecentsCheckWorker, "RecentsCheckWorker", NULL);
+}
+// same check as on boot, for when a game returns to a resident nextui
+// (minarch may have left a change disc request behind)
+static void recheckRecents(void) {
+	change_disc_path[0] = '\0';
+	if (exists(CHANGE_DISC_PATH)) {
+		getFile(CHANGE_DISC_PATH, change_disc_path, sizeof(change_disc_path));
+		unlink(CHANGE_DISC_PATH);
+	}
+
+	checked_generation = recents_generation;
+	SDL_CreateThread(RecentsCheckWorker, "RecentsCheckWorker", NULL);
+}
+
+// takes the result of RecentsCheckWorker, returns 1 if recents changed
+static int applyCheckedRecents(void) {
+	SDL_LockMutex(recentsMutex);
+	Array* checked = checked_recents;
+	int rewrite = checked_rewrite;
+	checked_recents = NULL;
+	SDL_UnlockMutex(recentsMutex);
+	if (!checked) return 0;
+
+	// a game was added or removed in the meantime, recent.txt already has the newer list
+	if (recents_generation!=checked_generation) {
+		RecentArray_free(checked);
+		return 0;
+	}
+
+	int changed = !RecentArray_equals(recents, checked);
+	if (changed) {
+		RecentArray_free(recents);
+		recents = checked;
+	}
+	else RecentArray_free(checked);
+
+	if (rewrite) saveRecents();
+	else if (changed || !recents_cached) saveRecentsCache();
+	return changed;
+}
+
+static int hasRecents(void) {
+	for (int i=0; i<recents->count; i++) {
+		Recent* recent = recents->items[i];
+		if (recent->available) return 1;
+	}
+	return 0;
 }
 static int hasCollections(void) {
 	int has = 0;
@@ -1212,10 +1417,590 @@ static Array* getEntries(char* path){
 }
 
 ///////////////////////////////////////
+// library search
+//
+// trigram index over the display name of everything under ROMS_PATH, saved
+// to disk so a launch only has to stat() folders to find what changed
+
+#define SEARCH_INDEX_PATH USERDATA_PATH "/search.idx"
+#define SEARCH_INDEX_MAGIC 0x58444953 // SIDX
+#define SEARCH_INDEX_VERSION 2
+#define SEARCH_BUCKETS 65536 // trigrams are hashed, candidates get verified anyway
+#define SEARCH_MAX_TRIGRAMS 8 // only intersect the shortest posting lists
+#define SEARCH_MAX_WORDS 8
+#define SEARCH_MAX_QUERY 32
+#define SEARCH_MAX_RESULTS 64
+
+typedef struct SearchHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t dir_count;
+	uint32_t item_count;
+	uint32_t posting_count;
+	uint32_t strings_size;
+} SearchHeader;
+
+typedef struct SearchDir {
+	uint32_t path; // offsets are into strings
+	uint32_t first; // items of a folder are contiguous
+	uint32_t count;
+	uint32_t unused;
+	int64_t mtime; // newest of the folder and its map.txt
+} SearchDir;
+
+typedef struct SearchItem {
+	uint32_t path;
+	uint32_t name;
+	uint32_t key; // normalized name, what queries actually match against
+	uint32_t initials; // key with hanzi spelled as pinyin initials, empty without any
+	uint32_t type;
+} SearchItem;
+
+// the file is the header followed by data as laid out here
+typedef struct SearchIndex {
+	SearchHeader header;
+	SearchDir* dirs; // sorted by path
+	SearchItem* items;
+	uint32_t* buckets; // SEARCH_BUCKETS+1 offsets into postings
+	uint32_t* postings; // item ids, ascending within a bucket
+	char* strings;
+	void* data;
+} SearchIndex;
+
+static size_t SearchIndex_dataSize(SearchHeader* header) {
+	return sizeof(SearchDir) * header->dir_count
+		+ sizeof(SearchItem) * header->item_count
+		+ sizeof(uint32_t) * (SEARCH_BUCKETS + 1 + header->posting_count)
+		+ header->strings_size;
+}
+static void SearchIndex_map(SearchIndex* self) {
+	char* data = self->data;
+	self->dirs = (SearchDir*)data;
+	data += sizeof(SearchDir) * self->header.dir_count;
+	self->items = (SearchItem*)data;
+	data += sizeof(SearchItem) * self->header.item_count;
+	self->buckets = (uint32_t*)data;
+	data += sizeof(uint32_t) * (SEARCH_BUCKETS + 1);
+	self->postings = (uint32_t*)data;
+	data += sizeof(uint32_t) * self->header.posting_count;
+	self->strings = data;
+}
+static void SearchIndex_free(SearchIndex* self) {
+	if (!self) return;
+	free(self->data);
+	free(self);
+}
+
+static int SearchIndex_valid(SearchIndex* self) {
+	SearchHeader* header = &self->header;
+	if (!header->strings_size || self->strings[header->strings_size-1]!='\0') return 0;
+	// queries size posting lists as buckets[t+1]-buckets[t], a bucket running
+	// backwards or past the postings would read far outside them
+	if (self->buckets[0]!=0 || self->buckets[SEARCH_BUCKETS]!=header->posting_count) return 0;
+	for (int t=0; t<SEARCH_BUCKETS; t++) {
+		if (self->buckets[t]>self->buckets[t+1]) return 0;
+	}
+	for (uint32_t i=0; i<header->item_count; i++) {
+		SearchItem* item = &self->items[i];
+		if (item->path>=header->strings_size || item->name>=header->strings_size || item->key>=header->strings_size || item->initials>=header->strings_size) return 0;
+	}
+	for (uint32_t i=0; i<header->dir_count; i++) {
+		SearchDir* dir = &self->dirs[i];
+		if (dir->path>=header->strings_size || dir->first>header->item_count || dir->count>header->item_count-dir->first) return 0;
+	}
+	for (uint32_t i=0; i<header->posting_count; i++) {
+		if (self->postings[i]>=header->item_count) return 0;
+	}
+	return 1;
+}
+static SearchIndex* SearchIndex_load(void) {
+	FILE* file = fopen(SEARCH_INDEX_PATH, "rb");
+	if (!file) return NULL;
+
+	SearchIndex* self = NULL;
+	SearchHeader header;
+	if (fread(&header, sizeof(header), 1, file)==1 && header.magic==SEARCH_INDEX_MAGIC && header.version==SEARCH_INDEX_VERSION) {
+		size_t size = SearchIndex_dataSize(&header);
+		void* data = malloc(size);
+		if (data && fread(data, 1, size, file)==size) {
+			self = calloc(1, sizeof(SearchIndex));
+			self->header = header;
+			self->data = data;
+			SearchIndex_map(self);
+			if (!SearchIndex_valid(self)) {
+				LOG_warn("Ignoring corrupt search index\n");
+				SearchIndex_free(self);
+				self = NULL;
+			}
+		}
+		else free(data);
+	}
+	fclose(file);
+	return self;
+}
+static void SearchIndex_save(SearchIndex* self) {
+	char tmp_path[256];
+	sprintf(tmp_path, "%s.tmp", SEARCH_INDEX_PATH);
+	FILE* file = fopen(tmp_path, "wb");
+	if (!file) {
+		LOG_error("Failed to write search index: %s (errno: %d)\n", tmp_path, errno);
+		return;
+	}
+	size_t size = SearchIndex_dataSize(&self->header);
+	int ok = fwrite(&self->header, sizeof(SearchHeader), 1, file)==1 && fwrite(self->data, 1, size, file)==size;
+	ok = fclose(file)==0 && ok;
+	// never leave a half written index where the next launch would load it
+	if (ok) rename(tmp_path, SEARCH_INDEX_PATH);
+	else unlink(tmp_path);
+}
+
+static SearchDir* SearchIndex_findDir(SearchIndex* self, const char* path) {
+	int lo = 0;
+	int hi = (int)self->header.dir_count - 1;
+	while (lo<=hi) {
+		int mid = (lo + hi) / 2;
+		int cmp = strcmp(self->strings + self->dirs[mid].path, path);
+		if (cmp==0) return &self->dirs[mid];
+		if (cmp<0) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return NULL;
+}
+
+// lowercase ascii, collapse punctuation and whitespace into single spaces,
+// utf-8 passes through untouched so byte trigrams still match it
+static void Search_normalize(const char* in, char* out, int out_size) {
+	int len = 0;
+	int space = 1; // drop leading separators
+	for (; *in && len<out_size-1; in++) {
+		unsigned char c = *in;
+		if (c>=0x80 || isalnum(c)) {
+			out[len++] = c<0x80 ? tolower(c) : c;
+			space = 0;
+		}
+		else if (!space) {
+			out[len++] = ' ';
+			space = 1;
+		}
+	}
+	if (len && out[len-1]==' ') len -= 1;
+	out[len] = '\0';
+}
+// "超级马里奥 3" -> "cjmla 3" so names can be found from an ascii keyboard,
+// empty when nothing in key has a known initial
+static void Search_initials(const char* key, char* out, int out_size) {
+	int len = 0;
+	int found = 0;
+	for (const char* c=key; *c && len<out_size-1;) {
+		unsigned char ch = *c;
+		int n = ch>=0xF0 ? 4 : ch>=0xE0 ? 3 : ch>=0xC0 ? 2 : 1;
+		for (int i=1; i<n; i++) {
+			if (!c[i]) n = i;
+		}
+		char initial = n==3 ? I18N_pinyinInitial(((ch & 0x0F) << 12) | ((c[1] & 0x3F) << 6) | (c[2] & 0x3F)) : 0;
+		if (initial) {
+			out[len++] = initial;
+			found = 1;
+		}
+		else {
+			if (len+n>out_size-1) break;
+			memcpy(out + len, c, n);
+			len += n;
+		}
+		c += n;
+	}
+	out[found ? len : 0] = '\0';
+}
+static inline uint32_t Search_trigram(const char* str) {
+	uint32_t t = ((uint8_t)str[0] << 16) | ((uint8_t)str[1] << 8) | (uint8_t)str[2];
+	return (t * 2654435761u) >> 16; // SEARCH_BUCKETS
+}
+
+///////////////////////////////////////
+
+typedef struct SearchBuilder {
+	SearchDir* dirs;
+	int dir_count;
+	int dir_capacity;
+	SearchItem* items;
+	int item_count;
+	int item_capacity;
+	char* strings;
+	int strings_size;
+	int strings_capacity;
+	int changed;
+} SearchBuilder;
+
+static void* Search_reserve(void* items, int* capacity, int count, size_t size) {
+	if (count<*capacity) return items;
+	*capacity = *capacity ? *capacity * 2 : 256;
+	return realloc(items, size * *capacity);
+}
+static uint32_t SearchBuilder_string(SearchBuilder* self, const char* str) {
+	int len = strlen(str) + 1;
+	while (self->strings_size+len>self->strings_capacity) {
+		self->strings_capacity = self->strings_capacity ? self->strings_capacity * 2 : 64 * 1024;
+		self->strings = realloc(self->strings, self->strings_capacity);
+	}
+	uint32_t offset = self->strings_size;
+	memcpy(self->strings + offset, str, len);
+	self->strings_size += len;
+	return offset;
+}
+static void SearchBuilder_addItem(SearchBuilder* self, const char* path, const char* name, const char* key, const char* initials, int type) {
+	self->items = Search_reserve(self->items, &self->item_capacity, self->item_count, sizeof(SearchItem));
+	SearchItem* item = &self->items[self->item_count++];
+	item->path = SearchBuilder_string(self, path);
+	item->name = SearchBuilder_string(self, name);
+	if (key) {
+		item->key = SearchBuilder_string(self, key);
+		item->initials = SearchBuilder_string(self, initials);
+	}
+	else {
+		char* trimmed = (char*)name;
+		trimSortingMeta(&trimmed);
+		char normalized[256];
+		Search_normalize(trimmed, normalized, sizeof(normalized));
+		item->key = SearchBuilder_string(self, normalized);
+		char spelled[256];
+		Search_initials(normalized, spelled, sizeof(spelled));
+		item->initials = spelled[0] ? SearchBuilder_string(self, spelled) : 0; // offset 0 is ""
+	}
+	item->type = type;
+}
+
+static int64_t Search_dirTime(const char* path) {
+	struct stat st;
+	if (stat(path, &st)!=0) return -1;
+	int64_t mtime = st.st_mtime;
+
+	// aliases change names without touching the folder itself
+	char map_path[256];
+	snprintf(map_path, sizeof(map_path), "%s/map.txt", path);
+	if (stat(map_path, &st)==0 && st.st_mtime>mtime) mtime = st.st_mtime;
+	return mtime;
+}
+static int Search_isGameDir(const char* path) { // opening these launches them, don't index their contents
+	char game_path[256];
+	const char* name = strrchr(path, '/') + 1;
+	snprintf(game_path, sizeof(game_path), "%s/%s.cue", path, name);
+	if (exists(game_path)) return 1;
+	snprintf(game_path, sizeof(game_path), "%s/%s.m3u", path, name);
+	return exists(game_path);
+}
+static void SearchBuilder_readDir(SearchBuilder* self, const char* path) {
+	DIR* dh = opendir(path);
+	if (!dh) return;
+
+	Hash* map = NULL;
+	char map_path[256];
+	snprintf(map_path, sizeof(map_path), "%s/map.txt", path);
+	FILE* file = fopen(map_path, "r");
+	if (file) {
+		map = Hash_new();
+		char line[256];
+		while (fgets(line, sizeof(line), file)) {
+			normalizeNewline(line);
+			trimTrailingNewlines(line);
+			char* tmp = strchr(line, '\t');
+			if (!tmp) continue;
+			tmp[0] = '\0';
+			Hash_set(map, line, tmp+1);
+		}
+		fclose(file);
+	}
+
+	struct dirent* dp;
+	char full_path[256];
+	char name[256];
+	while ((dp = readdir(dh))!=NULL) {
+		if (hide(dp->d_name)) continue;
+		snprintf(full_path, sizeof(full_path), "%s/%s", path, dp->d_name);
+
+		int type = ENTRY_ROM;
+		if (dp->d_type==DT_DIR) type = suffixMatch(".pak", dp->d_name) ? ENTRY_PAK : ENTRY_DIR;
+
+		char* alias = map ? Hash_get(map, dp->d_name) : NULL;
+		if (alias) {
+			if (hide(alias)) continue;
+			snprintf(name, sizeof(name), "%s", alias);
+		}
+		else getDisplayName(full_path, name);
+
+		SearchBuilder_addItem(self, full_path, name, NULL, NULL, type);
+	}
+	closedir(dh);
+	if (map) Hash_free(map);
+}
+static void SearchBuilder_scan(SearchBuilder* self, SearchIndex* old, const char* path) {
+	Workers_checkpoint();
+	int64_t mtime = Search_dirTime(path);
+	if (mtime<0) return;
+
+	int first = self->item_count;
+	SearchDir* prev = old ? SearchIndex_findDir(old, path) : NULL;
+	if (prev && prev->mtime==mtime) {
+		for (uint32_t i=0; i<prev->count; i++) {
+			SearchItem* item = &old->items[prev->first + i];
+			SearchBuilder_addItem(self, old->strings + item->path, old->strings + item->name, old->strings + item->key, old->strings + item->initials, item->type);
+		}
+	}
+	else {
+		SearchBuilder_readDir(self, path);
+		self->changed = 1;
+	}
+
+	self->dirs = Search_reserve(self->dirs, &self->dir_capacity, self->dir_count, sizeof(SearchDir));
+	SearchDir* dir = &self->dirs[self->dir_count++];
+	dir->path = SearchBuilder_string(self, path);
+	dir->first = first;
+	dir->count = self->item_count - first;
+	dir->unused = 0;
+	dir->mtime = mtime;
+
+	// only descend once this folder's items are all in so its range stays contiguous
+	int last = self->item_count;
+	for (int i=first; i<last; i++) {
+		if (self->items[i].type!=ENTRY_DIR) continue;
+		char sub_path[256];
+		snprintf(sub_path, sizeof(sub_path), "%s", self->strings + self->items[i].path);
+		if (!Search_isGameDir(sub_path)) SearchBuilder_scan(self, old, sub_path);
+	}
+}
+
+static const char* search_sort_strings; // only the indexing thread sorts
+static int SearchBuilder_sortDir(const void* a, const void* b) {
+	const SearchDir* dir1 = a;
+	const SearchDir* dir2 = b;
+	return strcmp(search_sort_strings + dir1->path, search_sort_strings + dir2->path);
+}
+static SearchIndex* SearchBuilder_finish(SearchBuilder* self) {
+	search_sort_strings = self->strings;
+	qsort(self->dirs, self->dir_count, sizeof(SearchDir), SearchBuilder_sortDir);
+
+	// count each distinct trigram once per item, then lay the posting lists out back to back
+	uint32_t* buckets = calloc(SEARCH_BUCKETS + 1, sizeof(uint32_t));
+	uint32_t* seen = malloc(SEARCH_BUCKETS * sizeof(uint32_t));
+	memset(seen, 0xff, SEARCH_BUCKETS * sizeof(uint32_t));
+	uint32_t posting_count = 0;
+	for (int i=0; i<self->item_count; i++) {
+		for (int k=0; k<2; k++) {
+			const char* key = self->strings + (k ? self->items[i].initials : self->items[i].key);
+			for (int j=0; key[j] && key[j+1] && key[j+2]; j++) {
+				uint32_t t = Search_trigram(key + j);
+				if (seen[t]==(uint32_t)i) continue;
+				seen[t] = i;
+				buckets[t] += 1;
+				posting_count += 1;
+			}
+		}
+	}
+	uint32_t offset = 0;
+	for (int t=0; t<SEARCH_BUCKETS; t++) {
+		uint32_t count = buckets[t];
+		buckets[t] = offset;
+		offset += count;
+	}
+	buckets[SEARCH_BUCKETS] = offset;
+
+	SearchIndex* index = calloc(1, sizeof(SearchIndex));
+	index->header.magic = SEARCH_INDEX_MAGIC;
+	index->header.version = SEARCH_INDEX_VERSION;
+	index->header.dir_count = self->dir_count;
+	index->header.item_count = self->item_count;
+	index->header.posting_count = posting_count;
+	index->header.strings_size = self->strings_size;
+	index->data = malloc(SearchIndex_dataSize(&index->header));
+	SearchIndex_map(index);
+
+	memcpy(index->dirs, self->dirs, sizeof(SearchDir) * self->dir_count);
+	memcpy(index->items, self->items, sizeof(SearchItem) * self->item_count);
+	memcpy(index->buckets, buckets, sizeof(uint32_t) * (SEARCH_BUCKETS + 1));
+	memcpy(index->strings, self->strings, self->strings_size);
+
+	// items are visited in order so every list comes out ascending
+	memset(seen, 0xff, SEARCH_BUCKETS * sizeof(uint32_t));
+	for (int i=0; i<self->item_count; i++) {
+		for (int k=0; k<2; k++) {
+			const char* key = self->strings + (k ? self->items[i].initials : self->items[i].key);
+			for (int j=0; key[j] && key[j+1] && key[j+2]; j++) {
+				uint32_t t = Search_trigram(key + j);
+				if (seen[t]==(uint32_t)i) continue;
+				seen[t] = i;
+				index->postings[buckets[t]++] = i;
+			}
+		}
+	}
+
+	free(seen);
+	free(buckets);
+	return index;
+}
+
+// returns a new index if anything on disk changed since old was built, NULL if old is current
+static SearchIndex* SearchIndex_update(SearchIndex* old) {
+	SearchBuilder builder = {0};
+	SearchBuilder_string(&builder, ""); // an empty library still has to save a valid index
+
+	DIR* dh = opendir(ROMS_PATH);
+	if (dh) {
+		struct dirent* dp;
+		char path[256];
+		while ((dp = readdir(dh))!=NULL) {
+			if (hide(dp->d_name)) continue;
+			if (dp->d_type!=DT_DIR) continue;
+			if (!hasRoms(dp->d_name)) continue;
+			snprintf(path, sizeof(path), "%s/%s", ROMS_PATH, dp->d_name);
+			SearchBuilder_scan(&builder, old, path);
+		}
+		closedir(dh);
+	}
+	// a system that went away (or lost its emu) leaves no changed folder behind
+	if (!old || builder.dir_count!=(int)old->header.dir_count) builder.changed = 1;
+
+	SearchIndex* index = builder.changed ? SearchBuilder_finish(&builder) : NULL;
+	free(builder.dirs);
+	free(builder.items);
+	free(builder.strings);
+	return index;
+}
+
+///////////////////////////////////////
+
+typedef struct SearchMatch {
+	uint32_t id;
+	int rank;
+	int length;
+} SearchMatch;
+
+static int SearchIndex_rank(const char* key, const char* query, char** words, int word_count) {
+	for (int i=0; i<word_count; i++) {
+		if (!strstr(key, words[i])) return -1;
+	}
+	if (exactMatch(key, query)) return 0;
+	if (prefixMatch((char*)query, key)) return 1;
+	const char* pos = strstr(key, words[0]);
+	if (pos==key) return 2;
+	if (pos[-1]==' ') return 3; // starts a later word
+	return 4;
+}
+static int SearchIndex_before(SearchIndex* self, SearchMatch* a, SearchMatch* b) {
+	if (a->rank!=b->rank) return a->rank<b->rank;
+	if (a->length!=b->length) return a->length<b->length;
+	return strcmp(self->strings + self->items[a->id].key, self->strings + self->items[b->id].key)<0;
+}
+
+// fills ids with the best matches first, returns how many
+static int SearchIndex_query(SearchIndex* self, const char* query, uint32_t* ids, int max) {
+	char normalized[SEARCH_MAX_QUERY * 2];
+	Search_normalize(query, normalized, sizeof(normalized));
+	if (!normalized[0]) return 0;
+
+	char split[sizeof(normalized)];
+	strcpy(split, normalized);
+	char* words[SEARCH_MAX_WORDS];
+	int word_count = 0;
+	for (char* word=strtok(split, " "); word && word_count<SEARCH_MAX_WORDS; word=strtok(NULL, " ")) {
+		words[word_count++] = word;
+	}
+
+	// pick the rarest trigrams, every match has to contain all of them
+	uint32_t trigrams[SEARCH_MAX_TRIGRAMS];
+	int trigram_count = 0;
+	for (int i=0; i<word_count; i++) {
+		for (char* c=words[i]; c[0] && c[1] && c[2]; c++) {
+			uint32_t t = Search_trigram(c);
+			uint32_t size = self->buckets[t+1] - self->buckets[t];
+			int j;
+			for (j=0; j<trigram_count && trigrams[j]!=t; j++);
+			if (j<trigram_count) continue;
+
+			if (trigram_count<SEARCH_MAX_TRIGRAMS) j = trigram_count++;
+			else {
+				j = 0;
+				for (int k=1; k<trigram_count; k++) {
+					if (self->buckets[trigrams[k]+1] - self->buckets[trigrams[k]] > self->buckets[trigrams[j]+1] - self->buckets[trigrams[j]]) j = k;
+				}
+				if (self->buckets[trigrams[j]+1] - self->buckets[trigrams[j]] <= size) continue;
+			}
+			trigrams[j] = t;
+		}
+	}
+
+	uint32_t* candidates = NULL;
+	int candidate_count = self->header.item_count;
+	if (trigram_count) {
+		// intersect from the shortest list up so the working set only shrinks
+		for (int i=1; i<trigram_count; i++) {
+			for (int j=i; j>0 && self->buckets[trigrams[j]+1] - self->buckets[trigrams[j]] < self->buckets[trigrams[j-1]+1] - self->buckets[trigrams[j-1]]; j--) {
+				uint32_t t = trigrams[j];
+				trigrams[j] = trigrams[j-1];
+				trigrams[j-1] = t;
+			}
+		}
+		candidate_count = self->buckets[trigrams[0]+1] - self->buckets[trigrams[0]];
+		candidates = malloc(sizeof(uint32_t) * (candidate_count + 1));
+		memcpy(candidates, self->postings + self->buckets[trigrams[0]], sizeof(uint32_t) * candidate_count);
+		for (int i=1; i<trigram_count && candidate_count; i++) {
+			uint32_t* list = self->postings + self->buckets[trigrams[i]];
+			uint32_t* end = self->postings + self->buckets[trigrams[i]+1];
+			int count = 0;
+			for (int j=0; j<candidate_count && list<end; j++) {
+				while (list<end && *list<candidates[j]) list++;
+				if (list<end && *list==candidates[j]) candidates[count++] = candidates[j];
+			}
+			candidate_count = count;
+		}
+	}
+
+	SearchMatch matches[SEARCH_MAX_RESULTS];
+	if (max>SEARCH_MAX_RESULTS) max = SEARCH_MAX_RESULTS;
+	int match_count = 0;
+	for (int i=0; i<candidate_count; i++) {
+		SearchMatch match;
+		match.id = candidates ? candidates[i] : (uint32_t)i;
+		const char* key = self->strings + self->items[match.id].key;
+		match.rank = SearchIndex_rank(key, normalized, words, word_count);
+		match.length = strlen(key);
+		const char* initials = self->strings + self->items[match.id].initials;
+		if (initials[0]) {
+			// trigrams may have come from either, keep whichever matches better
+			int rank = SearchIndex_rank(initials, normalized, words, word_count);
+			if (rank>=0 && (match.rank<0 || rank<match.rank)) {
+				match.rank = rank;
+				match.length = strlen(initials);
+			}
+		}
+		if (match.rank<0) continue;
+
+		if (match_count==max && !SearchIndex_before(self, &match, &matches[max-1])) continue;
+		int j = match_count<max ? match_count++ : max-1;
+		for (; j>0 && SearchIndex_before(self, &match, &matches[j-1]); j--) {
+			matches[j] = matches[j-1];
+		}
+		matches[j] = match;
+	}
+	if (candidates) free(candidates);
+
+	for (int i=0; i<match_count; i++) {
+		ids[i] = matches[i].id;
+	}
+	return match_count;
+}
+
+///////////////////////////////////////
+
+// in resident mode games are run by nextui itself instead of launch.sh,
+// anything else (paks, auto resume) still goes through /tmp/next
+static int resident_mode = 0;
+static int queued_game = 0;
+static char queued_cmd[512];
 
 static void queueNext(char* cmd) {
 	LOG_info("cmd: %s\n", cmd);
+	TRACE_instant("queueNext");
 	putFile("/tmp/next", cmd);
+	snprintf(queued_cmd, sizeof(queued_cmd), "%s", cmd);
 	quit = 1;
 }
 
@@ -1256,6 +2041,192 @@ static char* escapeSingleQuotes(char* str) {
 
 ///////////////////////////////////////
 
+// once the selection rests on a rom, warm the page cache with what minarch
+// reads first: the core, saves and states, then the rom itself
+#define PREFETCH_DELAY_MS 300
+#define PREFETCH_BUDGET (48 * 1024 * 1024) // per selection
+#define PREFETCH_CHUNK (1024 * 1024) // also how often a moved selection is noticed
+
+// not in glibc's headers, see linux/ioprio.h
+#ifndef IOPRIO_CLASS_IDLE
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+#endif
+
+static SDL_mutex* prefetchMutex = NULL;
+static SDL_cond* prefetchCond = NULL;
+static char prefetch_path[256];
+static _Atomic int prefetch_generation = 0; // bumped on every new selection, read by the worker between chunks
+static int prefetch_done = 0;
+static char prefetch_buffer[PREFETCH_CHUNK]; // only the worker reads into it
+
+// minarch gets its core from the pak's launch.sh, either from the
+// shared cores folder or, for extra paks, from the pak itself
+static int getCorePath(char* emu_path, char* core_path) {
+	FILE* file = fopen(emu_path, "r");
+	if (!file) return 0;
+
+	char core[128] = "";
+	int in_pak = 0;
+	char line[256];
+	while (fgets(line, 256, file)!=NULL) {
+		normalizeNewline(line);
+		trimTrailingNewlines(line);
+		if (prefixMatch("EMU_EXE=", line)) snprintf(core, sizeof(core), "%s", line + strlen("EMU_EXE="));
+		else if (prefixMatch("CORES_PATH=$(dirname", line)) in_pak = 1;
+	}
+	fclose(file);
+	if (!core[0]) return 0;
+
+	if (in_pak) {
+		char pak_path[256];
+		strcpy(pak_path, emu_path);
+		char* tmp = strrchr(pak_path, '/');
+		if (tmp) *tmp = '\0';
+		sprintf(core_path, "%s/%s_libretro.so", pak_path, core);
+	}
+	else sprintf(core_path, "%s/cores/%s_libretro.so", SYSTEM_PATH, core);
+	return 1;
+}
+
+// returns 0 once the selection moved or the budget ran out
+static int Prefetch_file(char* path, int generation, int* budget) {
+	int fd = open(path, O_RDONLY);
+	if (fd<0) return 1;
+
+	// readahead() and WILLNEED only queue the reads, a real read keeps
+	// exactly one chunk in flight and can stop as soon as the selection moves
+	struct stat st;
+	off_t size = fstat(fd, &st)==0 ? st.st_size : 0;
+	for (off_t offset=0; offset<size && *budget>0; offset+=PREFETCH_CHUNK) {
+		Workers_checkpoint();
+		if (generation!=prefetch_generation) break;
+		size_t len = size - offset < PREFETCH_CHUNK ? size - offset : PREFETCH_CHUNK;
+		if (pread(fd, prefetch_buffer, len, offset)<=0) break;
+		*budget -= len;
+	}
+	close(fd);
+	return generation==prefetch_generation && *budget>0;
+}
+static int Prefetch_dir(char* dir_path, char* prefix, char* skip, int generation, int* budget) {
+	DIR* dh = opendir(dir_path);
+	if (!dh) return 1;
+
+	int more = 1;
+	struct dirent* dp;
+	while (more && (dp = readdir(dh))!=NULL) {
+		if (dp->d_name[0]=='.' || !prefixMatch(prefix, dp->d_name)) continue;
+		if (skip && exactMatch(skip, dp->d_name)) continue;
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s", dir_path, dp->d_name);
+		more = Prefetch_file(path, generation, budget);
+	}
+	closedir(dh);
+	return more;
+}
+static void Prefetch_run(char* rom_path, int generation) {
+	TRACE_begin("prefetch");
+	int budget = PREFETCH_BUDGET;
+
+	char emu_name[256];
+	getEmuName(rom_path, emu_name);
+	char emu_path[256];
+	getEmuPath(emu_name, emu_path);
+
+	// every save and state format starts with the rom name minus its extension
+	char rom_dir[256];
+	strcpy(rom_dir, rom_path);
+	char* rom_file = strrchr(rom_dir, '/');
+	*rom_file++ = '\0';
+	char name[256];
+	strcpy(name, rom_file);
+	char* tmp = strrchr(name, '.');
+	if (tmp) *tmp = '\0';
+
+	char core_path[256];
+	char dir_path[256];
+	int more = 1;
+	if (getCorePath(emu_path, core_path)) more = Prefetch_file(core_path, generation, &budget);
+
+	if (more) {
+		sprintf(dir_path, "%s/Saves/%s", SDCARD_PATH, emu_name);
+		more = Prefetch_dir(dir_path, name, NULL, generation, &budget);
+	}
+
+	// states live in <tag>-<core name>, but the core name is only known to minarch
+	if (more) {
+		char state_prefix[256];
+		sprintf(state_prefix, "%s-", emu_name);
+		DIR* dh = opendir(SHARED_USERDATA_PATH);
+		struct dirent* dp;
+		while (more && dh && (dp = readdir(dh))!=NULL) {
+			if (dp->d_type!=DT_DIR || !prefixMatch(state_prefix, dp->d_name)) continue;
+			sprintf(dir_path, "%s/%s", SHARED_USERDATA_PATH, dp->d_name);
+			more = Prefetch_dir(dir_path, name, NULL, generation, &budget);
+		}
+		if (dh) closedir(dh);
+	}
+
+	if (more) more = Prefetch_file(rom_path, generation, &budget);
+
+	// a cue or m3u is tiny, the tracks or discs next to it are what gets read
+	if (more && (suffixMatch(".cue", rom_path) || suffixMatch(".m3u", rom_path)))
+		Prefetch_dir(rom_dir, name, rom_file, generation, &budget);
+
+	if (generation!=prefetch_generation) TRACE_instant("prefetch cancelled");
+	TRACE_counter("prefetch bytes", PREFETCH_BUDGET - budget);
+	TRACE_end("prefetch");
+	TRACE_flush(); // browsing can go on for long, keep room for the launch
+}
+int PrefetchWorker(void* unused) {
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+	// the cpu priority means nothing to the sd card, only read when nothing else is
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0))!=0)
+		LOG_warn("prefetch: couldn't lower io priority (%s)\n", strerror(errno));
+
+	SDL_LockMutex(prefetchMutex);
+	while (1) {
+		while (prefetch_done==prefetch_generation) SDL_CondWait(prefetchCond, prefetchMutex);
+
+		// scrolling through a list shouldn't touch every rom on the way
+		int generation;
+		do {
+			generation = prefetch_generation;
+			SDL_CondWaitTimeout(prefetchCond, prefetchMutex, PREFETCH_DELAY_MS);
+		} while (generation!=prefetch_generation);
+		prefetch_done = generation;
+
+		char path[256];
+		strcpy(path, prefetch_path);
+		SDL_UnlockMutex(prefetchMutex);
+		if (path[0]) Prefetch_run(path, generation);
+		SDL_LockMutex(prefetchMutex);
+	}
+	return 0;
+}
+static void Prefetch_init(void) {
+	if (exists(PREFETCH_DISABLE_PATH)) return;
+
+	prefetchMutex = SDL_CreateMutex();
+	prefetchCond = SDL_CreateCond();
+	SDL_CreateThread(PrefetchWorker, "PrefetchWorker", NULL);
+}
+static void Prefetch_select(char* path) {
+	if (!prefetchMutex) return;
+
+	SDL_LockMutex(prefetchMutex);
+	if (!exactMatch(prefetch_path, path)) {
+		strcpy(prefetch_path, path);
+		prefetch_generation += 1;
+		SDL_CondSignal(prefetchCond);
+	}
+	SDL_UnlockMutex(prefetchMutex);
+}
+
+///////////////////////////////////////
+
 static void readyResumePath(char* rom_path, int type) {
 	char* tmp;
 	can_resume = 0;
@@ -1274,6 +2245,7 @@ static void readyResumePath(char* rom_path, int type) {
 		}
 		strcpy(path, auto_path); // cue or m3u if one exists
 	}
+	Prefetch_select(path);
 	
 	if (!suffixMatch(".m3u", path)) {
 		char m3u_path[256];
@@ -1335,13 +2307,10 @@ static int autoResume(void) {
 	
 	// putFile(LAST_PATH, FAUX_RECENT_PATH); // saveLast() will crash here because top is NULL
 
-	char act[256];
-	sprintf(act, "gametimectl.elf start '%s'", escapeSingleQuotes(sd_path));
-	system(act);
+	gametime_start(sd_path);
 	
 	char cmd[256];
-	// dont escape sd_path again because it was already escaped for gametimectl and function modifies input str aswell
-	sprintf(cmd, "'%s' '%s'", escapeSingleQuotes(emu_path), sd_path);
+	sprintf(cmd, "'%s' '%s'", escapeSingleQuotes(emu_path), escapeSingleQuotes(sd_path));
 	putInt(RESUME_SLOT_PATH, AUTO_RESUME_SLOT);
 	queueNext(cmd);
 	return 1;
@@ -1414,12 +2383,10 @@ static void openRom(char* path, char* last) {
 	// so we need to save the path before we call that
 	addRecent(recent_path, recent_alias); // yiiikes
 	saveLast(last==NULL ? sd_path : last);
-	char act[256];
-	sprintf(act, "gametimectl.elf start '%s'", escapeSingleQuotes(sd_path));
-	system(act);
+	gametime_start(sd_path);
 	char cmd[256];
-	// dont escape sd_path again because it was already escaped for gametimectl and function modifies input str aswell
-	sprintf(cmd, "'%s' '%s'", escapeSingleQuotes(emu_path), sd_path);
+	sprintf(cmd, "'%s' '%s'", escapeSingleQuotes(emu_path), escapeSingleQuotes(sd_path));
+	queued_game = 1;
 	queueNext(cmd);
 }
 
@@ -1767,7 +2734,7 @@ static void QuickMenu_quit(void) {
 
 static void Menu_init(void) {
 	stack = Array_new(); // array of open Directories
-	recents = Array_new();
+	loadRecents();
 
 	openDirectory(SDCARD_PATH, 0);
 	loadLast(); // restore state when available
@@ -1787,6 +2754,10 @@ static int dirty = 1;
 static int remember_row = 0;
 static int remember_depth = 0;
 
+// longest the main loop blocks when nothing is animating, keeps
+// PWR_update() (autosleep, charging, settings overlay) and the clock ticking
+#define IDLE_WAIT_MS 250
+
 ///////////////////////////////////////
 
 enum {
@@ -1870,10 +2841,13 @@ static SDL_Surface* screen = NULL; // Must be assigned externally
 static int had_thumb = 0;
 static int ox;
 static int oy;
-int animationDraw = 1;
-int needDraw = 0;
-int folderbgchanged=0;
-int thumbchanged=0;
+_Atomic int animationDraw = 1; // animcallback sets it from the animation thread
+// set by the loader threads (under their own mutexes) and polled by the main
+// loop before it decides to sleep, atomic so that check never reads a torn
+// or stale flag
+_Atomic int needDraw = 0;
+_Atomic int folderbgchanged=0;
+_Atomic int thumbchanged=0;
 
 // queue a new image load task :D
 #define MAX_QUEUE_SIZE 1
@@ -1964,6 +2938,7 @@ int BGLoadWorker(void* unused) {
         SDL_UnlockMutex(bgqueueMutex);
 		// give processor lil space in between queue items for other shit
 		//SDL_Delay(100);
+		Workers_checkpoint();
         LoadBackgroundTask* task = node->task;
         free(node);
 
@@ -2000,6 +2975,7 @@ int ThumbLoadWorker(void* unused) {
         SDL_UnlockMutex(thumbqueueMutex);
 		// give processor lil space in between queue items for other shit
 		//SDL_Delay(100);
+		Workers_checkpoint();
         LoadBackgroundTask* task = node->task;
         free(node);
 
@@ -2042,11 +3018,13 @@ void onBackgroundLoaded(SDL_Surface* surface) {
     if (!surface) {
 		folderbgbmp = NULL;
 		SDL_UnlockMutex(bgMutex);
+		PAD_interruptWait();
 		return;
 	}
     folderbgbmp = surface;
 	needDraw = 1;
 	SDL_UnlockMutex(bgMutex);
+	PAD_interruptWait();
 }
 
 void startLoadThumb(const char* thumbpath, BackgroundLoadedCallback callback, void* userData) {
@@ -2065,6 +3043,7 @@ void onThumbLoaded(SDL_Surface* surface) {
     if (!surface) {
 		thumbbmp = NULL;
 		SDL_UnlockMutex(thumbMutex);
+		PAD_interruptWait();
 		return;
 	}
   
@@ -2089,6 +3068,7 @@ void onThumbLoaded(SDL_Surface* surface) {
 	);
 	needDraw = 1;
 	SDL_UnlockMutex(thumbMutex);
+	PAD_interruptWait();
 }
 
 SDL_Rect pillRect;
@@ -2128,6 +3108,7 @@ void animcallback(finishedTask *task) {
 	}
 	SDL_UnlockMutex(animMutex);
 	animationDraw = 1;
+	PAD_interruptWait();
 }
 bool frameReady = true;
 bool pillanimdone = false;
@@ -2142,6 +3123,7 @@ int animWorker(void* unused) {
         animTaskQueueHead = node->next;
         if (!animTaskQueueHead) animTtaskQueueTail = NULL;
 		SDL_UnlockMutex(animqueueMutex);
+		Workers_checkpoint();
 
         AnimTask* task = node->task;
 		finishedTask* finaltask = (finishedTask*)malloc(sizeof(finishedTask));
@@ -2253,14 +3235,162 @@ void initImageLoaderPool() {
 }
 ///////////////////////////////////////
 
+#define SEARCH_CHARS " abcdefghijklmnopqrstuvwxyz0123456789"
+#define SEARCH_ROW_COUNT (MAIN_ROW_COUNT - 1) // first row is the query
+
+static SDL_mutex* searchMutex = NULL;
+static SearchIndex* search_index = NULL; // swapped by the worker, only read under searchMutex
+// set by the worker, polled by the main loop
+static _Atomic int search_indexing = 0;
+static _Atomic int searchchanged = 0;
+
+static char search_query[SEARCH_MAX_QUERY + 1];
+static int search_char = 1; // into SEARCH_CHARS, starts on 'a'
+static int search_selected = -1; // -1 while the character picker has focus
+static int search_start = 0;
+static Array* search_results = NULL; // EntryArray
+
+int SearchIndexWorker(void* unused) {
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+	uint64_t start = getMicroseconds();
+
+	// whatever was saved last time is good enough to search while we rescan
+	SearchIndex* index = SearchIndex_load();
+	SDL_LockMutex(searchMutex);
+	search_index = index;
+	SDL_UnlockMutex(searchMutex);
+	searchchanged = 1;
+	PAD_interruptWait();
+
+	// this thread is the only writer so reading index unlocked is fine
+	SearchIndex* fresh = SearchIndex_update(index);
+	if (fresh) {
+		SearchIndex_save(fresh);
+		SDL_LockMutex(searchMutex);
+		search_index = fresh;
+		SDL_UnlockMutex(searchMutex);
+		SearchIndex_free(index);
+		index = fresh;
+	}
+	LOG_info("search index: %u items in %u folders, %s in %llums\n", index->header.item_count, index->header.dir_count, fresh ? "rebuilt" : "unchanged", (unsigned long long)(getMicroseconds() - start) / 1000);
+
+	search_indexing = 0;
+	searchchanged = 1;
+	PAD_interruptWait();
+	return 0;
+}
+static void Search_init(void) {
+	searchMutex = SDL_CreateMutex();
+	search_indexing = 1;
+	SDL_CreateThread(SearchIndexWorker, "SearchIndexWorker", NULL);
+}
+static void Search_quit(void) {
+	if (search_results) EntryArray_free(search_results);
+	search_results = NULL;
+}
+
+static void Search_run(void) {
+	if (search_results) EntryArray_free(search_results);
+	search_results = Array_new();
+	search_selected = -1;
+	search_start = 0;
+
+	uint32_t ids[SEARCH_MAX_RESULTS];
+	SDL_LockMutex(searchMutex);
+	if (search_index) {
+		int count = SearchIndex_query(search_index, search_query, ids, SEARCH_MAX_RESULTS);
+		for (int i=0; i<count; i++) {
+			SearchItem* item = &search_index->items[ids[i]];
+			Entry* entry = Entry_new(search_index->strings + item->path, item->type);
+			if (!entry) continue;
+			free(entry->name);
+			entry->name = strdup(search_index->strings + item->name);
+			Array_push(search_results, entry);
+		}
+	}
+	SDL_UnlockMutex(searchMutex);
+}
+
+///////////////////////////////////////
+
+// runs the queued game as a child while keeping everything but the display,
+// input and battery thread in memory. returns 1 when the menu should carry on
+static int Resident_launch(void) {
+	if (!resident_mode || !queued_game) return 0;
+	queued_game = 0;
+
+	int had_hdmi = GetHDMI();
+	TRACE_instant("resident launch");
+	TRACE_flush();
+
+	PWR_quit();
+	PAD_quit();
+	GFX_suspend();
+	CFG_flush(); // the game reads the same settings file, a debounced change must be on disk first
+
+	// the game runs its own governor, ours would fight it for the clock,
+	// and nothing in the background is worth the game's cpu or sd time
+	int auto_cpu = useAutoCpu;
+	useAutoCpu = AUTO_CPU_OFF;
+	PLAT_pauseCPUMonitor(1);
+	Prefetch_select(""); // cancels whatever it was reading
+	Workers_pause(1);
+
+	pid_t pid = fork();
+	if (pid==0) {
+		execl("/bin/sh", "sh", "-c", queued_cmd, (char*)NULL);
+		_exit(127);
+	}
+	if (pid<0) LOG_error("resident: fork failed (%s)\n", strerror(errno));
+	else {
+		// launch.sh would run it again if we died now, we own it from here
+		unlink("/tmp/next");
+		int status;
+		while (waitpid(pid, &status, 0)<0 && errno==EINTR);
+	}
+
+	// what launch.sh does between commands
+	PLAT_setRumble(0);
+	PLAT_setCPUSpeed(CPU_SPEED_PERFORMANCE);
+	gametime_stop_all();
+
+	Workers_pause(0);
+	useAutoCpu = auto_cpu;
+	PLAT_pauseCPUMonitor(0);
+
+	// power off, reboot and display changes want a clean start from launch.sh,
+	// nothing to tear down here that exiting doesn't
+	if (pid<0 || !exists("/tmp/nextui_exec") || exists("/tmp/poweroff") || exists("/tmp/reboot") || GetHDMI()!=had_hdmi) {
+		LOG_info("resident: handing back to launch.sh\n");
+		CFG_flush();
+		QuitSettings();
+		TRACE_flush();
+		exit(0);
+	}
+
+	TRACE_begin("resident resume");
+	screen = GFX_resume();
+	PAD_init();
+	PWR_init();
+	if (!HAS_POWER_BUTTON && !simple_mode) PWR_disableSleep();
+	recheckRecents();
+	TRACE_end("resident resume");
+	return 1;
+}
+
 int main (int argc, char *argv[]) {
-	// LOG_info("time from launch to:\n");
-	// unsigned long main_begin = SDL_GetTicks();
-	// unsigned long first_draw = 0;
-	
-	if (autoResume()) return 0; // nothing to do
+	TRACE_init("nextui");
+	TRACE_begin("startup");
+
+	if (autoResume()) { // nothing to do
+		TRACE_end("startup");
+		TRACE_instant("auto resume");
+		TRACE_flush();
+		return 0;
+	}
 	
 	simple_mode = exists(SIMPLE_MODE_PATH);
+	resident_mode = exists(RESIDENT_MODE_PATH);
 
 	LOG_info("NextUI\n");
 	I18N_init();
@@ -2271,26 +3401,32 @@ int main (int argc, char *argv[]) {
 	if (CFG_getHaptics())
 		VIB_singlePulse(VIB_bootStrength, VIB_bootDuration_ms);
 	
+	TRACE_begin("GFX_init");
 	screen = GFX_init(MODE_MAIN);
-	// LOG_info("- graphics init: %lu\n", SDL_GetTicks() - main_begin);
+	TRACE_end("GFX_init");
 	
+	TRACE_begin("PAD_init");
 	PAD_init();
-	// LOG_info("- input init: %lu\n", SDL_GetTicks() - main_begin);
+	TRACE_end("PAD_init");
 	VIB_init();
 	WIFI_init();
+	TRACE_begin("PWR_init");
 	PWR_init();
+	TRACE_end("PWR_init");
 	if (!HAS_POWER_BUTTON && !simple_mode) PWR_disableSleep();
-	// LOG_info("- power init: %lu\n", SDL_GetTicks() - main_begin);
 	
 	// start my threaded image loader :D
 	initImageLoaderPool();
+	Prefetch_init();
+	TRACE_begin("Menu_init");
 	Menu_init();
+	TRACE_end("Menu_init");
+	Search_init();
 	int qm_row = 0;
 	int qm_col = 0;
 	int qm_slot = 0;
 	int qm_shift = 0;
 	int qm_slots = QUICK_SWITCHER_COUNT > quick->count ? quick->count : QUICK_SWITCHER_COUNT;
-	// LOG_info("- menu init: %lu\n", SDL_GetTicks() - main_begin);
 
 	int lastScreen = SCREEN_OFF;
 	int currentScreen = CFG_getDefaultView();
@@ -2306,7 +3442,7 @@ int main (int argc, char *argv[]) {
 		lastScreen = SCREEN_GAME;
 
 	// make sure we have no running games logged as active anymore (we might be launching back into the UI here)
-	system("gametimectl.elf stop_all");
+	gametime_stop_all();
 	
 	GFX_setVsync(VSYNC_STRICT);
 
@@ -2321,6 +3457,10 @@ int main (int argc, char *argv[]) {
 	pthread_t cpucheckthread;
     pthread_create(&cpucheckthread, NULL, PLAT_cpu_monitor, NULL);
 
+	TRACE_end("startup");
+	TRACE_begin("first frame");
+	int first_frame = 1;
+
 	int selected_row = top->selected - top->start;
 	float targetY;
 	float previousY;
@@ -2329,6 +3469,7 @@ int main (int argc, char *argv[]) {
 
 	char folderBgPath[1024];
 	folderbgbmp = NULL;
+	char thumbPath[1024] = ""; // what LAYER_THUMBNAIL holds (or is loading)
 
 	SDL_Surface * blackBG = SDL_CreateRGBSurfaceWithFormat(0,screen->w,screen->h,32,SDL_PIXELFORMAT_RGBA8888);
 	SDL_FillRect(blackBG,NULL,SDL_MapRGBA(screen->format,0,0,0,255));
@@ -2371,6 +3512,47 @@ int main (int argc, char *argv[]) {
             dirty = 1;
         had_bt = has_bt;
 
+		// nothing else redraws the clock while idle
+		static time_t shown_minute = 0;
+		time_t minute = time(NULL) / 60;
+		if (minute != shown_minute) {
+			if (CFG_getShowClock()) dirty = 1;
+			shown_minute = minute;
+		}
+
+		// recents were checked in the background, only lists showing them need a rebuild
+		if (recentschecked) {
+			recentschecked = 0;
+			if (applyCheckedRecents()) {
+				for (int i=0; i<stack->count; i++) {
+					Directory* dir = stack->items[i];
+					if (exactMatch(dir->path, SDCARD_PATH) || exactMatch(dir->path, FAUX_RECENT_PATH))
+						Directory_refresh(dir);
+				}
+				selected = top->selected;
+				total = top->entries->count;
+				if (switcher_selected >= recents->count) switcher_selected = 0;
+
+				QuickMenu_quit();
+				QuickMenu_init();
+				qm_row = 0;
+				qm_col = 0;
+				qm_slot = 0;
+				qm_shift = 0;
+				qm_slots = QUICK_SWITCHER_COUNT > quick->count ? quick->count : QUICK_SWITCHER_COUNT;
+				dirty = 1;
+			}
+		}
+
+		// the index finished loading or rescanning, refresh whatever is on screen
+		if (searchchanged) {
+			searchchanged = 0;
+			if (currentScreen == SCREEN_SEARCH) {
+				Search_run();
+				dirty = 1;
+			}
+		}
+
 		int gsanimdir = ANIM_NONE;
 
 		if (currentScreen == SCREEN_QUICKMENU) {
@@ -2510,6 +3692,77 @@ int main (int argc, char *argv[]) {
 				gsanimdir = SLIDE_RIGHT;
 			}
 		}
+		else if(currentScreen == SCREEN_SEARCH) {
+			int result_count = search_results ? search_results->count : 0;
+			int len = strlen(search_query);
+
+			if (search_selected < 0) {
+				if (PAD_justPressed(BTN_B)) {
+					currentScreen = SCREEN_GAMELIST;
+					dirty = 1;
+					folderbgchanged = 1; // The background painting code is a clusterfuck, just force a repaint here
+				}
+				else if (PAD_justRepeated(BTN_A) && len < SEARCH_MAX_QUERY) {
+					search_query[len] = SEARCH_CHARS[search_char];
+					search_query[len+1] = '\0';
+					Search_run();
+					dirty = 1;
+				}
+				else if (PAD_justRepeated(BTN_Y) && len > 0) {
+					search_query[len-1] = '\0';
+					Search_run();
+					dirty = 1;
+				}
+				else if (PAD_justRepeated(BTN_LEFT)) {
+					search_char -= 1;
+					if (search_char < 0) search_char = strlen(SEARCH_CHARS) - 1;
+					dirty = 1;
+				}
+				else if (PAD_justRepeated(BTN_RIGHT)) {
+					search_char += 1;
+					if (search_char >= (int)strlen(SEARCH_CHARS)) search_char = 0;
+					dirty = 1;
+				}
+				else if (PAD_justPressed(BTN_DOWN) && result_count > 0) {
+					search_selected = 0;
+					dirty = 1;
+				}
+			}
+			else {
+				if (PAD_justPressed(BTN_B)) {
+					search_selected = -1;
+					dirty = 1;
+				}
+				else if (PAD_justPressed(BTN_A)) {
+					Entry* entry = search_results->items[search_selected];
+					Entry_open(entry);
+					if (!startgame) {
+						// folders open in the regular list
+						currentScreen = SCREEN_GAMELIST;
+						total = top->entries->count;
+						folderbgchanged = 1;
+						if (total>0) readyResume(top->entries->items[top->selected]);
+					}
+					dirty = 1;
+				}
+				else if (PAD_justRepeated(BTN_Y) && len > 0) {
+					search_query[len-1] = '\0';
+					Search_run();
+					dirty = 1;
+				}
+				else if (PAD_justRepeated(BTN_UP)) {
+					search_selected -= 1;
+					if (search_selected < search_start) search_start = search_selected;
+					if (search_start < 0) search_start = 0;
+					dirty = 1;
+				}
+				else if (PAD_justRepeated(BTN_DOWN) && search_selected < result_count - 1) {
+					search_selected += 1;
+					if (search_selected >= search_start + SEARCH_ROW_COUNT) search_start = search_selected - SEARCH_ROW_COUNT + 1;
+					dirty = 1;
+				}
+			}
+		}
 		else {
 			if (PAD_tappedMenu(now)) {
 				currentScreen = SCREEN_QUICKMENU;
@@ -2526,6 +3779,12 @@ int main (int argc, char *argv[]) {
 				switcher_selected = 0; 
 				dirty = 1;
 			}
+			else if (PAD_justReleased(BTN_Y)) {
+				currentScreen = SCREEN_SEARCH;
+				is_scrolling = 0;
+				Search_run();
+				dirty = 1;
+			}
 			else if (total>0) {
 				if (PAD_justRepeated(BTN_UP)) {
 					if (selected==0 && !PAD_justPressed(BTN_UP)) {
@@ -2872,7 +4131,7 @@ int main (int argc, char *argv[]) {
 
 						SDL_Surface* text;
 						SDL_Color textColor = uintToColour(THEME_COLOR6_255);
-						text = TTF_RenderUTF8_Blended(font.large, display_name, textColor);
+						text = GFX_renderText(font.large, display_name, textColor, 0);
 						const int text_offset_y = (SCALE1(PILL_SIZE) - text->h + 1) >> 1 + SCALE1(TEXT_Y_OFFSET);
 						GFX_blitPillLight(ASSET_WHITE_PILL, screen, &(SDL_Rect){
 							SCALE1(PADDING),
@@ -2991,12 +4250,89 @@ int main (int argc, char *argv[]) {
 				switcherSur = GFX_captureRendererToSurface();
 				lastScreen = SCREEN_GAMESWITCHER;
 			}
+			else if(currentScreen == SCREEN_SEARCH) {
+				if(lastScreen != SCREEN_SEARCH) {
+					GFX_clearLayers(LAYER_BACKGROUND);
+					GFX_clearLayers(LAYER_THUMBNAIL);
+				}
+
+				// buttons
+				if (show_setting && !GetHDMI()) GFX_blitHardwareHints(screen, show_setting);
+				else GFX_blitButtonGroup((char*[]){ "Y",(char*)TR("search.delete"),  NULL }, 0, screen, 0);
+
+				if (search_selected < 0) GFX_blitButtonGroup((char*[]){ "B",(char*)TR("common.back"), "A",(char*)TR("search.add"), NULL }, 1, screen, 1);
+				else GFX_blitButtonGroup((char*[]){ "B",(char*)TR("common.back"), "A",(char*)TR("common.open"), NULL }, 1, screen, 1);
+
+				// query, followed by the character A would add
+				SDL_Rect query_rect = { SCALE1(BUTTON_MARGIN), SCALE1(PADDING), MAX(0, screen->w - SCALE1(BUTTON_MARGIN + PADDING * 2) - ow), SCALE1(PILL_SIZE) };
+				GFX_blitPillColor(ASSET_WHITE_PILL, screen, &query_rect, THEME_COLOR3, RGB_WHITE);
+
+				int text_x = query_rect.x + SCALE1(BUTTON_PADDING);
+				int text_max = MAX(0, query_rect.w - SCALE1(BUTTON_PADDING * 2 + PILL_SIZE));
+				if (search_query[0]) {
+					SDL_Surface* text = GFX_renderText(font.large, search_query, uintToColour(THEME_COLOR4_255), 0);
+					// keep the end of a long query in view
+					SDL_Rect src_rect = { MAX(0, text->w - text_max), 0, MIN(text->w, text_max), text->h };
+					SDL_Rect dst_rect = { text_x, query_rect.y + ((query_rect.h - text->h + 1) >> 1) + SCALE1(TEXT_Y_OFFSET) };
+					SDL_BlitSurface(text, &src_rect, screen, &dst_rect);
+					text_x += src_rect.w;
+					SDL_FreeSurface(text);
+				}
+
+				char pending[2] = { SEARCH_CHARS[search_char], '\0' };
+				if (pending[0] == ' ') pending[0] = '_';
+				SDL_Rect pending_rect = { text_x, query_rect.y, SCALE1(PILL_SIZE), query_rect.h };
+				SDL_Color pending_color = uintToColour(THEME_COLOR4_255);
+				if (search_selected < 0) {
+					GFX_blitPillColor(ASSET_WHITE_PILL, screen, &pending_rect, THEME_COLOR1, RGB_WHITE);
+					pending_color = uintToColour(THEME_COLOR5_255);
+				}
+				SDL_Surface* pending_text = GFX_renderText(font.large, pending, pending_color, 0);
+				SDL_BlitSurface(pending_text, NULL, screen, &(SDL_Rect){ pending_rect.x + ((pending_rect.w - pending_text->w) >> 1), pending_rect.y + ((pending_rect.h - pending_text->h + 1) >> 1) + SCALE1(TEXT_Y_OFFSET) });
+				SDL_FreeSurface(pending_text);
+
+				// results
+				int result_count = search_results ? search_results->count : 0;
+				if (result_count == 0) {
+					const char* msg = search_indexing ? TR("search.indexing") : (search_query[0] ? TR("search.no_results") : TR("search.hint"));
+					GFX_blitMessage(font.large, (char*)msg, screen, &(SDL_Rect){0, SCALE1(PADDING + PILL_SIZE), screen->w, screen->h - SCALE1(PADDING * 2 + PILL_SIZE * 2)});
+				}
+				int row_max = MAX(0, screen->w - SCALE1(BUTTON_MARGIN + PADDING * 2 + BUTTON_PADDING * 2));
+				for (int i = search_start, j = 1; i < result_count && j <= SEARCH_ROW_COUNT; i++, j++) {
+					Entry* entry = search_results->items[i];
+					char* entry_name = (char*)Entry_label(entry);
+					trimSortingMeta(&entry_name);
+
+					// results span every system so always show which one
+					char emu_name[256];
+					getEmuName(entry->path, emu_name);
+					char unique_name[512];
+					snprintf(unique_name, sizeof(unique_name), "%s (%s)", entry_name, emu_name);
+
+					SDL_Color text_color = uintToColour(THEME_COLOR4_255);
+					SDL_Surface* text_unique = GFX_renderText(font.large, unique_name, COLOR_DARK_TEXT, row_max);
+					SDL_Rect row_rect = { SCALE1(BUTTON_MARGIN), SCALE1(PADDING + j * PILL_SIZE), text_unique->w + SCALE1(BUTTON_PADDING * 2), SCALE1(PILL_SIZE) };
+					if (i == search_selected) {
+						GFX_blitPillDark(ASSET_WHITE_PILL, screen, &row_rect);
+						text_color = uintToColour(THEME_COLOR5_255);
+					}
+					SDL_Surface* text = GFX_renderText(font.large, entry_name, text_color, row_max);
+					int text_y = row_rect.y + ((row_rect.h - text->h + 1) >> 1) + SCALE1(TEXT_Y_OFFSET);
+					SDL_BlitSurface(text_unique, NULL, screen, &(SDL_Rect){ row_rect.x + SCALE1(BUTTON_PADDING), text_y });
+					SDL_BlitSurface(text, NULL, screen, &(SDL_Rect){ row_rect.x + SCALE1(BUTTON_PADDING), text_y });
+					SDL_FreeSurface(text_unique);
+					SDL_FreeSurface(text);
+				}
+
+				lastScreen = SCREEN_SEARCH;
+			}
 			else { // if currentscreen == SCREEN_GAMELIST
 				// Safeguard: Check data validity before rendering to prevent black screen
 				if (!top || !stack || stack->count == 0 || top->entries->count == 0) {
 					SDL_Rect msg_rect = {0, 0, screen->w, screen->h};
 					GFX_blitMessage(font.large, (char*)TR("common.loading"), screen, &msg_rect);
 					dirty = 1;
+					thumbPath[0] = '\0';
 					lastScreen = SCREEN_GAMELIST;
 					continue;
 				}
@@ -3072,7 +4408,13 @@ int main (int argc, char *argv[]) {
 						char thumbpath[1024];
 						snprintf(thumbpath, sizeof(thumbpath), "%s/.media/%s.png", rompath, res_copy);
 						had_thumb = 0;
-						startLoadThumb(thumbpath, onThumbLoaded, NULL);
+						// the layer survives redraws of the same list (clock, battery, a
+						// press that didn't move the selection), only reload what changed
+						// or what a screen change or transition cleared
+						if (strcmp(thumbpath, thumbPath) != 0 || lastScreen != SCREEN_GAMELIST || animationdirection != ANIM_NONE) {
+							strcpy(thumbPath, thumbpath);
+							startLoadThumb(thumbpath, onThumbLoaded, NULL);
+						}
 						int max_w = (int)(screen->w - (screen->w * CFG_getGameArtWidth())); 
 						int max_h = (int)(screen->h * 0.6);  
 						int new_w = max_w;
@@ -3135,8 +4477,8 @@ int main (int argc, char *argv[]) {
 							text_color = uintToColour(THEME_COLOR5_255);
 							notext=1;
 						}
-						SDL_Surface* text = TTF_RenderUTF8_Blended(font.large, entry_name, text_color);
-						SDL_Surface* text_unique = TTF_RenderUTF8_Blended(font.large, display_name, COLOR_DARK_TEXT);
+						SDL_Surface* text = GFX_renderText(font.large, entry_name, text_color, 0);
+						SDL_Surface* text_unique = GFX_renderText(font.large, display_name, COLOR_DARK_TEXT, 0);
 						const int text_offset_y = (SCALE1(PILL_SIZE) - text->h + 1) >> 1 + SCALE1(TEXT_Y_OFFSET);
 						if (j == selected_row) {
 							is_scrolling = GFX_resetScrollText(font.large,display_name, max_width - SCALE1(BUTTON_PADDING*2));
@@ -3273,12 +4615,18 @@ int main (int argc, char *argv[]) {
 			if(!startgame) // dont flip if game gonna start
 				GFX_flip(screen);
 
+			if (first_frame) {
+				first_frame = 0;
+				TRACE_end("first frame");
+				TRACE_flush();
+			}
 			dirty = 0;
 		} else if(animationDraw || folderbgchanged || thumbchanged || is_scrolling) {
 			// honestly this whole thing is here only for the scrolling text, I set it now to run this at 30fps which is enough for scrolling text, should move this to seperate animation function eventually
 			Uint32 now = SDL_GetTicks();
 			Uint32 frame_start = now;
 			static char cached_display_name[256] = "";
+			int pill_moved = animationDraw; // the pill and its text only need redrawing when it did
 			SDL_LockMutex(bgMutex);
 			if(folderbgchanged) {
 				if(folderbgbmp)
@@ -3324,7 +4672,7 @@ int main (int argc, char *argv[]) {
 				animationDraw = 0;
 			}
 			SDL_UnlockMutex(animMutex);
-			if (currentScreen != SCREEN_GAMESWITCHER && currentScreen != SCREEN_QUICKMENU) {
+			if (currentScreen != SCREEN_GAMESWITCHER && currentScreen != SCREEN_QUICKMENU && currentScreen != SCREEN_SEARCH) {
 				if(is_scrolling && pillanimdone && currentAnimQueueSize < 1) {
 					int ow = GFX_blitHardwareGroup(screen, show_setting);
 					Entry* entry = top->entries->items[top->selected];
@@ -3359,38 +4707,29 @@ int main (int argc, char *argv[]) {
 					}
 				}
 				else {
-					GFX_clearLayers(LAYER_TRANSITION);
-					GFX_clearLayers(LAYER_SCROLLTEXT);
-					SDL_LockMutex(animMutex);
-					if (list_show_entry_names) {
-						GFX_drawOnLayer(globalpill, pillRect.x, pillRect.y, globallpillW, globalpill->h, 1.0f, 0, LAYER_TRANSITION);
-						GFX_drawOnLayer(globalText, SCALE1(BUTTON_MARGIN + BUTTON_PADDING),pilltargetTextY, globalText->w, globalText->h, 1.0f, 0, LAYER_SCROLLTEXT);
+					if (pill_moved) {
+						GFX_clearLayers(LAYER_TRANSITION);
+						GFX_clearLayers(LAYER_SCROLLTEXT);
+						SDL_LockMutex(animMutex);
+						if (list_show_entry_names) {
+							GFX_drawOnLayer(globalpill, pillRect.x, pillRect.y, globallpillW, globalpill->h, 1.0f, 0, LAYER_TRANSITION);
+							GFX_drawOnLayer(globalText, SCALE1(BUTTON_MARGIN + BUTTON_PADDING),pilltargetTextY, globalText->w, globalText->h, 1.0f, 0, LAYER_SCROLLTEXT);
+						}
+						SDL_UnlockMutex(animMutex);
 					}
-					SDL_UnlockMutex(animMutex);
 					PLAT_GPU_Flip();
 				} 
 			}
-			else {
-				SDL_Delay(100); // why are we running long delays on the render thread, wtf?
-			}
-			dirty = 0;
-		} 
-		else {
-			// want to draw only if needed
-			SDL_LockMutex(bgqueueMutex);
-			SDL_LockMutex(thumbqueueMutex);
-			SDL_LockMutex(animqueueMutex);
-			if(needDraw) {
+			else if(needDraw) {
 				PLAT_GPU_Flip();
 				needDraw = 0;
-			} else {
-				// TODO: Why 17? Seems like an odd choice for 60fps, it almost guarantees we miss at least one frame.
-				// This should either be 16(.66666667) or make proper use of SDL_Ticks to only wait for the next render pass.
-				SDL_Delay(17); 
 			}
-			SDL_UnlockMutex(animqueueMutex);
-			SDL_UnlockMutex(thumbqueueMutex);
-			SDL_UnlockMutex(bgqueueMutex);
+			dirty = 0;
+		} 
+		else if(needDraw) {
+			// a worker finished but nothing on our side changed, just recomposite the layers
+			PLAT_GPU_Flip();
+			needDraw = 0;
 		}
 	
 		SDL_LockMutex(frameMutex);
@@ -3419,14 +4758,46 @@ int main (int argc, char *argv[]) {
 			sleep(4);
 			quit = 1;
 		}
+
+		if (quit && Resident_launch()) {
+			// back from the game with the menu still in memory, pick up
+			// where a fresh start would (switcher hand-off, resume states)
+			quit = 0;
+			startgame = 0;
+			lastScreen = SCREEN_OFF;
+			if (exists(GAME_SWITCHER_PERSIST_PATH)) {
+				unlink(GAME_SWITCHER_PERSIST_PATH);
+				currentScreen = SCREEN_GAMESWITCHER;
+				lastScreen = SCREEN_GAME;
+			}
+			else if (currentScreen!=SCREEN_SEARCH) currentScreen = CFG_getDefaultView();
+			if (top->entries->count>0) readyResume(top->entries->items[top->selected]);
+
+			GFX_setVsync(VSYNC_STRICT);
+			PAD_reset();
+			GFX_clearLayers(LAYER_ALL);
+			GFX_clear(screen);
+			folderbgchanged = 1;
+			thumbchanged = 1;
+			dirty = 1;
+		}
+
+		// nothing left to draw, sleep until input, a worker callback or the
+		// next timer instead of spinning the render thread
+		int scrolling = is_scrolling && currentScreen == SCREEN_GAMELIST;
+		if (!quit && !dirty && !needDraw && !animationDraw && !folderbgchanged && !thumbchanged && !scrolling)
+			PAD_wait(IDLE_WAIT_MS);
 	}
 	if(blackBG)	SDL_FreeSurface(blackBG);
 	if (folderbgbmp) SDL_FreeSurface(folderbgbmp);
 	if (thumbbmp) SDL_FreeSurface(thumbbmp);
 
+	Search_quit();
 	Menu_quit();
+	CFG_flush(); // launch.sh starts what's queued as soon as we exit
 	PWR_quit();
 	PAD_quit();
 	GFX_quit();
 	QuitSettings();
+	TRACE_flush();
 }
@@ -349,8 +349,8 @@ int main(int argc, char *argv[])
             { CFG_setSaveFormat(std::any_cast<int>(value)); },
             []() { CFG_setSaveFormat(CFG_DEFAULT_SAVEFORMAT);}},
             new MenuItem{ListItemType::Generic, TR("settings.state_format"), TR("settings.state_format.desc"), 
-            {(int)STATE_FORMAT_SAV, (int)STATE_FORMAT_SRM_EXTRADOT, (int)STATE_FORMAT_SRM_UNCOMRESSED_EXTRADOT, (int)STATE_FORMAT_SRM, (int)STATE_FORMAT_SRM_UNCOMRESSED}, 
-            {TR("settings.state_format.minui"), TR("settings.state_format.raish_comp"), TR("settings.state_format.raish_uncomp"), TR("settings.state_format.ra_comp"), TR("settings.state_format.ra_uncomp")}, []() -> std::any
+            {(int)STATE_FORMAT_SAV, (int)STATE_FORMAT_SAV_LZ4, (int)STATE_FORMAT_SAV_ZSTD, (int)STATE_FORMAT_SRM_EXTRADOT, (int)STATE_FORMAT_SRM_UNCOMRESSED_EXTRADOT, (int)STATE_FORMAT_SRM, (int)STATE_FORMAT_SRM_UNCOMRESSED}, 
+            {TR("settings.state_format.minui"), TR("settings.state_format.minui_lz4"), TR("settings.state_format.minui_zstd"), TR("settings.state_format.raish_comp"), TR("settings.state_format.raish_uncomp"), TR("settings.state_format.ra_comp"), TR("settings.state_format.ra_uncomp")}, []() -> std::any
             { return CFG_getStateFormat(); }, [](const std::any &value)
             { CFG_setStateFormat(std::any_cast<int>(value)); },
             []() { CFG_setStateFormat(CFG_DEFAULT_STATEFORMAT);}},
@@ -91,6 +91,8 @@ static struct VID_Context {
 	SDL_Texture* target;
 	SDL_Texture* effect;
 	SDL_Texture* overlay;
+	SDL_Texture* scroll_text; // marquee label, doubled up for wrapping
+	SDL_Surface* scroll_text_src; // text cache reference scroll_text was built from
 	SDL_Surface* screen;
 	SDL_GLContext gl_context;
 	
@@ -683,6 +685,10 @@ void PLAT_quitVideo(void) {
 	if (vid.target_layer2) SDL_DestroyTexture(vid.target_layer2);
 	if (vid.target_layer4) SDL_DestroyTexture(vid.target_layer4);
 	if (vid.target_layer5) SDL_DestroyTexture(vid.target_layer5);
+	if (vid.scroll_text) SDL_DestroyTexture(vid.scroll_text);
+	if (vid.scroll_text_src) SDL_FreeSurface(vid.scroll_text_src);
+	vid.scroll_text = NULL;
+	vid.scroll_text_src = NULL;
 	if (overlay_path) free(overlay_path);
 	SDL_DestroyTexture(vid.stream_layer1);
 	SDL_DestroyRenderer(vid.renderer);
@@ -1115,42 +1121,50 @@ void PLAT_scrollTextTexture(
     if (transparency > 1.0f) transparency = 1.0f;
     color.a = (Uint8)(transparency * 255);
 
-    // Render the original text only once
-    SDL_Surface* singleSur = TTF_RenderUTF8_Blended(font, in_name, color);
+    // Render the original text only once, the text cache hands back the same
+    // surface for the same label so we only rebuild the texture when it changes
+    SDL_Surface* singleSur = GFX_renderText(font, in_name, color, 0);
     if (!singleSur) return;
 
     int single_width = singleSur->w;
     int single_height = singleSur->h;
 
-    // Create a surface to hold two copies side by side with padding
-    SDL_Surface* text_surface = SDL_CreateRGBSurfaceWithFormat(0,
-        single_width * 2 + padding, single_height, 32, SDL_PIXELFORMAT_RGBA8888);
+    if (singleSur != vid.scroll_text_src || !vid.scroll_text) {
+        // Create a surface to hold two copies side by side with padding
+        SDL_Surface* text_surface = SDL_CreateRGBSurfaceWithFormat(0,
+            single_width * 2 + padding, single_height, 32, SDL_PIXELFORMAT_RGBA8888);
 
-    SDL_FillRect(text_surface, NULL, THEME_COLOR1);
-    SDL_BlitSurface(singleSur, NULL, text_surface, NULL);
+        SDL_FillRect(text_surface, NULL, THEME_COLOR1);
+        SDL_BlitSurface(singleSur, NULL, text_surface, NULL);
 
-    SDL_Rect second = { single_width + padding, 0, single_width, single_height };
-    SDL_BlitSurface(singleSur, NULL, text_surface, &second);
-    SDL_FreeSurface(singleSur);
+        SDL_Rect second = { single_width + padding, 0, single_width, single_height };
+        SDL_BlitSurface(singleSur, NULL, text_surface, &second);
 
-    SDL_Texture* full_text_texture = SDL_CreateTextureFromSurface(vid.renderer, text_surface);
-    int full_text_width = text_surface->w;
-    SDL_FreeSurface(text_surface);
+        if (vid.scroll_text) SDL_DestroyTexture(vid.scroll_text);
+        vid.scroll_text = SDL_CreateTextureFromSurface(vid.renderer, text_surface);
+        SDL_FreeSurface(text_surface);
 
-    if (!full_text_texture) return;
+        // keep our reference so the cache can't hand this address to another label
+        if (vid.scroll_text_src) SDL_FreeSurface(vid.scroll_text_src);
+        vid.scroll_text_src = singleSur;
 
-    SDL_SetTextureBlendMode(full_text_texture, SDL_BLENDMODE_BLEND);
-    SDL_SetTextureAlphaMod(full_text_texture, color.a);
+        if (!vid.scroll_text) return;
+        SDL_SetTextureBlendMode(vid.scroll_text, SDL_BLENDMODE_BLEND);
+    }
+    else {
+        SDL_FreeSurface(singleSur); // already holding a reference
+    }
+
+    SDL_SetTextureAlphaMod(vid.scroll_text, color.a);
 
     SDL_SetRenderTarget(vid.renderer, vid.target_layer4);
 
     SDL_Rect src_rect = { text_offset, 0, w, single_height };
     SDL_Rect dst_rect = { x, y, w, single_height };
 
-    SDL_RenderCopy(vid.renderer, full_text_texture, &src_rect, &dst_rect);
+    SDL_RenderCopy(vid.renderer, vid.scroll_text, &src_rect, &dst_rect);
 
     SDL_SetRenderTarget(vid.renderer, NULL);
-    SDL_DestroyTexture(full_text_texture);
 
     // Scroll only if text is wider than clip width
     if (single_width > w) {
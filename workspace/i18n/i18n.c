@@ -3,6 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "defines.h" // for SDCARD_PATH
 
@@ -21,6 +26,39 @@ typedef struct I18N_Entry {
 static I18N_Entry *g_table = NULL;
 static char g_loaded_path[512] = {0};
 
+// Compiled table, see lang_compile.py for the layout. Mapped read-only and
+// used in place: no parsing or allocation, one hash probe per lookup.
+// Little endian like every device we build for; on anything else the
+// version check fails and the text loader takes over.
+#define I18N_COMPILED_MAGIC "NXTR"
+#define I18N_COMPILED_VERSION 1
+
+typedef struct I18N_Header {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t bucket_count; // power of two
+	uint32_t buckets_offset;
+	uint32_t entries_offset;
+	uint32_t pool_offset;
+	uint32_t pool_size;
+} I18N_Header;
+
+typedef struct I18N_CompiledEntry {
+	uint32_t hash;
+	uint32_t key;
+	uint32_t val;
+} I18N_CompiledEntry;
+
+static struct {
+	void *map;
+	size_t size;
+	const uint32_t *buckets; // entry index + 1, 0 is empty
+	const I18N_CompiledEntry *entries;
+	const char *pool;
+	uint32_t mask;
+} g_compiled = {0};
+
 const char *I18N_loadedPath(void) {
 	return g_loaded_path;
 }
@@ -35,6 +73,76 @@ static void I18N_freeTable(void) {
 		e = n;
 	}
 	g_table = NULL;
+
+	if (g_compiled.map) munmap(g_compiled.map, g_compiled.size);
+	memset(&g_compiled, 0, sizeof(g_compiled));
+}
+
+static uint32_t I18N_hash(const char *key) { // fnv-1a, same as lang_compile.py
+	uint32_t h = 2166136261u;
+	while (*key) h = (h ^ (unsigned char)*key++) * 16777619u;
+	return h;
+}
+
+// The table is trusted only after every offset has been bounds checked,
+// a truncated or stale file falls back to the text loader.
+static int I18N_validate(const unsigned char *data, size_t size) {
+	if (size < sizeof(I18N_Header)) return 0;
+	const I18N_Header *h = (const I18N_Header *)data;
+	if (memcmp(h->magic, I18N_COMPILED_MAGIC, 4) || h->version != I18N_COMPILED_VERSION) return 0;
+	if (!h->bucket_count || (h->bucket_count & (h->bucket_count - 1)) || h->count >= h->bucket_count) return 0;
+	if ((h->buckets_offset | h->entries_offset) & 3) return 0;
+	if (h->buckets_offset > size || (size - h->buckets_offset) / 4 < h->bucket_count) return 0;
+	if (h->entries_offset > size || (size - h->entries_offset) / sizeof(I18N_CompiledEntry) < h->count) return 0;
+	if (h->pool_offset > size || size - h->pool_offset < h->pool_size) return 0;
+	if (!h->pool_size || data[h->pool_offset + h->pool_size - 1]) return 0; // last string is terminated
+
+	const uint32_t *buckets = (const uint32_t *)(data + h->buckets_offset);
+	for (uint32_t i = 0; i < h->bucket_count; i++) {
+		if (buckets[i] > h->count) return 0;
+	}
+	const I18N_CompiledEntry *entries = (const I18N_CompiledEntry *)(data + h->entries_offset);
+	for (uint32_t i = 0; i < h->count; i++) {
+		if (entries[i].key >= h->pool_size || entries[i].val >= h->pool_size) return 0;
+	}
+	return 1;
+}
+
+static int I18N_loadCompiled(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return 0;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+
+	if (!I18N_validate(map, st.st_size)) {
+		fprintf(stderr, "i18n: ignoring invalid compiled table %s\n", path);
+		munmap(map, st.st_size);
+		return 0;
+	}
+
+	I18N_freeTable();
+	const I18N_Header *h = (const I18N_Header *)map;
+	g_compiled.map = map;
+	g_compiled.size = st.st_size;
+	g_compiled.buckets = (const uint32_t *)((const char *)map + h->buckets_offset);
+	g_compiled.entries = (const I18N_CompiledEntry *)((const char *)map + h->entries_offset);
+	g_compiled.pool = (const char *)map + h->pool_offset;
+	g_compiled.mask = h->bucket_count - 1;
+	return 1;
+}
+
+static const char *I18N_lookupCompiled(const char *key) {
+	uint32_t hash = I18N_hash(key);
+	for (uint32_t i = hash & g_compiled.mask; g_compiled.buckets[i]; i = (i + 1) & g_compiled.mask) {
+		const I18N_CompiledEntry *e = &g_compiled.entries[g_compiled.buckets[i] - 1];
+		if (e->hash == hash && strcmp(g_compiled.pool + e->key, key) == 0) return g_compiled.pool + e->val;
+	}
+	return NULL;
 }
 
 static void trim_inplace(char *s) {
@@ -109,6 +217,19 @@ static void I18N_put(const char *key, const char *val) {
 int I18N_load(const char *lang_file_path) {
 	if (!lang_file_path || !*lang_file_path) return -1;
 
+	// Prefer the compiled table next to it (foo.lang -> foo.langc), unless the
+	// text file has been edited since it was compiled.
+	char compiled_path[sizeof(g_loaded_path)];
+	struct stat text_st, compiled_st;
+	snprintf(compiled_path, sizeof(compiled_path), "%sc", lang_file_path);
+	int has_text = stat(lang_file_path, &text_st) == 0;
+	if (stat(compiled_path, &compiled_st) == 0 && (!has_text || compiled_st.st_mtime >= text_st.st_mtime)) {
+		if (I18N_loadCompiled(compiled_path)) {
+			strncpy(g_loaded_path, compiled_path, sizeof(g_loaded_path) - 1);
+			return 0;
+		}
+	}
+
 	FILE *f = fopen(lang_file_path, "rb");
 	if (!f) return -2;
 
@@ -148,9 +269,27 @@ void I18N_init(void) {
 
 const char *I18N_tr(const char *key) {
 	if (!key) return "";
+	if (g_compiled.map) {
+		const char *val = I18N_lookupCompiled(key);
+		return val ? val : key;
+	}
 	if (!g_table) return key;
 	for (I18N_Entry *e = g_table; e; e = e->next) {
 		if (strcmp(e->key, key) == 0) return e->val;
 	}
 	return key;
 }
+
+#include "pinyin_initials.h"
+
+char I18N_pinyinInitial(uint32_t codepoint) {
+	int lo = 0;
+	int hi = PINYIN_INITIAL_COUNT - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (pinyin_codepoints[mid] == codepoint) return pinyin_initials[mid];
+		if (pinyin_codepoints[mid] < codepoint) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return 0;
+}
@@ -4,7 +4,7 @@
 // Lightweight translation layer for downstream localization forks.
 //
 // Design goals:
-// - Minimal dependencies (C stdlib only)
+// - Minimal dependencies (C stdlib and mmap only)
 // - Safe fallback if no language file exists
 // - Stable keys to minimize re-translation during upstream updates
 //
@@ -12,6 +12,8 @@
 //   I18N_init();
 //   printf("%s\n", TR("settings"));
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -21,6 +23,8 @@ extern "C" {
 void I18N_init(void);
 
 // Explicitly (re)load a language file.
+// A compiled table next to it (`<path>c`, see lang_compile.py) is mapped
+// instead when present and not older than the text file.
 // Returns 0 on success, non-zero on failure.
 int I18N_load(const char *lang_file_path);
 
@@ -31,6 +35,10 @@ const char *I18N_tr(const char *key);
 // Empty string means I18N_init() hasn't run yet.
 const char *I18N_loadedPath(void);
 
+// First letter of the pinyin of a common hanzi, 0 for anything else.
+// Lets an ascii keyboard find Chinese names, see pinyin_gen.py.
+char I18N_pinyinInitial(uint32_t codepoint);
+
 // Convenience macro.
 #define TR(KEY) I18N_tr((KEY))
 
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+"""Compiles a .lang file into the binary table I18N_load() maps directly.
+
+Parsing matches the text loader in i18n.c byte for byte (trimming, comments,
+escapes, last duplicate wins), so both always translate the same.
+
+Layout, all integers u32 little endian:
+  header   magic "NXTR", version, count, bucket_count,
+           buckets_offset, entries_offset, pool_offset, pool_size
+  buckets  bucket_count x entry index + 1, 0 is empty (open addressing)
+  entries  count x (hash, key offset, value offset) into the pool
+  pool     nul terminated keys and values
+
+Usage:
+  python3 workspace/i18n/lang_compile.py workspace/i18n/locales/zh_CN.lang -o zh_CN.langc
+"""
+
+from __future__ import annotations
+
+import argparse
+import struct
+import sys
+from pathlib import Path
+
+MAGIC = b"NXTR"
+VERSION = 1
+HEADER = struct.Struct("<4s7I")
+ENTRY = struct.Struct("<3I")
+TRIM = b" \t\r\n"
+
+
+def fnv1a(data: bytes) -> int:
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def unescape(value: bytes) -> bytes:
+    out = bytearray()
+    i = 0
+    while i < len(value):
+        c = value[i:i + 1]
+        if c != b"\\":
+            out += c
+            i += 1
+            continue
+        nxt = value[i + 1:i + 2]
+        if nxt == b"n":
+            out += b"\n"
+        elif nxt == b"t":
+            out += b"\t"
+        elif nxt == b"\\":
+            out += b"\\"
+        else:
+            out += b"\\" + nxt  # unknown escape (or a trailing backslash) is kept as is
+        i += 2
+    return bytes(out)
+
+
+def parse(path: Path) -> dict[bytes, bytes]:
+    mapping: dict[bytes, bytes] = {}
+    for line in path.read_bytes().split(b"\n"):
+        if line.startswith(b"\xef\xbb\xbf"):
+            line = line[3:]
+        line = line.strip(TRIM)
+        if not line or line.startswith(b"#") or b"=" not in line:
+            continue
+        key, value = line.split(b"=", 1)
+        key = key.strip(TRIM)
+        if not key:
+            continue
+        mapping.pop(key, None)  # last one wins, like the text loader
+        mapping[key] = unescape(value.strip(TRIM))
+    return mapping
+
+
+def compile_table(mapping: dict[bytes, bytes]) -> bytes:
+    count = len(mapping)
+    bucket_count = 16
+    while bucket_count < count * 2:
+        bucket_count <<= 1
+    mask = bucket_count - 1
+
+    pool = bytearray()
+    entries = []
+    buckets = [0] * bucket_count
+    for index, (key, value) in enumerate(mapping.items()):
+        key_offset = len(pool)
+        pool += key + b"\0"
+        value_offset = len(pool)
+        pool += value + b"\0"
+
+        h = fnv1a(key)
+        entries.append(ENTRY.pack(h, key_offset, value_offset))
+        i = h & mask
+        while buckets[i]:
+            i = (i + 1) & mask
+        buckets[i] = index + 1
+
+    buckets_offset = HEADER.size
+    entries_offset = buckets_offset + bucket_count * 4
+    pool_offset = entries_offset + count * ENTRY.size
+    header = HEADER.pack(MAGIC, VERSION, count, bucket_count,
+                         buckets_offset, entries_offset, pool_offset, len(pool))
+    return header + struct.pack(f"<{bucket_count}I", *buckets) + b"".join(entries) + bytes(pool)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("lang", type=Path)
+    parser.add_argument("-o", "--output", type=Path, help="defaults to the input path + 'c'")
+    args = parser.parse_args()
+
+    output = args.output or args.lang.with_name(args.lang.name + "c")
+    mapping = parse(args.lang)
+    data = compile_table(mapping)
+    output.write_bytes(data)
+    print(f"{args.lang} -> {output}: {len(mapping)} keys, {len(data)} bytes")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+"""Generates pinyin_initials.h, the first letter of the pinyin of common hanzi.
+
+GB2312 lays out its level 1 characters (the 3755 most common ones) in pinyin
+order, so the initial of each follows from where it falls between the first
+characters of each letter. Level 2 is ordered by radical and isn't covered,
+nor are traditional forms; those stay as they are in search keys.
+
+Usage:
+  python3 workspace/i18n/pinyin_gen.py -o workspace/i18n/pinyin_initials.h
+"""
+
+from __future__ import annotations
+
+import argparse
+import sys
+from pathlib import Path
+
+# first GB2312 code of each initial, there are no words starting with i, u or v
+BOUNDARIES = [
+    (0xB0A1, "a"), (0xB0C5, "b"), (0xB2C1, "c"), (0xB4EE, "d"), (0xB6EA, "e"),
+    (0xB7A2, "f"), (0xB8C1, "g"), (0xB9FE, "h"), (0xBBF7, "j"), (0xBFA6, "k"),
+    (0xC0AC, "l"), (0xC2E8, "m"), (0xC4C3, "n"), (0xC5B6, "o"), (0xC5BE, "p"),
+    (0xC6DA, "q"), (0xC8BB, "r"), (0xC8F6, "s"), (0xCBFA, "t"), (0xCDDA, "w"),
+    (0xCEF4, "x"), (0xD1B9, "y"), (0xD4D1, "z"),
+]
+LEVEL1_END = 0xD7F9
+
+
+def initial(code: int) -> str | None:
+    if code < BOUNDARIES[0][0] or code > LEVEL1_END:
+        return None
+    letter = None
+    for start, value in BOUNDARIES:
+        if code < start:
+            break
+        letter = value
+    return letter
+
+
+def table() -> list[tuple[int, str]]:
+    entries = []
+    for cp in range(0x4E00, 0xA000):
+        try:
+            encoded = chr(cp).encode("gb2312")
+        except UnicodeEncodeError:
+            continue
+        letter = initial(int.from_bytes(encoded, "big"))
+        if letter:
+            entries.append((cp, letter))
+    return entries
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-o", "--output", type=Path, default=Path(__file__).with_name("pinyin_initials.h"))
+    args = parser.parse_args()
+
+    entries = table()
+    lines = [
+        "// generated by pinyin_gen.py, do not edit",
+        "// codepoints ascending, initials[i] belongs to codepoints[i]",
+        f"#define PINYIN_INITIAL_COUNT {len(entries)}",
+        "static const uint16_t pinyin_codepoints[PINYIN_INITIAL_COUNT] = {",
+    ]
+    for i in range(0, len(entries), 12):
+        lines.append("\t" + ",".join(f"0x{cp:04X}" for cp, _ in entries[i:i + 12]) + ",")
+    lines.append("};")
+    lines.append("static const char pinyin_initials[PINYIN_INITIAL_COUNT + 1] =")
+    letters = "".join(letter for _, letter in entries)
+    for i in range(0, len(letters), 96):
+        lines.append(f'\t"{letters[i:i + 96]}"')
+    lines[-1] += ";"
+    args.output.write_text("\n".join(lines) + "\n")
+    print(f"{args.output}: {len(entries)} characters")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -23,6 +23,9 @@
 #include <pthread.h>
 
 #include <dirent.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 
 static int finalScaleFilter=GL_LINEAR;
 static int reloadShaderTextures = 1;
@@ -72,11 +75,52 @@ int is_brick = 0;
 
 static SDL_Joystick **joysticks = NULL;
 static int num_joysticks = 0;
+
+// SDL_WaitEventTimeout() falls back to SDL_Delay(1) polling with joysticks open,
+// so idle loops block on our own handles to the evdev nodes instead. every open
+// handle gets its own event queue, draining ours doesn't steal input from SDL.
+// every event node is watched, bt and usb pads come up on higher numbers, and
+// new nodes wake the wait so SDL gets to see the hotplug and we reopen them.
+#define WAIT_INPUT_COUNT 32
+static int wait_inputs[WAIT_INPUT_COUNT];
+static int wait_input_count = 0;
+static int wait_wake = -1;
+static int wait_hotplug = -1;
+
+static void PLAT_closeWaitInputs(void) {
+	for (int i=0; i<wait_input_count; i++) {
+		close(wait_inputs[i]);
+	}
+	wait_input_count = 0;
+}
+static void PLAT_openWaitInputs(void) {
+	PLAT_closeWaitInputs();
+	DIR* dh = opendir("/dev/input");
+	if (!dh) return;
+	struct dirent* dp;
+	char path[300];
+	while ((dp = readdir(dh))!=NULL && wait_input_count<WAIT_INPUT_COUNT) {
+		if (!prefixMatch("event", dp->d_name)) continue;
+		snprintf(path, sizeof(path), "/dev/input/%s", dp->d_name);
+		int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd>=0) wait_inputs[wait_input_count++] = fd;
+	}
+	closedir(dh);
+}
+
 void PLAT_initInput(void) {
 	char* device = getenv("DEVICE");
 	is_brick = exactMatch("brick", device);
 	if(SDL_InitSubSystem(SDL_INIT_JOYSTICK) < 0)
 		LOG_error("Failed initializing joysticks: %s\n", SDL_GetError());
+
+	PLAT_openWaitInputs();
+	wait_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	wait_hotplug = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (wait_hotplug>=0 && inotify_add_watch(wait_hotplug, "/dev/input", IN_CREATE | IN_DELETE)<0) {
+		close(wait_hotplug);
+		wait_hotplug = -1;
+	}
 	num_joysticks = SDL_NumJoysticks();
     if (num_joysticks > 0) {
         joysticks = (SDL_Joystick **)malloc(sizeof(SDL_Joystick *) * num_joysticks);
@@ -100,6 +144,47 @@ void PLAT_quitInput(void) {
         num_joysticks = 0;
     }
 	SDL_QuitSubSystem(SDL_INIT_JOYSTICK);
+
+	PLAT_closeWaitInputs();
+	if (wait_wake>=0) close(wait_wake);
+	wait_wake = -1;
+	if (wait_hotplug>=0) close(wait_hotplug);
+	wait_hotplug = -1;
+}
+
+int PLAT_waitInput(uint32_t timeout_ms) {
+	// something (eg. a hotplug or PAD_interruptWait() fallback) is already queued
+	if (SDL_HasEvents(SDL_FIRSTEVENT, SDL_LASTEVENT)) return 1;
+
+	struct pollfd fds[WAIT_INPUT_COUNT+2];
+	int count = 0;
+	for (int i=0; i<wait_input_count; i++) {
+		fds[count++] = (struct pollfd){ .fd = wait_inputs[i], .events = POLLIN };
+	}
+	if (wait_wake>=0) fds[count++] = (struct pollfd){ .fd = wait_wake, .events = POLLIN };
+	if (wait_hotplug>=0) fds[count++] = (struct pollfd){ .fd = wait_hotplug, .events = POLLIN };
+	if (!count) return SDL_WaitEventTimeout(NULL, timeout_ms);
+
+	int ready = poll(fds, count, timeout_ms);
+	if (ready<=0) return 0;
+
+	// the actual events are picked up by SDL on the next PAD_poll()
+	char buf[256];
+	for (int i=0; i<count; i++) {
+		if (fds[i].revents & POLLIN) {
+			while (read(fds[i].fd, buf, sizeof(buf))>0);
+		}
+	}
+	return 1;
+}
+void PLAT_interruptWaitInput(void) {
+	if (wait_wake<0) {
+		SDL_Event event = {.type = SDL_USEREVENT};
+		SDL_PushEvent(&event);
+		return;
+	}
+	uint64_t one = 1;
+	write(wait_wake, &one, sizeof(one));
 }
 
 void PLAT_updateInput(const SDL_Event *event) {
@@ -107,6 +192,7 @@ void PLAT_updateInput(const SDL_Event *event) {
     case SDL_JOYDEVICEADDED: {
         int device_index = event->jdevice.which;
         SDL_Joystick *new_joy = SDL_JoystickOpen(device_index);
+        PLAT_openWaitInputs();
         if (new_joy) {
             joysticks = realloc(joysticks, sizeof(SDL_Joystick *) * (num_joysticks + 1));
             joysticks[num_joysticks++] = new_joy;
@@ -119,6 +205,7 @@ void PLAT_updateInput(const SDL_Event *event) {
 
     case SDL_JOYDEVICEREMOVED: {
         SDL_JoystickID removed_id = event->jdevice.which;
+        PLAT_openWaitInputs();
         for (int i = 0; i < num_joysticks; ++i) {
             if (SDL_JoystickInstanceID(joysticks[i]) == removed_id) {
                 LOG_info("Joystick removed: %s\n", SDL_JoystickName(joysticks[i]));
@@ -160,6 +247,8 @@ static struct VID_Context {
 	SDL_Texture* target;
 	SDL_Texture* effect;
 	SDL_Texture* overlay;
+	SDL_Texture* scroll_text; // marquee label, doubled up for wrapping
+	SDL_Surface* scroll_text_src; // text cache reference scroll_text was built from
 	SDL_Surface* screen;
 	SDL_GLContext gl_context;
 	
@@ -826,6 +915,10 @@ void PLAT_quitVideo(void) {
 	if (vid.target_layer2) SDL_DestroyTexture(vid.target_layer2);
 	if (vid.target_layer4) SDL_DestroyTexture(vid.target_layer4);
 	if (vid.target_layer5) SDL_DestroyTexture(vid.target_layer5);
+	if (vid.scroll_text) SDL_DestroyTexture(vid.scroll_text);
+	if (vid.scroll_text_src) SDL_FreeSurface(vid.scroll_text_src);
+	vid.scroll_text = NULL;
+	vid.scroll_text_src = NULL;
 	if (overlay_path) free(overlay_path);
 	SDL_DestroyTexture(vid.stream_layer1);
 	SDL_DestroyRenderer(vid.renderer);
@@ -1256,42 +1349,50 @@ void PLAT_scrollTextTexture(
     if (transparency > 1.0f) transparency = 1.0f;
     color.a = (Uint8)(transparency * 255);
 
-    // Render the original text only once
-    SDL_Surface* singleSur = TTF_RenderUTF8_Blended(font, in_name, color);
+    // Render the original text only once, the text cache hands back the same
+    // surface for the same label so we only rebuild the texture when it changes
+    SDL_Surface* singleSur = GFX_renderText(font, in_name, color, 0);
     if (!singleSur) return;
 
     int single_width = singleSur->w;
     int single_height = singleSur->h;
 
-    // Create a surface to hold two copies side by side with padding
-    SDL_Surface* text_surface = SDL_CreateRGBSurfaceWithFormat(0,
-        single_width * 2 + padding, single_height, 32, SDL_PIXELFORMAT_RGBA8888);
+    if (singleSur != vid.scroll_text_src || !vid.scroll_text) {
+        // Create a surface to hold two copies side by side with padding
+        SDL_Surface* text_surface = SDL_CreateRGBSurfaceWithFormat(0,
+            single_width * 2 + padding, single_height, 32, SDL_PIXELFORMAT_RGBA8888);
+
+        SDL_FillRect(text_surface, NULL, THEME_COLOR1);
+        SDL_BlitSurface(singleSur, NULL, text_surface, NULL);
 
-    SDL_FillRect(text_surface, NULL, THEME_COLOR1);
-    SDL_BlitSurface(singleSur, NULL, text_surface, NULL);
+        SDL_Rect second = { single_width + padding, 0, single_width, single_height };
+        SDL_BlitSurface(singleSur, NULL, text_surface, &second);
 
-    SDL_Rect second = { single_width + padding, 0, single_width, single_height };
-    SDL_BlitSurface(singleSur, NULL, text_surface, &second);
-    SDL_FreeSurface(singleSur);
+        if (vid.scroll_text) SDL_DestroyTexture(vid.scroll_text);
+        vid.scroll_text = SDL_CreateTextureFromSurface(vid.renderer, text_surface);
+        SDL_FreeSurface(text_surface);
 
-    SDL_Texture* full_text_texture = SDL_CreateTextureFromSurface(vid.renderer, text_surface);
-    int full_text_width = text_surface->w;
-    SDL_FreeSurface(text_surface);
+        // keep our reference so the cache can't hand this address to another label
+        if (vid.scroll_text_src) SDL_FreeSurface(vid.scroll_text_src);
+        vid.scroll_text_src = singleSur;
 
-    if (!full_text_texture) return;
+        if (!vid.scroll_text) return;
+        SDL_SetTextureBlendMode(vid.scroll_text, SDL_BLENDMODE_BLEND);
+    }
+    else {
+        SDL_FreeSurface(singleSur); // already holding a reference
+    }
 
-    SDL_SetTextureBlendMode(full_text_texture, SDL_BLENDMODE_BLEND);
-    SDL_SetTextureAlphaMod(full_text_texture, color.a);
+    SDL_SetTextureAlphaMod(vid.scroll_text, color.a);
 
     SDL_SetRenderTarget(vid.renderer, vid.target_layer4);
 
     SDL_Rect src_rect = { text_offset, 0, w, single_height };
     SDL_Rect dst_rect = { x, y, w, single_height };
 
-    SDL_RenderCopy(vid.renderer, full_text_texture, &src_rect, &dst_rect);
+    SDL_RenderCopy(vid.renderer, vid.scroll_text, &src_rect, &dst_rect);
 
     SDL_SetRenderTarget(vid.renderer, NULL);
-    SDL_DestroyTexture(full_text_texture);
 
     // Scroll only if text is wider than clip width
     if (single_width > w) {
@@ -2130,6 +2231,11 @@ void PLAT_getCPUTemp() {
 
 }
 
+void PLAT_getBatteryDraw(void) {
+	// uA, negative while discharging
+	currentbatterydraw = abs(getInt("/sys/class/power_supply/axp2202-battery/current_now")) / 1000;
+}
+
 static struct WIFI_connection connection = {
 	.valid = false,
 	.freq = -1,
@@ -2246,7 +2352,99 @@ static pthread_mutex_t currentcpuinfo;
 // a roling average for the display values of about 2 frames, otherwise they are unreadable jumping too fast up and down and stuff to read
 #define ROLLING_WINDOW 120  
 
-volatile int useAutoCpu = 1;
+static const int cpu_frequencies[] = {408,450,500,550,  600,650,700,750, 800,850,900,950, 1000,1050,1100,1150, 1200,1250,1300,1350, 1400,1450,1500,1550, 1600,1650,1700,1750, 1800,1850,1900,1950, 2000};
+#define NUM_CPU_FREQUENCIES (int)(sizeof(cpu_frequencies) / sizeof(cpu_frequencies[0]))
+
+// frame time governor, keeps each frame's work around FRAME_GOV_TARGET% of its budget
+#define FRAME_GOV_TARGET 75 // %
+#define FRAME_GOV_RAISE 90 // %, raise right away above this
+#define FRAME_GOV_WINDOW 30 // frames that have to fit at a lower clock before stepping down
+static struct {
+	int index; // into cpu_frequencies, -1 until the first frame
+	int hold; // frames left before stepping down is considered
+	int loads[FRAME_GOV_WINDOW]; // % of budget
+	int load_index;
+} frame_gov = {.index = -1};
+
+// starting step for both governors, from the game's profile. Only a start,
+// both are free to go above or below it once frames say otherwise
+static struct {
+	volatile int start; // -1 without a profile
+	volatile int restart; // for PLAT_cpu_monitor to pick up start
+} cpu_profile = {-1, 0};
+
+static int stepForCycles(int cycles, int budget_us, int percent) {
+	int64_t needed = (int64_t)cycles * 100 / ((int64_t)budget_us * percent); // MHz
+	int index = 0;
+	while (index<NUM_CPU_FREQUENCIES-1 && cpu_frequencies[index]<needed) index++;
+	return index;
+}
+
+void PLAT_setFrameProfile(int cycles, int budget_us) {
+	if (budget_us<=0 || cycles<=0) {
+		cpu_profile.start = -1;
+		return;
+	}
+	int start = stepForCycles(cycles, budget_us, FRAME_GOV_TARGET);
+	cpu_profile.start = start;
+	cpu_profile.restart = 1;
+	frame_gov.index = -1;
+	LOG_info("cpu profile: start %i MHz\n", cpu_frequencies[start]);
+}
+
+void PLAT_frameTime(int work_us, int budget_us) {
+	if (useAutoCpu!=AUTO_CPU_FRAME || budget_us<=0) return;
+
+	if (frame_gov.index<0) {
+		frame_gov.index = 0;
+		while (frame_gov.index<NUM_CPU_FREQUENCIES-1 && cpu_frequencies[frame_gov.index]<currentcpuspeed) frame_gov.index++;
+		if (cpu_profile.start>=0) frame_gov.index = cpu_profile.start;
+		frame_gov.hold = FRAME_GOV_WINDOW;
+	}
+
+	int load = (int64_t)work_us * 100 / budget_us;
+	frame_gov.loads[frame_gov.load_index] = load;
+	frame_gov.load_index = (frame_gov.load_index + 1) % FRAME_GOV_WINDOW;
+
+	int freq = cpu_frequencies[frame_gov.index];
+	if (load>FRAME_GOV_RAISE) {
+		// emulation work scales about inversely with the clock, so go straight to
+		// the step this frame would have fit at instead of climbing one at a time
+		int needed = freq * load / FRAME_GOV_TARGET;
+		while (frame_gov.index<NUM_CPU_FREQUENCIES-1 && cpu_frequencies[frame_gov.index]<needed) frame_gov.index++;
+		frame_gov.hold = FRAME_GOV_WINDOW;
+	}
+	else if (frame_gov.hold>0) {
+		frame_gov.hold -= 1;
+	}
+	else if (frame_gov.index>0) {
+		// only step down when the worst recent frame would still be under target,
+		// the gap to FRAME_GOV_RAISE keeps it from bouncing between two steps
+		int peak = 0;
+		for (int i=0; i<FRAME_GOV_WINDOW; i++) peak = MAX(peak, frame_gov.loads[i]);
+		if (peak * freq / cpu_frequencies[frame_gov.index-1] < FRAME_GOV_TARGET) {
+			frame_gov.index -= 1;
+			frame_gov.hold = FRAME_GOV_WINDOW;
+		}
+	}
+
+	// also puts the clock back after something else (the menu) changed it
+	if (cpu_frequencies[frame_gov.index]!=currentcpuspeed) {
+		PLAT_setCustomCPUSpeed(cpu_frequencies[frame_gov.index] * 1000);
+		currentcpuspeed = cpu_frequencies[frame_gov.index];
+	}
+}
+
+volatile int useAutoCpu = AUTO_CPU_USAGE;
+static pthread_mutex_t monitor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t monitor_cond = PTHREAD_COND_INITIALIZER;
+static int monitor_paused = 0;
+void PLAT_pauseCPUMonitor(int pause) {
+    pthread_mutex_lock(&monitor_mutex);
+    monitor_paused = pause;
+    pthread_cond_signal(&monitor_cond);
+    pthread_mutex_unlock(&monitor_mutex);
+}
 void *PLAT_cpu_monitor(void *arg) {
     struct timespec start_time, curr_time;
     clock_gettime(CLOCK_MONOTONIC_RAW, &start_time);
@@ -2256,8 +2454,7 @@ void *PLAT_cpu_monitor(void *arg) {
     double prev_real_time = get_time_sec();
     double prev_cpu_time = get_process_cpu_time_sec();
 
-	const int cpu_frequencies[] = {408,450,500,550,  600,650,700,750, 800,850,900,950, 1000,1050,1100,1150, 1200,1250,1300,1350, 1400,1450,1500,1550, 1600,1650,1700,1750, 1800,1850,1900,1950, 2000};
-    const int num_freqs = sizeof(cpu_frequencies) / sizeof(cpu_frequencies[0]);
+    const int num_freqs = NUM_CPU_FREQUENCIES;
     int current_index = 5; 
 
     double cpu_usage_history[ROLLING_WINDOW] = {0};
@@ -2266,7 +2463,21 @@ void *PLAT_cpu_monitor(void *arg) {
     int history_count = 0; 
 
     while (true) {
-        if (useAutoCpu) {
+        // sleeps while a child (resident launch) owns the clock, neither
+        // governing nor sampling so it doesn't cost the game anything
+        if (monitor_paused) {
+            pthread_mutex_lock(&monitor_mutex);
+            while (monitor_paused) pthread_cond_wait(&monitor_cond, &monitor_mutex);
+            pthread_mutex_unlock(&monitor_mutex);
+            prev_real_time = get_time_sec();
+            prev_cpu_time = get_process_cpu_time_sec();
+            continue;
+        }
+        if (cpu_profile.restart) {
+            cpu_profile.restart = 0;
+            current_index = cpu_profile.start>=0 ? cpu_profile.start : current_index;
+        }
+        if (useAutoCpu==AUTO_CPU_USAGE) {
             double curr_real_time = get_time_sec();
             double curr_cpu_time = get_process_cpu_time_sec();
 
@@ -2323,7 +2534,7 @@ void *PLAT_cpu_monitor(void *arg) {
 			// Who knows, maybe some CPU engineer will find my comment here one day and can explain, maybe this is looking for the limits of C and needs Assambler or whatever to call CPU instructions directly to go further, but all I know is PUSH and MOV, how did the orignal Roller Coaster Tycoon developer wrote a whole game like this anyways? Its insane..
             usleep(20000);
         } else {
-            // Just measure CPU usage without changing frequency
+            // Just measure CPU usage without changing frequency, PLAT_frameTime() does in AUTO_CPU_FRAME
             double curr_real_time = get_time_sec();
             double curr_cpu_time = get_process_cpu_time_sec();
 
@@ -2361,6 +2572,10 @@ void *PLAT_cpu_monitor(void *arg) {
 
 
 #define GOVERNOR_PATH "/sys/devices/system/cpu/cpu0/cpufreq/scaling_setspeed"
+static volatile int applied_cpu_speed = 0; // MHz, currentcpuspeed is an average in AUTO_CPU_USAGE
+int PLAT_getCPUSpeed(void) {
+    return applied_cpu_speed;
+}
 void PLAT_setCustomCPUSpeed(int speed) {
     FILE *fp = fopen(GOVERNOR_PATH, "w");
     if (fp == NULL) {
@@ -2370,6 +2585,7 @@ void PLAT_setCustomCPUSpeed(int speed) {
 
     fprintf(fp, "%d\n", speed);
     fclose(fp);
+    applied_cpu_speed = speed / 1000;
 }
 void PLAT_setCPUSpeed(int speed) {
 	int freq = 0;
@@ -2380,6 +2596,7 @@ void PLAT_setCPUSpeed(int speed) {
 		case CPU_SPEED_PERFORMANCE: freq = 2000000; currentcpuspeed = 2000; break;
 	}
 	putInt(GOVERNOR_PATH, freq);
+	applied_cpu_speed = freq / 1000;
 }
 
 #define MAX_STRENGTH 0xFFFF